@@ -0,0 +1,401 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <sched.h>
+
+#include "tclap/CmdLine.h"
+#include "starcamera.h"
+#include "starid.h"
+#include "scenegenerator.h"
+#include "getTime.h"
+
+using namespace std;
+
+/*
+ * Every allocation through operator new is counted, so a benchmark can
+ * report the allocations per frame. Allocations of OpenCV (cv::fastMalloc)
+ * are not seen.
+ */
+std::atomic<unsigned long> allocationCount(0); /*!< Number of calls of operator new*/
+
+void * operator new(std::size_t size)
+{
+    ++allocationCount;
+    void * p = std::malloc(size ? size : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void * operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+TCLAP::CmdLine cmd("Benchmark of the centroiding and identification methods on a corpus of raw frames", ' ', "0.1");
+
+TCLAP::ValueArg<unsigned> warmup("", "warmup", "Number of untimed runs of each method per frame", false, 3, "unsigned int");
+TCLAP::ValueArg<unsigned> repetitions("r", "repetitions", "Number of timed runs of each method per frame", false, 20, "unsigned int");
+TCLAP::ValueArg<int> cpu("", "cpu", "Pin the benchmark to this CPU, -1 does not pin", false, -1, "int");
+TCLAP::ValueArg<string> format("", "format", "Output format: json or csv", false, "json", "string");
+TCLAP::ValueArg<string> output("o", "output", "Write the results to this file instead of stdout", false, string(), "filename");
+TCLAP::ValueArg<float> epsilon("e", "epsilon", "The allowed tolerance for the feature (in degrees)", false, 0.1, "float");
+TCLAP::ValueArg<unsigned> area("a", "area", "The minimum area (in pixel) for a spot to be considered for identification", false, 16, "unsigned int");
+TCLAP::ValueArg<unsigned> threshold("t", "threshold", "Threshold under which pixels are set to 0", false, 64, "unsigned int");
+TCLAP::ValueArg<string> calibrationFile("", "calibration", "Set the calibration file for the camera", true, string(), "filename");
+TCLAP::ValueArg<string> kVectorFile("", "kvector", "k-vector feature list, enables the identification benchmark", false, string(), "filename");
+TCLAP::ValueArg<string> dbFile("", "db", "Feature list in the SQLite database format, enables TwoStar and PyramidSQL", false, string(), "filename");
+TCLAP::ValueArg<unsigned> threads("", "threads", "Number of threads for PyramidKVectorParallel, 1 skips it", false, 1, "unsigned int");
+TCLAP::ValueArg<unsigned> extractThreads("", "extract-threads", "Number of threads for the spot extraction", false, 1, "unsigned int");
+TCLAP::SwitchArg rawCentroiding("", "raw", "Extract the spots from the raw 12-bit images");
+TCLAP::SwitchArg adaptiveThreshold("", "adaptive", "Use the adaptive threshold");
+TCLAP::ValueArg<unsigned> synthetic("", "synthetic", "Benchmark this number of synthetic scenes instead of files (requires --catalog)", false, 0, "unsigned int");
+TCLAP::ValueArg<string> catalogFile("", "catalog", "hip-catalog (SQLite database) the synthetic scenes are rendered from", false, string(), "filename");
+TCLAP::ValueArg<unsigned> stars("", "stars", "Maximum number of stars of a synthetic scene, 0 renders all up to magnitude 6.5", false, 0, "unsigned int");
+TCLAP::ValueArg<unsigned> hotPixels("", "hot-pixels", "Number of hot pixels of a synthetic scene", false, 0, "unsigned int");
+TCLAP::ValueArg<unsigned> falseSpots("", "false-spots", "Number of false spots of a synthetic scene", false, 0, "unsigned int");
+TCLAP::ValueArg<float> readNoise("", "read-noise", "Read noise of a synthetic scene (raw 12-bit units)", false, 8.0f, "float");
+TCLAP::ValueArg<unsigned> seed("", "seed", "Seed of the synthetic scenes", false, 1, "unsigned int");
+TCLAP::UnlabeledMultiArg<string> files("fileNames", "Raw-image files of the corpus", false, "file1");
+
+/*!
+ \brief Timing of one method over the whole corpus
+*/
+struct BenchmarkResult
+{
+    string stage; /*!< centroiding or identification*/
+    string method; /*!< Name of the method*/
+    vector<double> samples; /*!< Duration of each timed run (in s)*/
+    unsigned long allocations; /*!< Allocations during the timed runs*/
+    unsigned failures; /*!< Timed runs which threw an exception*/
+};
+
+/*!
+ \brief Returns a percentile of sorted samples (nearest rank)
+
+ \param sorted
+ \param p Fraction, e.g. 0.99
+ \return double
+*/
+double percentile(const vector<double> &sorted, double p)
+{
+    if(sorted.empty())
+        return 0.0;
+    unsigned rank = (unsigned) (p * sorted.size() + 0.5);
+    rank = std::max(1u, std::min<unsigned>(rank, sorted.size()));
+    return sorted[rank - 1];
+}
+
+/*!
+ \brief Runs a method warmup times untimed and repetitions times timed
+
+ \param result Receives the samples, allocations and failures
+ \param run The method, may throw (counted as failure)
+*/
+template<typename Function>
+void measure(BenchmarkResult &result, Function run)
+{
+    for(unsigned i=0; i<warmup.getValue(); ++i)
+    {
+        try { run(); }
+        catch(std::exception &) {}
+    }
+
+    for(unsigned i=0; i<repetitions.getValue(); ++i)
+    {
+        const unsigned long allocations = allocationCount;
+        const double startTime = getRealTime();
+        try { run(); }
+        catch(std::exception &) { ++result.failures; }
+        const double endTime = getRealTime();
+        result.allocations += allocationCount - allocations;
+        result.samples.push_back(endTime - startTime);
+    }
+}
+
+/*!
+ \brief Prints the summary of all results
+
+ \param os
+ \param results
+*/
+void writeResults(ostream &os, vector<BenchmarkResult> &results)
+{
+    const bool json = (format.getValue() == "json");
+    if(json)
+    {
+        os << "{" << endl;
+        os << "  \"frames\": " << (synthetic.getValue() ? synthetic.getValue() : files.getValue().size()) << "," << endl;
+        os << "  \"synthetic\": " << (synthetic.getValue() ? "true" : "false") << "," << endl;
+        os << "  \"warmup\": " << warmup.getValue() << "," << endl;
+        os << "  \"repetitions\": " << repetitions.getValue() << "," << endl;
+        os << "  \"cpu\": " << cpu.getValue() << "," << endl;
+        os << "  \"results\": [" << endl;
+    }
+    else
+    {
+        os << "stage,method,samples,failures,median_ms,p99_ms,mean_ms,fps,allocations_per_frame" << endl;
+    }
+
+    for(unsigned r=0; r<results.size(); ++r)
+    {
+        BenchmarkResult & result = results[r];
+        std::sort(result.samples.begin(), result.samples.end());
+        double sum = 0.0;
+        for(unsigned s=0; s<result.samples.size(); ++s)
+            sum += result.samples[s];
+
+        const unsigned n = result.samples.size();
+        const double mean = n ? sum / n : 0.0;
+        const double fps = mean > 0.0 ? 1.0 / mean : 0.0;
+        const double allocations = n ? (double) result.allocations / n : 0.0;
+
+        if(json)
+        {
+            os << "    {\"stage\": \"" << result.stage << "\", \"method\": \"" << result.method << "\""
+               << ", \"samples\": " << n << ", \"failures\": " << result.failures
+               << ", \"median_ms\": " << percentile(result.samples, 0.5) * 1e3
+               << ", \"p99_ms\": " << percentile(result.samples, 0.99) * 1e3
+               << ", \"mean_ms\": " << mean * 1e3 << ", \"fps\": " << fps
+               << ", \"allocations_per_frame\": " << allocations << "}"
+               << (r + 1 < results.size() ? "," : "") << endl;
+        }
+        else
+        {
+            os << result.stage << "," << result.method << "," << n << "," << result.failures << ","
+               << percentile(result.samples, 0.5) * 1e3 << "," << percentile(result.samples, 0.99) * 1e3 << ","
+               << mean * 1e3 << "," << fps << "," << allocations << endl;
+        }
+    }
+
+    if(json)
+    {
+        os << "  ]" << endl;
+        os << "}" << endl;
+    }
+}
+
+/*!
+ \brief Main function
+
+ For each frame of the corpus every centroiding method and, if a feature
+ list is given, every identification method is run. The identification
+ uses the spots of ConnectedComponentsWeighted.
+
+ \param argc
+ \param argv
+ \return int
+*/
+int main(int argc, char **argv)
+{
+    try
+    {
+        cmd.add(warmup);
+        cmd.add(repetitions);
+        cmd.add(cpu);
+        cmd.add(format);
+        cmd.add(output);
+        cmd.add(epsilon);
+        cmd.add(area);
+        cmd.add(threshold);
+        cmd.add(calibrationFile);
+        cmd.add(kVectorFile);
+        cmd.add(dbFile);
+        cmd.add(threads);
+        cmd.add(extractThreads);
+        cmd.add(rawCentroiding);
+        cmd.add(adaptiveThreshold);
+        cmd.add(synthetic);
+        cmd.add(catalogFile);
+        cmd.add(stars);
+        cmd.add(hotPixels);
+        cmd.add(falseSpots);
+        cmd.add(readNoise);
+        cmd.add(seed);
+        cmd.add(files);
+        cmd.parse(argc, argv);
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+        return 1;
+    }
+
+    if(format.getValue() != "json" && format.getValue() != "csv")
+    {
+        std::cerr << "error: unknown format " << format.getValue() << endl;
+        return 1;
+    }
+    if(synthetic.getValue() ? catalogFile.getValue().empty() : files.getValue().empty())
+    {
+        std::cerr << "error: no raw-image files given, or --synthetic without --catalog" << endl;
+        return 1;
+    }
+
+    // reproducible timing: no page faults and no migration between cores
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        std::cerr << "warning: mlockall failed, page faults may disturb the timing" << endl;
+    if(cpu.getValue() >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu.getValue(), &set);
+        if(sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            std::cerr << "error: unable to pin to CPU " << cpu.getValue() << endl;
+            return 1;
+        }
+    }
+
+    StarCamera starCam;
+    StarIdentifier starId;
+    starCam.setMinArea(area.getValue());
+    starCam.setThreshold(threshold.getValue());
+    starCam.loadCalibration(calibrationFile.getValue());
+    starCam.setRawCentroiding(rawCentroiding.getValue());
+    starCam.setAdaptiveThreshold(adaptiveThreshold.getValue());
+    if(extractThreads.getValue() != 1)
+        starCam.setNumThreads(extractThreads.getValue());
+
+    const bool identification = !kVectorFile.getValue().empty();
+    const bool sql = !dbFile.getValue().empty();
+    if(identification)
+        starId.loadFeatureListKVector(kVectorFile.getValue());
+    if(sql)
+    {
+        starId.setFeatureListDB(dbFile.getValue());
+        starId.openDb();
+    }
+    if(threads.getValue() != 1)
+        starId.setNumThreads(threads.getValue());
+
+    const StarCamera::CentroidingMethod centroidingMethods[] = {
+        StarCamera::ContoursGeometric, StarCamera::ContoursWeighted, StarCamera::ContoursWeightedBoundingBox,
+        StarCamera::ConnectedComponentsGeometric, StarCamera::ConnectedComponentsWeighted,
+        StarCamera::ConnectedComponentsGaussianFit};
+    const char * centroidingNames[] = {
+        "ContoursGeometric", "ContoursWeighted", "ContoursWeightedBoundingBox",
+        "ConnectedComponentsGeometric", "ConnectedComponentsWeighted",
+        "ConnectedComponentsGaussianFit"};
+    const unsigned nCentroiding = sizeof(centroidingMethods) / sizeof(centroidingMethods[0]);
+
+    const StarIdentifier::IdentificationMethod identificationMethods[] = {
+        StarIdentifier::TwoStar, StarIdentifier::PyramidSQL,
+        StarIdentifier::PyramidKVector, StarIdentifier::PyramidKVectorParallel};
+    const char * identificationNames[] = {"TwoStar", "PyramidSQL", "PyramidKVector", "PyramidKVectorParallel"};
+    const unsigned nIdentification = sizeof(identificationMethods) / sizeof(identificationMethods[0]);
+
+    vector<BenchmarkResult> results(nCentroiding + nIdentification);
+    for(unsigned m=0; m<results.size(); ++m)
+    {
+        results[m].stage = m < nCentroiding ? "centroiding" : "identification";
+        results[m].method = m < nCentroiding ? centroidingNames[m] : identificationNames[m - nCentroiding];
+        results[m].allocations = 0;
+        results[m].failures = 0;
+    }
+
+    StarIdentifier::Scratch scratch;
+    if(identification)
+        scratch.reserve(starId);
+    vector<int> idList;
+    vector<Eigen::Vector3f> spotVectors;
+    vector<float> brightness;
+
+    SceneGenerator generator(starCam);
+    if(synthetic.getValue())
+    {
+        generator.loadStarCatalog(catalogFile.getValue());
+        generator.setSeed(seed.getValue());
+        generator.setMaxStars(stars.getValue());
+        generator.setHotPixels(hotPixels.getValue());
+        generator.setFalseSpots(falseSpots.getValue());
+        generator.setReadNoise(readNoise.getValue());
+    }
+
+    const vector<string> & fileNames = files.getValue();
+    const unsigned nFrames = synthetic.getValue() ? synthetic.getValue() : fileNames.size();
+    for(unsigned frame=0; frame<nFrames; ++frame)
+    {
+        // loading or rendering is not part of the benchmark
+        if(synthetic.getValue())
+        {
+            generator.generate();
+            generator.loadInto(starCam);
+        }
+        else
+        {
+            starCam.getImageFromFile(fileNames[frame]);
+        }
+
+        for(unsigned m=0; m<nCentroiding; ++m)
+            measure(results[m], [&]() { starCam.extractSpots(centroidingMethods[m]); });
+
+        if(!identification)
+            continue;
+
+        starCam.extractSpots(StarCamera::ConnectedComponentsWeighted);
+        const vector<Spot> & spots = starCam.getSpots();
+        if(spots.empty())
+            continue;
+        starCam.calculateSpotVectors(spots, spotVectors);
+        brightness.resize(spots.size());
+        for(unsigned s=0; s<spots.size(); ++s)
+            brightness[s] = spots[s].flux;
+
+        for(unsigned m=0; m<nIdentification; ++m)
+        {
+            const StarIdentifier::IdentificationMethod method = identificationMethods[m];
+            if(!sql && (method == StarIdentifier::TwoStar || method == StarIdentifier::PyramidSQL))
+                continue;
+            if(threads.getValue() == 1 && method == StarIdentifier::PyramidKVectorParallel)
+                continue;
+
+            measure(results[nCentroiding + m], [&]()
+            {
+                starId.identifyStars(spotVectors, epsilon.getValue(), idList, scratch, method, &brightness);
+            });
+        }
+    }
+
+    // methods which were not run are not reported
+    vector<BenchmarkResult> measured;
+    for(unsigned m=0; m<results.size(); ++m)
+    {
+        if(!results[m].samples.empty())
+            measured.push_back(results[m]);
+    }
+
+    if(output.getValue().empty())
+    {
+        writeResults(cout, measured);
+    }
+    else
+    {
+        ofstream file(output.getValue().c_str());
+        if(!file.is_open())
+        {
+            std::cerr << "error: unable to write " << output.getValue() << endl;
+            return 1;
+        }
+        writeResults(file, measured);
+    }
+
+    return 0;
+}
@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #ifndef APBASE_LITE
     #include "apbase.h"
@@ -48,21 +54,165 @@ public:
      The formate is Bayer-12 in 2 bytes with leading 0s
 
      Note:
-          At the moment no internal buffer handling is done, hence the function
-          will overwrite the last frame. Therefore the caller must ensure that
-          processing of the frame is finished.
-
-     TODO:
-          Use double or triple buffer to avoid side effects from above mentioned
-          behaviour.
+          This is the synchronous single-shot interface: the same buffer is
+          overwritten on every call, hence the caller must ensure that
+          processing of the frame is finished. For continuous acquisition use
+          startCapture() together with acquireFrame() and releaseFrame().
+          Calling grabFrame() while the capture thread is running throws.
 
      \param imageBuf Will contain the address of the image buffer the frame was written to
      \return bool True if the frame was grabbed successfully.
     */
     bool grabFrame(uint8_t **imageBuf);
 
+    /*!
+     \brief Starts the asynchronous acquisition of frames
+
+     Allocates a ring of nBuffers frame buffers and starts a capture thread
+     which continuously grabs frames into the free buffers. Filled buffers
+     are queued until the caller takes them with acquireFrame(). If all
+     buffers are either queued or held by the caller the oldest queued frame
+     is overwritten (and counted as dropped), thus acquireFrame() always
+     returns the most recent frames.
+
+     All buffers of a previous capture have to be released before, otherwise
+     std::logic_error is thrown and a running capture continues.
+
+     \param nBuffers Number of frame buffers in the ring (at least 2)
+    */
+    void startCapture(unsigned nBuffers = 3);
+
+    /*!
+     \brief Stops the capture thread
+
+     Blocks until the frame currently being grabbed is finished. Buffers
+     held by the caller stay valid until they are released or the camera is destroyed.
+    */
+    void stopCapture();
+
+    /*!
+     \brief Returns if the capture thread is running
+
+     \return bool
+    */
+    bool isCapturing() const { return mCapturing; }
+
+    /*!
+     \brief Takes the oldest filled frame from the capture queue
+
+     The buffer belongs to the caller until it is handed back with
+     releaseFrame(), the capture thread will not write into it meanwhile.
+
+     \param imageBuf Will contain the address of the frame buffer
+     \param timeoutMs Maximum time to wait for a frame (in milliseconds)
+     \param timestamp If not NULL, receives the getRealTime() at which the frame was completed
+     \return bool True if a frame was acquired, false on timeout or if the capture was stopped meanwhile
+    */
+    bool acquireFrame(uint8_t **imageBuf, unsigned timeoutMs = 1000, double *timestamp = NULL);
+
+    /*!
+     \brief Hands a buffer from acquireFrame() back to the capture thread
+
+     \param imageBuf Address of the frame buffer
+    */
+    void releaseFrame(uint8_t *imageBuf);
+
+    /*!
+     \brief Returns the number of frames which were overwritten before being acquired
+
+     \return unsigned
+    */
+    unsigned getDroppedFrames() const { return mDroppedFrames; }
+
+
+
+    /*!
+     \brief Sets the readout window of the sensor
+
+     The start coordinates are rounded down to even values and the size down
+     to a multiple of 2 * getSubsampling(), as required by the Bayer pattern.
+     The frame buffers are reallocated for the new frame size. If the capture
+     thread is running, it is stopped and restarted with the new buffers, in
+     this case no frame may be held by the caller (see releaseFrame()).
+
+     \param rowStart First row on the sensor (0 is the first active row)
+     \param colStart First column on the sensor (0 is the first active column)
+     \param height Number of sensor rows to read (before subsampling)
+     \param width Number of sensor columns to read (before subsampling)
+    */
+    void setReadoutWindow(unsigned rowStart, unsigned colStart, unsigned height, unsigned width);
+
+    /*!
+     \brief Sets a readout window of the given size centered on the sensor
+
+     \param height Number of sensor rows to read (before subsampling)
+     \param width Number of sensor columns to read (before subsampling)
+    */
+    void setCenteredWindow(unsigned height, unsigned width);
+
+    /*!
+     \brief Reads out the full sensor
+    */
+    void setFullWindow() { setReadoutWindow(0, 0, SENSOR_HEIGHT, SENSOR_WIDTH); }
+
+    /*!
+     \brief Sets the subsampling of rows and columns
+
+     Frames are reduced by factor in both directions, either by skipping or by
+     binning (summing) the pixels. The Bayer pattern is kept, i.e. pairs of
+     rows and columns are skipped or binned. The window is adjusted to a
+     multiple of the new factor. Frame buffers are reallocated as for
+     setReadoutWindow().
+
+     \param factor Subsampling factor: 1 to 4 for skipping, 1, 2 or 4 for binning
+     \param binning Bin the pixels instead of skipping them
+    */
+    void setSubsampling(unsigned factor, bool binning = false);
+
+    /*!
+     \brief Sets the exposure time
+
+     \param rows Exposure (shutter width) in row times
+    */
+    void setExposure(unsigned rows);
+
+    /*!
+     \brief Returns the exposure time
+
+     \return unsigned Exposure (shutter width) in row times
+    */
+    unsigned getExposure() const { return mExposure; }
+
+    /*!
+     \brief Returns the first sensor row of the readout window
+
+     \return unsigned
+    */
+    unsigned getRowStart() const { return mRowStart; }
+
+    /*!
+     \brief Returns the first sensor column of the readout window
+
+     \return unsigned
+    */
+    unsigned getColumnStart() const { return mColStart; }
+
+    /*!
+     \brief Returns the subsampling factor
+
+     \return unsigned
+    */
+    unsigned getSubsampling() const { return mSubsampling; }
 
+    /*!
+     \brief Returns if the subsampling is done by binning instead of skipping
+
+     \return bool
+    */
+    bool getBinning() const { return mBinning; }
 
+    static const unsigned SENSOR_WIDTH = 2592; /*!< Number of active columns of the MT9P031*/
+    static const unsigned SENSOR_HEIGHT = 1944; /*!< Number of active rows of the MT9P031*/
 
     /*!
      \brief Returns the number of columns of the frame
@@ -86,11 +236,57 @@ public:
     ap_u32 getBufferSize() const { return mBufferSize; }
 
 private:
+    /*!
+     \brief A filled frame buffer waiting in the capture queue
+    */
+    struct QueuedFrame
+    {
+        uint8_t * buffer; /*!< Frame buffer*/
+        double timestamp; /*!< getRealTime() at which the frame was completed*/
+    };
+
+    /*!
+     \brief Main loop of the capture thread
+    */
+    void captureLoop();
+
+    /*!
+     \brief Writes a sensor register
+
+     \param address Register address
+     \param value New value
+    */
+    void writeRegister(ap_u32 address, ap_u32 value);
+
+    /*!
+     \brief Writes window and subsampling registers and reallocates the frame buffers
+
+     Stops and restarts the capture thread if it is running.
+    */
+    void applyFormat();
+
     AP_HANDLE mHandle; /*!< Camera handle of the Apbase library */
     ap_u32 mWidth; /*!< Frame width with current camera settings*/
     ap_u32 mHeight; /*!< Frame height with current camera settings*/
     ap_u32 mBufferSize; /*!< Buffer size (in Bytes) with current camera settings*/
-    uint8_t * mImageBuf; /*!< Image buffer*/
+    uint8_t * mImageBuf; /*!< Image buffer for grabFrame()*/
+    unsigned mRowStart; /*!< First sensor row of the readout window*/
+    unsigned mColStart; /*!< First sensor column of the readout window*/
+    unsigned mWindowHeight; /*!< Number of sensor rows of the readout window*/
+    unsigned mWindowWidth; /*!< Number of sensor columns of the readout window*/
+    unsigned mSubsampling; /*!< Subsampling factor of rows and columns*/
+    bool mBinning; /*!< Subsampling by binning instead of skipping*/
+    unsigned mExposure; /*!< Shutter width in row times*/
+
+    std::vector<uint8_t*> mRing; /*!< All frame buffers used by the capture thread*/
+    std::deque<uint8_t*> mFreeFrames; /*!< Buffers the capture thread may write into*/
+    std::deque<QueuedFrame> mReadyFrames; /*!< Filled buffers in order of acquisition*/
+    std::mutex mQueueMutex; /*!< Protects mFreeFrames and mReadyFrames*/
+    std::condition_variable mQueueCond; /*!< Signals changes of the queues*/
+    std::thread mCaptureThread; /*!< Thread running captureLoop()*/
+    std::atomic<bool> mCapturing; /*!< Capture thread is running*/
+    std::atomic<unsigned> mDroppedFrames; /*!< Number of frames overwritten before being acquired*/
+    unsigned mHeldFrames; /*!< Buffers acquired by the caller and not released yet (protected by mQueueMutex)*/
 };
 
 #endif
@@ -0,0 +1,78 @@
+#ifndef ATTITUDE_H
+#define ATTITUDE_H
+
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "starid.h"
+
+/*!
+ \brief Attitude of the camera determined from identified stars
+*/
+struct Attitude
+{
+    Attitude() :valid(false), nStars(0), loss(0.0)
+    {
+        quaternion.setIdentity();
+        covariance.setZero();
+    }
+
+    bool valid; /*!< An attitude could be determined (at least 2 identified stars)*/
+    unsigned nStars; /*!< Number of stars used*/
+    Eigen::Quaterniond quaternion; /*!< Rotation from the inertial frame into the camera frame (b = q * r)*/
+    Eigen::Matrix3d covariance; /*!< Covariance of the attitude error angles in the camera frame (in rad^2)*/
+    double loss; /*!< Value of Wahba's loss function at the solution*/
+};
+
+/*!
+ \brief Solves Wahba's problem for the identified spots with the QUEST algorithm
+
+ With B = sum(w * b * r^T) the optimal quaternion is the eigenvector of the
+ largest eigenvalue of Davenport's K-matrix. QUEST finds this eigenvalue
+ with a Newton iteration on the characteristic polynomial, starting from the
+ sum of the weights. For rotations close to 180 degree the QUEST
+ quaternion is undefined, in this case the eigenvector is computed directly
+ (Davenport's q-method).
+
+ All vectors are processed with fixed size Eigen types and no memory is
+ allocated, so solving takes only a few microseconds.
+
+ Reference: M. D. Shuster, S. D. Oh, "Three-Axis Attitude Determination from
+ Vector Observations", 1981
+*/
+class AttitudeSolver
+{
+public:
+    /*!
+     \brief Constructor
+    */
+    AttitudeSolver();
+
+    /*!
+     \brief Sets the standard deviation of the direction of a spot vector
+
+     Used for the weights and the covariance, all spots have the same accuracy.
+
+     \param sigma Standard deviation (in rad)
+    */
+    void setMeasurementSigma(double sigma) { mSigma = sigma; }
+
+    /*!
+     \brief Determines the attitude from the identified spots
+
+     \param spotVectors Camera vectors of the spots (e.g. StarCamera::getSpotVectors())
+     \param ids hip-IDs of the spots, -1 for unidentified (e.g. StarIdentifier::identifyStars())
+     \param catalog Identifier with the inertial vectors loaded (see StarIdentifier::loadStarCatalog())
+     \param attitude Result
+     \return bool attitude.valid
+    */
+    bool solve(const StarIdentifier::vectorList_t &spotVectors, const std::vector<int> &ids,
+               const StarIdentifier &catalog, Attitude &attitude) const;
+
+private:
+    double mSigma; /*!< Standard deviation of a spot direction (in rad)*/
+};
+
+#endif // ATTITUDE_H
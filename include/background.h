@@ -0,0 +1,159 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <vector>
+#include <stdint.h>
+
+/*!
+ \brief Estimates the background and noise of raw frames in tiles and derives a threshold per tile
+
+ The frame is divided into square tiles. For each tile the median and the
+ median absolute deviation (MAD) of a subsampled grid of pixels are
+ computed; the grid uses every 3rd row and column, so all four colors of
+ the Bayer pattern are sampled and a few stars barely change the
+ estimate. The threshold of a tile is
+
+    median + max(k * 1.4826 * MAD, minDelta)
+
+ where 1.4826 * MAD is the standard deviation for gaussian noise. With
+ stray light or a gradient over the frame the threshold follows the
+ background, so the number of noise spots stays small and dim stars in
+ dark regions are kept.
+
+ Background changes slowly compared to the frame rate, hence update()
+ only estimates a part of the tiles per frame (round robin). A change of
+ the frame size restarts with all tiles.
+*/
+class BackgroundEstimator
+{
+public:
+    /*!
+     \brief Constructor
+    */
+    BackgroundEstimator();
+
+    /*!
+     \brief Sets the size of the tiles
+
+     Has to be a multiple of 16, clears the estimate.
+
+     \param size Width and height of a tile (in px, default 64)
+    */
+    void setTileSize(unsigned size);
+
+    /*!
+     \brief Returns the size of the tiles
+
+     \return unsigned
+    */
+    unsigned getTileSize() const { return mTileSize; }
+
+    /*!
+     \brief Sets the distance of the threshold from the background in standard deviations
+
+     \param k Factor (default 5)
+    */
+    void setSigmaFactor(float k) { mSigmaFactor = k; }
+
+    /*!
+     \brief Sets the minimum distance of the threshold from the background
+
+     Avoids a threshold within the noise for tiles with a MAD of 0, e.g. dark frames.
+
+     \param delta Minimum distance (raw 12-bit units, default 64)
+    */
+    void setMinDelta(unsigned delta) { mMinDelta = delta; }
+
+    /*!
+     \brief Sets after how many frames each tile is estimated again
+
+     \param frames Number of frames, 1 estimates all tiles in every frame (default 4)
+    */
+    void setUpdateInterval(unsigned frames);
+
+    /*!
+     \brief Forgets the estimate, the next update() estimates all tiles
+    */
+    void reset();
+
+    /*!
+     \brief Updates the estimate with a new frame
+
+     \param raw Raw Bayer-12 frame
+     \param rows Height of the frame
+     \param cols Width of the frame
+    */
+    void update(const uint16_t *raw, const unsigned rows, const unsigned cols);
+
+    /*!
+     \brief Returns the number of tiles in a row
+
+     \return unsigned
+    */
+    unsigned getTilesPerRow() const { return mTilesPerRow; }
+
+    /*!
+     \brief Returns the number of rows of tiles
+
+     \return unsigned
+    */
+    unsigned getTileRows() const { return mTileRows; }
+
+    /*!
+     \brief Returns the background (raw median) of a tile
+
+     \param tileRow
+     \param tileCol
+     \return uint16_t
+    */
+    uint16_t getBackground(unsigned tileRow, unsigned tileCol) const { return mBackground[tileRow * mTilesPerRow + tileCol]; }
+
+    /*!
+     \brief Returns the thresholds on the 8-bit scale, one per tile in row major order
+
+     A pixel is above the threshold if its 8-bit value is greater than the
+     threshold of its tile. Input for convert12To8ThresholdTiles().
+
+     \return const uint8_t*
+    */
+    const uint8_t * getThresholds() const { return mThresholds.data(); }
+
+    /*!
+     \brief Returns the same thresholds on the raw scale for each column
+
+     For each row of tiles one value per column of the frame: a raw pixel
+     p is above the threshold if p > t, which is equivalent to
+     getThresholds(). Input for RunLabeller::label() on raw data.
+
+     \return const uint16_t*
+    */
+    const uint16_t * getRawThresholdRows() const { return mRawThresholdRows.data(); }
+
+private:
+    /*!
+     \brief Estimates background and threshold of one tile
+
+     \param raw Raw frame
+     \param tile Index of the tile
+    */
+    void estimateTile(const uint16_t *raw, unsigned tile);
+
+    unsigned mTileSize; /*!< Width and height of the tiles*/
+    float mSigmaFactor; /*!< Distance of the threshold in standard deviations*/
+    unsigned mMinDelta; /*!< Minimum distance of the threshold (raw units)*/
+    unsigned mUpdateInterval; /*!< Number of frames after which a tile is estimated again*/
+
+    unsigned mRows; /*!< Height of the frames*/
+    unsigned mCols; /*!< Width of the frames*/
+    unsigned mTileRows; /*!< Number of rows of tiles*/
+    unsigned mTilesPerRow; /*!< Number of tiles in a row*/
+    unsigned mNextTile; /*!< Next tile for the round robin update*/
+    bool mValid; /*!< All tiles were estimated at least once*/
+
+    std::vector<uint16_t> mBackground; /*!< Median of each tile*/
+    std::vector<uint8_t> mThresholds; /*!< 8-bit threshold of each tile*/
+    std::vector<uint16_t> mRawThresholdRows; /*!< Raw threshold of each column for each row of tiles*/
+    std::vector<uint16_t> mSamples; /*!< Working memory for the median*/
+};
+
+#endif // BACKGROUND_H
@@ -0,0 +1,207 @@
+#ifndef BATCH_REPLAY_H
+#define BATCH_REPLAY_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <ostream>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+#include "datatypes.h"
+#include "starcatalog.h"
+#include "pipeline.h"
+#include "threadpool.h"
+
+/*!
+ \brief Header of the binary replay stream (see BatchReplay::writeBinaryHeader())
+
+ The stream consists of (all values in native, i.e. little endian, byte order):
+    ReplayStreamHeader header;
+    for each image in input order:
+        ReplayRecordHeader record;
+        ReplaySpotRecord spots[record.spotCount];
+*/
+struct ReplayStreamHeader
+{
+    char magic[4]; /*!< Always "SCRP"*/
+    uint32_t version; /*!< Version of the stream format*/
+};
+
+/*!
+ \brief Record of one image in the binary replay stream
+*/
+struct ReplayRecordHeader
+{
+    uint32_t index; /*!< Position of the image in the input list*/
+    uint32_t status; /*!< BatchReplay::Status*/
+    uint32_t spotCount; /*!< Number of ReplaySpotRecord following*/
+    uint32_t attitudeValid; /*!< 1 if the quaternion is valid*/
+    double quaternion[4]; /*!< Attitude w, x, y, z (rotation from the inertial frame into the camera frame)*/
+    double loss; /*!< Value of Wahba's loss function*/
+};
+
+/*!
+ \brief Spot of an image in the binary replay stream
+*/
+struct ReplaySpotRecord
+{
+    float x; /*!< Column of the centroid*/
+    float y; /*!< Row of the centroid*/
+    float flux; /*!< Flux on the 12-bit scale*/
+    uint32_t area; /*!< Number of pixels*/
+    int32_t hip; /*!< hip-ID (-1 if not identified)*/
+};
+
+/*!
+ \brief Magic number at the beginning of every binary replay stream
+*/
+const char REPLAY_STREAM_MAGIC[4] = {'S', 'C', 'R', 'P'};
+
+/*!
+ \brief Current version of the binary replay stream format
+*/
+const uint32_t REPLAY_STREAM_VERSION = 1;
+
+/*!
+ \brief Offline replay of a list of raw image files with a pool of workers
+
+ Each worker processes whole images with its own Pipeline, all pipelines
+ share one catalog. The images are handed out in input order and their
+ results are passed to the callback in input order as well, serialized
+ (from one of the workers). At most maxInFlight images are processed or
+ waiting for an earlier one to be written, so the memory does not depend on
+ the number of files, and the buffers of the results are reused.
+*/
+class BatchReplay
+{
+public:
+    /*!
+     \brief Outcome of the processing of an image
+    */
+    enum Status
+    {
+        Identified = 0, /*!< The identification was run*/
+        TooFewSpots = 1, /*!< Not enough spots for an identification*/
+        Failed = 2 /*!< The image could not be processed (see ImageResult::error)*/
+    };
+
+    /*!
+     \brief Result of one image
+    */
+    struct ImageResult
+    {
+        unsigned index; /*!< Position of the image in the input list*/
+        std::string filename; /*!< Raw image file*/
+        Status status; /*!< Outcome*/
+        std::string error; /*!< Message of the exception if status is Failed*/
+        std::vector<Spot> spots; /*!< Extracted spots*/
+        std::vector<int> ids; /*!< hip-IDs of the spots (-1 if not identified)*/
+        Attitude attitude; /*!< Attitude of the camera (only valid if the star catalog is loaded)*/
+    };
+
+    /*!
+     \brief Typedef for the function which configures the pipeline of each worker
+
+     Called once per worker before the first image, e.g. to load the
+     camera calibration and set the thresholds.
+    */
+    typedef std::function<void (Pipeline &)> Setup;
+
+    /*!
+     \brief Typedef for the function which is called with the result of every image in input order
+    */
+    typedef std::function<void (const ImageResult &)> ResultCallback;
+
+    /*!
+     \brief Constructor
+
+     \param catalog Loaded catalog, shared by all workers
+     \param setup Configuration of the pipeline of each worker
+     \param nThreads Number of workers, 0 uses the number of cores
+     \param maxInFlight Largest number of images processed or waiting to be written, 0 uses twice the number of workers
+    */
+    BatchReplay(const std::shared_ptr<const StarCatalog> &catalog, const Setup &setup,
+                unsigned nThreads = 0, unsigned maxInFlight = 0);
+
+    /*!
+     \brief Returns the number of workers
+
+     \return unsigned
+    */
+    unsigned getNumThreads() const { return mPool.getNumThreads(); }
+
+    /*!
+     \brief Processes all files and passes the results to the callback in input order
+
+     Exceptions of the processing of an image are reported in its result
+     (status Failed), exceptions of the callback abort the replay and are
+     rethrown.
+
+     \param files Raw image files (of the default size of Pipeline::processImageFile())
+     \param callback Receives the result of each image
+    */
+    void run(const std::vector<std::string> &files, const ResultCallback &callback);
+
+    /*!
+     \brief Writes the column names of writeCsv()
+
+     \param os
+    */
+    static void writeCsvHeader(std::ostream &os);
+
+    /*!
+     \brief Writes the result of an image as one line of CSV
+
+     The hip-IDs of the spots are written space separated in the last column.
+
+     \param os
+     \param result
+    */
+    static void writeCsv(std::ostream &os, const ImageResult &result);
+
+    /*!
+     \brief Writes the header of the binary replay stream (see ReplayStreamHeader)
+
+     \param os
+    */
+    static void writeBinaryHeader(std::ostream &os);
+
+    /*!
+     \brief Writes the result of an image as record of the binary replay stream
+
+     \param os
+     \param result
+    */
+    static void writeBinary(std::ostream &os, const ImageResult &result);
+
+private:
+    BatchReplay(const BatchReplay &);
+    BatchReplay & operator = (const BatchReplay &);
+
+    /*!
+     \brief Processes one image with the pipeline of a worker
+
+     \param index Position of the image in the input list
+     \param worker Number of the worker
+     \param files Input list
+     \param callback Receives the results which are next in input order
+    */
+    void processImage(unsigned index, unsigned worker, const std::vector<std::string> &files,
+                      const ResultCallback &callback);
+
+    ThreadPool mPool; /*!< Workers*/
+    std::vector<std::unique_ptr<Pipeline> > mPipelines; /*!< Pipeline of each worker*/
+    std::vector<ImageResult, Eigen::aligned_allocator<ImageResult> > mSlots; /*!< Results of the images in flight, image i in slot i % size*/
+    std::vector<bool> mDone; /*!< Result of the slot is complete*/
+    unsigned mWritten; /*!< Number of results passed to the callback*/
+    bool mAborted; /*!< The callback threw, the remaining images are skipped*/
+    std::mutex mMutex; /*!< Protects mDone, mWritten and mAborted*/
+    std::condition_variable mSlotFree; /*!< Signals that mWritten advanced*/
+};
+
+#endif // BATCH_REPLAY_H
@@ -0,0 +1,75 @@
+#ifndef CENTROID_KERNELS_H
+#define CENTROID_KERNELS_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ \brief Weighting of the pixels of a centroid
+*/
+enum CentroidWeighting
+{
+    GeometricWeighting, /*!< Every counted pixel has the weight 1*/
+    IntensityWeighting /*!< Pixels are weighted with their value*/
+};
+
+/*!
+ \brief Moments of the pixels of a window
+
+ The centroid is (sumX / sum, sumY / sum) relative to the first pixel of
+ the window. The sums are 64 bit, so even a saturated 16-bit window of the
+ size of a full frame does not overflow.
+*/
+struct WindowMoments
+{
+    WindowMoments() :area(0), sum(0), sumX(0), sumY(0) {}
+
+    uint64_t area; /*!< Number of counted pixels with a value greater than 0*/
+    uint64_t sum; /*!< sum(w), w is the weight of the pixel*/
+    uint64_t sumX; /*!< sum(x * w)*/
+    uint64_t sumY; /*!< sum(y * w)*/
+};
+
+/*!
+ \brief Accumulates the moments of the pixels of a window
+
+ Specialized at compile time for the pixel type, the weighting and the
+ masking, so every variant has a branch free inner loop the compiler can
+ unroll and vectorize. Instantiated for uint8_t (8-bit frames) and uint16_t
+ (raw Bayer-12 and 16-bit frames), both weightings and with and without mask.
+
+ \param image First pixel of the window
+ \param stride Distance between two rows of image (in pixels)
+ \param mask If Masked, only pixels with a mask value other than 0 are counted
+ \param maskStride Distance between two rows of mask (in pixels)
+ \param rows Height of the window
+ \param cols Width of the window
+ \param moments Moments the pixels of the window are added to
+*/
+template<typename T, CentroidWeighting Weighting, bool Masked>
+void accumulateWindowMoments(const T *image, std::size_t stride, const uint8_t *mask, std::size_t maskStride,
+                             unsigned rows, unsigned cols, WindowMoments &moments);
+
+/*!
+ \brief Typedef for a pointer to an instantiation of accumulateWindowMoments()
+
+ The pixel type is erased, image points to pixels of the type the kernel was
+ selected for (see selectWindowMomentsKernel()).
+*/
+typedef void (*WindowMomentsKernel)(const void *image, std::size_t stride, const uint8_t *mask, std::size_t maskStride,
+                                    unsigned rows, unsigned cols, WindowMoments &moments);
+
+/*!
+ \brief Selects the instantiation of accumulateWindowMoments() for a kind of image
+
+ Meant to be called once before the windows of a frame are processed, the
+ returned kernel has no further runtime dispatch.
+
+ \param pixelSize Size of a pixel in bytes (1 for uint8_t, 2 for uint16_t)
+ \param weighting
+ \param masked Count only the pixels of the mask
+ \return WindowMomentsKernel
+*/
+WindowMomentsKernel selectWindowMomentsKernel(std::size_t pixelSize, CentroidWeighting weighting, bool masked);
+
+#endif // CENTROID_KERNELS_H
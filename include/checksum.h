@@ -0,0 +1,19 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include <cstddef>
+
+/*!
+ \brief Computes the checksum of the data of a binary file (k-vector, defect map)
+
+ Fletcher like checksum over 32-bit words: with a = sum(w[i]) and
+ b = sum((n-i) * w[i]) (both modulo 2^32) the checksum is a XOR b.
+
+ \param data Start of the data (has to be 4-byte aligned)
+ \param size Size of the data in bytes (multiple of 4)
+ \return uint32_t
+*/
+uint32_t dataChecksum(const void *data, std::size_t size);
+
+#endif // CHECKSUM_H
@@ -7,7 +7,7 @@
  \brief Representation of a star spot
 
  A spot represents the 2-dimensional coordinates of a bright
- spot in a star image and its area.
+ spot in a star image, its area and its brightness.
 
 */
 struct Spot
@@ -15,18 +15,20 @@ struct Spot
 /*!
  \brief Constructs an empty Spot
 */
-    Spot() {}
+    Spot() :area(0), flux(0.0f) {}
 
 /*!
  \brief Constructs a Spot from predefined values
 
  \param center_ Centroid of the Spot (2D)
  \param area_   Area (in px) of the Spot
+ \param flux_   Integrated brightness of the Spot
 */
-    Spot(cv::Point2f center_, float area_)
-        :center(center_), area(area_) {}
+    Spot(cv::Point2f center_, float area_, float flux_ = 0.0f)
+        :center(center_), area(area_), flux(flux_) {}
     cv::Point2f center; /*!< Centroid of the Spot (2D) */
     unsigned area; /*!< Area (in px) of the Spot */
+    float flux; /*!< Sum of the pixel values of the Spot on the 12-bit scale (0 if unknown)*/
 };
 
 /*!
@@ -0,0 +1,212 @@
+#ifndef DEFECT_MAP_H
+#define DEFECT_MAP_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ \brief Run of defective pixels in a row of the sensor
+*/
+struct DefectRun
+{
+    uint16_t row; /*!< Row of the run*/
+    uint16_t col; /*!< First column of the run*/
+    uint16_t length; /*!< Number of pixels*/
+    uint16_t reserved; /*!< Padding, has to be 0*/
+};
+
+/*!
+ \brief Header of the binary defect map file
+
+ The file consists of (all values in native, i.e. little endian, byte order):
+    DefectMapFileHeader header;
+    DefectRun runs[runCount];   sorted by row and column, not overlapping
+
+ The checksum is computed with dataChecksum() over the runs.
+*/
+struct DefectMapFileHeader
+{
+    char magic[4]; /*!< Always "SCDM"*/
+    uint32_t version; /*!< Version of the file format*/
+    uint32_t rows; /*!< Height of the sensor*/
+    uint32_t cols; /*!< Width of the sensor*/
+    uint32_t runCount; /*!< Number of DefectRun following*/
+    uint32_t checksum; /*!< Checksum of the runs*/
+};
+
+/*!
+ \brief Magic number at the beginning of every binary defect map file
+*/
+const char DEFECT_MAP_FILE_MAGIC[4] = {'S', 'C', 'D', 'M'};
+
+/*!
+ \brief Current version of the binary defect map file format
+*/
+const uint32_t DEFECT_MAP_FILE_VERSION = 1;
+
+/*!
+ \brief Hot pixels and defective columns of the sensor
+
+ The defects are stored as runs of pixels per row, a few hundred hot pixels
+ and some bad columns take a few kilobytes. StarCamera zeroes them in the
+ thresholded image right after each row is converted (see
+ convert12To8Threshold()), while the row is still in the cache, so the
+ labelling and identification never see them.
+
+ The map is calibrated from dark frames: a pixel is defective if it is above
+ the threshold in most of the frames, a column if a large part of its pixels
+ is defective. Once calibrated, the map is not changed and can be shared
+ read-only by several cameras, e.g. with a std::shared_ptr<const DefectMap>.
+*/
+class DefectMap
+{
+public:
+    /*!
+     \brief Constructs an empty map
+    */
+    DefectMap();
+
+    /*!
+     \brief Starts a calibration, forgets the current map
+
+     \param rows Height of the dark frames
+     \param cols Width of the dark frames
+    */
+    void beginCalibration(unsigned rows, unsigned cols);
+
+    /*!
+     \brief Counts the pixels of a dark frame which are above the threshold
+
+     A pixel is counted if its 8-bit value (see convert12To8Threshold()) is
+     greater than threshold, i.e. if it would pass the thresholding of StarCamera.
+
+     \param raw Raw Bayer-12 dark frame of the size passed to beginCalibration()
+     \param threshold Threshold (in 8-bit units)
+    */
+    void addDarkFrame(const uint16_t *raw, unsigned threshold);
+
+    /*!
+     \brief Builds the map from the counted dark frames
+
+     \param minFraction Fraction of the dark frames in which a pixel has to be above the threshold
+     \param columnFraction Fraction of the defective pixels of a column to mark the whole column, 0 disables column defects
+    */
+    void endCalibration(float minFraction = 0.5f, float columnFraction = 0.25f);
+
+    /*!
+     \brief Loads a binary defect map file (see DefectMapFileHeader)
+
+     \param filename
+    */
+    void load(const std::string filename);
+
+    /*!
+     \brief Saves the map as binary defect map file
+
+     \param filename
+    */
+    void save(const std::string filename) const;
+
+    /*!
+     \brief Returns if the map has no defects
+
+     \return bool
+    */
+    bool empty() const { return mRuns.empty(); }
+
+    /*!
+     \brief Returns the height of the sensor
+
+     \return unsigned
+    */
+    unsigned getRows() const { return mRows; }
+
+    /*!
+     \brief Returns the width of the sensor
+
+     \return unsigned
+    */
+    unsigned getCols() const { return mCols; }
+
+    /*!
+     \brief Returns if the map was made for frames of this size
+
+     \param rows
+     \param cols
+     \return bool
+    */
+    bool matches(unsigned rows, unsigned cols) const { return rows == mRows && cols == mCols; }
+
+    /*!
+     \brief Returns the runs (sorted by row and column)
+
+     \return const std::vector<DefectRun> &
+    */
+    const std::vector<DefectRun> & getRuns() const { return mRuns; }
+
+    /*!
+     \brief Returns the number of defective pixels
+
+     \return std::size_t
+    */
+    std::size_t getPixelCount() const;
+
+    /*!
+     \brief Returns the first run of a row
+
+     The runs of row y are [rowBegin(y), rowBegin(y + 1)).
+
+     \param y Row (at most getRows())
+     \return const DefectRun *
+    */
+    const DefectRun * rowBegin(unsigned y) const { return mRuns.empty() ? NULL : &mRuns[0] + mRowStart[y]; }
+
+    /*!
+     \brief Returns if a pixel is defective
+
+     \param y Row
+     \param x Column
+     \return bool
+    */
+    bool isDefect(unsigned y, unsigned x) const;
+
+    /*!
+     \brief Sets the defective pixels of a row to 0
+
+     \param y Row
+     \param row Pixels of the row
+    */
+    void maskRow(unsigned y, uint8_t *row) const
+    {
+        if(mRuns.empty())
+            return;
+        for(const DefectRun *run = rowBegin(y), *end = rowBegin(y + 1); run != end; ++run)
+            std::memset(row + run->col, 0, run->length);
+    }
+
+    /*!
+     \brief Sets the defective pixels of an image to 0
+
+     \param image 8-bit image of getRows() x getCols() pixels
+     \param stride Distance between two rows (in pixels)
+    */
+    void maskImage(uint8_t *image, std::size_t stride) const;
+
+private:
+    /*!
+     \brief Builds mRowStart from mRuns
+    */
+    void indexRows();
+
+    unsigned mRows; /*!< Height of the sensor*/
+    unsigned mCols; /*!< Width of the sensor*/
+    std::vector<DefectRun> mRuns; /*!< Defects sorted by row and column*/
+    std::vector<uint32_t> mRowStart; /*!< Index of the first run of each row, mRows + 1 entries*/
+    std::vector<uint16_t> mCounts; /*!< Number of dark frames each pixel was above the threshold (calibration only)*/
+    unsigned mFrames; /*!< Number of dark frames of the calibration*/
+};
+
+#endif // DEFECT_MAP_H
@@ -0,0 +1,141 @@
+#ifndef FIX_SERVER_H
+#define FIX_SERVER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "pipeline.h"
+
+/*!
+ \brief Long-running service computing attitude fixes on request over a Unix socket
+
+ The camera, its calibration and the catalog stay loaded between the fixes,
+ so a fix costs only the grab and the processing instead of the start-up of
+ a process. Clients connect to a Unix domain stream socket and send requests
+ as lines of text, each request is answered before the next line is read:
+
+    fix [file]                  grab a frame (or load a raw image file, the rest of the line) and identify it
+    set threshold <n>           StarCamera::setThreshold()
+    set min-area <n>            StarCamera::setMinArea()
+    set epsilon <degree>        tolerance of the identification
+    set exposure <rows>         StarCamera::setExposure() (camera only)
+    get                         current settings
+    stats                       number of fixes and their latency
+    quit                        close the connection
+    shutdown                    close the connection and stop the server
+
+ Replies are one line starting with "OK" or "ERR <message>". The reply of a
+ fix is followed by one line per spot and a line "END":
+
+    OK fix <spots> <identified> <attitude valid> <qw> <qx> <qy> <qz> <loss> <latency in s>
+    <x> <y> <flux> <area> <hip-ID or -1>
+    [...]
+    END
+
+ Clients are served one after another, requests of different clients are
+ never processed concurrently. A client is disconnected if it sends no
+ complete request for 10 s, so an idle client cannot block the others. The
+ socket file is only accessible by its owner, as requests can stop the
+ server and read any file of the owner.
+*/
+class FixServer
+{
+public:
+    /*!
+     \brief Statistics of the processed fixes
+    */
+    struct Stats
+    {
+        Stats() :fixes(0), identified(0), failed(0), lastLatency(0.0), totalLatency(0.0) {}
+
+        unsigned fixes; /*!< Requested fixes*/
+        unsigned identified; /*!< Fixes with a valid attitude (or identified stars without star catalog)*/
+        unsigned failed; /*!< Fixes which threw an exception*/
+        double lastLatency; /*!< Processing time of the last fix (in s)*/
+        double totalLatency; /*!< Sum of the processing times (in s)*/
+    };
+
+    /*!
+     \brief Constructor
+
+     The pipeline has to be configured (calibration, thresholds, methods, and
+     initializeCamera() of its camera if fixes are grabbed).
+
+     \param pipeline Processing chain of the fixes, with the resident catalog
+     \param useCamera Grab a frame for "fix" requests without file
+    */
+    FixServer(Pipeline &pipeline, bool useCamera);
+
+    /*!
+     \brief Destructor, closes the socket and removes its file
+    */
+    ~FixServer();
+
+    /*!
+     \brief Creates the socket and listens on it
+
+     An existing socket file of the path is replaced, any other existing file
+     is an error. The socket is created with the mode rw------- (the umask of
+     the process is changed during the call).
+
+     \param path File name of the Unix domain socket
+    */
+    void listen(const std::string &path);
+
+    /*!
+     \brief Serves the clients until a shutdown request or stop()
+    */
+    void run();
+
+    /*!
+     \brief Stops run() within a fraction of a second
+
+     Only sets a flag, hence it is safe to be called from a signal handler.
+    */
+    void stop() { mStop = true; }
+
+    /*!
+     \brief Processes a request line and returns the reply (including the newlines)
+
+     \param request Request without the newline
+     \param closeConnection Set to true if the connection is to be closed after the reply
+     \return std::string
+    */
+    std::string handleRequest(const std::string &request, bool &closeConnection);
+
+    /*!
+     \brief Returns the statistics of the fixes
+
+     \return const Stats &
+    */
+    const Stats & getStats() const { return mStats; }
+
+private:
+    FixServer(const FixServer &);
+    FixServer & operator = (const FixServer &);
+
+    /*!
+     \brief Computes a fix and writes its reply
+
+     \param file Raw image file, empty to grab a frame
+     \return std::string
+    */
+    std::string fix(const std::string &file);
+
+    /*!
+     \brief Serves one client until it closes the connection or asks to
+
+     \param client Connected socket
+    */
+    void serveClient(int client);
+
+    Pipeline & mPipeline; /*!< Processing chain of the fixes*/
+    bool mUseCamera; /*!< Grab frames from the camera*/
+    Stats mStats; /*!< Statistics of the fixes*/
+    int mSocket; /*!< Listening socket (-1 if not listening)*/
+    std::string mPath; /*!< File name of the socket*/
+    std::atomic<bool> mStop; /*!< Request to stop run()*/
+};
+
+#endif // FIX_SERVER_H
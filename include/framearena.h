@@ -0,0 +1,94 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/*!
+ \brief Monotonic allocator for the scratch memory of one frame
+
+ Memory is handed out by advancing an offset in a block and is only given
+ back as a whole by reset() at the beginning of the next frame, there is no
+ per-allocation bookkeeping. If a frame needs more than the block holds,
+ further blocks are allocated; reset() then replaces all of them by a
+ single block covering the whole frame, so after the first frames of a
+ kind the steady state does not allocate at all.
+
+ The memory is not initialized and no constructors or destructors are run,
+ hence only trivially copyable types should be placed in it.
+*/
+class FrameArena
+{
+public:
+    /*!
+     \brief Constructs an arena without memory
+
+     \param blockSize Minimum size of the blocks (in byte)
+    */
+    explicit FrameArena(std::size_t blockSize = 64 * 1024);
+
+    /*!
+     \brief Destructor, frees all blocks
+    */
+    ~FrameArena();
+
+    /*!
+     \brief Returns memory valid until the next reset()
+
+     \param size Number of bytes
+     \param alignment Alignment of the memory (a power of two)
+     \return void *
+    */
+    void * allocate(std::size_t size, std::size_t alignment = DEFAULT_ALIGNMENT);
+
+    /*!
+     \brief Returns memory for n elements valid until the next reset()
+
+     \param n Number of elements
+     \return T *
+    */
+    template<typename T>
+    T * allocate(std::size_t n) { return static_cast<T *>(allocate(n * sizeof(T), alignof(T))); }
+
+    /*!
+     \brief Releases all memory handed out since the last reset (to be called at the frame boundary)
+    */
+    void reset();
+
+    /*!
+     \brief Returns the number of bytes handed out since the last reset
+
+     \return std::size_t
+    */
+    std::size_t getUsed() const { return mUsed; }
+
+    /*!
+     \brief Returns the total size of the blocks
+
+     \return std::size_t
+    */
+    std::size_t getCapacity() const;
+
+    static const std::size_t DEFAULT_ALIGNMENT = 16; /*!< Alignment suitable for all scalar and SSE types*/
+
+private:
+    FrameArena(const FrameArena &);
+    FrameArena & operator = (const FrameArena &);
+
+    /*!
+     \brief Contiguous memory of the arena
+    */
+    struct Block
+    {
+        char * data; /*!< Start of the block*/
+        std::size_t size; /*!< Size of the block (in byte)*/
+    };
+
+    std::size_t mBlockSize; /*!< Minimum size of the blocks*/
+    std::vector<Block> mBlocks; /*!< Blocks in the order of use*/
+    std::size_t mCurrent; /*!< Block memory is handed out from*/
+    std::size_t mOffset; /*!< First free byte of the current block*/
+    std::size_t mUsed; /*!< Bytes handed out since the last reset, including the alignment padding*/
+};
+
+#endif // FRAME_ARENA_H
@@ -0,0 +1,144 @@
+#ifndef FRAME_CORRECTION_H
+#define FRAME_CORRECTION_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ \brief Dark-frame subtraction and flat-field correction of raw frames
+
+ The dark frame holds the offset of each pixel (fixed-pattern noise and dark
+ current for the exposure it was taken with), the flat field its relative
+ sensitivity. A raw pixel is corrected to
+
+    ((raw - dark) * gain) >> 8
+
+ with the gain in Q8 fixed point (256 is a factor of 1), see correctDarkFlat().
+ The gain of a pixel is mean / (flat - dark), so a uniformly lit frame keeps
+ its mean level. Both tables are 16 bit per pixel, hence the correction is a
+ single vectorized pass over the raw buffer.
+
+ Once loaded the correction is not changed and can be shared read-only by
+ several cameras, e.g. with a std::shared_ptr<const FrameCorrection>.
+*/
+class FrameCorrection
+{
+public:
+    /*!
+     \brief Constructs a correction without dark frame and flat field
+    */
+    FrameCorrection();
+
+    /*!
+     \brief Sets the dark frame
+
+     Has to be set before the flat field, as the gain is computed from the flat
+     field minus the dark frame. Average several dark frames of the exposure
+     used for the star images to reduce its noise.
+
+     \param dark Raw Bayer-12 dark frame
+     \param rows Height of the frame
+     \param cols Width of the frame
+    */
+    void setDarkFrame(const uint16_t *dark, unsigned rows, unsigned cols);
+
+    /*!
+     \brief Computes the gain of each pixel from a flat field
+
+     Pixels without signal in the flat field keep a gain of 1.
+
+     \param flat Raw Bayer-12 image of a uniformly lit scene (of the size of the dark frame if one is set)
+     \param rows Height of the frame
+     \param cols Width of the frame
+    */
+    void setFlatField(const uint16_t *flat, unsigned rows, unsigned cols);
+
+    /*!
+     \brief Loads the dark frame from a raw image file (see setDarkFrame())
+
+     \param filename Raw Bayer-12 image
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void loadDarkFrame(const std::string filename, unsigned rows = 1944, unsigned cols = 2592);
+
+    /*!
+     \brief Loads the flat field from a raw image file (see setFlatField())
+
+     \param filename Raw Bayer-12 image
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void loadFlatField(const std::string filename, unsigned rows = 1944, unsigned cols = 2592);
+
+    /*!
+     \brief Returns if neither a dark frame nor a flat field is set
+
+     \return bool
+    */
+    bool empty() const { return mDark.empty() && mGain.empty(); }
+
+    /*!
+     \brief Returns if the correction was made for frames of this size
+
+     \param rows
+     \param cols
+     \return bool
+    */
+    bool matches(unsigned rows, unsigned cols) const { return rows == mRows && cols == mCols; }
+
+    /*!
+     \brief Returns the dark level of each pixel
+
+     \return const uint16_t * NULL without dark frame
+    */
+    const uint16_t * getDark() const { return mDark.empty() ? NULL : &mDark[0]; }
+
+    /*!
+     \brief Returns the Q8 gain of each pixel
+
+     \return const uint16_t * NULL without flat field
+    */
+    const uint16_t * getGain() const { return mGain.empty() ? NULL : &mGain[0]; }
+
+    /*!
+     \brief Corrects a raw frame of the size of the correction
+
+     \param src Raw Bayer-12 frame
+     \param dst Corrected Bayer-12 frame (may be src)
+    */
+    void apply(const uint16_t *src, uint16_t *dst) const;
+
+    /*!
+     \brief Corrects a single pixel, e.g. for windows read directly from a raw frame
+
+     \param index Position of the pixel in the frame (row * cols + col)
+     \param value Raw value
+     \return uint16_t Corrected value (same as apply())
+    */
+    uint16_t correct(std::size_t index, uint16_t value) const
+    {
+        const uint32_t dark = mDark.empty() ? 0 : mDark[index];
+        const uint32_t signal = value > dark ? value - dark : 0;
+        const uint32_t corrected = mGain.empty() ? signal : (signal * mGain[index]) >> 8;
+        return corrected > 4095 ? 4095 : (uint16_t) corrected;
+    }
+
+private:
+    /*!
+     \brief Checks and sets the size of the frames
+
+     \param rows
+     \param cols
+    */
+    void setSize(unsigned rows, unsigned cols);
+
+    unsigned mRows; /*!< Height of the frames*/
+    unsigned mCols; /*!< Width of the frames*/
+    std::vector<uint16_t> mDark; /*!< Dark level of each pixel (empty if not set)*/
+    std::vector<uint16_t> mGain; /*!< Q8 gain of each pixel (empty if not set)*/
+};
+
+#endif // FRAME_CORRECTION_H
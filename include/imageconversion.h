@@ -0,0 +1,91 @@
+#ifndef IMAGE_CONVERSION_H
+#define IMAGE_CONVERSION_H
+
+#include <stdint.h>
+#include <cstddef>
+
+class DefectMap;
+
+/*!
+ \brief Subtracts a dark frame from a raw Bayer-12 buffer and multiplies it with a flat-field gain
+
+ Each pixel becomes min(((src - dark) * gain) >> 8, 4095), where the
+ subtraction saturates at 0 and gain is a fixed-point factor with 8
+ fractional bits (Q8, 256 is a factor of 1), so the output is a Bayer-12
+ buffer again. Uses SSE2 or NEON if available.
+
+ \param src Raw Bayer-12 data stored in 2 bytes with leading 0s
+ \param dark Dark level of each pixel (raw 12-bit units), NULL skips the subtraction
+ \param gain Q8 gain of each pixel, NULL skips the multiplication
+ \param dst Corrected output, has to hold length pixels (may be src)
+ \param length Number of pixels
+*/
+void correctDarkFlat(const uint16_t *src, const uint16_t *dark, const uint16_t *gain, uint16_t *dst, std::size_t length);
+
+/*!
+ \brief Converts a raw Bayer-12 buffer into an 8-bit image
+
+ Each pixel is shifted by 4 bits (values above 12 bit saturate at 255).
+ Uses SSE2 or NEON if available.
+
+ \param src Raw Bayer-12 data stored in 2 bytes with leading 0s
+ \param dst 8-bit output, has to hold length pixels
+ \param length Number of pixels
+*/
+void convert12To8(const uint16_t *src, uint8_t *dst, std::size_t length);
+
+/*!
+ \brief Converts a raw Bayer-12 buffer into an 8-bit image and thresholds it in the same pass
+
+ The thresholded output equals cv::threshold(frame, threshed, threshold, 0, cv::THRESH_TOZERO),
+ i.e. all pixels which are not greater than threshold are set to 0.
+ Uses SSE2 or NEON if available.
+
+ \param src Raw Bayer-12 data stored in 2 bytes with leading 0s
+ \param frame 8-bit output of the converted image, may be NULL if not needed
+ \param threshed 8-bit output of the thresholded image
+ \param length Number of pixels
+ \param threshold Threshold (in 8-bit units) under which pixels are set to 0
+*/
+void convert12To8Threshold(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                           std::size_t length, unsigned threshold);
+
+/*!
+ \brief Converts a raw Bayer-12 frame into an 8-bit image and thresholds it with a threshold per tile
+
+ Same as convert12To8Threshold(), but the frame is divided into square tiles
+ with their own threshold (see BackgroundEstimator). The rows of a tile are
+ passed to the vectorized kernel, so tileSize should be a multiple of 16.
+
+ \param src Raw Bayer-12 data stored in 2 bytes with leading 0s
+ \param frame 8-bit output of the converted image, may be NULL if not needed
+ \param threshed 8-bit output of the thresholded image
+ \param rows Height of the frame
+ \param cols Width of the frame
+ \param thresholds Threshold of each tile (8-bit units) in row major order
+ \param tileSize Width and height of the tiles
+ \param defects Pixels set to 0 in threshed right after their row is converted, may be NULL
+*/
+void convert12To8ThresholdTiles(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                                unsigned rows, unsigned cols, const uint8_t *thresholds, unsigned tileSize,
+                                const DefectMap *defects = NULL);
+
+/*!
+ \brief Converts a raw Bayer-12 frame into an 8-bit image, thresholds it and masks the defective pixels
+
+ Same as convert12To8Threshold(), but the frame is converted row by row and
+ the defects of each row are set to 0 in threshed while the row is still in
+ the cache. frame is not masked.
+
+ \param src Raw Bayer-12 data stored in 2 bytes with leading 0s
+ \param frame 8-bit output of the converted image, may be NULL if not needed
+ \param threshed 8-bit output of the thresholded image
+ \param rows Height of the frame
+ \param cols Width of the frame
+ \param threshold Threshold (in 8-bit units) under which pixels are set to 0
+ \param defects Defects of a frame of this size
+*/
+void convert12To8Threshold(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                           unsigned rows, unsigned cols, unsigned threshold, const DefectMap &defects);
+
+#endif // IMAGE_CONVERSION_H
@@ -0,0 +1,242 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <vector>
+#include <string>
+#include <ostream>
+#include <chrono>
+#include <stdint.h>
+
+/*!
+ \brief Histogram of latencies with logarithmic buckets
+
+ Durations are given in nanoseconds. Below 16 ns each value has its own
+ bucket, above every power of two is divided into 16 buckets, so the
+ relative error of a percentile is at most 6.25%. Durations up to about
+ 18 minutes are resolved, longer ones are counted in the last bucket.
+*/
+class LatencyHistogram
+{
+public:
+    static const unsigned SUB_BUCKETS = 16; /*!< Buckets per power of two*/
+    static const unsigned BUCKET_COUNT = 592; /*!< Number of buckets (up to 2^40 ns)*/
+
+    /*!
+     \brief Constructor, creates an empty histogram
+    */
+    LatencyHistogram();
+
+    /*!
+     \brief Adds a duration
+
+     \param ns Duration in nanoseconds
+    */
+    void add(uint64_t ns);
+
+    /*!
+     \brief Adds all durations of another histogram
+
+     \param other
+    */
+    void merge(const LatencyHistogram &other);
+
+    /*!
+     \brief Returns the number of durations
+
+     \return uint64_t
+    */
+    uint64_t getCount() const { return mCount; }
+
+    /*!
+     \brief Returns the mean duration in nanoseconds
+
+     \return double 0 if empty
+    */
+    double getMean() const { return mCount ? (double) mSum / mCount : 0.0; }
+
+    /*!
+     \brief Returns the longest duration in nanoseconds
+
+     \return uint64_t
+    */
+    uint64_t getMax() const { return mMax; }
+
+    /*!
+     \brief Returns a percentile in nanoseconds
+
+     The upper bound of the bucket containing the percentile, but at most
+     getMax(), hence the true value is never underestimated.
+
+     \param p Fraction of the durations, e.g. 0.99
+     \return uint64_t 0 if empty
+    */
+    uint64_t getPercentile(double p) const;
+
+    /*!
+     \brief Returns the bucket of a duration
+
+     \param ns Duration in nanoseconds
+     \return unsigned
+    */
+    static unsigned bucketOf(uint64_t ns);
+
+    /*!
+     \brief Returns the largest duration counted in a bucket
+
+     \param bucket
+     \return uint64_t Duration in nanoseconds
+    */
+    static uint64_t bucketUpperBound(unsigned bucket);
+
+private:
+    friend class Instrumentation;
+
+    std::vector<uint64_t> mBuckets; /*!< Number of durations in each bucket*/
+    uint64_t mCount; /*!< Number of durations*/
+    uint64_t mSum; /*!< Sum of all durations*/
+    uint64_t mMax; /*!< Longest duration*/
+};
+
+/*!
+ \brief Latency measurement of the processing steps
+
+ Every thread records into its own set of histograms, one per probe. The
+ histograms are only written by their thread with relaxed atomic stores,
+ so recording takes no lock and other threads can read them at any time;
+ snapshot() merges the histograms of all threads. The histograms of a
+ thread stay registered after it exits and are reused by the next new
+ thread, so the statistics cover the whole run.
+
+ The probes are placed in the code with STARCAM_TIMER(), which only
+ measures if the build defines STARCAM_INSTRUMENTATION (cmake
+ -DSTARCAM_INSTRUMENTATION=ON). Otherwise the timers compile to nothing and
+ all histograms stay empty.
+*/
+class Instrumentation
+{
+public:
+    /*!
+     \brief The measured processing steps
+    */
+    enum Probe
+    {
+        GrabFrame, /*!< Reading a frame from the camera (Aptina)*/
+        Conversion, /*!< Conversion of a raw frame to the 8-bit images*/
+        Threshold, /*!< Background estimation and thresholding*/
+        Labelling, /*!< Connected components labelling or contour search*/
+        SpotVectors, /*!< StarCamera::calculateSpotVectors()*/
+        KVectorQuery, /*!< Feature ranges of the k-vector for a triad or a 4th star*/
+        TriadMatching, /*!< Matching the features of a triad or a 4th star*/
+        AttitudeOutput, /*!< AttitudeSolver::solve()*/
+        ProbeCount /*!< Number of probes*/
+    };
+
+    /*!
+     \brief Returns if the probes were compiled in (STARCAM_INSTRUMENTATION)
+
+     \return bool
+    */
+    static bool isEnabled();
+
+    /*!
+     \brief Returns the name of a probe as used in the exports
+
+     \param probe
+     \return const char*
+    */
+    static const char * getProbeName(Probe probe);
+
+    /*!
+     \brief Records a duration in the histogram of the calling thread
+
+     \param probe
+     \param ns Duration in nanoseconds
+    */
+    static void record(Probe probe, uint64_t ns);
+
+    /*!
+     \brief Merges the histograms of all threads
+
+     \param histograms Output, one histogram per probe
+    */
+    static void snapshot(std::vector<LatencyHistogram> &histograms);
+
+    /*!
+     \brief Writes count, mean, p50, p99 and max of each probe as CSV (in us)
+
+     \param os
+     \param header Write the line with the column names
+    */
+    static void writeCsv(std::ostream &os, bool header = true);
+
+    /*!
+     \brief Writes count, mean, p50, p99 and max of each probe as JSON object (in us)
+
+     \param os
+    */
+    static void writeJson(std::ostream &os);
+
+    /*!
+     \brief Writes a snapshot to a file
+
+     JSON if the filename ends with ".json", CSV otherwise. The file is
+     written under a temporary name and renamed, so a reader never sees a
+     partial report.
+
+     \param filename
+    */
+    static void writeReport(const std::string &filename);
+};
+
+/*!
+ \brief Records the lifetime of the object for a probe
+
+ Use STARCAM_TIMER() instead, so the timer can be compiled out.
+*/
+class ScopedTimer
+{
+public:
+    /*!
+     \brief Constructor, starts the measurement
+
+     \param probe
+    */
+    explicit ScopedTimer(Instrumentation::Probe probe) :mProbe(probe), mStart(now()) {}
+
+    /*!
+     \brief Destructor, records the duration
+    */
+    ~ScopedTimer() { Instrumentation::record(mProbe, now() - mStart); }
+
+    /*!
+     \brief Returns a monotonic time in nanoseconds
+
+     \return uint64_t
+    */
+    static uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &);
+    ScopedTimer & operator=(const ScopedTimer &);
+
+    Instrumentation::Probe mProbe; /*!< Probe the duration is recorded for*/
+    uint64_t mStart; /*!< Start of the measurement*/
+};
+
+#define STARCAM_TIMER_CONCAT_(a, b) a##b
+#define STARCAM_TIMER_NAME_(line) STARCAM_TIMER_CONCAT_(scopedTimer_, line)
+
+#ifdef STARCAM_INSTRUMENTATION
+/*!
+ \brief Measures the rest of the enclosing scope for the given probe
+*/
+#define STARCAM_TIMER(probe) ScopedTimer STARCAM_TIMER_NAME_(__LINE__)(probe)
+#else
+#define STARCAM_TIMER(probe) do {} while(0)
+#endif
+
+#endif // INSTRUMENTATION_H
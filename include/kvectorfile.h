@@ -0,0 +1,63 @@
+#ifndef KVECTOR_FILE_H
+#define KVECTOR_FILE_H
+
+#include <stdint.h>
+#include <cstddef>
+#include <vector>
+
+#include "checksum.h"
+#include "datatypes.h"
+
+/*!
+ \brief Header of the binary k-vector file (version 2)
+
+ The binary file is meant to be memory mapped and used without any parsing.
+ The features are stored as structure of arrays, sorted by ascending cos(theta)
+ (i.e. descending theta), and the stars are referenced by their index in the
+ star table instead of the hip-ID. It consists of (all values in native,
+ i.e. little endian, byte order):
+    KVectorFileHeader header;
+    int32_t  hip[starCount];          hip-IDs in ascending order, index = catalog index
+    int32_t  kVector[featureCount];   k-vector over cosTheta
+    float    cosTheta[featureCount];  cosine of the angular distance
+    float    theta[featureCount];     angular distance (in degree)
+    uint16_t id1[featureCount];       catalog index of the first star
+    uint16_t id2[featureCount];       catalog index of the second star
+
+ For the k-vector k[i] is the number of features with cosTheta <= m*i + q.
+ The checksum is computed with dataChecksum() over all data following
+ the header.
+*/
+struct KVectorFileHeader
+{
+    char magic[4]; /*!< Always "SCKV"*/
+    uint32_t version; /*!< Version of the file format*/
+    double q; /*!< Parameter q for k-Vector technique*/
+    double m; /*!< Parameter m for k-Vector technique*/
+    uint32_t featureCount; /*!< Number of features (and k-vector elements)*/
+    uint32_t starCount; /*!< Number of stars in the star table*/
+    uint32_t checksum; /*!< Checksum of the data following the header*/
+    uint32_t reserved; /*!< Padding, has to be 0*/
+};
+
+/*!
+ \brief Magic number at the beginning of every binary k-vector file
+*/
+const char KVECTOR_FILE_MAGIC[4] = {'S', 'C', 'K', 'V'};
+
+/*!
+ \brief Current version of the binary k-vector file format
+*/
+const uint32_t KVECTOR_FILE_VERSION = 2;
+
+/*!
+ \brief Creates the content of a binary k-vector file (current version) from a feature list
+
+ Builds the star table, sorts the features by cos(theta) and creates the k-vector.
+
+ \param features Features with hip-IDs and theta in degree (in arbitrary order)
+ \param image Receives the complete file content
+*/
+void buildKVectorImage(const std::vector<Feature2> &features, std::vector<uint8_t> &image);
+
+#endif // KVECTOR_FILE_H
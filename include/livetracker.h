@@ -0,0 +1,234 @@
+#ifndef LIVE_TRACKER_H
+#define LIVE_TRACKER_H
+
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <ostream>
+#include <string>
+
+#include <Eigen/Core>
+
+#include "datatypes.h"
+#include "spscqueue.h"
+#include "starcamera.h"
+#include "starid.h"
+#include "pipeline.h"
+
+/*!
+ \brief Continuous star identification from the Aptina camera
+
+ Runs the processing chain as a pipeline with one thread per stage:
+    1. capture: takes the raw frames from the camera ring buffer
+    2. extraction: converts the frame and extracts the spots (StarCamera::extractSpots())
+    3. vectors: computes the camera vectors of the spots (StarCamera::calculateSpotVectors())
+    4. identification: identifies the stars and determines the attitude if the
+       star catalog is loaded (Pipeline::identify())
+
+ The stages are connected by lock-free single producer single consumer queues.
+ If a stage is still busy when the previous one finishes the next frame, the new
+ frame is dropped in order to keep the latency bounded.
+*/
+class LiveTracker
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /*!
+     \brief Result of the identification of a single frame
+    */
+    struct Result
+    {
+        unsigned frame; /*!< Consecutive number of the frame*/
+        double timestamp; /*!< getRealTime() at which the frame was completed by the camera*/
+        double latency; /*!< Time from the completion of the frame until its identification was finished*/
+        std::vector<Spot> spots; /*!< Extracted spots*/
+        std::vector<Eigen::Vector3f> spotVectors; /*!< Camera vectors of the spots*/
+        std::vector<int> ids; /*!< hip-IDs of the spots (-1 if not identified)*/
+        Attitude attitude; /*!< Attitude of the camera (only valid if the star catalog is loaded)*/
+    };
+
+    /*!
+     \brief Typedef for the function which is called with the result of every processed frame
+    */
+    typedef std::function<void (const Result &)> ResultCallback;
+
+    /*!
+     \brief Latency statistics of one pipeline stage (in seconds)
+    */
+    struct StageStatistics
+    {
+        StageStatistics() :count(0), sum(0.0), max(0.0) {}
+
+        /*!
+         \brief Adds a new sample
+
+         \param value Duration in seconds
+        */
+        void add(double value) { ++count; sum += value; if(value > max) max = value; }
+
+        /*!
+         \brief Returns the mean of all samples
+
+         \return double
+        */
+        double mean() const { return count ? sum / count : 0.0; }
+
+        unsigned count; /*!< Number of samples*/
+        double sum; /*!< Sum of all samples*/
+        double max; /*!< Largest sample*/
+    };
+
+    /*!
+     \brief Constructor
+
+     The camera has to be initialized and the feature list of the identifier loaded.
+     The identification stage uses a Pipeline sharing the catalog of identifier
+     and with its settings (candidates and magnitude tolerance).
+
+     \param camera Camera the frames are taken from
+     \param identifier Identifier whose catalog and settings are used for the identification stage
+    */
+    LiveTracker(StarCamera &camera, const StarIdentifier &identifier);
+
+    /*!
+     \brief Sets the maximum rate at which frames are processed
+
+     \param rate Frame rate in Hz, 0 processes every frame the camera delivers (free-run)
+    */
+    void setFrameRate(float rate) { mFrameRate = rate; }
+
+    /*!
+     \brief Sets the tolerance used for the identification
+
+     \param eps Allowed tolerance when comparing features (in degree)
+    */
+    void setEpsilon(float eps) { mPipeline.setEpsilon(eps); }
+
+    /*!
+     \brief Enables the identification from the previous frame (see TrackingIdentifier)
+
+     \param enable If false every frame is identified lost-in-space
+    */
+    void setTracking(bool enable) { mPipeline.setTracking(enable); }
+
+    /*!
+     \brief Gives access to the settings of the tracking identification
+
+     \return TrackingIdentifier &
+    */
+    TrackingIdentifier & getTrackingIdentifier() { return mPipeline.getTrackingIdentifier(); }
+
+    /*!
+     \brief Sets the centroiding method used in the extraction stage
+
+     \param method
+    */
+    void setCentroidingMethod(StarCamera::CentroidingMethod method) { mCentroiding = method; }
+
+    /*!
+     \brief Periodically writes the latency histograms of the processing steps while running
+
+     The report (see Instrumentation::writeReport()) is written by the
+     identification stage every interval seconds and at the end of run().
+     The histograms are only filled if built with STARCAM_INSTRUMENTATION.
+
+     \param filename Report file (.json or CSV), empty disables the report
+     \param interval Time between two reports (in s)
+    */
+    void setLatencyReport(const std::string &filename, double interval)
+    {
+        mLatencyReport = filename;
+        mReportInterval = interval;
+    }
+
+    /*!
+     \brief Runs the pipeline
+
+     Blocks until nFrames frames were identified or stop() was called. The
+     callback is run in the calling thread, which also executes the
+     identification stage.
+
+     \param nFrames Number of frames to identify, 0 runs until stop() is called
+     \param callback Function called with the result of every frame
+    */
+    void run(unsigned nFrames, ResultCallback callback);
+
+    /*!
+     \brief Stops a running pipeline
+
+     Only sets a flag, hence it is safe to be called from a signal handler.
+    */
+    void stop() { mStop = true; }
+
+    /*!
+     \brief Prints the latency of each stage and the number of dropped frames
+
+     \param os
+    */
+    void printStatistics(std::ostream &os) const;
+
+private:
+    /*!
+     \brief A raw frame passed from the capture to the extraction stage
+    */
+    struct FrameToken
+    {
+        const uint16_t * buffer; /*!< Raw frame owned by the camera ring*/
+        unsigned frame; /*!< Consecutive number of the frame*/
+        double timestamp; /*!< Time at which the frame was completed*/
+    };
+
+    /*!
+     \brief Stage 1: takes frames from the camera, limited to mFrameRate
+    */
+    void captureStage();
+
+    /*!
+     \brief Stage 2: converts the frames and extracts the spots
+    */
+    void extractionStage();
+
+    /*!
+     \brief Stage 3: computes the camera vectors of the spots
+    */
+    void vectorStage();
+
+    /*!
+     \brief Stage 4: identifies the stars and hands the results to the callback
+
+     \param nFrames Number of frames to identify, 0 runs until stop() is called
+     \param callback Function called with the result of every frame
+    */
+    void identificationStage(unsigned nFrames, ResultCallback &callback);
+
+    /*!
+     \brief Waits a short time, used by the stages when their input queue is empty
+    */
+    static void idle();
+
+    StarCamera &mCamera; /*!< Camera providing the frames*/
+    Pipeline mPipeline; /*!< Identification of the last stage (its camera is not used)*/
+    float mFrameRate; /*!< Maximum frame rate (0 for free-run)*/
+    StarCamera::CentroidingMethod mCentroiding; /*!< Centroiding method for the extraction stage*/
+    std::string mLatencyReport; /*!< File of the periodic latency report, empty if disabled*/
+    double mReportInterval; /*!< Time between two latency reports (in s)*/
+
+    SpscQueue<FrameToken> mFrameQueue; /*!< Queue between capture and extraction*/
+    SpscQueue<Result, Eigen::aligned_allocator<Result> > mSpotQueue; /*!< Queue between extraction and vector calculation*/
+    SpscQueue<Result, Eigen::aligned_allocator<Result> > mVectorQueue; /*!< Queue between vector calculation and identification*/
+
+    std::atomic<bool> mStop; /*!< Request to stop all stages*/
+    std::atomic<bool> mCaptureDone; /*!< Capture stage has finished*/
+    std::atomic<bool> mExtractionDone; /*!< Extraction stage has finished*/
+    std::atomic<unsigned> mDroppedFrames; /*!< Frames dropped because a stage was busy*/
+    unsigned mCameraDroppedFrames; /*!< Frames overwritten in the camera ring during the last run*/
+    unsigned mFailedFrames; /*!< Frames in which no identification was possible*/
+
+    StageStatistics mExtractionStats; /*!< Latency of the extraction stage*/
+    StageStatistics mVectorStats; /*!< Latency of the vector stage*/
+    StageStatistics mIdentificationStats; /*!< Latency of the identification stage*/
+    StageStatistics mTotalStats; /*!< Latency from frame completion to identification*/
+};
+
+#endif // LIVE_TRACKER_H
@@ -0,0 +1,105 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+/*!
+ \brief Read-only memory mapping of a whole file
+
+ The file content is accessed directly from the page cache without
+ copying it into a separate buffer.
+*/
+class MappedFile
+{
+public:
+    /*!
+    \brief Usage hints for the kernel, see advise()
+    */
+    enum AccessPattern
+    {
+        Normal,
+        Sequential,
+        Random,
+        WillNeed
+    };
+
+    /*!
+    \brief Constructor
+
+    Creates an instance without a mapped file
+    */
+    MappedFile();
+
+    /*!
+     \brief Destructor, unmaps the file
+    */
+    ~MappedFile();
+
+    /*!
+     \brief Maps a file into memory (an already mapped file is unmapped before)
+
+     \param filename
+    */
+    void open(const std::string filename);
+
+    /*!
+     \brief Unmaps the file
+    */
+    void close();
+
+    /*!
+     \brief Gives the kernel a hint how the mapping will be accessed
+
+     WillNeed starts reading the file into the page cache asynchronously,
+     which is used to prefetch a file while another one is processed.
+
+     \param pattern
+    */
+    void advise(AccessPattern pattern) const;
+
+    /*!
+     \brief Exchanges the mappings of two instances
+
+     \param other
+    */
+    void swap(MappedFile &other);
+
+    /*!
+     \brief Returns if a file is mapped
+
+     \return bool
+    */
+    bool isOpen() const { return mData != NULL; }
+
+    /*!
+     \brief Returns the address of the mapped file content
+
+     \return const void*
+    */
+    const void * data() const { return mData; }
+
+    /*!
+     \brief Returns the size of the mapped file (in bytes)
+
+     \return std::size_t
+    */
+    std::size_t size() const { return mSize; }
+
+    /*!
+     \brief Returns the name of the mapped file
+
+     \return const std::string
+    */
+    const std::string & getFilename() const { return mFilename; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile & operator=(const MappedFile &);
+
+    std::string mFilename; /*!< Name of the mapped file*/
+    void * mData; /*!< Start of the mapping (NULL if no file is mapped)*/
+    std::size_t mSize; /*!< Size of the mapping in bytes*/
+};
+
+#endif // MAPPED_FILE_H
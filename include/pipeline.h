@@ -0,0 +1,214 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+#include "datatypes.h"
+#include "starcamera.h"
+#include "starcatalog.h"
+#include "starid.h"
+#include "trackingidentifier.h"
+#include "attitude.h"
+
+/*!
+ \brief Processing chain from a raw image to the identified stars and the attitude
+
+ Extracts the spots (StarCamera::extractSpots()), computes their camera
+ vectors, identifies the stars (StarIdentifier::identifyStars()) and
+ determines the attitude if the star catalog is loaded (AttitudeSolver).
+ Images come from files, memory or the camera (processFrame()). Chains which
+ extract the spots elsewhere, e.g. in another thread, only run identify().
+
+ A Pipeline owns all its buffers and settings, only the catalog is shared,
+ hence several instances can process images in different threads at the
+ same time, e.g. one per camera head or per worker of an offline replay.
+ A single instance must not be used by several threads at once.
+*/
+class Pipeline
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /*!
+     \brief Result of the last processed image
+    */
+    struct Result
+    {
+        Result() :identified(false) {}
+
+        std::vector<int> ids; /*!< hip-IDs of the spots (-1 if not identified), see getSpots()*/
+        Attitude attitude; /*!< Attitude of the camera (only valid if the star catalog is loaded)*/
+        bool identified; /*!< The identification was run (false with too few spots)*/
+    };
+
+    /*!
+     \brief Constructor
+
+     The camera calibration has to be loaded before processing (see getCamera()).
+
+     \param catalog Loaded catalog, shared with the other instances
+    */
+    explicit Pipeline(const std::shared_ptr<const StarCatalog> &catalog);
+
+    /*!
+     \brief Gives access to the settings of the spot extraction
+
+     \return StarCamera &
+    */
+    StarCamera & getCamera() { return mCamera; }
+
+    /*!
+     \brief Gives access to the settings of the identification
+
+     \return StarIdentifier &
+    */
+    StarIdentifier & getIdentifier() { return mIdentifier; }
+
+    /*!
+     \brief Sets the tolerance used for the identification
+
+     \param eps Allowed tolerance when comparing features (in degree)
+    */
+    void setEpsilon(float eps) { mEps = eps; mTrackingIdentifier.setEpsilon(eps); }
+
+    /*!
+     \brief Returns the tolerance used for the identification
+
+     \return float
+    */
+    float getEpsilon() const { return mEps; }
+
+    /*!
+     \brief Sets the centroiding method of the spot extraction
+
+     \param method
+    */
+    void setCentroidingMethod(StarCamera::CentroidingMethod method) { mCentroiding = method; }
+
+    /*!
+     \brief Sets the identification method
+
+     \param method
+    */
+    void setIdentificationMethod(StarIdentifier::IdentificationMethod method) { mIdentification = method; }
+
+    /*!
+     \brief Enables the identification from the previous image (see TrackingIdentifier)
+
+     For sequences of frames, the identification method is then only used
+     when tracking is lost.
+
+     \param enable If false every image is identified lost-in-space
+    */
+    void setTracking(bool enable) { mTrackingEnabled = enable; }
+
+    /*!
+     \brief Gives access to the settings of the tracking identification
+
+     \return TrackingIdentifier &
+    */
+    TrackingIdentifier & getTrackingIdentifier() { return mTrackingIdentifier; }
+
+    /*!
+     \brief Returns the tracking identification, e.g. for its statistics
+
+     \return const TrackingIdentifier &
+    */
+    const TrackingIdentifier & getTrackingIdentifier() const { return mTrackingIdentifier; }
+
+    /*!
+     \brief Returns if the identification from the previous image is enabled
+
+     \return bool
+    */
+    bool getTracking() const { return mTrackingEnabled; }
+
+    /*!
+     \brief Processes a raw image file (see StarCamera::getImageFromFile())
+
+     \param filename Raw Bayer-12 image
+     \param rows Height of the image
+     \param cols Width of the image
+     \return const Result &
+    */
+    const Result & processImageFile(const std::string &filename, unsigned rows = 1944, unsigned cols = 2592);
+
+    /*!
+     \brief Processes a full frame raw image in memory (see StarCamera::getImageFromMemory())
+
+     \param buffer Raw Bayer-12 image
+     \param rows Height of the image
+     \param cols Width of the image
+     \return const Result &
+    */
+    const Result & processImage(const uint16_t *buffer, unsigned rows, unsigned cols);
+
+    /*!
+     \brief Grabs a frame from the camera and processes it (see StarCamera::getImage())
+
+     The camera has to be initialized (see getCamera()).
+
+     \return const Result &
+    */
+    const Result & processFrame();
+
+    /*!
+     \brief Identifies spots extracted elsewhere and determines the attitude
+
+     The last step of the processing chain, run by the other process functions
+     with the spots of getCamera().
+
+     \param spots Extracted spots (their flux selects the candidates of the triads)
+     \param spotVectors Camera vectors of the spots
+     \return const Result &
+    */
+    const Result & identify(const std::vector<Spot> &spots, const std::vector<Eigen::Vector3f> &spotVectors);
+
+    /*!
+     \brief Returns the result of the last processed image
+
+     \return const Result &
+    */
+    const Result & getResult() const { return mResult; }
+
+    /*!
+     \brief Returns the spots of the last processed image
+
+     \return const std::vector<Spot> &
+    */
+    const std::vector<Spot> & getSpots() const { return mCamera.getSpots(); }
+
+    /*!
+     \brief Returns the camera vectors of the spots of the last processed image
+
+     \return const std::vector<Eigen::Vector3f> &
+    */
+    const std::vector<Eigen::Vector3f> & getSpotVectors() const { return mCamera.getSpotVectors(); }
+
+private:
+    /*!
+     \brief Runs the processing chain on the loaded image
+
+     \return const Result &
+    */
+    const Result & process();
+
+    StarCamera mCamera; /*!< Spot extraction*/
+    StarIdentifier mIdentifier; /*!< Identification with the shared catalog*/
+    TrackingIdentifier mTrackingIdentifier; /*!< Identification from the previous image*/
+    bool mTrackingEnabled; /*!< Use mTrackingIdentifier instead of lost-in-space for every image*/
+    AttitudeSolver mAttitudeSolver; /*!< Attitude of the identified spots*/
+    StarIdentifier::Scratch mScratch; /*!< Working memory of the identification*/
+    std::vector<float> mBrightness; /*!< Flux of each spot for the candidates of the triads*/
+    float mEps; /*!< Tolerance of the identification (in degree)*/
+    StarCamera::CentroidingMethod mCentroiding; /*!< Centroiding method of the spot extraction*/
+    StarIdentifier::IdentificationMethod mIdentification; /*!< Method of the identification*/
+    Result mResult; /*!< Result of the last processed image*/
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,104 @@
+#ifndef PSF_FIT_H
+#define PSF_FIT_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ \brief Parameters of a circular Gaussian point spread function on a constant background
+
+    I(x, y) = background + amplitude * exp(-((x - x0)^2 + (y - y0)^2) / (2 * sigma^2))
+
+ Pixel centers are at integer coordinates, as for the moments of the labeller.
+*/
+struct GaussianPsf
+{
+    GaussianPsf() :x(0.0f), y(0.0f), amplitude(0.0f), background(0.0f), sigma(0.0f), iterations(0) {}
+
+    float x; /*!< Column of the center x0*/
+    float y; /*!< Row of the center y0*/
+    float amplitude; /*!< Peak above the background (in pixel units)*/
+    float background; /*!< Constant background (in pixel units)*/
+    float sigma; /*!< Standard deviation of the Gaussian (in px)*/
+    unsigned iterations; /*!< Gauss-Newton iterations used*/
+};
+
+/*!
+ \brief Least-squares fit of a Gaussian PSF around a star for sub-pixel centroids
+
+ The moments of a thresholded blob are biased towards its brightest pixels
+ and lose the wings below the threshold, which matters for dim stars. The
+ fit uses all pixels of a small square window around an initial guess (e.g.
+ the moment centroid of a labelled blob) and refines the five parameters of
+ GaussianPsf with a few Gauss-Newton iterations, using the analytic Jacobian
+ of the model.
+
+ The fitter holds only settings, fit() uses no state, so one instance can be
+ used by several threads at once (e.g. one spot per worker).
+*/
+class PsfFitter
+{
+public:
+    static const unsigned MAX_WINDOW_SIZE = 15; /*!< Largest window, the pixels are kept on the stack*/
+
+    /*!
+     \brief Constructor
+    */
+    PsfFitter();
+
+    /*!
+     \brief Sets the size of the fitted window
+
+     \param size Width and height (odd, 5 to MAX_WINDOW_SIZE, default 7)
+    */
+    void setWindowSize(unsigned size);
+
+    /*!
+     \brief Returns the size of the fitted window
+
+     \return unsigned
+    */
+    unsigned getWindowSize() const { return mWindowSize; }
+
+    /*!
+     \brief Sets the largest number of Gauss-Newton iterations
+
+     \param iterations Maximum iterations (default 6)
+    */
+    void setMaxIterations(unsigned iterations) { mMaxIterations = iterations; }
+
+    /*!
+     \brief Sets the initial standard deviation of the PSF
+
+     \param sigma Initial sigma (in px, default 1.0)
+    */
+    void setInitialSigma(float sigma) { mInitialSigma = sigma; }
+
+    /*!
+     \brief Fits the PSF in the window around a guess
+
+     The window is centered at the pixel nearest to the guess and clipped to
+     the image. The fit is rejected (false is returned and psf holds the last
+     estimate) if the normal equations are singular, the amplitude is not
+     positive, sigma leaves [0.3, window size] or the center leaves the window.
+     Instantiated for uint8_t (8-bit frames) and uint16_t (raw frames).
+
+     \param image First pixel of the image
+     \param stride Distance between two rows (in pixels)
+     \param rows Height of the image
+     \param cols Width of the image
+     \param x Column of the initial guess
+     \param y Row of the initial guess
+     \param psf Receives the fitted parameters
+     \return bool If the fit converged to a valid PSF
+    */
+    template<typename T>
+    bool fit(const T *image, std::size_t stride, unsigned rows, unsigned cols, float x, float y, GaussianPsf &psf) const;
+
+private:
+    unsigned mWindowSize; /*!< Width and height of the fitted window*/
+    unsigned mMaxIterations; /*!< Largest number of Gauss-Newton iterations*/
+    float mInitialSigma; /*!< Start value of sigma*/
+};
+
+#endif // PSF_FIT_H
@@ -0,0 +1,208 @@
+#ifndef RUN_LABELLER_H
+#define RUN_LABELLER_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+class DefectMap;
+
+/*!
+ \brief Moments of a connected blob of pixels above the threshold
+
+ The centroid is (sumXP / sumP, sumYP / sumP) weighted with the pixel values
+ and (sumX / area, sumY / area) geometrically. Pixel centers are at integer
+ coordinates, as for cv::connectedComponentsWithStats().
+*/
+struct BlobMoments
+{
+    BlobMoments() :area(0), sumX(0), sumY(0), sumP(0), sumXP(0), sumYP(0) {}
+
+    /*!
+     \brief Adds the moments of another part of the same blob
+
+     \param other
+    */
+    void add(const BlobMoments &other)
+    {
+        area += other.area;
+        sumX += other.sumX;
+        sumY += other.sumY;
+        sumP += other.sumP;
+        sumXP += other.sumXP;
+        sumYP += other.sumYP;
+    }
+
+    unsigned area; /*!< Number of pixels*/
+    int64_t sumX; /*!< sum(x)*/
+    int64_t sumY; /*!< sum(y)*/
+    int64_t sumP; /*!< sum(p), p is the pixel value*/
+    int64_t sumXP; /*!< sum(x * p)*/
+    int64_t sumYP; /*!< sum(y * p)*/
+};
+
+/*!
+ \brief Streaming connected component labelling on runs of pixels
+
+ The image is read once, row by row. Each row is split into runs of pixels
+ above the threshold, a run is connected to the runs of the previous row
+ it touches (8-connectivity by default, see setConnectivity()) and the
+ labels of touching runs are joined
+ with union-find. The moments are accumulated per label while scanning, so
+ no label image is written and only the runs of two rows are kept.
+
+ Blobs are reported in raster order of their first pixel. All buffers are
+ kept between calls, so labelling allocates no memory once the largest
+ image was processed.
+*/
+class RunLabeller
+{
+public:
+    /*!
+     \brief Constructor
+    */
+    RunLabeller();
+
+    /*!
+     \brief Sets which neighbours of a pixel are connected
+
+     The labelling loop is instantiated for each connectivity, it is selected
+     once per call of label().
+
+     \param connectivity 8 (also diagonal neighbours) or 4 (only horizontal and vertical neighbours)
+    */
+    void setConnectivity(unsigned connectivity);
+
+    /*!
+     \brief Returns which neighbours of a pixel are connected
+
+     \return unsigned 4 or 8
+    */
+    unsigned getConnectivity() const { return mConnectivity; }
+
+    /*!
+     \brief Sets defective pixels which are background regardless of their value
+
+     The runs of the map are skipped while the runs of the image are scanned,
+     so images which are not thresholded yet (e.g. raw frames) need no masked
+     copy. The map has to be of the full image, its rows are indexed with
+     firstRow + y (see label()).
+
+     \param defects Defects of the labelled images, NULL to label all pixels
+    */
+    void setDefectMap(const DefectMap *defects) { mDefects = defects; }
+
+    /*!
+     \brief Labels all pixels greater than threshold
+
+     Instantiated for uint8_t (8-bit frames) and uint16_t (raw Bayer-12 frames).
+
+     \param image First pixel of the image
+     \param rows Number of rows
+     \param cols Number of columns
+     \param stride Distance between two rows (in pixels)
+     \param threshold Pixels which are not greater than threshold are background
+     \param firstRow y-coordinate of the first row in the moments (for strips of a larger image)
+     \return unsigned Number of blobs
+    */
+    template<typename T>
+    unsigned label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                   const T threshold, const unsigned firstRow = 0);
+
+    /*!
+     \brief Labels all pixels greater than the threshold of their tile
+
+     \param image First pixel of the image
+     \param rows Number of rows
+     \param cols Number of columns
+     \param stride Distance between two rows (in pixels)
+     \param thresholdRows For each band of tileSize rows a threshold per column, cols values per band
+            (e.g. BackgroundEstimator::getRawThresholdRows()), indexed with firstRow + y
+     \param tileSize Number of rows of a band
+     \param firstRow y-coordinate of the first row in the moments and in thresholdRows
+     \return unsigned Number of blobs
+    */
+    template<typename T>
+    unsigned label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                   const T *thresholdRows, const unsigned tileSize, const unsigned firstRow = 0);
+
+    /*!
+     \brief Returns the number of blobs found by the last call of label()
+
+     \return unsigned
+    */
+    unsigned getBlobCount() const { return mBlobs.size(); }
+
+    /*!
+     \brief Returns the moments of a blob
+
+     \param index Blob in raster order (0 to getBlobCount()-1)
+     \return const BlobMoments &
+    */
+    const BlobMoments & getBlob(unsigned index) const { return mMoments[mBlobs[index]]; }
+
+private:
+    friend class StripLabeller;
+
+    /*!
+     \brief Horizontal run of foreground pixels
+    */
+    struct Run
+    {
+        Run(unsigned start_, unsigned end_, unsigned label_) :start(start_), end(end_), label(label_) {}
+
+        unsigned start; /*!< First column*/
+        unsigned end; /*!< Last column*/
+        unsigned label; /*!< Label (not necessarily the root), blob index in mFirstRuns and mPrevRuns after label()*/
+    };
+
+    /*!
+     \brief Labelling with the thresholds given by a policy (uniform or per tile), masked with the defects
+    */
+    template<typename T, typename Threshold>
+    unsigned labelImage(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                        const Threshold &thresholds, const unsigned firstRow);
+
+    /*!
+     \brief Selects the labelling loop of the connectivity
+    */
+    template<typename T, typename Threshold>
+    unsigned labelConnectivity(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                               const Threshold &thresholds, const unsigned firstRow);
+
+    /*!
+     \brief Labelling loop for a connectivity (see setConnectivity())
+    */
+    template<typename T, typename Threshold, unsigned Connectivity>
+    unsigned labelRuns(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                       const Threshold &thresholds, const unsigned firstRow);
+
+    /*!
+     \brief Returns the root of a label and compresses the path
+
+     \param label
+     \return unsigned
+    */
+    unsigned find(unsigned label);
+
+    /*!
+     \brief Joins two labels, the smaller root becomes the root of both
+
+     \param rootA Root label
+     \param label Any label
+     \return unsigned The new root
+    */
+    unsigned merge(unsigned rootA, unsigned label);
+
+    unsigned mConnectivity; /*!< 4 or 8*/
+    const DefectMap * mDefects; /*!< Pixels which are background, NULL if none*/
+    std::vector<Run> mRuns; /*!< Runs of the current row*/
+    std::vector<Run> mPrevRuns; /*!< Runs of the previous row (of the last row after label())*/
+    std::vector<Run> mFirstRuns; /*!< Runs of the first row*/
+    std::vector<unsigned> mParent; /*!< Union-find parent of each label*/
+    std::vector<BlobMoments> mMoments; /*!< Moments of each label, complete for the roots*/
+    std::vector<unsigned> mBlobs; /*!< Root labels in raster order*/
+    std::vector<unsigned> mBlobIndex; /*!< Index in mBlobs of each root label*/
+};
+
+#endif // RUN_LABELLER_H
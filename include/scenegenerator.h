@@ -0,0 +1,284 @@
+#ifndef SCENE_GENERATOR_H
+#define SCENE_GENERATOR_H
+
+#include <vector>
+#include <string>
+#include <random>
+#include <stdint.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "starcamera.h"
+
+/*!
+ \brief A star rendered by the SceneGenerator (ground truth)
+*/
+struct SyntheticStar
+{
+    int hip; /*!< hip-ID of the star*/
+    float magnitude; /*!< Visual magnitude*/
+    Eigen::Vector3f vector; /*!< Direction in the camera frame (unit vector)*/
+    Eigen::Vector2f pixel; /*!< Center of the spot in sensor coordinates*/
+    float flux; /*!< Total signal of the spot (raw 12-bit units, before saturation)*/
+};
+
+/*!
+ \brief Renders synthetic raw star images with known content
+
+ The stars of the catalog are rotated into the camera frame with the
+ attitude (b = q * r as in AttitudeSolver) and projected with the
+ calibration of a StarCamera, including the lens distortion (see
+ StarCamera::projectVector()). Each star is rendered as a gaussian PSF
+ integrated over the pixel area, with a flux of
+ zeroPointFlux * 10^(-0.4 * magnitude), onto the background. Then the
+ Bayer gains, shot noise (gaussian approximation) and read noise are
+ applied and the image is quantized to 12 bit. Hot pixels (single bright
+ pixels) and false spots (PSFs at random positions, e.g. planets or
+ debris) are added on request.
+
+ Pixel centers are at integer coordinates, as for the centroids of the
+ StarCamera. All random numbers come from a seeded generator, so the
+ same seed and settings reproduce the same scenes.
+
+ The image stays in memory and is loaded into a StarCamera with
+ loadInto(), no file is written.
+
+ The generator holds aligned fixed-size Eigen members (e.g. the attitude),
+ so it provides the aligned operator new for heap allocation.
+*/
+class SceneGenerator
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    /*!
+     \brief Constructor
+
+     \param camera Camera whose calibration is used for the projection
+    */
+    explicit SceneGenerator(const StarCamera &camera);
+
+    /*!
+     \brief Loads the stars of the catalog up to a magnitude limit
+
+     \param filename hip-catalog (SQLite database, see StarIdentifier::loadStarCatalog())
+     \param magnitudeLimit Fainter stars are not rendered
+    */
+    void loadStarCatalog(const std::string &filename, float magnitudeLimit = 6.5f);
+
+    /*!
+     \brief Returns the number of loaded catalog stars
+
+     \return unsigned
+    */
+    unsigned getCatalogSize() const { return mCatalog.size(); }
+
+    /*!
+     \brief Restarts the random number generator
+
+     \param seed
+    */
+    void setSeed(unsigned seed) { mRandom.seed(seed); }
+
+    /*!
+     \brief Sets the size of the rendered images
+
+     \param rows Height (default 1944)
+     \param cols Width (default 2592)
+    */
+    void setImageSize(unsigned rows, unsigned cols);
+
+    /*!
+     \brief Sets the standard deviation of the gaussian PSF
+
+     \param sigma In pixel (default 1.2)
+    */
+    void setPsfSigma(float sigma) { mPsfSigma = sigma; }
+
+    /*!
+     \brief Sets the flux of a star of magnitude 0
+
+     \param flux Raw 12-bit units (default 2.5e6, i.e. 10^4 for magnitude 6)
+    */
+    void setZeroPointFlux(float flux) { mZeroPointFlux = flux; }
+
+    /*!
+     \brief Sets the level of the background
+
+     \param level Raw 12-bit units (default 100)
+    */
+    void setBackground(float level) { mBackground = level; }
+
+    /*!
+     \brief Sets the standard deviation of the read noise
+
+     \param sigma Raw 12-bit units (default 8)
+    */
+    void setReadNoise(float sigma) { mReadNoise = sigma; }
+
+    /*!
+     \brief Sets the gain of the shot noise
+
+     \param gain Raw units per electron, the variance of a pixel is gain * signal. 0 disables the shot noise (default 1)
+    */
+    void setShotNoiseGain(float gain) { mShotNoiseGain = gain; }
+
+    /*!
+     \brief Sets the gains of the four pixels of the Bayer pattern
+
+     \param gains Gains of the pixels (even row, even column), (even, odd), (odd, even) and (odd, odd), default 1
+    */
+    void setBayerGains(const Eigen::Vector4f &gains) { mBayerGains = gains; }
+
+    /*!
+     \brief Renders only the brightest stars in the field of view
+
+     \param n Maximum number of stars, 0 renders all stars of the catalog in view
+    */
+    void setMaxStars(unsigned n) { mMaxStars = n; }
+
+    /*!
+     \brief Sets the number of hot pixels added to each image
+
+     \param n
+    */
+    void setHotPixels(unsigned n) { mHotPixels = n; }
+
+    /*!
+     \brief Sets the number of false spots added to each image
+
+     \param n
+    */
+    void setFalseSpots(unsigned n) { mFalseSpots = n; }
+
+    /*!
+     \brief Returns a random attitude, uniformly distributed over all rotations
+
+     \return Eigen::Quaterniond
+    */
+    Eigen::Quaterniond randomAttitude();
+
+    /*!
+     \brief Renders the scene seen with a random attitude
+
+     \return const std::vector<SyntheticStar>& The rendered stars (see getStars())
+    */
+    const std::vector<SyntheticStar> & generate() { return generate(randomAttitude()); }
+
+    /*!
+     \brief Renders the scene seen with the given attitude
+
+     \param attitude Rotation from the inertial frame into the camera frame
+     \return const std::vector<SyntheticStar>& The rendered stars (see getStars())
+    */
+    const std::vector<SyntheticStar> & generate(const Eigen::Quaterniond &attitude);
+
+    /*!
+     \brief Loads the last rendered image into a camera (StarCamera::getImageFromMemory())
+
+     With raw centroiding the camera references the image, so it must not
+     be regenerated before the spots are extracted.
+
+     \param camera
+    */
+    void loadInto(StarCamera &camera) const { camera.getImageFromMemory(mImage.data(), mRows, mCols); }
+
+    /*!
+     \brief Returns the last rendered raw Bayer-12 image
+
+     \return const std::vector<uint16_t>& rows * cols pixels in row major order
+    */
+    const std::vector<uint16_t> & getImage() const { return mImage; }
+
+    /*!
+     \brief Returns the height of the images
+
+     \return unsigned
+    */
+    unsigned getRows() const { return mRows; }
+
+    /*!
+     \brief Returns the width of the images
+
+     \return unsigned
+    */
+    unsigned getCols() const { return mCols; }
+
+    /*!
+     \brief Returns the attitude of the last rendered image
+
+     \return const Eigen::Quaterniond
+    */
+    const Eigen::Quaterniond & getAttitude() const { return mAttitude; }
+
+    /*!
+     \brief Returns the stars of the last rendered image, brightest first
+
+     \return const std::vector<SyntheticStar>&
+    */
+    const std::vector<SyntheticStar> & getStars() const { return mStars; }
+
+    /*!
+     \brief Returns the centers of the false spots of the last rendered image
+
+     \return const std::vector<Eigen::Vector2f>&
+    */
+    const std::vector<Eigen::Vector2f> & getFalseSpots() const { return mFalseSpotCenters; }
+
+    /*!
+     \brief Returns the ground truth hip-ID of each spot
+
+     Each spot is matched with the nearest rendered star within maxDistance,
+     spots without a star (noise, hot pixels or false spots) get -1. The
+     result has the format of StarIdentifier::identifyStars().
+
+     \param spots Extracted spots (StarCamera::getSpots() of the loaded image)
+     \param maxDistance Maximum distance of a spot from its star (in pixel)
+     \return std::vector<int>
+    */
+    std::vector<int> getTrueIds(const std::vector<Spot> &spots, float maxDistance = 2.0f) const;
+
+private:
+    /*!
+     \brief A star of the catalog
+    */
+    struct CatalogStar
+    {
+        int hip; /*!< hip-ID*/
+        float magnitude; /*!< Visual magnitude*/
+        Eigen::Vector3f vector; /*!< Inertial direction*/
+    };
+
+    /*!
+     \brief Adds a gaussian PSF to the signal image
+
+     \param center Center in sensor coordinates
+     \param flux Total signal
+    */
+    void renderPsf(const Eigen::Vector2f &center, float flux);
+
+    const StarCamera &mCamera; /*!< Camera model for the projection*/
+    std::vector<CatalogStar> mCatalog; /*!< Loaded stars*/
+    std::mt19937 mRandom; /*!< Random number generator*/
+
+    unsigned mRows; /*!< Height of the images*/
+    unsigned mCols; /*!< Width of the images*/
+    float mPsfSigma; /*!< Standard deviation of the PSF (in pixel)*/
+    float mZeroPointFlux; /*!< Flux of a star of magnitude 0*/
+    float mBackground; /*!< Background level*/
+    float mReadNoise; /*!< Standard deviation of the read noise*/
+    float mShotNoiseGain; /*!< Raw units per electron*/
+    Eigen::Vector4f mBayerGains; /*!< Gains of the Bayer pattern (gain of (row & 1) * 2 + (col & 1))*/
+    unsigned mMaxStars; /*!< Maximum number of rendered stars (0 for all)*/
+    unsigned mHotPixels; /*!< Number of hot pixels per image*/
+    unsigned mFalseSpots; /*!< Number of false spots per image*/
+
+    Eigen::Quaterniond mAttitude; /*!< Attitude of the last image*/
+    std::vector<SyntheticStar> mStars; /*!< Stars of the last image*/
+    std::vector<Eigen::Vector2f> mFalseSpotCenters; /*!< False spots of the last image*/
+    std::vector<float> mSignal; /*!< Signal of each pixel while rendering*/
+    std::vector<uint16_t> mImage; /*!< Last rendered raw image*/
+};
+
+#endif // SCENE_GENERATOR_H
@@ -0,0 +1,134 @@
+#ifndef SKY_INDEX_H
+#define SKY_INDEX_H
+
+#include <vector>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+/*!
+ \brief Spatial index of the inertial star vectors for cone queries
+
+ The sphere is divided with a cube map: each unit vector is assigned to the
+ face of the cube its largest component points to, and the face is divided
+ into resolution x resolution cells of the gnomonic coordinates
+ u, v in [-1, 1]. The boundaries of the cells are great circles, hence
+ the cells a cone may touch are found exactly per row and column by the
+ distance of the cone axis from these great circles, without testing every
+ cell of the sphere.
+
+ The stars are stored sorted by cell, with their vectors next to each other,
+ so a query only reads the cells it touches. Queries do not allocate once
+ the output vector has grown to the size of the result.
+
+ The index is keyed by the catalog index of StarIdentifier, zero vectors
+ (stars unknown to the hip-catalog) are not indexed.
+*/
+class SkyIndex
+{
+public:
+    /*!
+     \brief Constructs an empty SkyIndex
+    */
+    SkyIndex();
+
+    /*!
+     \brief Builds the index
+
+     \param vectors Unit vector of each catalog index (zero vectors are skipped)
+     \param resolution Number of cells along each edge of a cube face, about
+            90 / resolution degree per cell
+    */
+    void build(const std::vector<Eigen::Vector3f> &vectors, unsigned resolution = 16);
+
+    /*!
+     \brief Removes all stars
+    */
+    void clear();
+
+    /*!
+     \brief Returns if no stars are indexed
+
+     \return bool
+    */
+    bool empty() const { return mIndices.empty(); }
+
+    /*!
+     \brief Returns the number of indexed stars
+
+     \return unsigned
+    */
+    unsigned size() const { return mIndices.size(); }
+
+    /*!
+     \brief Returns the number of cells along each edge of a cube face
+
+     \return unsigned
+    */
+    unsigned getResolution() const { return mResolution; }
+
+    /*!
+     \brief Finds all stars within an angle of a direction
+
+     \param center Axis of the cone (unit vector)
+     \param radius Half opening angle of the cone (in degree)
+     \param indices Output catalog indices of the stars in the cone, ordered by cell
+    */
+    void coneQuery(const Eigen::Vector3f &center, float radius, std::vector<int> &indices) const;
+
+    /*!
+     \brief Finds all stars within an angle of a direction
+
+     Variant for repeated queries with the same radius, no transcendental
+     function is evaluated.
+
+     \param center Axis of the cone (unit vector)
+     \param cosRadius Cosine of the half opening angle
+     \param sinRadius Sine of the half opening angle
+     \param indices Output catalog indices of the stars in the cone, ordered by cell
+    */
+    void coneQuery(const Eigen::Vector3f &center, float cosRadius, float sinRadius, std::vector<int> &indices) const;
+
+private:
+    /*!
+     \brief Returns the cube face of a vector and its gnomonic coordinates
+
+     \param v Unit vector
+     \param u Output coordinate along the first axis of the face
+     \param w Output coordinate along the second axis of the face
+     \return unsigned The face 0..5 (+x, -x, +y, -y, +z, -z)
+    */
+    static unsigned faceOf(const Eigen::Vector3f &v, float &u, float &w);
+
+    /*!
+     \brief Returns the cell of a coordinate within a face
+
+     \param u Gnomonic coordinate in [-1, 1]
+     \return unsigned
+    */
+    unsigned cellOf(float u) const;
+
+    /*!
+     \brief Determines the cells along one axis of a face which a cone may touch
+
+     Cell c spans [u_c, u_c+1]. The half-space u >= u_c is bounded by a great
+     circle, which the cone touches if the distance of its axis from it is at
+     most the radius.
+
+     \param axis Component of the cone axis along the axis of the face coordinate
+     \param normal Component of the cone axis along the normal of the face
+     \param sinRadius Sine of the radius (1 for cones of 90 degree and more)
+     \param first Output first cell
+     \param last Output last cell
+     \return bool False if no cell is touched
+    */
+    bool cellRange(float axis, float normal, float sinRadius, unsigned &first, unsigned &last) const;
+
+    unsigned mResolution; /*!< Cells along each edge of a face*/
+    std::vector<uint32_t> mCellStart; /*!< Position of the first star of each cell in mIndices (6 * resolution^2 + 1 entries)*/
+    std::vector<int> mIndices; /*!< Catalog indices sorted by cell*/
+    std::vector<Eigen::Vector3f> mVectors; /*!< Vector of each entry of mIndices*/
+    std::vector<float> mBoundaryScale; /*!< 1 / sqrt(1 + u^2) of each cell boundary u*/
+};
+
+#endif // SKY_INDEX_H
@@ -0,0 +1,95 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+
+/*!
+ \brief Lock-free bounded queue for exactly one producer and one consumer thread
+
+ Elements are exchanged with std::swap instead of being copied, hence the
+ storage of containers (e.g. std::vector) travels between the slots and the
+ caller and does not have to be reallocated for every element passed through
+ the queue.
+
+ \tparam T Element type, has to be default constructible and swappable
+ \tparam Allocator Allocator of the slots (e.g. Eigen::aligned_allocator for types with fixed-size Eigen members)
+*/
+template<typename T, typename Allocator = std::allocator<T> >
+class SpscQueue
+{
+public:
+    /*!
+     \brief Constructs a queue which can hold at least capacity elements
+
+     \param capacity Minimum number of elements (rounded up to a power of 2)
+    */
+    explicit SpscQueue(std::size_t capacity)
+        :mHead(0), mTail(0)
+    {
+        std::size_t size = 2;
+        while(size < capacity)
+            size <<= 1;
+        mSlots.resize(size);
+        mMask = size - 1;
+    }
+
+    /*!
+     \brief Moves item into the queue (only to be called by the producer)
+
+     On success item contains the previous content of the slot.
+
+     \param item Element to insert
+     \return bool False if the queue is full, item is left untouched in this case
+    */
+    bool tryPush(T &item)
+    {
+        const std::size_t tail = mTail.load(std::memory_order_relaxed);
+        if(tail - mHead.load(std::memory_order_acquire) > mMask)
+            return false;
+
+        std::swap(mSlots[tail & mMask], item);
+        mTail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+     \brief Moves the oldest element out of the queue (only to be called by the consumer)
+
+     \param item Receives the element, its previous content is left in the slot
+     \return bool False if the queue is empty
+    */
+    bool tryPop(T &item)
+    {
+        const std::size_t head = mHead.load(std::memory_order_relaxed);
+        if(head == mTail.load(std::memory_order_acquire))
+            return false;
+
+        std::swap(mSlots[head & mMask], item);
+        mHead.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /*!
+     \brief Returns if the queue is currently empty
+
+     \return bool
+    */
+    bool empty() const
+    {
+        return mHead.load(std::memory_order_acquire) == mTail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T, Allocator> mSlots; /*!< Storage of the ring*/
+    std::size_t mMask; /*!< Size of the ring - 1 for fast modulo*/
+    char mPad0[64]; /*!< Keeps the indices on separate cache lines*/
+    std::atomic<std::size_t> mHead; /*!< Index of the next element to pop (written by the consumer)*/
+    char mPad1[64]; /*!< Keeps the indices on separate cache lines*/
+    std::atomic<std::size_t> mTail; /*!< Index of the next free slot (written by the producer)*/
+};
+
+#endif // SPSC_QUEUE_H
@@ -5,12 +5,22 @@
 #include <stdint.h>
 #include <vector>
 #include <string>
+#include <memory>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
 #include "datatypes.h"
 #include "aptina.h"
+#include "mappedfile.h"
+#include "runlabeller.h"
+#include "striplabeller.h"
+#include "background.h"
+#include "defectmap.h"
+#include "framecorrection.h"
+#include "framearena.h"
+#include "centroidkernels.h"
+#include "psffit.h"
 
 /*!
  \brief
@@ -29,8 +39,8 @@ public:
      \brief Enumeration of the different methods for centroiding
 
      More detailed information about each method can be found in
-     CentroidingContours(), CentroidingConnectedComponentsGeometric()
-     and CentroidingConnectedComponentsWeighted()
+     CentroidingContours(), CentroidingConnectedComponentsGeometric(),
+     CentroidingConnectedComponentsWeighted() and CentroidingGaussianFit()
     */
     enum CentroidingMethod
     {
@@ -38,7 +48,20 @@ public:
         ContoursWeighted,
         ContoursWeightedBoundingBox,
         ConnectedComponentsGeometric,
-        ConnectedComponentsWeighted
+        ConnectedComponentsWeighted,
+        ConnectedComponentsGaussianFit
+    };
+
+    /*!
+     \brief Window around a predicted star position for extractSpotsInWindows()
+    */
+    struct Window
+    {
+        Window() :size(0) {}
+        Window(cv::Point2f center_, unsigned size_) :center(center_), size(size_) {}
+
+        cv::Point2f center; /*!< Predicted centroid (in px)*/
+        unsigned size; /*!< Width and height of the window (in px)*/
     };
 
     /*!
@@ -57,9 +80,130 @@ public:
 
     /*!
      \brief Grab a frame from the Aptina camera
+
+     If streaming was started with startStreaming() the next frame is taken from
+     the capture queue and its buffer is handed back right after the conversion,
+     so the camera exposes the next frame while this one is processed.
+     Otherwise a single frame is grabbed synchronously.
+     With raw centroiding (see setRawCentroiding()) a streamed buffer is only
+     handed back with the next call or stopStreaming().
     */
     void getImage();
 
+    /*!
+     \brief Starts the continuous acquisition of the Aptina camera
+
+     \param nBuffers Number of frame buffers in the capture ring
+    */
+    void startStreaming(unsigned nBuffers = 3) { mCamera.startCapture(nBuffers); }
+
+    /*!
+     \brief Stops the continuous acquisition of the Aptina camera
+    */
+    void stopStreaming();
+
+    /*!
+     \brief Takes the next raw frame from the capture queue without converting it
+
+     Only available while streaming. The buffer has to be handed back with
+     releaseRawFrame() as soon as it is not needed anymore.
+
+     \param buffer Will contain the address of the raw Bayer-12 frame
+     \param timestamp If not NULL, receives the time at which the frame was completed
+     \param timeoutMs Maximum time to wait for a frame (in milliseconds)
+     \return bool True if a frame was acquired, false on timeout
+    */
+    bool acquireRawFrame(const uint16_t **buffer, double *timestamp = NULL, unsigned timeoutMs = 1000);
+
+    /*!
+     \brief Hands a buffer from acquireRawFrame() back to the camera
+
+     \param buffer Address of the raw frame
+    */
+    void releaseRawFrame(const uint16_t *buffer);
+
+    /*!
+     \brief Returns the number of frames the camera overwrote before they were taken
+
+     \return unsigned
+    */
+    unsigned getDroppedFrames() const { return mCamera.getDroppedFrames(); }
+
+    /*!
+     \brief Returns the number of rows of the frames delivered by the camera
+
+     \return unsigned
+    */
+    unsigned getCameraRows() const { return mCamera.getHeight(); }
+
+    /*!
+     \brief Returns the number of columns of the frames delivered by the camera
+
+     \return unsigned
+    */
+    unsigned getCameraCols() const { return mCamera.getWidth(); }
+
+    /*!
+     \brief Sets the readout window of the Aptina camera (see Aptina::setReadoutWindow())
+
+     Spots are extracted in frame coordinates, calculateSpotVectors() maps
+     them back to the sensor for frames of the camera.
+
+     \param rowStart First sensor row
+     \param colStart First sensor column
+     \param height Number of sensor rows
+     \param width Number of sensor columns
+    */
+    void setReadoutWindow(unsigned rowStart, unsigned colStart, unsigned height, unsigned width);
+
+    /*!
+     \brief Sets the subsampling of the Aptina camera (see Aptina::setSubsampling())
+
+     \param factor Subsampling factor
+     \param binning Bin the pixels instead of skipping them
+    */
+    void setSubsampling(unsigned factor, bool binning = false);
+
+    /*!
+     \brief Sets the exposure time of the Aptina camera
+
+     \param rows Exposure in row times
+    */
+    void setExposure(unsigned rows) { mCamera.setExposure(rows); }
+
+    /*!
+     \brief Load a raw image from a buffer in memory
+
+     The buffer has to be in Bayer-12 format with 12-bit resolution
+     being stored in 2 bytes with leading 0s. The data is copied,
+     hence the buffer can be reused as soon as the function returns.
+     The conversion to 8 bit and the threshold are applied in a single pass.
+     A dark frame and flat field correction (see setFrameCorrection()) is
+     applied to a copy of the buffer first.
+
+     With raw centroiding (see setRawCentroiding()) the buffer is not
+     converted but only referenced (or its corrected copy), it has to stay
+     valid until the spots are extracted.
+
+     \param buffer Raw image data
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void getImageFromBuffer(const uint16_t *buffer, const unsigned rows, const unsigned cols);
+
+    /*!
+     \brief Load a full frame raw image from memory, e.g. a synthetic one (see SceneGenerator)
+
+     As getImageFromBuffer(), but the frame coordinates are the sensor
+     coordinates as for getImageFromFile() instead of the readout window of
+     the camera.
+
+     \param buffer Raw image data
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void getImageFromMemory(const uint16_t *buffer, const unsigned rows, const unsigned cols);
+
     /*!
      \brief Load a raw image from file
      The image has to be in Bayer-12 format with 12-bit resolution
@@ -68,12 +212,71 @@ public:
      Defaults for height and width of the image correspond to the
      5 MP Aptina camera.
 
+     The file is memory mapped and converted directly from the page cache.
+     The mapping stays valid until the next image is loaded from file, see getRawFrame().
+
      \param filename Filename
      \param rows Width of the image
      \param cols Height of the image
     */
     void getImageFromFile(const std::string filename, const unsigned rows=1944, const unsigned cols=2592);
 
+    /*!
+     \brief Starts reading a raw image file into the page cache in the background
+
+     Intended for processing lists of files: while the current image is processed
+     the next one is already read from disk. If the next call of getImageFromFile()
+     is for the same file, the prefetched mapping is used. Errors are ignored, a
+     missing or unreadable file is reported by getImageFromFile().
+
+     \param filename Filename of the image which will be loaded next
+    */
+    void prefetchImageFile(const std::string filename);
+
+    /*!
+     \brief Returns the raw Bayer-12 image last loaded by getImageFromFile()
+
+     The matrix only wraps the memory mapped file, it is valid until the next
+     image is loaded from file.
+
+     \return const cv::Mat_<uint16_t>
+    */
+    const cv::Mat_<uint16_t> & getRawFrame() const { return mRawFrame; }
+
+    /*!
+     \brief Returns the 8-bit frame of the previously loaded image
+
+     With raw centroiding the frame is converted from the raw data on the
+     first call after loading, e.g. for display.
+
+     \return const cv::Mat_<uint8_t>&
+    */
+    const cv::Mat_<uint8_t> & getFrame();
+
+    /*!
+     \brief Sets if the spots are extracted from the raw 12-bit data
+
+     If enabled, loading an image does not convert it to 8 bit. The
+     connected components methods threshold and label the raw buffer directly
+     and weight the centroids with the full 12-bit values, which saves the
+     conversion pass and improves the centroids of faint stars. A pixel is
+     part of a spot if its 8-bit value would be above the threshold, so the
+     same spots are found as with the 8-bit images. The contour methods and
+     getFrame() convert the image on demand, the weighted contour methods
+     still weight with the 12-bit values. The pixels of a defect map (see
+     setDefectMap()) are skipped while labelling the raw data.
+
+     \param value
+    */
+    void setRawCentroiding(bool value);
+
+    /*!
+     \brief Returns if the spots are extracted from the raw 12-bit data
+
+     \return bool
+    */
+    bool getRawCentroiding() const { return mRawCentroiding; }
+
     /*!
      \brief Extracts the star spots from the previously loaded image
 
@@ -84,15 +287,104 @@ public:
     */
     unsigned extractSpots(CentroidingMethod method = ConnectedComponentsWeighted);
 
+    /*!
+     \brief Extracts one spot in each window directly from a raw frame
+
+     Intended for tracking, where the positions of the stars are known
+     approximately: only the pixels within the windows are read, the full frame
+     is neither converted, thresholded nor labeled. In each window (clipped to
+     the frame) the weighted centroid of all pixels above the threshold is
+     computed, using the full 12-bit values as weights. If the centroid is
+     further than a quarter of the window size from its center, the window is
+     moved to the centroid once and the centroid is computed again. A spot is
+     only added if it covers more than getMinArea() pixels.
+
+     Use setThreshold() (on the 8-bit scale, like for extractSpots()) and
+     setMinArea() to set main parameters. The spots are stored in the order
+     of the windows and can be read with getSpots().
+
+     \param buffer Raw Bayer-12 frame (e.g. from acquireRawFrame() or getRawFrame())
+     \param rows Height of the frame
+     \param cols Width of the frame
+     \param windows Windows around the predicted centroids
+     \param spotIndex If not NULL, receives for each window the index of its spot in getSpots() (-1 if none)
+     \return unsigned Number of extracted spots
+    */
+    unsigned extractSpotsInWindows(const uint16_t *buffer, const unsigned rows, const unsigned cols,
+                                   const std::vector<Window> &windows, std::vector<int> *spotIndex = NULL);
+
     /*!
      \brief Calulates the Vectors in Camera frame for each spot extracted in an image
 
     */
     void calculateSpotVectors();
 
+    /*!
+     \brief Calulates the Vectors in Camera frame for a list of spots
+
+     Does not touch the internal state, hence it can run in parallel to
+     getImage() and extractSpots() as long as the calibration is not changed.
+
+     \param spots Spots in image coordinates
+     \param spotVectors Output list of unit vectors, one for each spot
+    */
+    void calculateSpotVectors(const std::vector<Spot> &spots, std::vector<Eigen::Vector3f> &spotVectors) const;
+
+    /*!
+     \brief Removes the lens distortion from a batch of points
+
+     The points are given in normalized image coordinates (principal point
+     subtracted, divided by the focal length, skew removed) as separate
+     arrays of x and y (structure of arrays). They are processed in blocks of
+     UNDISTORT_BLOCK points with Eigen arrays, which vectorize with SSE or
+     NEON. The fixed-point iteration of a block stops as soon as no point
+     moves by more than 1e-7 (at most 20 iterations).
+
+     \param x x-coordinates, overwritten with the undistorted ones
+     \param y y-coordinates, overwritten with the undistorted ones
+     \param n Number of points
+    */
+    void undistortPoints(float *x, float *y, unsigned n) const;
+
+    /*!
+     \brief Projects a vector in the camera frame onto the sensor
+
+     The inverse of calculateSpotVectors(): the lens distortion of the
+     calibration is applied, so the pixel is where the spot of a star in
+     this direction appears.
+
+     \param vector Direction in the camera frame (does not have to be normalized)
+     \param pixel Output sensor coordinates
+     \return bool false if the direction is not in front of the camera
+    */
+    bool projectVector(const Eigen::Vector3f &vector, Eigen::Vector2f &pixel) const;
+
+    /*!
+     \brief Sets the spacing of the precomputed undistortion grid
+
+     With a grid, the undistorted direction of every grid node on the sensor
+     is computed once (now and in each loadCalibration()), and the spot
+     vectors are interpolated bilinearly between the four surrounding nodes.
+     This takes a constant small time per spot. With a spacing of 16 px the
+     interpolation error is far below the centroid accuracy for typical
+     lenses. Spots outside of the sensor are still undistorted iteratively.
+
+     \param spacing Distance of the grid nodes (in sensor pixels), 0 disables the grid
+    */
+    void setUndistortionGrid(unsigned spacing);
+
+    /*!
+     \brief Returns the spacing of the undistortion grid
+
+     \return unsigned 0 if no grid is used
+    */
+    unsigned getUndistortionGrid() const { return mGridSpacing; }
+
     /*!
      \brief Loads the calibration file for the Aptina camera
 
+     Rebuilds the undistortion grid if one is used.
+
      \param filename
     */
     void loadCalibration(const std::string filename);
@@ -111,6 +403,94 @@ public:
     */
     void setThreshold(unsigned value) { mThreshold = value; }
 
+    /*!
+     \brief Sets if the threshold is derived from the background of each tile
+
+     If enabled, the background and noise of every loaded image are
+     estimated in tiles (see getBackgroundEstimator()) and each tile is
+     thresholded at its own level instead of getThreshold(). The estimate is
+     updated incrementally from frame to frame.
+
+     \param value
+    */
+    void setAdaptiveThreshold(bool value) { mAdaptiveThreshold = value; }
+
+    /*!
+     \brief Returns if the threshold is derived from the background of each tile
+
+     \return bool
+    */
+    bool getAdaptiveThreshold() const { return mAdaptiveThreshold; }
+
+    /*!
+     \brief Returns the estimator of the adaptive threshold for configuration
+
+     \return BackgroundEstimator &
+    */
+    BackgroundEstimator & getBackgroundEstimator() { return mBackground; }
+
+    /*!
+     \brief Sets the hot pixels and defective columns which are ignored
+
+     The defects are set to 0 in the thresholded image during the conversion
+     of each loaded image (and when it is thresholded again), and skipped by
+     extractSpotsInWindows(), so no spot contains them. The 8-bit frame
+     itself is not changed. The map is only applied to images of its size,
+     e.g. not to subsampled frames. With raw centroiding the raw data is not
+     modified, the labeller skips the defects instead.
+
+     \param defects Calibrated map (shared, not copied), NULL disables the masking
+    */
+    void setDefectMap(const std::shared_ptr<const DefectMap> &defects) { mDefects = defects; }
+
+    /*!
+     \brief Returns the map of the ignored defects
+
+     \return const std::shared_ptr<const DefectMap> & NULL if none
+    */
+    const std::shared_ptr<const DefectMap> & getDefectMap() const { return mDefects; }
+
+    /*!
+     \brief Sets the dark frame and flat field which correct the loaded images
+
+     Each loaded image of the size of the correction is corrected into a buffer
+     of the camera before anything else, so the background estimate, the
+     thresholds and the centroids all work on the corrected values.
+     extractSpotsInWindows() corrects the pixels of the windows. getRawFrame()
+     still returns the uncorrected file content.
+
+     \param correction Loaded correction (shared, not copied), NULL disables it
+    */
+    void setFrameCorrection(const std::shared_ptr<const FrameCorrection> &correction) { mCorrection = correction; }
+
+    /*!
+     \brief Returns the dark frame and flat field correction
+
+     \return const std::shared_ptr<const FrameCorrection> & NULL if none
+    */
+    const std::shared_ptr<const FrameCorrection> & getFrameCorrection() const { return mCorrection; }
+
+
+    /*!
+     \brief Set if the 8-bit frame is kept when loading an image
+
+     By default both mFrame and the thresholded mThreshed are produced while
+     loading an image. If the frame is not kept only mThreshed is written, which
+     saves one full frame of memory traffic. In this case the threshold can not be
+     changed between loading and extracting and the methods ContoursWeighted,
+     ContoursWeightedBoundingBox and, without raw centroiding,
+     ConnectedComponentsGaussianFit are not available.
+
+     \param value
+    */
+    void setKeepFrame(bool value) { mKeepFrame = value; }
+
+    /*!
+     \brief Return if the 8-bit frame is kept when loading an image
+
+     \return bool
+    */
+    bool getKeepFrame() const { return mKeepFrame; }
 
     /*!
      \brief Return the current minimum Area a spot has to cover to count as star
@@ -125,6 +505,50 @@ public:
     */
     void setMinArea(unsigned value) {mMinArea = value; }
 
+    /*!
+     \brief Sets the number of threads of the connected components methods
+
+     With more than one thread the image is labelled in horizontal strips in
+     parallel (see StripLabeller), the extracted spots are identical to the
+     sequential labelling.
+
+     \param nThreads Number of threads including the calling one, 0 uses
+            the number of cores, 1 labels sequentially
+    */
+    void setNumThreads(unsigned nThreads);
+
+    /*!
+     \brief Returns the number of threads of the connected components methods
+
+     \return unsigned
+    */
+    unsigned getNumThreads() const { return mStripLabeller ? mStripLabeller->getNumThreads() : 1; }
+
+    /*!
+     \brief Sets which neighbours of a pixel are connected in the connected components methods
+
+     8 (default) joins diagonal neighbours into one spot, 4 only horizontal
+     and vertical ones, which separates close stars touching at a corner.
+     The findContours() of the contour methods always uses 8-connectivity.
+
+     \param connectivity 4 or 8
+    */
+    void setConnectivity(unsigned connectivity);
+
+    /*!
+     \brief Returns which neighbours of a pixel are connected in the connected components methods
+
+     \return unsigned 4 or 8
+    */
+    unsigned getConnectivity() const { return mLabeller.getConnectivity(); }
+
+    /*!
+     \brief Returns the PSF fit of ConnectedComponentsGaussianFit for configuration
+
+     \return PsfFitter &
+    */
+    PsfFitter & getPsfFitter() { return mPsfFitter; }
+
 
     /*!
      \brief Returns a const reference to the vector of extracted Spots
@@ -153,14 +577,13 @@ public:
     */
     void cameraTest();
 
-    cv::Mat_<u_int8_t> mFrame; /*!< Object which contains the current frame*/
+    cv::Mat_<u_int8_t> mFrame; /*!< Object which contains the current frame (empty if not kept, see setKeepFrame())*/
     cv::Mat_<u_int8_t> mThreshed; /*!< Object which contains the current frame after applying a Threshold*/
 
 
 
 
 private:
-    cv::Mat_<u_int16_t> mLabels; /*!< TODO: Useful? */
     unsigned mThreshold; /*!< Threshold under which pixels will be seen as black*/
     unsigned int mMinArea; /*!< Lowest area under which a star spot will be treated as noise*/
     std::vector<Spot> mSpots; /*!< Vector containing all identified spots from the last run of extractSpots()*/
@@ -170,6 +593,102 @@ private:
     Eigen::Vector2f mFocalLength; /*!< 2D focal length of the lense determined in calibration procedure*/
     float mPixelSkew; /*!< Pixel skew of the camera determined in calibration procedure*/
     Aptina mCamera; /*!< Representation of the Aptina camera to grab images from*/
+    int mThreshedLevel; /*!< Threshold mThreshed was computed with (-1 if not valid)*/
+    MappedFile mRawFile; /*!< Mapping of the raw image file last loaded*/
+    MappedFile mNextRawFile; /*!< Mapping of the raw image file passed to prefetchImageFile()*/
+    cv::Mat_<uint16_t> mRawFrame; /*!< Header wrapping the data of mRawFile*/
+    bool mKeepFrame; /*!< Write mFrame when loading an image*/
+    RunLabeller mLabeller; /*!< Labeller for the connected components methods*/
+    std::unique_ptr<StripLabeller> mStripLabeller; /*!< Parallel labeller (NULL if sequential)*/
+    Eigen::Vector2f mSensorOrigin; /*!< Sensor coordinates of the frame pixel (0, 0)*/
+    float mSensorScale; /*!< Sensor pixels per frame pixel*/
+    bool mRawCentroiding; /*!< Extract spots from the raw data without converting it*/
+    const uint16_t * mRawData; /*!< Raw data of the loaded image (NULL if converted on loading)*/
+    unsigned mRawRows; /*!< Height of mRawData*/
+    unsigned mRawCols; /*!< Width of mRawData*/
+    bool mFrameValid; /*!< mFrame holds the loaded image*/
+    uint8_t * mHeldFrame; /*!< Streamed buffer referenced by mRawData, handed back on the next frame*/
+    bool mAdaptiveThreshold; /*!< Threshold each tile at the level of mBackground*/
+    BackgroundEstimator mBackground; /*!< Background and noise of the loaded images*/
+    std::shared_ptr<const DefectMap> mDefects; /*!< Pixels masked in mThreshed (NULL if none)*/
+    std::shared_ptr<const FrameCorrection> mCorrection; /*!< Dark frame and flat field (NULL if none)*/
+    std::vector<uint16_t> mCorrected; /*!< Corrected copy of the loaded image*/
+    unsigned mGridSpacing; /*!< Distance of the nodes of the undistortion grid (0 if not used)*/
+    unsigned mGridCols; /*!< Number of grid nodes in a row*/
+    unsigned mGridRows; /*!< Number of rows of grid nodes*/
+    std::vector<Eigen::Vector2f> mGrid; /*!< Undistorted normalized coordinates of the grid nodes*/
+    std::vector<Contour_t> mContours; /*!< Contours of the last run of CentroidingContours(), kept for their memory*/
+    cv::Mat_<u_int8_t> mContourInput; /*!< Copy of mThreshed modified by findContours(), kept for its memory*/
+    FrameArena mArena; /*!< Scratch memory of the current frame, reset by extractSpots()*/
+    PsfFitter mPsfFitter; /*!< Refines the centroids of ConnectedComponentsGaussianFit*/
+
+    static const int ADAPTIVE_LEVEL = -2; /*!< mThreshedLevel of an image thresholded with mBackground*/
+
+    /*!
+     \brief Returns if defects are to be masked in images of this size
+
+     \param rows
+     \param cols
+     \return bool
+    */
+    bool hasDefects(unsigned rows, unsigned cols) const { return mDefects && !mDefects->empty() && mDefects->matches(rows, cols); }
+
+    /*!
+     \brief Returns if images of this size are corrected
+
+     \param rows
+     \param cols
+     \return bool
+    */
+    bool hasCorrection(unsigned rows, unsigned cols) const { return mCorrection && !mCorrection->empty() && mCorrection->matches(rows, cols); }
+
+    /*!
+     \brief Returns the level mThreshed has to be computed with for the current settings
+
+     \return int mThreshold or ADAPTIVE_LEVEL
+    */
+    int getThresholdLevel() const { return mAdaptiveThreshold ? ADAPTIVE_LEVEL : (int) mThreshold; }
+
+    /*!
+     \brief Computes mThreshed from mFrame for the current settings
+    */
+    void thresholdFrame();
+
+    /*!
+     \brief Converts a raw image to mFrame (if kept) and mThreshed
+
+     \param buffer Raw image data
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void convertRawFrame(const uint16_t *buffer, const unsigned rows, const unsigned cols);
+
+    /*!
+     \brief Hands the streamed buffer kept for raw centroiding back to the camera
+    */
+    void releaseHeldFrame();
+
+    /*!
+     \brief Sets the mapping from frame to sensor coordinates to the one of the camera
+
+     With subsampling pairs of columns are kept (Bayer pattern), so a frame
+     column x corresponds on average to the sensor column factor * x - (factor - 1) / 2
+     when skipping and factor * x + (factor - 1) / 2 when binning.
+    */
+    void useCameraGeometry();
+
+    /*!
+     \brief Sets the mapping from frame to sensor coordinates to the identity (full frame images)
+    */
+    void useFullFrameGeometry();
+
+    /*!
+     \brief Allocates mThreshed (and mFrame if it is kept) for a new image
+
+     \param rows Height of the image
+     \param cols Width of the image
+    */
+    void prepareFrame(const unsigned rows, const unsigned cols);
 
 
     /*!
@@ -195,48 +714,152 @@ private:
     unsigned CentroidingContours(CentroidingMethod method);
 
     /*!
-     \brief Extracts spots from image using OpendCVs (new) connectedComponents method
+     \brief Extracts spots from image with connected components (geometric centroid)
 
-     Uses the statistics the connectedComponents function produces to determine the
-     center and the area of the Spot.
+     Labels mThreshed with the RunLabeller and uses the mean position of the
+     pixels of each component as center and the number of pixels as area.
 
      \return unsigned
     */
     unsigned CentroidingConnectedComponentsGeometric();
 
     /*!
-     \brief Extracts spots from image using an altered version OpendCVs (new) connectedComponents method
+     \brief Extracts spots from image with connected components (weighted centroid)
 
-     Uses the statistics produced by this function to calculate the weighted centroid
-     and the area of each Spot
+     Labels mThreshed with the RunLabeller, which accumulates the intensity
+     weighted moments of each component while scanning the image. The center
+     of a spot is sum(x*p)/sum(p), sum(y*p)/sum(p) and the area the number of pixels.
 
      \return unsigned
     */
     unsigned CentroidingConnectedComponentsWeighted();
 
+    /*!
+     \brief Extracts spots with connected components and refines them with a Gaussian PSF fit
+
+     The blobs are found and filtered by area as in
+     CentroidingConnectedComponentsWeighted(), then the centroid of each spot
+     is fitted in a small window around its weighted centroid (see
+     PsfFitter), using the pixels below the threshold as well. The raw data
+     is fitted if it is kept (raw centroiding), the 8-bit frame otherwise,
+     which therefore has to be kept (see setKeepFrame(), extractSpots() throws
+     if it is not). The spots are fitted in parallel with the threads of
+     setNumThreads(). If a fit does not converge the weighted centroid is kept.
+
+     \return unsigned
+    */
+    unsigned CentroidingGaussianFit();
+
+    /*!
+     \brief Labels the raw data (raw centroiding) or mThreshed with mLabeller or mStripLabeller
+
+     \return unsigned Number of blobs
+    */
+    unsigned labelFrame();
+
+    /*!
+     \brief Returns the moments of a blob found by labelFrame()
+
+     \param index Blob in raster order
+     \return const BlobMoments &
+    */
+    const BlobMoments & getLabelledBlob(unsigned index) const
+    {
+        return mStripLabeller ? mStripLabeller->getBlob(index) : mLabeller.getBlob(index);
+    }
+
+    /*!
+     \brief Returns the flux of a blob found by labelFrame() on the 12-bit scale
+
+     \param blob
+     \return float
+    */
+    float getLabelledFlux(const BlobMoments &blob) const { return mRawData ? blob.sumP : 16.0f * blob.sumP; }
+
+    /*!
+     \brief Computes the weighted centroid of the pixels above the threshold in a window of a raw frame
+
+     \param buffer Raw Bayer-12 frame
+     \param rows Height of the frame
+     \param cols Width of the frame
+     \param center Center of the window
+     \param size Width and height of the window
+     \param centroid Output centroid
+     \param flux Output sum of the raw values of the pixels above the threshold
+     \return unsigned Number of pixels above the threshold
+    */
+    unsigned computeWindowCentroid(const uint16_t *buffer, const unsigned rows, const unsigned cols,
+                                   const cv::Point2f center, const unsigned size, cv::Point2f &centroid,
+                                   float &flux) const;
+
+    /*!
+     \brief Returns the pixels the weighted contour methods use within a rectangle
+
+     The raw data if it is kept (raw centroiding), the 8-bit frame otherwise.
+
+     \param rect Rectangle within the frame
+     \param stride Receives the distance between two rows (in pixels)
+     \return const void * First pixel of the rectangle (uint16_t or uint8_t)
+    */
+    const void * getWeightPixels(const cv::Rect &rect, std::size_t &stride) const;
+
     /*!
      \brief Computes the weighted centroid for a given contour
 
-     \param contour Reference to the contour
+     The mask of the contour is drawn into memory of mArena.
+
+     \param contours All contours of the frame
+     \param index Index of the contour
+     \param kernel Masked kernel for the pixels of getWeightPixels()
      \param centroid
+     \param flux Sum of the pixel values within the contour (12-bit scale)
+     \return unsigned Number of pixels within the contour
     */
-    void computeWeightedCentroid(Contour_t &contour, cv::Point2f &centroid);
+    unsigned computeWeightedCentroid(const std::vector<Contour_t> &contours, unsigned index, WindowMomentsKernel kernel,
+                                     cv::Point2f &centroid, float &flux);
     /*!
      \brief Computes the weighted centroid and area for a given contour using the bounding rectangle
 
      \param contour Reference to the contour
+     \param kernel Unmasked kernel for the pixels of getWeightPixels()
      \param centroid
      \param area
+     \param flux Sum of the pixel values within the rectangle (12-bit scale)
+    */
+    void computeWeightedCentroidBoundingRect(const Contour_t &contour, WindowMomentsKernel kernel,
+                                             cv::Point2f &centroid, unsigned &area, float &flux);
+
+    static const unsigned UNDISTORT_BLOCK = 16; /*!< Number of points undistorted together by undistortPoints()*/
+
+    /*!
+     \brief Removes the lens distortion of one block of points (see undistortPoints())
+
+     \param x x-coordinates of UNDISTORT_BLOCK points
+     \param y y-coordinates of UNDISTORT_BLOCK points
+    */
+    void undistortBlock(float *x, float *y) const;
+
+    /*!
+     \brief Converts sensor coordinates to normalized image coordinates (without undistortion)
+
+     \param pixel Sensor coordinates
+     \return Eigen::Vector2f
+    */
+    Eigen::Vector2f normalizePixel(const Eigen::Vector2f &pixel) const;
+
+    /*!
+     \brief Computes the undistorted directions of the grid nodes
     */
-    void computeWeightedCentroidBoundingRect(Contour_t &contour, cv::Point2f &centroid, unsigned &area);
+    void buildUndistortionGrid();
 
     /*!
-     \brief Compensates centroids of Spots for the lens distortion effects
+     \brief Interpolates the undistorted normalized coordinates of a point in the grid
 
-     \param in Original Spot centroid
-     \return Eigen::Vector2f Spot centroid after compensation for lens distortion
+     \param pixel Sensor coordinates
+     \param out Undistorted normalized coordinates
+     \return bool False if the point is outside of the grid
     */
-    Eigen::Vector2f undistortRadialTangential(const Eigen::Vector2f in) const;
+    bool lookupUndistortionGrid(const Eigen::Vector2f &pixel, Eigen::Vector2f &out) const;
 };
 
 #endif // STARCAMERA_H
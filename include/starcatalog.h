@@ -0,0 +1,235 @@
+#ifndef STAR_CATALOG_H
+#define STAR_CATALOG_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <Eigen/Core>
+
+#include "datatypes.h"
+#include "mappedfile.h"
+#include "skyindex.h"
+
+/*!
+ \brief Feature list (k-vector) and inertial star vectors used for the identification
+
+ The catalog is loaded once and not changed afterwards, so it can be shared
+ read-only by any number of StarIdentifier instances and threads, e.g. with
+ a std::shared_ptr<const StarCatalog> (see StarIdentifier::setCatalog()).
+ The feature list is memory mapped from binary k-vector files, hence all
+ processes using the same file also share its pages.
+
+ Stars are referenced by their catalog index, the position in the ascending
+ table of hip-IDs of the feature list.
+*/
+class StarCatalog
+{
+public:
+    /*!
+     \brief Typedef for the index of a star in the in-memory catalog
+
+     The catalog references stars by their position in the (sorted) star table
+     instead of the hip-ID, which halves the memory of the feature list.
+    */
+    typedef uint16_t catalogIndex_t;
+
+    static const int8_t MAGNITUDE_UNKNOWN = -128; /*!< Marks stars without magnitude in getStarMagnitudes()*/
+
+    /*!
+     \brief Constructs an empty catalog
+    */
+    StarCatalog();
+
+    /*!
+     \brief Loads the FeatureList as from file and saves it as k-Vector
+
+     The format is detected automatically: binary files (see KVectorFileHeader)
+     are memory mapped and used without parsing, otherwise the file is read as
+     text of the form
+        q m
+        k hip1 hip2 theta
+        [...]
+     Text files are converted into the binary layout while loading. The star
+     vectors of a previous loadStarCatalog() are removed.
+
+     Note:
+        k-Vector technique is described by Mortari
+
+     \param filename
+     \param verifyChecksum Check the checksum of binary files
+    */
+    void loadFeatureListKVector(const std::string filename, bool verifyChecksum = true);
+
+    /*!
+     \brief Loads the inertial unit vectors of the stars of the feature list
+
+     Reads hip, rightAscNow and declNow (in degree) from the table catalog of
+     the SQLite hip-catalog database (see scripts/hip-catalog) and stores the
+     vectors in a table with one entry per catalog index. Has to be called
+     after loadFeatureListKVector(), as loading a new feature list changes
+     the catalog indices and clears the table.
+
+     The vectors are also sorted into the sky index for cone queries, and the
+     magnitudes (column mag) are stored in tenths of a magnitude.
+     Stars of the feature list which are missing in the catalog keep a zero
+     vector and are never predicted.
+
+     \param filename SQLite-database file of the hip-catalog
+     \return unsigned Number of stars of the feature list missing in the catalog
+    */
+    unsigned loadStarCatalog(const std::string filename);
+
+    /*!
+     \brief Returns if the inertial vectors are loaded (see loadStarCatalog())
+
+     \return bool
+    */
+    bool hasStarCatalog() const { return !mStarVectors.empty(); }
+
+    /*!
+     \brief Returns the catalog index of a star
+
+     \param hip hip-ID of the star
+     \return int Catalog index, -1 if the star is not in the feature list
+    */
+    int getCatalogIndex(int hip) const;
+
+    /*!
+     \brief Returns the hip-ID of each catalog index (ascending)
+
+     \return const int32_t * getStarCount() entries
+    */
+    const int32_t * getStarHip() const { return mStarHip; }
+
+    /*!
+     \brief Returns the number of stars in the feature list
+
+     \return uint32_t
+    */
+    uint32_t getStarCount() const { return mStarCount; }
+
+    /*!
+     \brief Returns the k-vector over getCosTheta()
+
+     \return const int32_t * getFeatureCount() entries
+    */
+    const int32_t * getKVector() const { return mKVectorData; }
+
+    /*!
+     \brief Returns cos(theta) of each feature (ascending)
+
+     \return const float *
+    */
+    const float * getCosTheta() const { return mCosTheta; }
+
+    /*!
+     \brief Returns theta (in degree) of each feature
+
+     \return const float *
+    */
+    const float * getTheta() const { return mTheta; }
+
+    /*!
+     \brief Returns the catalog index of the first star of each feature
+
+     \return const catalogIndex_t *
+    */
+    const catalogIndex_t * getId1() const { return mId1; }
+
+    /*!
+     \brief Returns the catalog index of the second star of each feature
+
+     \return const catalogIndex_t *
+    */
+    const catalogIndex_t * getId2() const { return mId2; }
+
+    /*!
+     \brief Returns the number of features
+
+     \return uint32_t
+    */
+    uint32_t getFeatureCount() const { return mFeatureCount; }
+
+    /*!
+     \brief Returns the largest number of features a single star is part of
+
+     \return uint32_t
+    */
+    uint32_t getMaxStarFeatures() const { return mMaxStarFeatures; }
+
+    /*!
+     \brief Returns the parameter q of the k-vector line
+
+     \return double
+    */
+    double getQ() const { return mQ; }
+
+    /*!
+     \brief Returns the parameter m of the k-vector line
+
+     \return double
+    */
+    double getM() const { return mM; }
+
+    /*!
+     \brief Returns the inertial unit vector of each catalog index (empty without loadStarCatalog())
+
+     \return const std::vector<Eigen::Vector3f> & Zero vectors for stars unknown to the hip-catalog
+    */
+    const std::vector<Eigen::Vector3f> & getStarVectors() const { return mStarVectors; }
+
+    /*!
+     \brief Returns the magnitude of each catalog index in tenths (empty without loadStarCatalog())
+
+     \return const std::vector<int8_t> & MAGNITUDE_UNKNOWN for stars without magnitude
+    */
+    const std::vector<int8_t> & getStarMagnitudes() const { return mStarMagnitudes; }
+
+    /*!
+     \brief Returns the sky index of the inertial vectors (see loadStarCatalog())
+
+     \return const SkyIndex &
+    */
+    const SkyIndex & getSkyIndex() const { return mSkyIndex; }
+
+private:
+    StarCatalog(const StarCatalog &);
+    StarCatalog & operator = (const StarCatalog &);
+
+    /*!
+     \brief Sets up the catalog arrays to point into the content of a binary k-vector file
+
+     \param image File content (has to stay valid as long as the catalog is used)
+     \param size Size of the content in bytes
+     \param verifyChecksum Check the checksum of the content
+    */
+    void attachCatalog(const uint8_t *image, std::size_t size, bool verifyChecksum);
+
+    /*!
+     \brief Reads the features of a k-vector text file
+
+     \param filename
+     \param features Output list of features (hip-IDs, theta in degree)
+    */
+    static void readKVectorText(const std::string filename, std::vector<Feature2> &features);
+
+    std::vector<uint8_t> mCatalogImage; /*!< Storage of the catalog if it was converted while loading*/
+    MappedFile mKVectorFile; /*!< Storage of the catalog if loaded from a current binary file*/
+    const int32_t * mStarHip; /*!< hip-ID of each catalog index (ascending)*/
+    uint32_t mStarCount; /*!< Number of stars in the catalog*/
+    const int32_t * mKVectorData; /*!< k-Vector over mCosTheta*/
+    const float * mCosTheta; /*!< cos(theta) of each feature (ascending)*/
+    const float * mTheta; /*!< theta (in degree) of each feature*/
+    const catalogIndex_t * mId1; /*!< Catalog index of the first star of each feature*/
+    const catalogIndex_t * mId2; /*!< Catalog index of the second star of each feature*/
+    uint32_t mFeatureCount; /*!< Number of features*/
+    uint32_t mMaxStarFeatures; /*!< Largest number of features a single star is part of*/
+    double mQ; /*!< Parameter q for k-Vector technique*/
+    double mM; /*!< Parameter m for k-Vector technique*/
+    std::vector<Eigen::Vector3f> mStarVectors; /*!< Inertial unit vector of each catalog index*/
+    std::vector<int8_t> mStarMagnitudes; /*!< Magnitude of each catalog index in tenths (MAGNITUDE_UNKNOWN if not in the catalog)*/
+    SkyIndex mSkyIndex; /*!< Cone queries over mStarVectors*/
+};
+
+#endif // STAR_CATALOG_H
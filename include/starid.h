@@ -5,16 +5,28 @@
 #include<string>
 #include<vector>
 #include<utility>
+#include<stdint.h>
+#include<memory>
+#include<mutex>
+#include<cmath>
+#include<cstdlib>
 
 #include <Eigen/Core>
 #include <Eigen/Geometry>
 
 #include "datatypes.h"
+#include "starcatalog.h"
+#include "triadmatcher.h"
+#include "threadpool.h"
 
 
 /*!
- \brief
+ \brief Identification of the stars of the spot vectors of a frame
 
+ The catalog (see StarCatalog) is held by a std::shared_ptr<const StarCatalog>,
+ so identifiers of several pipelines can share one loaded catalog. Everything
+ else an identifier owns, hence independent instances can be used by
+ different threads at the same time.
 */
 class StarIdentifier
 {
@@ -23,7 +35,8 @@ public:
     {
         TwoStar,
         PyramidSQL,
-        PyramidKVector
+        PyramidKVector,
+        PyramidKVectorParallel /*!< PyramidKVector with the triads tested in parallel (see setNumThreads())*/
     };
 
     /*!
@@ -38,11 +51,64 @@ public:
     */
     typedef std::vector<Feature2> featureList_t;
 
+    /*!
+     \brief Typedef for the index of a star in the in-memory catalog (see StarCatalog)
+    */
+    typedef StarCatalog::catalogIndex_t catalogIndex_t;
+
     /*!
      \brief Typedef for a list of 3D-Vectors
     */
     typedef std::vector<Eigen::Vector3f> vectorList_t;
 
+    /*!
+     \brief Half-open range [begin, end) of indices
+
+     Used as a view into the catalog arrays or into a Scratch instead of
+     copying the matching features.
+    */
+    struct IndexRange
+    {
+        IndexRange() :begin(0), end(0) {}
+        IndexRange(uint32_t b, uint32_t e) :begin(b), end(e) {}
+
+        bool empty() const { return begin >= end; }
+        uint32_t size() const { return empty() ? 0 : end - begin; }
+
+        uint32_t begin; /*!< First index*/
+        uint32_t end; /*!< One past the last index*/
+    };
+
+    /*!
+     \brief Reusable working memory for identifyStars()
+
+     The filtered k-vector queries store the indices of the matching features
+     in this arena and the candidates are matched with its TriadMatcher. It grows to the size required by the loaded catalog during
+     the first identification and is reused afterwards, hence following calls
+     do not allocate. A Scratch must not be used by several threads at once.
+    */
+    class Scratch
+    {
+    public:
+        /*!
+         \brief Reserves the memory required for the catalog of identifier
+
+         Optional, otherwise the memory is reserved by the first identification.
+
+         \param identifier
+        */
+        void reserve(const StarIdentifier &identifier) { mFeatures.reserve(3 * identifier.mMaxStarFeatures); }
+
+    private:
+        friend class StarIdentifier;
+
+        std::vector<uint32_t> mFeatures; /*!< Feature indices of the filtered queries*/
+        std::vector<int> mCandidates; /*!< Spots the triads are formed of*/
+        std::vector<float> mSpotMagnitudes; /*!< Instrumental magnitude of each spot (in tenths)*/
+        std::vector<int> mNeighbours; /*!< Result of the cone queries of the verification*/
+        TriadMatcher mMatcher; /*!< Hash tables for matching the candidate pairs*/
+    };
+
     /*!
     \brief Constructor
 
@@ -65,21 +131,154 @@ public:
     /*!
      \brief Opens the database file and initializes the SQLite handle
 
-     TODO:
-        load the file into memory to get faster IO than reading from disk?
+     The database is copied into memory and an index on theta is added to the
+     copy, and the statements of the SQL methods are prepared once.
 
     */
     void openDb();
 
     /*!
-     \brief Loads the FeatureList as from file and saves it as k-Vector
+     \brief Loads a new catalog with the feature list of a k-vector file
 
-     Note:
-        k-Vector technique is described by Mortari
+     See StarCatalog::loadFeatureListKVector(). The identifier owns the new
+     catalog until it is shared with getCatalog().
 
      \param filename
+     \param verifyChecksum Check the checksum of binary files
+    */
+    void loadFeatureListKVector(const std::string filename, bool verifyChecksum = true);
+
+    /*!
+     \brief Loads the inertial unit vectors of the stars of the feature list
+
+     See StarCatalog::loadStarCatalog(). Has to be called after
+     loadFeatureListKVector() and before the catalog is shared, as a shared
+     catalog is not changed anymore.
+
+     \param filename SQLite-database file of the hip-catalog
+     \return unsigned Number of stars of the feature list missing in the catalog
+    */
+    unsigned loadStarCatalog(const std::string filename);
+
+    /*!
+     \brief Uses a loaded catalog, e.g. the one of another identifier
+
+     \param catalog
+    */
+    void setCatalog(const std::shared_ptr<const StarCatalog> &catalog);
+
+    /*!
+     \brief Returns the catalog to share it with other identifiers
+
+     \return std::shared_ptr<const StarCatalog>
+    */
+    std::shared_ptr<const StarCatalog> getCatalog() const { return mCatalog; }
+
+    /*!
+     \brief Returns if the inertial vectors are loaded (see loadStarCatalog())
+
+     \return bool
+    */
+    bool hasStarCatalog() const { return mCatalog->hasStarCatalog(); }
+
+    /*!
+     \brief Returns the catalog index of a star
+
+     \param hip hip-ID of the star
+     \return int Catalog index, -1 if the star is not in the feature list
+    */
+    int getCatalogIndex(int hip) const { return mCatalog->getCatalogIndex(hip); }
+
+    /*!
+     \brief Returns the inertial unit vector of a star
+
+     \param index Catalog index of the star (see getCatalogIndex())
+     \return const Eigen::Vector3f & Zero vector if the star is unknown to the hip-catalog
+    */
+    const Eigen::Vector3f & getInertialVector(int index) const { return mStarVectors[index]; }
+
+    /*!
+     \brief Finds the stars of the feature list within an angle of a direction
+
+     E.g. the stars expected in the field of view for an attitude, to predict
+     where the stars of a triad or of the tracked frame should be. Requires
+     loadStarCatalog().
+
+     \param center Inertial direction (unit vector), e.g. the boresight
+     \param radius Angle around center (in degree)
+     \param indices Output catalog indices of the stars (see getInertialVector())
+    */
+    void getStarsInCone(const Eigen::Vector3f &center, float radius, std::vector<int> &indices) const { getSkyIndex().coneQuery(center, radius, indices); }
+
+    /*!
+     \brief Returns the sky index of the inertial vectors (see loadStarCatalog())
+
+     \return const SkyIndex &
+    */
+    const SkyIndex & getSkyIndex() const { return mCatalog->getSkyIndex(); }
+
+    /*!
+     \brief Sets the number of threads used by PyramidKVectorParallel
+
+     \param nThreads Number of threads including the calling one, 0 uses
+            the number of cores, 1 runs PyramidKVectorParallel sequentially
+    */
+    void setNumThreads(unsigned nThreads);
+
+    /*!
+     \brief Returns the number of threads used by PyramidKVectorParallel
+
+     \return unsigned
+    */
+    unsigned getNumThreads() const { return mPool ? mPool->getNumThreads() : 1; }
+
+    /*!
+     \brief Sets the number of spots the triads of the pyramid methods are formed of
+
+     The number of triads grows cubically with the number of spots, and on
+     cluttered frames most of them contain noise spots. With a limit only the
+     n brightest spots (or the first n without brightness) are candidates for
+     the triads. The 4th star and all remaining spots are still searched among
+     all spots once a triad is found.
+
+     Applies to PyramidKVector and PyramidKVectorParallel.
+
+     \param n Number of candidates, at least 3, 0 uses all spots
+    */
+    void setMaxCandidates(unsigned n);
+
+    /*!
+     \brief Returns the number of spots the triads are formed of
+
+     \return unsigned 0 if all spots are used
+    */
+    unsigned getMaxCandidates() const { return mMaxCandidates; }
+
+    /*!
+     \brief Sets the tolerance of the magnitude check of the pyramid methods
+
+     If the brightness of the spots is given to identifyStars() and the star
+     catalog is loaded, the differences of the instrumental magnitudes
+     -2.5 log10(brightness) of the spots are compared with the differences of
+     the catalog magnitudes. Candidate pairs of a triad whose magnitude
+     difference deviates by more than the tolerance are dropped before the
+     matching, for the 4th star the sign of the difference is checked as
+     well. The brightness has to be proportional to the flux, and the
+     tolerance has to cover saturated spots, the spectral response and the
+     noise of faint spots.
+
+     Applies to PyramidKVector and PyramidKVectorParallel.
+
+     \param tolerance In magnitudes, e.g. 1.5, 0 disables the check (default)
+    */
+    void setMagnitudeTolerance(float tolerance);
+
+    /*!
+     \brief Returns the tolerance of the magnitude check
+
+     \return float 0 if the check is disabled
     */
-    void loadFeatureListKVector(const std::string filename);
+    float getMagnitudeTolerance() const { return mMagnitudeTolerance; }
 
     /*!
      \brief Identify the star using the specified identification method
@@ -91,12 +290,34 @@ public:
     */
     std::vector<int> identifyStars(const vectorList_t &starVectors, const float eps, IdentificationMethod method = PyramidKVector) const;
 
+    /*!
+     \brief Identify the star using the specified identification method
+
+     With PyramidKVector no memory is allocated once scratch and idList have
+     reached the required size, i.e. after the first call with the same
+     objects (as long as the number of spots does not grow).
+
+     \param starVectors Input Vectors extracted from an image
+     \param eps Allowed tolerance when comparing features (in degree)
+     \param idList Output vector of hip-IDs which correspond to the elements of starVectors
+     \param scratch Working memory which is reused between calls
+     \param method The method to use for identification
+     \param brightness If not NULL, brightness of each spot (e.g. Spot::flux) to select the candidates (see setMaxCandidates())
+    */
+    void identifyStars(const vectorList_t &starVectors, const float eps, std::vector<int> &idList,
+                       Scratch &scratch, IdentificationMethod method = PyramidKVector,
+                       const std::vector<float> *brightness = NULL) const;
+
 private:
 
     /*!
      \brief Star identification using the 2-star method
 
-     Uses the SQLite database for searching through the feature list
+     Uses the SQLite database for searching through the feature list. The
+     votes are counted in one array over the hip-IDs, which is reset after
+     each spot, so no memory is allocated once the buffers have grown. The
+     buffers are kept in the identifier, hence the SQL methods must not be
+     called concurrently.
 
      \param starVectors vector of star vectors
      \param eps the tolerance for feature matching in degrees
@@ -121,9 +342,153 @@ private:
 
      \param starVectors vector of star vectors
      \param eps the tolerance for feature matching in degrees
-     \return std::vector<int>
+     \param idList Output vector of hip-IDs
+     \param scratch Working memory for the filtered queries
+     \param brightness Brightness of each spot for the candidates (may be NULL)
+    */
+    void identifyPyramidMethodKVector(const vectorList_t& starVectors, const float eps,
+                                      std::vector<int> &idList, Scratch &scratch,
+                                      const std::vector<float> *brightness = NULL) const;
+
+    /*!
+     \brief Star identification using Pyramid method with the triads tested in parallel
+
+     The triads are tested in the same order as by identifyPyramidMethodKVector()
+     and distributed over the thread pool. As soon as a triad is confirmed, the
+     workers skip all triads which come later in the order. The result is the
+     one of the first confirmed triad in the order, hence it does not depend on
+     the scheduling. If no triad is confirmed, the result is the one of the last
+     triad in the order, the same as of identifyPyramidMethodKVector().
+
+     \param starVectors vector of star vectors
+     \param eps the tolerance for feature matching in degrees
+     \param idList Output vector of hip-IDs
+     \param brightness Brightness of each spot for the candidates (may be NULL)
+    */
+    void identifyPyramidMethodKVectorParallel(const vectorList_t& starVectors, const float eps,
+                                              std::vector<int> &idList,
+                                              const std::vector<float> *brightness = NULL) const;
+
+    /*!
+     \brief Selects the spots the triads are formed of
+
+     \param nSpots Number of spots
+     \param brightness Brightness of each spot (may be NULL)
+     \param candidates Output indices of the candidates, brightest first
+    */
+    void selectCandidates(unsigned nSpots, const std::vector<float> *brightness, std::vector<int> &candidates) const;
+
+    /*!
+     \brief Computes the instrumental magnitudes of the spots for the magnitude check
+
+     \param brightness Brightness of each spot (may be NULL)
+     \param magnitudes Output magnitude of each spot in tenths, NaN for spots without flux
+     \return bool False if the check is disabled or not possible
+    */
+    bool spotMagnitudes(const std::vector<float> *brightness, std::vector<float> &magnitudes) const;
+
+    /*!
+     \brief Returns if a feature may be the pair of two spots with the given magnitude difference
+
+     The order of the spots in the feature is unknown, hence the absolute
+     differences are compared.
+
+     \param a Catalog index of the first star
+     \param b Catalog index of the second star
+     \param spotDifference Absolute difference of the spot magnitudes (in tenths, NaN always matches)
+     \return bool
+    */
+    bool matchesMagnitudes(int a, int b, float spotDifference) const
+    {
+        if(mStarMagnitudes[a] == StarCatalog::MAGNITUDE_UNKNOWN || mStarMagnitudes[b] == StarCatalog::MAGNITUDE_UNKNOWN)
+            return true;
+        const float difference = std::abs(mStarMagnitudes[a] - mStarMagnitudes[b]);
+        return !(std::fabs(difference - spotDifference) > 10.0f * mMagnitudeTolerance);
+    }
+
+    /*!
+     \brief Returns if a star may be a spot with the given magnitude relative to an identified star
+
+     \param star Catalog index of the candidate
+     \param reference Catalog index of the identified star
+     \param spotDifference Magnitude of the spot of the candidate minus the one of the identified star (in tenths, NaN always matches)
+     \return bool
+    */
+    bool matchesMagnitude(int star, int reference, float spotDifference) const
+    {
+        if(mStarMagnitudes[star] == StarCatalog::MAGNITUDE_UNKNOWN || mStarMagnitudes[reference] == StarCatalog::MAGNITUDE_UNKNOWN)
+            return true;
+        const float difference = mStarMagnitudes[star] - mStarMagnitudes[reference];
+        return !(std::fabs(difference - spotDifference) > 10.0f * mMagnitudeTolerance);
+    }
+
+    /*!
+     \brief Tests a single triad of the pyramid method and identifies the remaining spots
+
+     If the star catalog is loaded, the attitude of a unique triad is computed
+     (see triadAttitude()) and each remaining spot is identified with the star
+     at its predicted position within twice the tolerance, found in the sky
+     index. Spots with no or several stars at the position, or all spots
+     without star catalog, are searched with the k-vector queries of the 4th
+     star, since the error of the attitude grows with a short baseline of the
+     triad and may exceed the radius.
+
+     \param starVectors vector of star vectors
+     \param i Index of the first spot of the triad
+     \param j Index of the second spot of the triad
+     \param k Index of the third spot of the triad
+     \param cosEps Cosine of the tolerance
+     \param sinEps Sine of the tolerance
+     \param magnitudes Spot magnitudes for the magnitude check (see spotMagnitudes()), NULL to disable it
+     \param idList Output vector of catalog indices (-1 where no star was found)
+     \param scratch Working memory
+     \return bool True if the triad was confirmed by at least one 4th star
+    */
+    bool identifyTriadKVector(const vectorList_t& starVectors, int i, int j, int k, float cosEps, float sinEps,
+                              const float *magnitudes, std::vector<int> &idList, Scratch &scratch) const;
+
+    /*!
+     \brief Computes the attitude of an identified triad for the verification (TRIAD method)
+
+     \param starVectors vector of star vectors
+     \param i Index of the first spot of the triad
+     \param j Index of the second spot of the triad
+     \param k Index of the third spot of the triad
+     \param hipI Catalog index of the first star
+     \param hipJ Catalog index of the second star
+     \param hipK Catalog index of the third star
+     \param cosRadius Cosine of the largest distance of the third star from its predicted position
+     \param sinRadius Sine of the largest distance of the third star from its predicted position
+     \param attitude Output rotation from the inertial frame into the camera frame
+     \return bool False without inertial vectors of the stars or if the third star contradicts the attitude,
+                  then the prediction is not used
+    */
+    bool triadAttitude(const vectorList_t& starVectors, int i, int j, int k, int hipI, int hipJ, int hipK,
+                       float cosRadius, float sinRadius, Eigen::Matrix3f &attitude) const;
+
+    /*!
+     \brief Identifies a spot with the star at its position predicted by the attitude
+
+     \param attitude Rotation from the inertial frame into the camera frame (see triadAttitude())
+     \param spot Vector of the spot
+     \param hipI Catalog index of the first star of the triad
+     \param hipJ Catalog index of the second star of the triad
+     \param hipK Catalog index of the third star of the triad
+     \param cosRadius Cosine of the largest distance of the star from the predicted position
+     \param sinRadius Sine of the largest distance of the star from the predicted position
+     \param magnitude Magnitude of the spot minus the one of the first spot of the triad (in tenths), NaN disables the magnitude check
+     \param scratch Working memory
+     \return int Catalog index of the star, PREDICTION_NONE if no star or PREDICTION_AMBIGUOUS if several stars are at the position
+    */
+    int predictStar(const Eigen::Matrix3f &attitude, const Eigen::Vector3f &spot, int hipI, int hipJ, int hipK,
+                    float cosRadius, float sinRadius, float magnitude, Scratch &scratch) const;
+
+    /*!
+     \brief Translates the catalog indices of idList into hip-IDs
+
+     \param idList
     */
-    std::vector<int> identifyPyramidMethodKVector(const vectorList_t& starVectors, const float eps=1e-2) const;
+    void catalogIndexToHip(std::vector<int> &idList) const;
 
     /*!
      \brief Create a list of all unique features between the stars in starVectors
@@ -135,39 +500,162 @@ private:
                             featureList_t &output) const;
 
     /*!
-     \brief Run an SQL-statement and read the results into a featureList_t object
+     \brief Finds the features of the database within theta +- eps of each feature
+
+     The intervals are written into a temporary table (in one transaction)
+     and joined with the feature list, which uses the index on theta, so a
+     single query is run for all features of a frame.
+
+     \param features Features measured between the spots (theta in degree)
+     \param eps Tolerance (in degree)
+     \param matches Output features of the database (hip-IDs) for each feature
+    */
+    void queryFeatureIntervals(const featureList_t &features, const float eps, std::vector<featureList_t> &matches) const;
+
+    /*!
+     \brief Adds a vote for a star to the counters of the current spot of the 2-star method
+
+     \param hip hip-ID of the star
+    */
+    void castVote(int hip) const
+    {
+        if((unsigned) hip >= mVotes.size())
+            mVotes.resize(hip + 1, 0);
+        if(mVotes[hip]++ == 0)
+            mVoted.push_back(hip);
+    }
+
+    /*!
+     \brief Returns the star with the most votes and resets the counters
+
+     \return int hip-ID of the star, -1 if there were no votes or several stars have the most votes
+    */
+    int countVotes() const;
+
+    /*!
+     \brief Selects the features which contain a star
+
+     \param features
+     \param hip hip-ID of the star
+     \param output Features containing hip
+    */
+    static void selectFeatures(const featureList_t &features, int hip, featureList_t &output);
+
+    /*!
+     \brief Returns the position of the feature between spot i and j in the list of createFeatureList2()
+
+     \param i Index of a spot
+     \param j Index of another spot
+     \param nSpots Number of spots
+     \return int
+    */
+    static int pairIndex(int i, int j, int nSpots)
+    {
+        if(i > j)
+            std::swap(i, j);
+        return i * nSpots - i * (i + 1) / 2 + (j - i - 1);
+    }
+
+    /*!
+     \brief Finalizes the statements and closes the database
+    */
+    void closeDb();
+
+    /*!
+     \brief Computes the interval of cos(theta) which corresponds to theta +- eps
+
+     Uses cos(theta +- eps) = cos(theta)cos(eps) -+ sin(theta)sin(eps), hence
+     no transcendental function has to be evaluated per query.
 
-     \param sqlStmt SQL-statement to evaluate
-     \param output FeatureList containing all possible pairs which match
+     \param cosTheta Cosine of the measured angle (dot product of two unit vectors)
+     \param cosEps Cosine of the tolerance
+     \param sinEps Sine of the tolerance
+     \param cosMin Lower bound of the interval
+     \param cosMax Upper bound of the interval
     */
-    void retrieveFeatureList(sqlite3_stmt *sqlStmt, StarIdentifier::featureList_t &output) const;
+    static void cosineInterval(float cosTheta, float cosEps, float sinEps, float &cosMin, float &cosMax);
 
     /*!
-     \brief Get all features which are within thetaMin and thetaMax
+     \brief Get all features whose cos(theta) is within cosMin and cosMax
 
-     \param thetaMin Minimum angle between two stars
-     \param thetaMax Maximum angle between two stars
-     \param output FeatureList containing all possible pairs that match
+     The k-vector gives the buckets containing the interval, their ends are
+     trimmed with a binary search on mCosTheta, hence the range contains
+     exactly the matching features. Intervals outside of the catalog (or
+     empty or NaN bounds) give an empty range.
+
+     \param cosMin Minimum cosine of the angle between two stars
+     \param cosMax Maximum cosine of the angle between two stars
+     \return IndexRange Range of possible pairs in the catalog arrays (mId1, mId2, mTheta)
     */
-    void retrieveFeatureListKVector(float thetaMin, float thetaMax, StarIdentifier::featureList_t &output) const;
+    IndexRange retrieveFeatureRangeKVector(float cosMin, float cosMax) const;
 
     /*!
-     \brief Get all features which are within thetaMin and thetaMax and contain hip
+     \brief Get all features whose cos(theta) is within cosMin and cosMax and which contain star
+
+     The indices of the matching features are appended to the arena of scratch.
 
-     \param thetaMin Minimum angle between two stars
-     \param thetaMax Maximum angle between two stars
-     \param hip hip-ID which has to match one star in pair
-     \param output FeatureList containing all possible pairs that match
+     \param cosMin Minimum cosine of the angle between two stars
+     \param cosMax Maximum cosine of the angle between two stars
+     \param star Catalog index which has to match one star in pair
+     \param scratch Arena receiving the feature indices
+     \return IndexRange Range of the matching feature indices in the arena
     */
-    void retrieveFeatureListKVector(float thetaMin, float thetaMax, int hip, StarIdentifier::featureList_t &output) const;
+    IndexRange retrieveFeatureRangeKVector(float cosMin, float cosMax, int star, Scratch &scratch) const;
 
     std::string mDbFile; /*!< Filename of the database file */
     sqlite3 * mDb; /*!< SQLite database handle*/
     bool mOpenDb; /*!< Database is opened or closed*/
-    std::vector<Feature2>  mFeatureList; /*!< Sorted feature list for k-Vector technique*/
-    std::vector<int> mKVector; /*!< k-Vector for k-Vector technique*/
+    sqlite3_stmt * mIntervalClear; /*!< Clears the table of search intervals*/
+    sqlite3_stmt * mIntervalInsert; /*!< Inserts a search interval*/
+    sqlite3_stmt * mIntervalQuery; /*!< Joins the search intervals with the feature list*/
+    mutable featureList_t mSqlFeatures; /*!< Features between the spots of the SQL methods*/
+    mutable std::vector<featureList_t> mSqlMatches; /*!< Candidates of each feature of the SQL methods*/
+    mutable std::vector<uint32_t> mVotes; /*!< Votes of the current spot for each hip-ID (2-star method)*/
+    mutable std::vector<int> mVoted; /*!< hip-IDs with votes of the current spot*/
+    std::shared_ptr<const StarCatalog> mCatalog; /*!< Feature list and star vectors (never NULL)*/
+    std::shared_ptr<StarCatalog> mOwnCatalog; /*!< mCatalog if it was loaded by this identifier (for loadStarCatalog())*/
+
+    // views of the arrays of mCatalog (see updateCatalogViews()), which are used in the inner loops
+    const int32_t * mStarHip; /*!< hip-ID of each catalog index (ascending)*/
+    uint32_t mStarCount; /*!< Number of stars in the catalog*/
+    const int32_t * mKVectorData; /*!< k-Vector over mCosTheta*/
+    const float * mCosTheta; /*!< cos(theta) of each feature (ascending)*/
+    const float * mTheta; /*!< theta (in degree) of each feature*/
+    const catalogIndex_t * mId1; /*!< Catalog index of the first star of each feature*/
+    const catalogIndex_t * mId2; /*!< Catalog index of the second star of each feature*/
+    uint32_t mFeatureCount; /*!< Number of features*/
+    uint32_t mMaxStarFeatures; /*!< Largest number of features a single star is part of*/
+    unsigned mMaxCandidates; /*!< Number of spots the triads are formed of (0 for all)*/
+    const Eigen::Vector3f * mStarVectors; /*!< Inertial unit vector of each catalog index (NULL without star catalog)*/
+    const int8_t * mStarMagnitudes; /*!< Magnitude of each catalog index in tenths (NULL without star catalog)*/
     double mQ; /*!< Parameter q for k-Vector technique*/
     double mM; /*!< Parameter m for k-Vector technique*/
+    float mMagnitudeTolerance; /*!< Tolerance of the magnitude check (0 if disabled)*/
+    static const int PREDICTION_NONE = -1; /*!< predictStar() found no star*/
+    static const int PREDICTION_AMBIGUOUS = -2; /*!< predictStar() found several stars*/
+
+    /*!
+     \brief State of one worker of the parallel identification
+    */
+    struct WorkerState
+    {
+        unsigned triad; /*!< Position of the confirmed triad in the order (or number of triads if none)*/
+        unsigned last; /*!< Position of the last triad tested (or number of triads if none)*/
+        std::vector<int> idList; /*!< Result of the confirmed triad, or else of the last triad tested*/
+        Scratch scratch; /*!< Working memory of the worker*/
+    };
+
+    std::unique_ptr<ThreadPool> mPool; /*!< Workers of PyramidKVectorParallel (NULL if sequential)*/
+    mutable std::mutex mParallelMutex; /*!< Protects the state of the parallel identification*/
+    mutable std::vector<WorkerState> mWorkers; /*!< State of each worker*/
+    mutable std::vector<Eigen::Vector3i> mTriads; /*!< Triads in the order in which they are tested*/
+    mutable std::vector<int> mCandidates; /*!< Spots the triads of the parallel identification are formed of*/
+    mutable std::vector<float> mSpotMagnitudes; /*!< Spot magnitudes of the parallel identification*/
+
+    /*!
+     \brief Sets the views of the catalog arrays to the ones of mCatalog
+    */
+    void updateCatalogViews();
 };
 
 #endif // STARCAMERA_H
@@ -0,0 +1,146 @@
+#ifndef STRIP_LABELLER_H
+#define STRIP_LABELLER_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "runlabeller.h"
+#include "threadpool.h"
+
+/*!
+ \brief Connected component labelling of horizontal strips in parallel
+
+ The image is split into one strip of rows per thread and every strip is
+ labelled by its own RunLabeller on a persistent ThreadPool. Blobs crossing
+ a seam are then joined with a union-find over the blobs of all strips,
+ using the runs in the last row of a strip and in the first row of the next
+ one. As the moments are integer sums and the blobs are reported in raster
+ order of their first pixel, the result is identical to RunLabeller.
+*/
+class StripLabeller
+{
+public:
+    /*!
+     \brief Constructor
+
+     \param nThreads Number of threads including the calling one, 0 uses the number of cores
+    */
+    explicit StripLabeller(unsigned nThreads = 0);
+
+    /*!
+     \brief Sets which neighbours of a pixel are connected (see RunLabeller::setConnectivity())
+
+     \param connectivity 4 or 8
+    */
+    void setConnectivity(unsigned connectivity);
+
+    /*!
+     \brief Sets defective pixels which are background (see RunLabeller::setDefectMap())
+
+     \param defects Defects of the full image, NULL to label all pixels
+    */
+    void setDefectMap(const DefectMap *defects);
+
+    /*!
+     \brief Returns which neighbours of a pixel are connected
+
+     \return unsigned 4 or 8
+    */
+    unsigned getConnectivity() const { return mStrips[0].getConnectivity(); }
+
+    /*!
+     \brief Labels all pixels greater than threshold (see RunLabeller::label())
+
+     \param image First pixel of the image
+     \param rows Number of rows
+     \param cols Number of columns
+     \param stride Distance between two rows (in pixels)
+     \param threshold Pixels which are not greater than threshold are background
+     \return unsigned Number of blobs
+    */
+    template<typename T>
+    unsigned label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride, const T threshold);
+
+    /*!
+     \brief Labels all pixels greater than the threshold of their tile (see RunLabeller::label())
+
+     \param image First pixel of the image
+     \param rows Number of rows
+     \param cols Number of columns
+     \param stride Distance between two rows (in pixels)
+     \param thresholdRows For each band of tileSize rows a threshold per column
+     \param tileSize Number of rows of a band
+     \return unsigned Number of blobs
+    */
+    template<typename T>
+    unsigned label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                   const T *thresholdRows, const unsigned tileSize);
+
+    /*!
+     \brief Returns the number of threads including the calling one
+
+     \return unsigned
+    */
+    unsigned getNumThreads() const { return mPool.getNumThreads(); }
+
+    /*!
+     \brief Returns the workers of the labelling, e.g. to process the blobs in parallel afterwards
+
+     \return ThreadPool &
+    */
+    ThreadPool & getThreadPool() { return mPool; }
+
+    /*!
+     \brief Returns the number of blobs found by the last call of label()
+
+     \return unsigned
+    */
+    unsigned getBlobCount() const { return mBlobs.size(); }
+
+    /*!
+     \brief Returns the moments of a blob
+
+     \param index Blob in raster order (0 to getBlobCount()-1)
+     \return const BlobMoments &
+    */
+    const BlobMoments & getBlob(unsigned index) const { return mBlobs[index]; }
+
+private:
+    /*!
+     \brief Labels the strips in parallel and joins them
+
+     \param rows Number of rows of the image
+     \param labelStrip Called as labelStrip(labeller, begin, end) to label rows [begin, end)
+     \return unsigned Number of blobs
+    */
+    template<typename LabelStrip>
+    unsigned labelStrips(const unsigned rows, const LabelStrip &labelStrip);
+
+    /*!
+     \brief Joins the blobs touching the seam between two strips
+
+     \param upper Strip above the seam
+     \param lower Strip below the seam
+     \param upperOffset Global index of the first blob of upper
+     \param lowerOffset Global index of the first blob of lower
+    */
+    void stitch(const RunLabeller &upper, const RunLabeller &lower, unsigned upperOffset, unsigned lowerOffset);
+
+    /*!
+     \brief Returns the root of a global blob index and compresses the path
+
+     \param blob
+     \return unsigned
+    */
+    unsigned find(unsigned blob);
+
+    ThreadPool mPool; /*!< Workers labelling the strips*/
+    std::vector<RunLabeller> mStrips; /*!< Labeller of each strip*/
+    std::vector<unsigned> mOffset; /*!< Global index of the first blob of each strip*/
+    std::vector<unsigned> mParent; /*!< Union-find parent of each global blob index*/
+    std::vector<unsigned> mOutput; /*!< Index in mBlobs of each root*/
+    std::vector<BlobMoments> mBlobs; /*!< Joined blobs in raster order*/
+};
+
+#endif // STRIP_LABELLER_H
@@ -0,0 +1,95 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+/*!
+ \brief Fixed set of worker threads for data parallel loops
+
+ The threads are created once and wait for work, so running a parallel loop
+ does not create threads. The calling thread takes part as worker 0.
+*/
+class ThreadPool
+{
+public:
+    /*!
+     \brief Typedef for the body of a parallel loop
+
+     Called with the index of the iteration and the number of the worker
+     (0 ... getNumThreads()-1) which executes it.
+    */
+    typedef std::function<void (unsigned index, unsigned worker)> Task;
+
+    /*!
+     \brief Constructor
+
+     \param nThreads Number of threads including the calling thread, 0 uses the number of cores
+    */
+    explicit ThreadPool(unsigned nThreads = 0);
+
+    /*!
+     \brief Destructor, stops all workers
+    */
+    ~ThreadPool();
+
+    /*!
+     \brief Returns the number of threads including the calling thread
+
+     \return unsigned
+    */
+    unsigned getNumThreads() const { return mThreads.size() + 1; }
+
+    /*!
+     \brief Runs task for every index in [0, n) and waits until all are done
+
+     The indices are handed out in ascending order, each worker takes the
+     next one as soon as it is done with the previous one. If a task throws,
+     the remaining indices are still processed and the first exception is
+     rethrown in the calling thread. Calls from different threads are
+     serialized.
+
+     \param n Number of iterations
+     \param task Body of the loop
+    */
+    void parallelFor(unsigned n, const Task &task);
+
+private:
+    ThreadPool(const ThreadPool &);
+    ThreadPool & operator=(const ThreadPool &);
+
+    /*!
+     \brief Main loop of the background threads
+
+     \param worker Number of the worker
+    */
+    void workerLoop(unsigned worker);
+
+    /*!
+     \brief Processes indices of the current loop until none are left
+
+     \param worker Number of the worker
+    */
+    void work(unsigned worker);
+
+    std::vector<std::thread> mThreads; /*!< Background workers*/
+    std::mutex mRunMutex; /*!< Serializes calls of parallelFor()*/
+    std::mutex mMutex; /*!< Protects the state of the current loop*/
+    std::condition_variable mStartCond; /*!< Signals the workers a new loop*/
+    std::condition_variable mDoneCond; /*!< Signals the caller that a worker finished*/
+
+    const Task * mTask; /*!< Body of the current loop*/
+    unsigned mCount; /*!< Number of iterations of the current loop*/
+    std::atomic<unsigned> mNext; /*!< Next index to hand out*/
+    unsigned mGeneration; /*!< Incremented for every loop*/
+    unsigned mBusy; /*!< Number of background workers still in the current loop*/
+    bool mShutdown; /*!< Request to stop the workers*/
+    std::exception_ptr mError; /*!< First exception thrown by a task*/
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,130 @@
+#ifndef TRACKING_IDENTIFIER_H
+#define TRACKING_IDENTIFIER_H
+
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "starid.h"
+
+/*!
+ \brief Star identification for a continuous sequence of frames (recursive mode)
+
+ Keeps the identified spots of the previous frame and predicts their
+ position in the new frame with the rotation between the last two frames
+ (constant angular rate). Each new spot is matched to the closest predicted
+ star within the search radius, only mutual nearest neighbours are accepted.
+ This costs O(n*m) dot products for n spots and m tracked stars instead of a
+ search through the catalog.
+
+ If fewer than the minimum number of stars can be tracked, the frame is
+ identified with StarIdentifier::PyramidKVector (lost-in-space) and tracking
+ restarts from that result. Spots which enter the field of view while
+ tracking are not identified until the next lost-in-space identification.
+*/
+class TrackingIdentifier
+{
+public:
+    /*!
+     \brief Constructor
+
+     \param identifier Identifier used when tracking is lost, the feature list has to be loaded
+    */
+    explicit TrackingIdentifier(const StarIdentifier &identifier);
+
+    /*!
+     \brief Sets the tolerance for the lost-in-space identification
+
+     \param eps Allowed tolerance when comparing features (in degree)
+    */
+    void setEpsilon(float eps) { mEps = eps; }
+
+    /*!
+     \brief Sets the maximum angle between a predicted star and a spot
+
+     \param radius Search radius (in degree)
+    */
+    void setSearchRadius(float radius);
+
+    /*!
+     \brief Sets the number of stars which have to be tracked, otherwise tracking is lost
+
+     \param n At least 2, as the rotation between frames can not be determined otherwise
+    */
+    void setMinTrackedStars(unsigned n);
+
+    /*!
+     \brief Forgets the previous frame, the next identification is lost-in-space
+    */
+    void reset();
+
+    /*!
+     \brief Identifies the spots of the next frame
+
+     \param starVectors Input Vectors extracted from the image
+     \param idList Output vector of hip-IDs which correspond to the elements of starVectors
+     \param brightness If not NULL, brightness of each spot for the lost-in-space candidates
+            (see StarIdentifier::setMaxCandidates())
+    */
+    void identifyStars(const StarIdentifier::vectorList_t &starVectors, std::vector<int> &idList,
+                       const std::vector<float> *brightness = NULL);
+
+    /*!
+     \brief Returns if the last frame was identified by tracking
+
+     \return bool
+    */
+    bool isTracking() const { return mTracking; }
+
+    /*!
+     \brief Returns the number of frames identified by tracking since the last reset()
+
+     \return unsigned
+    */
+    unsigned getTrackedFrames() const { return mTrackedFrames; }
+
+    /*!
+     \brief Returns the number of lost-in-space identifications since the last reset()
+
+     \return unsigned
+    */
+    unsigned getLostInSpaceFrames() const { return mLostInSpaceFrames; }
+
+private:
+    /*!
+     \brief Matches the spots to the predicted stars of the previous frame
+
+     \param starVectors Input Vectors extracted from the image
+     \param idList Output vector of hip-IDs
+     \return unsigned Number of matched spots
+    */
+    unsigned track(const StarIdentifier::vectorList_t &starVectors, std::vector<int> &idList);
+
+    /*!
+     \brief Stores the frame as previous one and estimates the rotation since the last frame
+
+     \param starVectors
+     \param idList
+    */
+    void update(const StarIdentifier::vectorList_t &starVectors, const std::vector<int> &idList);
+
+    const StarIdentifier & mIdentifier; /*!< Identifier for the lost-in-space case*/
+    StarIdentifier::Scratch mScratch; /*!< Working memory of mIdentifier*/
+    float mEps; /*!< Tolerance for the lost-in-space identification*/
+    float mCosRadius; /*!< Cosine of the search radius*/
+    unsigned mMinTracked; /*!< Minimum number of tracked stars*/
+
+    StarIdentifier::vectorList_t mPrevVectors; /*!< Normalized vectors of the identified spots of the previous frame*/
+    std::vector<int> mPrevIds; /*!< hip-IDs of mPrevVectors*/
+    Eigen::Matrix3f mRate; /*!< Rotation from the frame before the previous one to the previous one*/
+    bool mTracking; /*!< The last frame was identified by tracking*/
+    unsigned mTrackedFrames; /*!< Number of frames identified by tracking*/
+    unsigned mLostInSpaceFrames; /*!< Number of lost-in-space identifications*/
+
+    StarIdentifier::vectorList_t mPredicted; /*!< Predicted vectors of the stars of the previous frame*/
+    std::vector<int> mSpotMatch; /*!< Closest predicted star of each spot (-1 if none)*/
+    std::vector<int> mStarMatch; /*!< Closest spot of each predicted star (-1 if none)*/
+    std::vector<float> mStarDot; /*!< Dot product of each predicted star with its closest spot*/
+};
+
+#endif // TRACKING_IDENTIFIER_H
@@ -0,0 +1,226 @@
+#ifndef TRIAD_MATCHER_H
+#define TRIAD_MATCHER_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+/*!
+ \brief Matches candidate star pairs to triads and confirms 4th stars
+
+ The candidate pairs of the pyramid method are indexed by star id in flat
+ open addressing hash tables, hence finding all triads (i, j, k) with
+ {i, j} in IJ, {i, k} in IK and {j, k} in JK takes
+ O(|IJ| * d + |IK| + |JK|) (with d the number of IK pairs per star) instead
+ of O(|IJ| * |IK| * |JK|) for nested loops. The same holds for the
+ confirmation of a 4th star, which becomes linear in the number of candidates.
+
+ Usage for a triad:
+    beginTriads(nIK, nJK);
+    addIK(...), addJK(...) for every candidate pair
+    matchIJ(...) for every candidate pair of IJ
+    getTriadCount(), getTriad()
+
+ Usage for a 4th star r:
+    beginFourth(nJR, nKR);
+    addJR(...), addKR(...) for the partner of i/j in every candidate pair
+    matchIR(...) for the partner of k in every candidate pair
+    getFourthCount(), getFourth()
+
+ The memory of the tables is reused, so once it has grown to the required
+ size no further allocation takes place.
+*/
+class TriadMatcher
+{
+public:
+    /*!
+     \brief Constructor
+    */
+    TriadMatcher();
+
+    /*!
+     \brief Starts a new triad search
+
+     \param nIK Number of IK pairs which will be added
+     \param nJK Number of JK pairs which will be added
+    */
+    void beginTriads(std::size_t nIK, std::size_t nJK);
+
+    /*!
+     \brief Adds a candidate pair for the feature between star i and k
+
+     \param a
+     \param b
+    */
+    void addIK(int a, int b);
+
+    /*!
+     \brief Adds a candidate pair for the feature between star j and k
+
+     \param a
+     \param b
+    */
+    void addJK(int a, int b);
+
+    /*!
+     \brief Finds all triads which contain the candidate pair for the feature between star i and j
+
+     \param a
+     \param b
+    */
+    void matchIJ(int a, int b);
+
+    /*!
+     \brief Returns the number of triads found since beginTriads()
+
+     \return unsigned
+    */
+    unsigned getTriadCount() const { return mTriadCount; }
+
+    /*!
+     \brief Returns the last triad found
+
+     \param i Star matching spot i
+     \param j Star matching spot j
+     \param k Star matching spot k
+    */
+    void getTriad(int &i, int &j, int &k) const { i = mTriadI; j = mTriadJ; k = mTriadK; }
+
+    /*!
+     \brief Starts a new search for a 4th star
+
+     \param nJR Number of JR candidates which will be added
+     \param nKR Number of KR candidates which will be added
+    */
+    void beginFourth(std::size_t nJR, std::size_t nKR);
+
+    /*!
+     \brief Adds the partner of star j in a candidate pair for the feature between j and r
+
+     \param star
+    */
+    void addJR(int star);
+
+    /*!
+     \brief Adds the partner of star k in a candidate pair for the feature between k and r
+
+     \param star
+    */
+    void addKR(int star);
+
+    /*!
+     \brief Checks the partner of star i in a candidate pair for the feature between i and r
+
+     \param star
+    */
+    void matchIR(int star);
+
+    /*!
+     \brief Returns the number of matching 4th stars found since beginFourth()
+
+     \return unsigned
+    */
+    unsigned getFourthCount() const { return mFourthCount; }
+
+    /*!
+     \brief Returns the last matching 4th star
+
+     \return int
+    */
+    int getFourth() const { return mFourth; }
+
+private:
+    /*!
+     \brief Flat open addressing hash table with linear probing
+
+     Keys are 64-bit, the value of each slot is an int.
+    */
+    class FlatTable
+    {
+    public:
+        /*!
+         \brief Removes all elements and resizes the table for n elements
+
+         \param n Maximum number of elements
+        */
+        void reset(std::size_t n);
+
+        /*!
+         \brief Returns the slot of key, inserting it if it is not present
+
+         New slots have the value -1.
+
+         \param key
+         \return std::size_t
+        */
+        std::size_t insert(uint64_t key);
+
+        /*!
+         \brief Returns the slot of key
+
+         \param key
+         \return std::ptrdiff_t -1 if key is not in the table
+        */
+        std::ptrdiff_t find(uint64_t key) const;
+
+        /*!
+         \brief Returns the value stored in slot
+
+         \param slot
+         \return int &
+        */
+        int & value(std::size_t slot) { return mValues[slot]; }
+
+    private:
+        std::size_t slotOf(uint64_t key) const;
+
+        std::vector<uint64_t> mKeys; /*!< Key of each slot (EMPTY if unused)*/
+        std::vector<int> mValues; /*!< Value of each slot*/
+        std::size_t mMask; /*!< Number of slots - 1*/
+    };
+
+    /*!
+     \brief Returns the key of a single star
+
+     \param star
+     \return uint64_t
+    */
+    static uint64_t starKey(int star) { return (uint32_t) star; }
+
+    /*!
+     \brief Returns the key of an unordered pair of stars
+
+     \param a
+     \param b
+     \return uint64_t
+    */
+    static uint64_t pairKey(int a, int b)
+    {
+        return a < b ? ((uint64_t) (uint32_t) a << 32) | (uint32_t) b
+                     : ((uint64_t) (uint32_t) b << 32) | (uint32_t) a;
+    }
+
+    /*!
+     \brief Counts all triads with star i and j, where star k is taken from the IK adjacency of i
+
+     \param i
+     \param j
+    */
+    void matchOrientation(int i, int j);
+
+    void addNeighbour(int star, int neighbour);
+
+    FlatTable mIKHeads; /*!< Star -> first node in the IK adjacency*/
+    std::vector<int> mNodeStar; /*!< Neighbour stored in each adjacency node*/
+    std::vector<int> mNodeNext; /*!< Next node of the same star (-1 at the end)*/
+    FlatTable mJKPairs; /*!< Set of all JK pairs*/
+    unsigned mTriadCount; /*!< Number of triads found*/
+    int mTriadI, mTriadJ, mTriadK; /*!< Last triad found*/
+
+    FlatTable mJRStars; /*!< Set of all candidates for r from JR*/
+    FlatTable mKRStars; /*!< Set of all candidates for r from KR*/
+    unsigned mFourthCount; /*!< Number of matching 4th stars*/
+    int mFourth; /*!< Last matching 4th star*/
+};
+
+#endif // TRIAD_MATCHER_H
@@ -1,6 +1,7 @@
 #!/bin/python
 
 import sqlite3
+import struct
 
 import numpy as np
 
@@ -42,4 +43,49 @@ for i in range(1, len(stars)):
     # format as k hip1 hip2 theta
     
     s = repr(j) + '\t' + repr(stars[i][0]) + '\t' + repr(stars[i][1]) + '\t' + repr(stars[i][2]) + '\n'
-    outFile.write(s)
\ No newline at end of file
+    outFile.write(s)
+    k.append(j)
+
+outFile.close()
+
+# binary version of the same data which can be memory mapped by the StarIdentifier
+# (see include/kvectorfile.h for the layout, has to match buildKVectorImage())
+KVECTOR_FILE_VERSION = 2
+FLT_EPSILON = float(np.finfo(np.float32).eps)
+
+# star table: hip-IDs in ascending order, the position is the catalog index
+hip = np.unique([star[0] for star in stars] + [star[1] for star in stars]).astype('<i4')
+if len(hip) > 65535:
+    raise ValueError('Too many stars for 16-bit catalog indices')
+
+# features sorted by ascending cos(theta)
+theta = np.array([star[2] for star in stars], dtype='<f4')
+cosTheta = np.cos(np.radians(theta.astype(np.float64))).astype('<f4')
+order = np.argsort(cosTheta, kind='mergesort')
+theta = theta[order]
+cosTheta = cosTheta[order]
+id1 = np.searchsorted(hip, np.array([star[0] for star in stars])[order]).astype('<u2')
+id2 = np.searchsorted(hip, np.array([star[1] for star in stars])[order]).astype('<u2')
+
+# k-vector over cos(theta): k(i) = number of features with cosTheta <= m*i + q
+n = len(stars)
+cmin = float(cosTheta[0])
+cmax = float(cosTheta[-1])
+mCos = (cmax - cmin + 2 * FLT_EPSILON) / (n - 1)
+qCos = cmin - FLT_EPSILON
+z = mCos * np.arange(n, dtype=np.float64) + qCos
+kVector = np.searchsorted(cosTheta.astype(np.float64), z, side='right').astype('<i4')
+
+data = hip.tobytes() + kVector.tobytes() + cosTheta.tobytes() + theta.tobytes() + id1.tobytes() + id2.tobytes()
+
+# checksum: a = sum(w[i]), b = sum((n-i) * w[i]) over 32-bit words (modulo 2^32), a XOR b
+words = np.frombuffer(data, dtype='<u4').astype(np.uint64)
+nWords = len(words)
+a = int(words.sum()) & 0xFFFFFFFF
+b = int((words * np.arange(nWords, 0, -1, dtype=np.uint64)).sum()) & 0xFFFFFFFF
+checksum = a ^ b
+
+binFile = open("kVector.bin", 'wb')
+binFile.write(struct.pack('<4sIddIIII', b'SCKV', KVECTOR_FILE_VERSION, qCos, mCos, n, len(hip), checksum, 0))
+binFile.write(data)
+binFile.close()
@@ -1,19 +1,51 @@
 #include <stdexcept>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 using std::endl;
 using std::cout;
 
 #include "aptina.h"
+#include "getTime.h"
+#include "instrumentation.h"
+
+namespace
+{
+// MT9P031 registers
+const ap_u32 REG_ROW_START = 0x01;
+const ap_u32 REG_COLUMN_START = 0x02;
+const ap_u32 REG_ROW_SIZE = 0x03;
+const ap_u32 REG_COLUMN_SIZE = 0x04;
+const ap_u32 REG_SHUTTER_WIDTH_UPPER = 0x08;
+const ap_u32 REG_SHUTTER_WIDTH_LOWER = 0x09;
+const ap_u32 REG_ROW_ADDRESS_MODE = 0x22;
+const ap_u32 REG_COLUMN_ADDRESS_MODE = 0x23;
+
+// offset of the first active pixel (default of row and column start)
+const unsigned ACTIVE_ROW_OFFSET = 54;
+const unsigned ACTIVE_COLUMN_OFFSET = 16;
+}
 
 Aptina::Aptina()
-    :mHandle(NULL), mWidth(0), mHeight(0)
+    :mHandle(NULL), mWidth(0), mHeight(0), mBufferSize(0), mImageBuf(NULL),
+      mRowStart(0), mColStart(0), mWindowHeight(SENSOR_HEIGHT), mWindowWidth(SENSOR_WIDTH),
+      mSubsampling(1), mBinning(false), mExposure(0),
+      mCapturing(false), mDroppedFrames(0), mHeldFrames(0)
 {
 }
 
 Aptina::~Aptina()
 {
+    stopCapture();
+
+    for(std::vector<uint8_t*>::iterator it = mRing.begin(); it != mRing.end(); ++it)
+        delete [] *it;
+
     delete [] mImageBuf;
-    ap_Finalize();
+
+    // instances which were never initialized (e.g. of an offline Pipeline) must not finalize the library
+    if(mHandle)
+        ap_Finalize();
 }
 
 
@@ -44,7 +76,124 @@ void Aptina::initialize(const std::string initFile)
 
     mBufferSize = ap_GrabFrame(mHandle, NULL, 0);
 
+    delete [] mImageBuf;
     mImageBuf = new uint8_t[mBufferSize];
+
+    // the preset reads out the full sensor
+    mRowStart = 0;
+    mColStart = 0;
+    mWindowHeight = SENSOR_HEIGHT;
+    mWindowWidth = SENSOR_WIDTH;
+    mSubsampling = 1;
+    mBinning = false;
+
+    ap_u32 upper = 0, lower = 0;
+    ap_GetSensorRegisterAddr(mHandle, MI_REG_ADDR, 0, REG_SHUTTER_WIDTH_UPPER, 16, &upper, 0);
+    ap_GetSensorRegisterAddr(mHandle, MI_REG_ADDR, 0, REG_SHUTTER_WIDTH_LOWER, 16, &lower, 0);
+    mExposure = (upper << 16) | lower;
+}
+
+void Aptina::setReadoutWindow(unsigned rowStart, unsigned colStart, unsigned height, unsigned width)
+{
+    const unsigned step = 2 * mSubsampling;
+    rowStart &= ~1u;
+    colStart &= ~1u;
+    height -= height % step;
+    width -= width % step;
+
+    if(height == 0 || width == 0 || rowStart + height > SENSOR_HEIGHT || colStart + width > SENSOR_WIDTH)
+        throw std::invalid_argument("Readout window outside of the sensor");
+
+    mRowStart = rowStart;
+    mColStart = colStart;
+    mWindowHeight = height;
+    mWindowWidth = width;
+    applyFormat();
+}
+
+void Aptina::setCenteredWindow(unsigned height, unsigned width)
+{
+    if(height > SENSOR_HEIGHT || width > SENSOR_WIDTH)
+        throw std::invalid_argument("Readout window larger than the sensor");
+
+    setReadoutWindow((SENSOR_HEIGHT - height) / 2, (SENSOR_WIDTH - width) / 2, height, width);
+}
+
+void Aptina::setSubsampling(unsigned factor, bool binning)
+{
+    if(factor < 1 || factor > 4 || (binning && factor == 3))
+        throw std::invalid_argument("Unsupported subsampling factor");
+
+    mSubsampling = factor;
+    mBinning = binning && factor > 1;
+
+    // the window has to be a multiple of the Bayer pattern after subsampling
+    const unsigned step = 2 * mSubsampling;
+    mWindowHeight = std::max(step, mWindowHeight - mWindowHeight % step);
+    mWindowWidth = std::max(step, mWindowWidth - mWindowWidth % step);
+    applyFormat();
+}
+
+void Aptina::setExposure(unsigned rows)
+{
+    if(mHandle == NULL)
+        throw std::runtime_error("Set exposure failed. Camera handle not initialized");
+
+    // takes effect with the next frame, no reallocation necessary
+    writeRegister(REG_SHUTTER_WIDTH_UPPER, (rows >> 16) & 0xFFFF);
+    writeRegister(REG_SHUTTER_WIDTH_LOWER, rows & 0xFFFF);
+    mExposure = rows;
+}
+
+void Aptina::writeRegister(ap_u32 address, ap_u32 value)
+{
+    ap_s32 sideEffects = 0;
+    if(ap_SetSensorRegisterAddr(mHandle, MI_REG_ADDR, 0, address, 16, value, &sideEffects) != AP_CAMERA_SUCCESS)
+        throw std::runtime_error("Writing sensor register failed");
+    if(sideEffects & (AP_FLAG_ILLEGAL_REG_VALUE | AP_FLAG_ILLEGAL_REG_COMBO | AP_FLAG_NOT_SUPPORTED))
+        throw std::invalid_argument("Sensor register value not supported");
+}
+
+void Aptina::applyFormat()
+{
+    if(mHandle == NULL)
+        throw std::runtime_error("Set format failed. Camera handle not initialized");
+
+    // the ring is reallocated, so the caller must not hold any of its buffers
+    // (checked before stopping, so a failed call leaves the capture running)
+    const bool capturing = mCaptureThread.joinable();
+    const unsigned nBuffers = mRing.size();
+    if(capturing)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            if(mHeldFrames != 0)
+                throw std::logic_error("Set format failed. Frames are still held by the caller, use releaseFrame()");
+        }
+        stopCapture();
+    }
+
+    // the skip and bin fields are factor - 1 (bits 2:0 and 5:4)
+    const ap_u32 skip = mSubsampling - 1;
+    const ap_u32 addressMode = mBinning ? (skip | (skip << 4)) : skip;
+
+    writeRegister(REG_ROW_ADDRESS_MODE, addressMode);
+    writeRegister(REG_COLUMN_ADDRESS_MODE, addressMode);
+    writeRegister(REG_ROW_START, ACTIVE_ROW_OFFSET + mRowStart);
+    writeRegister(REG_COLUMN_START, ACTIVE_COLUMN_OFFSET + mColStart);
+    writeRegister(REG_ROW_SIZE, mWindowHeight - 1);
+    writeRegister(REG_COLUMN_SIZE, mWindowWidth - 1);
+
+    // let apbase pick up the new image format and get the new buffer size
+    ap_CheckSensorState(mHandle, 0);
+    ap_GetImageFormat(mHandle, &mWidth, &mHeight, NULL, 0);
+    mBufferSize = ap_GrabFrame(mHandle, NULL, 0);
+
+    delete [] mImageBuf;
+    mImageBuf = new uint8_t[mBufferSize];
+
+    if(capturing)
+        startCapture(nBuffers);
 }
 
 bool Aptina::grabFrame(uint8_t **imageBuf)
@@ -52,8 +201,16 @@ bool Aptina::grabFrame(uint8_t **imageBuf)
     if(mHandle == NULL)
         throw std::runtime_error("Grab frame failed. Camera handle not initialized");
 
-    ap_u32 numBytes = ap_GrabFrame(mHandle, mImageBuf, mBufferSize);
-    ap_s32 result = ap_GetLastError();
+    if(mCapturing)
+        throw std::logic_error("Grab frame failed. Capture thread is running, use acquireFrame()");
+
+    ap_u32 numBytes;
+    ap_s32 result;
+    {
+        STARCAM_TIMER(Instrumentation::GrabFrame);
+        numBytes = ap_GrabFrame(mHandle, mImageBuf, mBufferSize);
+        result = ap_GetLastError();
+    }
     cout << numBytes << "\t" << result << endl;
     if(result != AP_CAMERA_SUCCESS)
         return false;
@@ -61,3 +218,138 @@ bool Aptina::grabFrame(uint8_t **imageBuf)
     *imageBuf = mImageBuf;
     return true;
 }
+
+void Aptina::startCapture(unsigned nBuffers)
+{
+    if(mHandle == NULL)
+        throw std::runtime_error("Start capture failed. Camera handle not initialized");
+
+    if(nBuffers < 2)
+        throw std::invalid_argument("Start capture failed. At least 2 frame buffers necessary");
+
+    // the ring is reallocated, so the caller must not hold any of its buffers
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        if(mHeldFrames != 0)
+            throw std::logic_error("Start capture failed. Frames are still held by the caller, use releaseFrame()");
+    }
+
+    stopCapture();
+
+    // (re)allocate the ring
+    for(std::vector<uint8_t*>::iterator it = mRing.begin(); it != mRing.end(); ++it)
+        delete [] *it;
+    mRing.clear();
+    mFreeFrames.clear();
+    mReadyFrames.clear();
+
+    for(unsigned i=0; i<nBuffers; ++i)
+    {
+        mRing.push_back(new uint8_t[mBufferSize]);
+        mFreeFrames.push_back(mRing.back());
+    }
+
+    mDroppedFrames = 0;
+    mCapturing = true;
+    mCaptureThread = std::thread(&Aptina::captureLoop, this);
+}
+
+void Aptina::stopCapture()
+{
+    if(!mCaptureThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        mCapturing = false;
+    }
+    mQueueCond.notify_all();
+    mCaptureThread.join();
+}
+
+bool Aptina::acquireFrame(uint8_t **imageBuf, unsigned timeoutMs, double *timestamp)
+{
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+
+    if(!mCapturing && mReadyFrames.empty())
+        throw std::logic_error("Acquire frame failed. Capture thread is not running");
+
+    if(!mQueueCond.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+                            [this]{ return !mReadyFrames.empty() || !mCapturing; }))
+        return false;
+
+    // the capture was stopped while waiting
+    if(mReadyFrames.empty())
+        return false;
+
+    QueuedFrame frame = mReadyFrames.front();
+    mReadyFrames.pop_front();
+    ++mHeldFrames;
+
+    *imageBuf = frame.buffer;
+    if(timestamp)
+        *timestamp = frame.timestamp;
+    return true;
+}
+
+void Aptina::releaseFrame(uint8_t *imageBuf)
+{
+    {
+        std::lock_guard<std::mutex> lock(mQueueMutex);
+        mFreeFrames.push_back(imageBuf);
+        --mHeldFrames;
+    }
+    mQueueCond.notify_all();
+}
+
+void Aptina::captureLoop()
+{
+    std::unique_lock<std::mutex> lock(mQueueMutex);
+
+    while(mCapturing)
+    {
+        uint8_t * buffer;
+        if(!mFreeFrames.empty())
+        {
+            buffer = mFreeFrames.front();
+            mFreeFrames.pop_front();
+        }
+        else if(!mReadyFrames.empty())
+        {
+            // the consumer is too slow, overwrite the oldest frame in the queue
+            buffer = mReadyFrames.front().buffer;
+            mReadyFrames.pop_front();
+            ++mDroppedFrames;
+        }
+        else
+        {
+            // all buffers are held by the consumer, wait until one is released
+            mQueueCond.wait(lock);
+            continue;
+        }
+
+        // grab without holding the lock so the consumer can acquire and release meanwhile
+        lock.unlock();
+        ap_s32 result;
+        {
+            STARCAM_TIMER(Instrumentation::GrabFrame);
+            ap_GrabFrame(mHandle, buffer, mBufferSize);
+            result = ap_GetLastError();
+        }
+        double timestamp = getRealTime();
+        lock.lock();
+
+        if(result == AP_CAMERA_SUCCESS)
+        {
+            QueuedFrame frame = {buffer, timestamp};
+            mReadyFrames.push_back(frame);
+            mQueueCond.notify_all();
+        }
+        else
+        {
+            // give the camera some time before trying again
+            mFreeFrames.push_front(buffer);
+            mQueueCond.wait_for(lock, std::chrono::milliseconds(10));
+        }
+    }
+}
@@ -0,0 +1,116 @@
+#include <cmath>
+
+#include <Eigen/LU>
+#include <Eigen/Eigenvalues>
+
+#include "attitude.h"
+#include "instrumentation.h"
+
+AttitudeSolver::AttitudeSolver()
+    :mSigma(1e-4)
+{
+}
+
+bool AttitudeSolver::solve(const StarIdentifier::vectorList_t &spotVectors, const std::vector<int> &ids,
+                           const StarIdentifier &catalog, Attitude &attitude) const
+{
+    STARCAM_TIMER(Instrumentation::AttitudeOutput);
+    attitude = Attitude();
+
+    if(!catalog.hasStarCatalog())
+        throw std::runtime_error("No star catalog loaded");
+    if(spotVectors.size() != ids.size())
+        throw std::invalid_argument("List of ids must have same size as list of spot vectors");
+
+    // attitude profile matrix B = sum(b * r^T) and sum(b * b^T) for the covariance
+    Eigen::Matrix3d B = Eigen::Matrix3d::Zero();
+    Eigen::Matrix3d BB = Eigen::Matrix3d::Zero();
+    unsigned n = 0;
+    for(unsigned s=0; s<ids.size(); ++s)
+    {
+        if(ids[s] == -1)
+            continue;
+        const int index = catalog.getCatalogIndex(ids[s]);
+        if(index == -1)
+            continue;
+        const Eigen::Vector3f & r = catalog.getInertialVector(index);
+        if(r.isZero())
+            continue;
+
+        const Eigen::Vector3d b = spotVectors[s].cast<double>().normalized();
+        B += b * r.cast<double>().transpose();
+        BB += b * b.transpose();
+        ++n;
+    }
+
+    attitude.nStars = n;
+    if(n < 2)
+        return false;
+
+    // equal weights w = 1/n, hence the sum of the weights is 1
+    B /= n;
+
+    const double sigma = B.trace();
+    const Eigen::Matrix3d S = B + B.transpose();
+    const Eigen::Vector3d Z(B(1, 2) - B(2, 1), B(2, 0) - B(0, 2), B(0, 1) - B(1, 0));
+    const Eigen::Matrix3d S2 = S * S;
+    const double kappa = 0.5 * (S.trace() * S.trace() - S2.trace()); // trace of adj(S)
+    const double delta = S.determinant();
+
+    // Newton iteration on the characteristic polynomial of K
+    const double a = sigma * sigma - kappa;
+    const double b = sigma * sigma + Z.dot(Z);
+    const double c = delta + Z.dot(S * Z);
+    const double d = Z.dot(S2 * Z);
+    double lambda = 1.0;
+    for(unsigned i=0; i<20; ++i)
+    {
+        const double l2 = lambda * lambda;
+        const double f = l2 * l2 - (a + b) * l2 - c * lambda + (a * b + c * sigma - d);
+        const double df = 4 * l2 * lambda - 2 * (a + b) * lambda - c;
+        if(df == 0.0)
+            break;
+        const double step = f / df;
+        lambda -= step;
+        if(std::abs(step) < 1e-14)
+            break;
+    }
+
+    // optimal quaternion (Shuster convention q = [X, gamma])
+    const double alpha = lambda * lambda - sigma * sigma + kappa;
+    const double beta = lambda - sigma;
+    const double gamma = (lambda + sigma) * alpha - delta;
+    const Eigen::Vector3d X = (alpha * Eigen::Matrix3d::Identity() + beta * S + S2) * Z;
+    const double norm = std::sqrt(gamma * gamma + X.dot(X));
+
+    Eigen::Quaterniond q;
+    if(norm > 1e-6)
+    {
+        // A(q) = (q4^2 - |q|^2) I + 2 q q^T - 2 q4 [q x] is the matrix of the conjugated Eigen quaternion
+        q = Eigen::Quaterniond(gamma / norm, -X[0] / norm, -X[1] / norm, -X[2] / norm);
+    }
+    else
+    {
+        // rotation of about 180 degree: eigenvector of the largest eigenvalue of K
+        Eigen::Matrix4d K;
+        K.topLeftCorner<3, 3>() = S - sigma * Eigen::Matrix3d::Identity();
+        K.topRightCorner<3, 1>() = Z;
+        K.bottomLeftCorner<1, 3>() = Z.transpose();
+        K(3, 3) = sigma;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix4d> solver(K);
+        const Eigen::Vector4d v = solver.eigenvectors().col(3);
+        lambda = solver.eigenvalues()[3];
+        q = Eigen::Quaterniond(v[3], -v[0], -v[1], -v[2]);
+    }
+
+    // covariance of the error angles: sigma^2 * (n I - sum(b * b^T))^-1
+    const Eigen::Matrix3d F = n * Eigen::Matrix3d::Identity() - BB;
+    if(std::abs(F.determinant()) < 1e-12)
+        return false; // all stars in one direction, the rotation about it is unobservable
+
+    attitude.quaternion = q.normalized();
+    attitude.covariance = mSigma * mSigma * F.inverse();
+    attitude.loss = 1.0 - lambda;
+    attitude.valid = true;
+    return true;
+}
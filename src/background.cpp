@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "background.h"
+
+BackgroundEstimator::BackgroundEstimator()
+    :mTileSize(64), mSigmaFactor(5.0f), mMinDelta(64), mUpdateInterval(4)
+{
+    reset();
+}
+
+void BackgroundEstimator::setTileSize(unsigned size)
+{
+    if(size == 0 || size % 16 != 0)
+        throw std::invalid_argument("Tile size has to be a multiple of 16");
+
+    mTileSize = size;
+    reset();
+}
+
+void BackgroundEstimator::setUpdateInterval(unsigned frames)
+{
+    if(frames == 0)
+        throw std::invalid_argument("Update interval has to be at least 1 frame");
+
+    mUpdateInterval = frames;
+}
+
+void BackgroundEstimator::reset()
+{
+    mRows = 0;
+    mCols = 0;
+    mTileRows = 0;
+    mTilesPerRow = 0;
+    mNextTile = 0;
+    mValid = false;
+}
+
+void BackgroundEstimator::update(const uint16_t *raw, const unsigned rows, const unsigned cols)
+{
+    if(!mValid || rows != mRows || cols != mCols)
+    {
+        mRows = rows;
+        mCols = cols;
+        mTileRows = (rows + mTileSize - 1) / mTileSize;
+        mTilesPerRow = (cols + mTileSize - 1) / mTileSize;
+        mBackground.assign(mTileRows * mTilesPerRow, 0);
+        mThresholds.assign(mTileRows * mTilesPerRow, 255);
+        mRawThresholdRows.assign(mTileRows * cols, 0xFFFF);
+        mNextTile = 0;
+
+        // no estimate yet: all tiles
+        for(unsigned tile=0; tile<mBackground.size(); ++tile)
+            estimateTile(raw, tile);
+        mValid = true;
+        return;
+    }
+
+    const unsigned nTiles = mBackground.size();
+    const unsigned perUpdate = (nTiles + mUpdateInterval - 1) / mUpdateInterval;
+    for(unsigned i=0; i<perUpdate; ++i)
+    {
+        estimateTile(raw, mNextTile);
+        if(++mNextTile == nTiles)
+            mNextTile = 0;
+    }
+}
+
+void BackgroundEstimator::estimateTile(const uint16_t *raw, unsigned tile)
+{
+    const unsigned tileRow = tile / mTilesPerRow;
+    const unsigned tileCol = tile % mTilesPerRow;
+    const unsigned y0 = tileRow * mTileSize;
+    const unsigned x0 = tileCol * mTileSize;
+    const unsigned y1 = std::min(y0 + mTileSize, mRows);
+    const unsigned x1 = std::min(x0 + mTileSize, mCols);
+
+    // every 3rd row and column hits all colors of the Bayer pattern
+    const unsigned step = 3;
+    mSamples.clear();
+    for(unsigned y=y0; y<y1; y+=step)
+    {
+        const uint16_t * row = raw + (std::size_t) y * mCols;
+        for(unsigned x=x0; x<x1; x+=step)
+            mSamples.push_back(row[x]);
+    }
+
+    const std::vector<uint16_t>::iterator middle = mSamples.begin() + mSamples.size() / 2;
+    std::nth_element(mSamples.begin(), middle, mSamples.end());
+    const uint16_t median = *middle;
+
+    for(std::vector<uint16_t>::iterator it = mSamples.begin(); it != mSamples.end(); ++it)
+        *it = *it > median ? *it - median : median - *it;
+    std::nth_element(mSamples.begin(), middle, mSamples.end());
+    const float sigma = 1.4826f * *middle;
+
+    const float delta = std::max(mSigmaFactor * sigma, (float) mMinDelta);
+    const unsigned threshold = std::min(255u, (unsigned) ((median + delta) / 16.0f));
+
+    mBackground[tile] = median;
+    mThresholds[tile] = threshold;
+
+    // (p >> 4) > threshold <=> p > threshold * 16 + 15, never true for threshold 255
+    const uint16_t rawThreshold = threshold >= 255 ? 0xFFFF : (threshold << 4) | 0xF;
+    std::fill(mRawThresholdRows.begin() + tileRow * mCols + x0, mRawThresholdRows.begin() + tileRow * mCols + x1, rawThreshold);
+}
@@ -0,0 +1,144 @@
+#include <stdexcept>
+
+#include "batchreplay.h"
+
+BatchReplay::BatchReplay(const std::shared_ptr<const StarCatalog> &catalog, const BatchReplay::Setup &setup,
+                         unsigned nThreads, unsigned maxInFlight)
+    :mPool(nThreads), mWritten(0), mAborted(false)
+{
+    for(unsigned w=0; w<mPool.getNumThreads(); ++w)
+    {
+        mPipelines.push_back(std::unique_ptr<Pipeline>(new Pipeline(catalog)));
+        if(setup)
+            setup(*mPipelines.back());
+    }
+
+    mSlots.resize(maxInFlight ? maxInFlight : 2 * mPool.getNumThreads());
+    mDone.assign(mSlots.size(), false);
+}
+
+void BatchReplay::run(const std::vector<std::string> &files, const BatchReplay::ResultCallback &callback)
+{
+    mWritten = 0;
+    mAborted = false;
+    mDone.assign(mSlots.size(), false);
+
+    mPool.parallelFor(files.size(), [&](unsigned index, unsigned worker)
+    {
+        processImage(index, worker, files, callback);
+    });
+}
+
+void BatchReplay::processImage(unsigned index, unsigned worker, const std::vector<std::string> &files,
+                               const BatchReplay::ResultCallback &callback)
+{
+    const unsigned window = mSlots.size();
+    {
+        // the slot is free once the image window positions earlier was written
+        std::unique_lock<std::mutex> lock(mMutex);
+        while(!mAborted && index >= mWritten + window)
+            mSlotFree.wait(lock);
+        if(mAborted)
+            return;
+    }
+
+    ImageResult & result = mSlots[index % window];
+    result.index = index;
+    result.filename = files[index];
+    result.error.clear();
+    try
+    {
+        Pipeline & pipeline = *mPipelines[worker];
+        const Pipeline::Result & processed = pipeline.processImageFile(files[index]);
+        result.status = processed.identified ? Identified : TooFewSpots;
+        result.spots.assign(pipeline.getSpots().begin(), pipeline.getSpots().end());
+        result.ids.assign(processed.ids.begin(), processed.ids.end());
+        result.attitude = processed.attitude;
+    }
+    catch(std::exception &e)
+    {
+        // e.g. a missing or truncated file, the other images are still processed
+        result.status = Failed;
+        result.error = e.what();
+        result.spots.clear();
+        result.ids.clear();
+        result.attitude = Attitude();
+    }
+
+    // write all results which are complete and next in input order
+    std::lock_guard<std::mutex> lock(mMutex);
+    mDone[index % window] = true;
+    try
+    {
+        while(!mAborted && mWritten < files.size() && mDone[mWritten % window])
+        {
+            callback(mSlots[mWritten % window]);
+            mDone[mWritten % window] = false;
+            ++mWritten;
+        }
+    }
+    catch(...)
+    {
+        mAborted = true;
+        mSlotFree.notify_all();
+        throw;
+    }
+    mSlotFree.notify_all();
+}
+
+void BatchReplay::writeCsvHeader(std::ostream &os)
+{
+    os << "image,file,status,spots,identified,attitude_valid,qw,qx,qy,qz,loss,ids" << std::endl;
+}
+
+void BatchReplay::writeCsv(std::ostream &os, const BatchReplay::ImageResult &result)
+{
+    unsigned identified = 0;
+    for(std::vector<int>::const_iterator it = result.ids.begin(); it != result.ids.end(); ++it)
+    {
+        if(*it != -1)
+            ++identified;
+    }
+
+    const Eigen::Quaterniond & q = result.attitude.quaternion;
+    os << result.index << "," << result.filename << "," << result.status << "," << result.spots.size() << ","
+       << identified << "," << result.attitude.valid << ","
+       << q.w() << "," << q.x() << "," << q.y() << "," << q.z() << "," << result.attitude.loss << ",";
+    for(unsigned s=0; s<result.ids.size(); ++s)
+        os << (s ? " " : "") << result.ids[s];
+    os << "\n";
+}
+
+void BatchReplay::writeBinaryHeader(std::ostream &os)
+{
+    ReplayStreamHeader header;
+    std::copy(REPLAY_STREAM_MAGIC, REPLAY_STREAM_MAGIC + sizeof(REPLAY_STREAM_MAGIC), header.magic);
+    header.version = REPLAY_STREAM_VERSION;
+    os.write((const char *) &header, sizeof(header));
+}
+
+void BatchReplay::writeBinary(std::ostream &os, const BatchReplay::ImageResult &result)
+{
+    ReplayRecordHeader record;
+    record.index = result.index;
+    record.status = result.status;
+    record.spotCount = result.spots.size();
+    record.attitudeValid = result.attitude.valid ? 1 : 0;
+    record.quaternion[0] = result.attitude.quaternion.w();
+    record.quaternion[1] = result.attitude.quaternion.x();
+    record.quaternion[2] = result.attitude.quaternion.y();
+    record.quaternion[3] = result.attitude.quaternion.z();
+    record.loss = result.attitude.loss;
+    os.write((const char *) &record, sizeof(record));
+
+    for(unsigned s=0; s<result.spots.size(); ++s)
+    {
+        ReplaySpotRecord spot;
+        spot.x = result.spots[s].center.x;
+        spot.y = result.spots[s].center.y;
+        spot.flux = result.spots[s].flux;
+        spot.area = result.spots[s].area;
+        spot.hip = s < result.ids.size() ? result.ids[s] : -1;
+        os.write((const char *) &spot, sizeof(spot));
+    }
+}
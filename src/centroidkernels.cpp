@@ -0,0 +1,86 @@
+#include <stdexcept>
+
+#include "centroidkernels.h"
+
+template<typename T, CentroidWeighting Weighting, bool Masked>
+void accumulateWindowMoments(const T *image, std::size_t stride, const uint8_t *mask, std::size_t maskStride,
+                             unsigned rows, unsigned cols, WindowMoments &moments)
+{
+    for(unsigned y=0; y<rows; ++y)
+    {
+        const T * row = image + y * stride;
+        const uint8_t * maskRow = Masked ? mask + y * maskStride : NULL;
+
+        // sums of the row without branches, the weight is 0 outside of the mask
+        uint64_t rowArea = 0, rowSum = 0, rowSumX = 0;
+        for(unsigned x=0; x<cols; ++x)
+        {
+            const uint32_t value = row[x];
+            const uint32_t inside = Masked ? (maskRow[x] != 0) : 1u;
+            const uint32_t weight = Weighting == IntensityWeighting ? value * inside : inside;
+            rowArea += (value != 0) & inside;
+            rowSum += weight;
+            rowSumX += (uint64_t) x * weight;
+        }
+
+        moments.area += rowArea;
+        moments.sum += rowSum;
+        moments.sumX += rowSumX;
+        moments.sumY += (uint64_t) y * rowSum;
+    }
+}
+
+namespace
+{
+/*!
+ \brief Instantiation of accumulateWindowMoments() with the pixel type erased (see WindowMomentsKernel)
+*/
+template<typename T, CentroidWeighting Weighting, bool Masked>
+void windowMomentsKernel(const void *image, std::size_t stride, const uint8_t *mask, std::size_t maskStride,
+                         unsigned rows, unsigned cols, WindowMoments &moments)
+{
+    accumulateWindowMoments<T, Weighting, Masked>((const T *) image, stride, mask, maskStride, rows, cols, moments);
+}
+
+/*!
+ \brief Selects the weighting and masking for a pixel type
+*/
+template<typename T>
+WindowMomentsKernel selectKernel(CentroidWeighting weighting, bool masked)
+{
+    if(weighting == IntensityWeighting)
+        return masked ? &windowMomentsKernel<T, IntensityWeighting, true> : &windowMomentsKernel<T, IntensityWeighting, false>;
+    else
+        return masked ? &windowMomentsKernel<T, GeometricWeighting, true> : &windowMomentsKernel<T, GeometricWeighting, false>;
+}
+}
+
+WindowMomentsKernel selectWindowMomentsKernel(std::size_t pixelSize, CentroidWeighting weighting, bool masked)
+{
+    switch(pixelSize)
+    {
+    case sizeof(uint8_t):
+        return selectKernel<uint8_t>(weighting, masked);
+    case sizeof(uint16_t):
+        return selectKernel<uint16_t>(weighting, masked);
+    default:
+        throw std::invalid_argument("No centroid kernel for this pixel size");
+    }
+}
+
+template void accumulateWindowMoments<uint8_t, GeometricWeighting, false>(const uint8_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                          unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint8_t, GeometricWeighting, true>(const uint8_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                         unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint8_t, IntensityWeighting, false>(const uint8_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                          unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint8_t, IntensityWeighting, true>(const uint8_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                         unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint16_t, GeometricWeighting, false>(const uint16_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                           unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint16_t, GeometricWeighting, true>(const uint16_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                          unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint16_t, IntensityWeighting, false>(const uint16_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                           unsigned, unsigned, WindowMoments &);
+template void accumulateWindowMoments<uint16_t, IntensityWeighting, true>(const uint16_t *, std::size_t, const uint8_t *, std::size_t,
+                                                                          unsigned, unsigned, WindowMoments &);
@@ -0,0 +1,15 @@
+#include "checksum.h"
+
+uint32_t dataChecksum(const void *data, std::size_t size)
+{
+    const uint32_t * words = (const uint32_t *) data;
+    const std::size_t n = size / sizeof(uint32_t);
+
+    uint32_t a = 0, b = 0;
+    for(std::size_t i=0; i<n; ++i)
+    {
+        a += words[i];
+        b += (uint32_t) (n - i) * words[i];
+    }
+    return a ^ b;
+}
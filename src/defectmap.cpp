@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include "defectmap.h"
+#include "checksum.h"
+
+DefectMap::DefectMap()
+    :mRows(0), mCols(0), mFrames(0)
+{
+}
+
+void DefectMap::beginCalibration(unsigned rows, unsigned cols)
+{
+    if(rows > 0xFFFF || cols > 0xFFFF)
+        throw std::invalid_argument("Frame too large for a defect map");
+
+    mRows = rows;
+    mCols = cols;
+    mRuns.clear();
+    indexRows();
+    mCounts.assign((std::size_t) rows * cols, 0);
+    mFrames = 0;
+}
+
+void DefectMap::addDarkFrame(const uint16_t *raw, unsigned threshold)
+{
+    if(mCounts.empty())
+        throw std::logic_error("DefectMap: beginCalibration() has to be called before adding dark frames");
+    if(mFrames == 0xFFFF)
+        throw std::length_error("DefectMap: Too many dark frames");
+
+    // same comparison as the conversion: 8-bit value (saturated) greater than the threshold
+    const unsigned limit = std::min(threshold, 255u);
+    for(std::size_t i=0; i<mCounts.size(); ++i)
+    {
+        if(std::min<unsigned>(raw[i] >> 4, 255u) > limit)
+            ++mCounts[i];
+    }
+    ++mFrames;
+}
+
+void DefectMap::endCalibration(float minFraction, float columnFraction)
+{
+    if(mFrames == 0)
+        throw std::logic_error("DefectMap: No dark frames added");
+
+    const unsigned minCount = std::max(1u, (unsigned) (minFraction * mFrames + 0.5f));
+
+    // columns with too many defective pixels are masked completely
+    std::vector<bool> badColumn(mCols, false);
+    if(columnFraction > 0.0f)
+    {
+        std::vector<unsigned> columnCount(mCols, 0);
+        for(unsigned y=0; y<mRows; ++y)
+        {
+            const uint16_t * counts = &mCounts[(std::size_t) y * mCols];
+            for(unsigned x=0; x<mCols; ++x)
+            {
+                if(counts[x] >= minCount)
+                    ++columnCount[x];
+            }
+        }
+        for(unsigned x=0; x<mCols; ++x)
+            badColumn[x] = columnCount[x] >= columnFraction * mRows;
+    }
+
+    mRuns.clear();
+    for(unsigned y=0; y<mRows; ++y)
+    {
+        const uint16_t * counts = &mCounts[(std::size_t) y * mCols];
+        unsigned x = 0;
+        while(x < mCols)
+        {
+            if(counts[x] < minCount && !badColumn[x])
+            {
+                ++x;
+                continue;
+            }
+
+            DefectRun run;
+            run.row = y;
+            run.col = x;
+            run.reserved = 0;
+            while(x < mCols && (counts[x] >= minCount || badColumn[x]))
+                ++x;
+            run.length = x - run.col;
+            mRuns.push_back(run);
+        }
+    }
+
+    indexRows();
+    std::vector<uint16_t>().swap(mCounts);
+    mFrames = 0;
+}
+
+void DefectMap::load(const std::string filename)
+{
+    std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if(!file.is_open())
+        throw std::runtime_error("Failed to open defect map " + filename);
+
+    DefectMapFileHeader header;
+    if(!file.read((char *) &header, sizeof(header)) ||
+       !std::equal(DEFECT_MAP_FILE_MAGIC, DEFECT_MAP_FILE_MAGIC + sizeof(DEFECT_MAP_FILE_MAGIC), header.magic))
+        throw std::runtime_error("Not a defect map file: " + filename);
+    if(header.version != DEFECT_MAP_FILE_VERSION)
+        throw std::runtime_error("Unsupported version of the defect map file: " + filename);
+    if(header.rows > 0xFFFF || header.cols > 0xFFFF)
+        throw std::runtime_error("Corrupt defect map file: " + filename);
+
+    // check the size before allocating, the header is not covered by the checksum
+    const std::streamoff dataStart = file.tellg();
+    file.seekg(0, std::ios_base::end);
+    const std::streamoff dataSize = file.tellg() - dataStart;
+    file.seekg(dataStart);
+    if(dataSize < 0 || (uint64_t) header.runCount * sizeof(DefectRun) > (uint64_t) dataSize)
+        throw std::runtime_error("Defect map file too short: " + filename);
+
+    std::vector<DefectRun> runs(header.runCount);
+    if(header.runCount && !file.read((char *) &runs[0], runs.size() * sizeof(DefectRun)))
+        throw std::runtime_error("Defect map file too short: " + filename);
+    if(!runs.empty() && dataChecksum(&runs[0], runs.size() * sizeof(DefectRun)) != header.checksum)
+        throw std::runtime_error("Checksum of the defect map file does not match: " + filename);
+
+    // the masking relies on sorted runs within the frame
+    for(unsigned r=0; r<runs.size(); ++r)
+    {
+        const DefectRun & run = runs[r];
+        const bool ordered = r == 0 || run.row > runs[r-1].row ||
+                             (run.row == runs[r-1].row && run.col >= runs[r-1].col + runs[r-1].length);
+        if(!ordered || run.row >= header.rows || run.length == 0 || run.col + run.length > header.cols)
+            throw std::runtime_error("Corrupt defect map file: " + filename);
+    }
+
+    mRows = header.rows;
+    mCols = header.cols;
+    mRuns.swap(runs);
+    indexRows();
+    mCounts.clear();
+    mFrames = 0;
+}
+
+void DefectMap::save(const std::string filename) const
+{
+    DefectMapFileHeader header;
+    std::copy(DEFECT_MAP_FILE_MAGIC, DEFECT_MAP_FILE_MAGIC + sizeof(DEFECT_MAP_FILE_MAGIC), header.magic);
+    header.version = DEFECT_MAP_FILE_VERSION;
+    header.rows = mRows;
+    header.cols = mCols;
+    header.runCount = mRuns.size();
+    header.checksum = mRuns.empty() ? 0 : dataChecksum(&mRuns[0], mRuns.size() * sizeof(DefectRun));
+
+    std::ofstream file(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+    if(!file.is_open())
+        throw std::runtime_error("Failed to open " + filename);
+    file.write((const char *) &header, sizeof(header));
+    if(!mRuns.empty())
+        file.write((const char *) &mRuns[0], mRuns.size() * sizeof(DefectRun));
+    if(!file)
+        throw std::runtime_error("Failed to write " + filename);
+}
+
+std::size_t DefectMap::getPixelCount() const
+{
+    std::size_t count = 0;
+    for(unsigned r=0; r<mRuns.size(); ++r)
+        count += mRuns[r].length;
+    return count;
+}
+
+bool DefectMap::isDefect(unsigned y, unsigned x) const
+{
+    if(mRuns.empty() || y >= mRows)
+        return false;
+
+    for(const DefectRun *run = rowBegin(y), *end = rowBegin(y + 1); run != end && run->col <= x; ++run)
+    {
+        if(x < (unsigned) run->col + run->length)
+            return true;
+    }
+    return false;
+}
+
+void DefectMap::maskImage(uint8_t *image, std::size_t stride) const
+{
+    for(unsigned y=0; y<mRows; ++y)
+        maskRow(y, image + y * stride);
+}
+
+void DefectMap::indexRows()
+{
+    mRowStart.assign(mRows + 1, 0);
+    for(unsigned r=0; r<mRuns.size(); ++r)
+        ++mRowStart[mRuns[r].row + 1];
+    for(unsigned y=0; y<mRows; ++y)
+        mRowStart[y + 1] += mRowStart[y];
+}
@@ -0,0 +1,319 @@
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "fixserver.h"
+#include "getTime.h"
+
+namespace
+{
+/*!
+ \brief Milliseconds run() and a connected client wait for input before checking the stop flag
+*/
+const int POLL_INTERVAL_MS = 200;
+
+/*!
+ \brief Largest request line, longer lines close the connection
+*/
+const std::size_t MAX_REQUEST = 4096;
+
+/*!
+ \brief Seconds a client may stay connected without a complete request, so it cannot block the others
+*/
+const double CLIENT_TIMEOUT = 10.0;
+
+/*!
+ \brief Returns the message of errno with a prefix
+*/
+std::string systemError(const std::string &what)
+{
+    return what + ": " + std::strerror(errno);
+}
+
+/*!
+ \brief Writes the whole buffer to a socket
+
+ \return bool false if the client closed the connection
+*/
+bool sendAll(int socket, const std::string &data)
+{
+    std::size_t sent = 0;
+    while(sent < data.size())
+    {
+        // no SIGPIPE if the client is gone
+        const ssize_t n = send(socket, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+/*!
+ \brief Reads a value of a "set" request
+
+ \return bool false if the value is missing or not fully parsed
+*/
+template<typename T>
+bool readValue(std::istringstream &is, T &value)
+{
+    is >> value;
+    return !is.fail() && (is >> std::ws).eof();
+}
+}
+
+FixServer::FixServer(Pipeline &pipeline, bool useCamera)
+    :mPipeline(pipeline), mUseCamera(useCamera), mSocket(-1), mStop(false)
+{
+}
+
+FixServer::~FixServer()
+{
+    if(mSocket >= 0)
+    {
+        close(mSocket);
+        unlink(mPath.c_str());
+    }
+}
+
+void FixServer::listen(const std::string &path)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(path.empty() || path.size() >= sizeof(address.sun_path))
+        throw std::invalid_argument("Invalid socket path: " + path);
+    std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+
+    // only a socket file left by a previous instance is replaced, never another file
+    struct stat info;
+    if(lstat(path.c_str(), &info) == 0)
+    {
+        if(!S_ISSOCK(info.st_mode))
+            throw std::invalid_argument("Not a socket, refusing to replace it: " + path);
+        unlink(path.c_str());
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+        throw std::runtime_error(systemError("Failed to create socket"));
+
+    // the socket file is created by bind(), only the owner may connect (rw-------)
+    const mode_t previousMask = umask(0177);
+    const int bound = bind(fd, (const sockaddr *) &address, sizeof(address));
+    umask(previousMask);
+    if(bound < 0 || ::listen(fd, 4) < 0)
+    {
+        const std::string message = systemError("Failed to listen on " + path);
+        close(fd);
+        throw std::runtime_error(message);
+    }
+
+    if(mSocket >= 0)
+    {
+        close(mSocket);
+        unlink(mPath.c_str());
+    }
+    mSocket = fd;
+    mPath = path;
+}
+
+void FixServer::run()
+{
+    if(mSocket < 0)
+        throw std::logic_error("FixServer: listen() has to be called before run()");
+
+    mStop = false;
+    while(!mStop)
+    {
+        pollfd listening = {mSocket, POLLIN, 0};
+        const int ready = poll(&listening, 1, POLL_INTERVAL_MS);
+        if(ready < 0 && errno != EINTR)
+            throw std::runtime_error(systemError("Failed to wait for clients"));
+        if(ready <= 0)
+            continue;
+
+        const int client = accept(mSocket, NULL, NULL);
+        if(client < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            throw std::runtime_error(systemError("Failed to accept a client"));
+        }
+
+        serveClient(client);
+        close(client);
+    }
+}
+
+void FixServer::serveClient(int client)
+{
+    std::string buffer;
+    char chunk[1024];
+    bool closeConnection = false;
+    double lastRequest = getRealTime();
+    while(!mStop && !closeConnection)
+    {
+        if(getRealTime() - lastRequest > CLIENT_TIMEOUT)
+        {
+            sendAll(client, "ERR Timeout\n");
+            return;
+        }
+
+        pollfd connection = {client, POLLIN, 0};
+        const int ready = poll(&connection, 1, POLL_INTERVAL_MS);
+        if(ready < 0 && errno != EINTR)
+            return;
+        if(ready <= 0)
+            continue;
+
+        const ssize_t n = recv(client, chunk, sizeof(chunk), 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return;
+        buffer.append(chunk, n);
+
+        // answer all complete lines
+        std::size_t begin = 0, end;
+        while(!closeConnection && (end = buffer.find('\n', begin)) != std::string::npos)
+        {
+            std::string request = buffer.substr(begin, end - begin);
+            if(!request.empty() && request[request.size() - 1] == '\r')
+                request.erase(request.size() - 1);
+            begin = end + 1;
+
+            if(!sendAll(client, handleRequest(request, closeConnection)))
+                return;
+            lastRequest = getRealTime();
+        }
+        buffer.erase(0, begin);
+        if(buffer.size() > MAX_REQUEST)
+        {
+            sendAll(client, "ERR Request too long\n");
+            return;
+        }
+    }
+}
+
+std::string FixServer::handleRequest(const std::string &request, bool &closeConnection)
+{
+    std::istringstream is(request);
+    std::string command;
+    is >> command;
+
+    std::ostringstream reply;
+    if(command == "fix")
+    {
+        // the file name may contain spaces
+        std::string file;
+        std::getline(is >> std::ws, file);
+        return fix(file);
+    }
+    else if(command == "set")
+    {
+        std::string name;
+        is >> name;
+        unsigned value;
+        float eps;
+        StarCamera & camera = mPipeline.getCamera();
+        if(name == "threshold" && readValue(is, value))
+            camera.setThreshold(value);
+        else if(name == "min-area" && readValue(is, value))
+            camera.setMinArea(value);
+        else if(name == "epsilon" && readValue(is, eps) && eps > 0.0f)
+            mPipeline.setEpsilon(eps);
+        else if(name == "exposure" && mUseCamera && readValue(is, value))
+            camera.setExposure(value);
+        else
+            return "ERR Invalid setting: " + request + "\n";
+        reply << "OK";
+    }
+    else if(command == "get")
+    {
+        reply << "OK threshold " << mPipeline.getCamera().getThreshold() << " min-area " << mPipeline.getCamera().getMinArea()
+              << " epsilon " << mPipeline.getEpsilon();
+    }
+    else if(command == "stats")
+    {
+        const double mean = mStats.fixes ? mStats.totalLatency / mStats.fixes : 0.0;
+        reply << "OK fixes " << mStats.fixes << " identified " << mStats.identified << " failed " << mStats.failed
+              << " last-latency " << mStats.lastLatency << " mean-latency " << mean;
+    }
+    else if(command == "quit")
+    {
+        closeConnection = true;
+        reply << "OK";
+    }
+    else if(command == "shutdown")
+    {
+        closeConnection = true;
+        mStop = true;
+        reply << "OK";
+    }
+    else
+    {
+        return "ERR Unknown request: " + command + "\n";
+    }
+
+    reply << "\n";
+    return reply.str();
+}
+
+std::string FixServer::fix(const std::string &file)
+{
+    if(file.empty() && !mUseCamera)
+        return "ERR No camera, a raw image file is required\n";
+
+    ++mStats.fixes;
+    const double startTime = getRealTime();
+    const Pipeline::Result * result;
+    try
+    {
+        result = file.empty() ? &mPipeline.processFrame() : &mPipeline.processImageFile(file);
+    }
+    catch(std::exception &e)
+    {
+        ++mStats.failed;
+        mStats.lastLatency = getRealTime() - startTime;
+        mStats.totalLatency += mStats.lastLatency;
+        return std::string("ERR ") + e.what() + "\n";
+    }
+    mStats.lastLatency = getRealTime() - startTime;
+    mStats.totalLatency += mStats.lastLatency;
+
+    const std::vector<int> & ids = result->ids;
+    unsigned identified = 0;
+    for(unsigned s=0; s<ids.size(); ++s)
+    {
+        if(ids[s] != -1)
+            ++identified;
+    }
+    const Attitude & attitude = result->attitude;
+    if(attitude.valid || (identified && !mPipeline.getIdentifier().hasStarCatalog()))
+        ++mStats.identified;
+
+    const std::vector<Spot> & spots = mPipeline.getSpots();
+    const Eigen::Quaterniond & q = attitude.quaternion;
+    std::ostringstream reply;
+    reply.precision(9);
+    reply << "OK fix " << spots.size() << " " << identified << " " << attitude.valid << " "
+          << q.w() << " " << q.x() << " " << q.y() << " " << q.z() << " " << attitude.loss << " "
+          << mStats.lastLatency << "\n";
+    for(unsigned s=0; s<spots.size(); ++s)
+    {
+        reply << spots[s].center.x << " " << spots[s].center.y << " " << spots[s].flux << " "
+              << spots[s].area << " " << ids[s] << "\n";
+    }
+    reply << "END\n";
+    return reply.str();
+}
@@ -0,0 +1,76 @@
+#include <stdexcept>
+#include <algorithm>
+#include <stdint.h>
+
+#include "framearena.h"
+
+FrameArena::FrameArena(std::size_t blockSize)
+    :mBlockSize(std::max<std::size_t>(blockSize, 1)), mCurrent(0), mOffset(0), mUsed(0)
+{
+}
+
+FrameArena::~FrameArena()
+{
+    for(std::vector<Block>::iterator it = mBlocks.begin(); it != mBlocks.end(); ++it)
+        delete[] it->data;
+}
+
+void * FrameArena::allocate(std::size_t size, std::size_t alignment)
+{
+    if(alignment == 0 || (alignment & (alignment - 1)))
+        throw std::invalid_argument("Alignment has to be a power of two");
+
+    if(!mBlocks.empty())
+    {
+        const Block & block = mBlocks[mCurrent];
+        const uintptr_t begin = (uintptr_t) (block.data + mOffset);
+        const std::size_t padding = (alignment - (begin & (alignment - 1))) & (alignment - 1);
+        if(padding <= block.size - mOffset && size <= block.size - mOffset - padding)
+        {
+            mOffset += padding + size;
+            mUsed += padding + size;
+            return block.data + mOffset - size;
+        }
+    }
+
+    // the frame needs more memory than before, reset() merges the blocks
+    Block block;
+    block.size = std::max(mBlockSize, size + alignment);
+    block.data = new char[block.size];
+    mBlocks.push_back(block);
+    mCurrent = mBlocks.size() - 1;
+
+    const uintptr_t begin = (uintptr_t) block.data;
+    const std::size_t padding = (alignment - (begin & (alignment - 1))) & (alignment - 1);
+    mOffset = padding + size;
+    mUsed += padding + size;
+    return block.data + padding;
+}
+
+void FrameArena::reset()
+{
+    if(mBlocks.size() > 1)
+    {
+        const std::size_t capacity = getCapacity();
+        for(std::vector<Block>::iterator it = mBlocks.begin(); it != mBlocks.end(); ++it)
+            delete[] it->data;
+        mBlocks.clear();
+
+        Block block;
+        block.size = capacity;
+        block.data = new char[capacity];
+        mBlocks.push_back(block);
+    }
+
+    mCurrent = 0;
+    mOffset = 0;
+    mUsed = 0;
+}
+
+std::size_t FrameArena::getCapacity() const
+{
+    std::size_t capacity = 0;
+    for(std::vector<Block>::const_iterator it = mBlocks.begin(); it != mBlocks.end(); ++it)
+        capacity += it->size;
+    return capacity;
+}
@@ -0,0 +1,96 @@
+#include <stdexcept>
+
+#include "framecorrection.h"
+#include "imageconversion.h"
+#include "mappedfile.h"
+
+namespace
+{
+/*!
+ \brief Maps a raw image file and checks its size
+*/
+void mapRawFile(MappedFile &file, const std::string &filename, unsigned rows, unsigned cols)
+{
+    file.open(filename);
+    if(file.size() < (std::size_t) rows * cols * sizeof(uint16_t))
+        throw std::runtime_error("Image file too short: " + filename);
+    file.advise(MappedFile::Sequential);
+}
+}
+
+FrameCorrection::FrameCorrection()
+    :mRows(0), mCols(0)
+{
+}
+
+void FrameCorrection::setSize(unsigned rows, unsigned cols)
+{
+    if(rows == 0 || cols == 0)
+        throw std::invalid_argument("FrameCorrection: Empty frame");
+    if(!empty() && !matches(rows, cols))
+        throw std::invalid_argument("FrameCorrection: Dark frame and flat field differ in size");
+
+    mRows = rows;
+    mCols = cols;
+}
+
+void FrameCorrection::setDarkFrame(const uint16_t *dark, unsigned rows, unsigned cols)
+{
+    if(!mGain.empty())
+        throw std::logic_error("FrameCorrection: The dark frame has to be set before the flat field");
+
+    setSize(rows, cols);
+    mDark.assign(dark, dark + (std::size_t) rows * cols);
+}
+
+void FrameCorrection::setFlatField(const uint16_t *flat, unsigned rows, unsigned cols)
+{
+    mGain.clear();
+    setSize(rows, cols);
+
+    // signal of the flat field above the dark level
+    const std::size_t length = (std::size_t) rows * cols;
+    std::vector<uint16_t> signal(length);
+    correctDarkFlat(flat, getDark(), NULL, &signal[0], length);
+
+    uint64_t sum = 0;
+    std::size_t lit = 0;
+    for(std::size_t i=0; i<length; ++i)
+    {
+        if(signal[i] > 0)
+        {
+            sum += signal[i];
+            ++lit;
+        }
+    }
+    if(lit == 0)
+        throw std::runtime_error("FrameCorrection: Flat field has no signal above the dark frame");
+
+    // gain = mean / signal in Q8, without signal the pixel is left unchanged
+    const double mean = (double) sum / lit;
+    mGain.resize(length);
+    for(std::size_t i=0; i<length; ++i)
+    {
+        const double gain = signal[i] ? 256.0 * mean / signal[i] : 256.0;
+        mGain[i] = gain > 0xFFFF ? 0xFFFF : (uint16_t) (gain + 0.5);
+    }
+}
+
+void FrameCorrection::loadDarkFrame(const std::string filename, unsigned rows, unsigned cols)
+{
+    MappedFile file;
+    mapRawFile(file, filename, rows, cols);
+    setDarkFrame((const uint16_t *) file.data(), rows, cols);
+}
+
+void FrameCorrection::loadFlatField(const std::string filename, unsigned rows, unsigned cols)
+{
+    MappedFile file;
+    mapRawFile(file, filename, rows, cols);
+    setFlatField((const uint16_t *) file.data(), rows, cols);
+}
+
+void FrameCorrection::apply(const uint16_t *src, uint16_t *dst) const
+{
+    correctDarkFlat(src, getDark(), getGain(), dst, (std::size_t) mRows * mCols);
+}
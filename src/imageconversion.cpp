@@ -0,0 +1,190 @@
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define IMAGE_CONVERSION_NEON
+#endif
+
+#include "imageconversion.h"
+#include "defectmap.h"
+
+namespace
+{
+/*!
+ \brief Scalar conversion of a single pixel from 12 to 8 bit
+*/
+inline uint8_t pixel12To8(uint16_t value)
+{
+    value >>= 4;
+    return value > 255 ? 255 : (uint8_t) value;
+}
+
+const uint16_t MAX_12_BIT = 4095; /*!< Largest value of a Bayer-12 pixel*/
+
+/*!
+ \brief Scalar dark and flat-field correction of a single pixel (see correctDarkFlat())
+*/
+inline uint16_t correctPixel(uint16_t value, uint16_t dark, uint16_t gain)
+{
+    const uint32_t signal = value > dark ? value - dark : 0;
+    const uint32_t corrected = (signal * gain) >> 8;
+    return corrected > MAX_12_BIT ? MAX_12_BIT : (uint16_t) corrected;
+}
+}
+
+void correctDarkFlat(const uint16_t *src, const uint16_t *dark, const uint16_t *gain, uint16_t *dst, std::size_t length)
+{
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i maxValue = _mm_set1_epi16(MAX_12_BIT);
+    const __m128i maxHigh = _mm_set1_epi16(MAX_12_BIT >> 8);
+    const __m128i unity = _mm_set1_epi16(256);
+    for(; i + 8 <= length; i += 8)
+    {
+        __m128i value = _mm_loadu_si128((const __m128i *) (src + i));
+        if(dark)
+            value = _mm_subs_epu16(value, _mm_loadu_si128((const __m128i *) (dark + i)));
+
+        // (value * gain) >> 8 from the high and low 16 bits of the 32-bit product,
+        // valid as long as the high part is below 16, i.e. the result is within 12 bit
+        const __m128i g = gain ? _mm_loadu_si128((const __m128i *) (gain + i)) : unity;
+        const __m128i high = _mm_mulhi_epu16(value, g);
+        const __m128i low = _mm_mullo_epi16(value, g);
+        const __m128i product = _mm_or_si128(_mm_slli_epi16(high, 8), _mm_srli_epi16(low, 8));
+        const __m128i valid = _mm_cmpeq_epi16(_mm_subs_epu16(high, maxHigh), zero);
+        value = _mm_or_si128(_mm_and_si128(valid, product), _mm_andnot_si128(valid, maxValue));
+        _mm_storeu_si128((__m128i *) (dst + i), value);
+    }
+#elif defined(IMAGE_CONVERSION_NEON)
+    const uint16x8_t maxValue = vdupq_n_u16(MAX_12_BIT);
+    const uint16x8_t unity = vdupq_n_u16(256);
+    for(; i + 8 <= length; i += 8)
+    {
+        uint16x8_t value = vld1q_u16(src + i);
+        if(dark)
+            value = vqsubq_u16(value, vld1q_u16(dark + i));
+
+        const uint16x8_t g = gain ? vld1q_u16(gain + i) : unity;
+        const uint32x4_t lo = vshrq_n_u32(vmull_u16(vget_low_u16(value), vget_low_u16(g)), 8);
+        const uint32x4_t hi = vshrq_n_u32(vmull_u16(vget_high_u16(value), vget_high_u16(g)), 8);
+        value = vcombine_u16(vqmovn_u32(lo), vqmovn_u32(hi));
+        vst1q_u16(dst + i, vminq_u16(value, maxValue));
+    }
+#endif
+
+    // remaining pixels (or all pixels without SIMD support)
+    for(; i < length; ++i)
+        dst[i] = correctPixel(src[i], dark ? dark[i] : 0, gain ? gain[i] : 256);
+}
+
+void convert12To8(const uint16_t *src, uint8_t *dst, std::size_t length)
+{
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 8));
+        __m128i value = _mm_packus_epi16(_mm_srli_epi16(lo, 4), _mm_srli_epi16(hi, 4));
+        _mm_storeu_si128((__m128i *) (dst + i), value);
+    }
+#elif defined(IMAGE_CONVERSION_NEON)
+    for(; i + 16 <= length; i += 16)
+    {
+        uint8x8_t lo = vqmovn_u16(vshrq_n_u16(vld1q_u16(src + i), 4));
+        uint8x8_t hi = vqmovn_u16(vshrq_n_u16(vld1q_u16(src + i + 8), 4));
+        vst1q_u8(dst + i, vcombine_u8(lo, hi));
+    }
+#endif
+
+    // remaining pixels (or all pixels without SIMD support)
+    for(; i < length; ++i)
+        dst[i] = pixel12To8(src[i]);
+}
+
+void convert12To8Threshold(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                           std::size_t length, unsigned threshold)
+{
+    // no 8-bit value is greater than 255, hence the thresholded image is black
+    if(threshold >= 255)
+    {
+        if(frame)
+            convert12To8(src, frame, length);
+        std::memset(threshed, 0, length);
+        return;
+    }
+
+    std::size_t i = 0;
+
+#if defined(__SSE2__)
+    // SSE2 has no unsigned compare of bytes: value > threshold <=> max(value, threshold+1) == value
+    const __m128i limit = _mm_set1_epi8((char) (threshold + 1));
+    for(; i + 16 <= length; i += 16)
+    {
+        __m128i lo = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i hi = _mm_loadu_si128((const __m128i *) (src + i + 8));
+        __m128i value = _mm_packus_epi16(_mm_srli_epi16(lo, 4), _mm_srli_epi16(hi, 4));
+        __m128i mask = _mm_cmpeq_epi8(_mm_max_epu8(value, limit), value);
+        if(frame)
+            _mm_storeu_si128((__m128i *) (frame + i), value);
+        _mm_storeu_si128((__m128i *) (threshed + i), _mm_and_si128(value, mask));
+    }
+#elif defined(IMAGE_CONVERSION_NEON)
+    const uint8x16_t limit = vdupq_n_u8((uint8_t) threshold);
+    for(; i + 16 <= length; i += 16)
+    {
+        uint8x8_t lo = vqmovn_u16(vshrq_n_u16(vld1q_u16(src + i), 4));
+        uint8x8_t hi = vqmovn_u16(vshrq_n_u16(vld1q_u16(src + i + 8), 4));
+        uint8x16_t value = vcombine_u8(lo, hi);
+        if(frame)
+            vst1q_u8(frame + i, value);
+        vst1q_u8(threshed + i, vandq_u8(value, vcgtq_u8(value, limit)));
+    }
+#endif
+
+    for(; i < length; ++i)
+    {
+        uint8_t value = pixel12To8(src[i]);
+        if(frame)
+            frame[i] = value;
+        threshed[i] = value > threshold ? value : 0;
+    }
+}
+
+void convert12To8ThresholdTiles(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                                unsigned rows, unsigned cols, const uint8_t *thresholds, unsigned tileSize,
+                                const DefectMap *defects)
+{
+    const unsigned tilesPerRow = (cols + tileSize - 1) / tileSize;
+
+    for(unsigned y=0; y<rows; ++y)
+    {
+        const std::size_t offset = (std::size_t) y * cols;
+        const uint8_t * tileThreshold = thresholds + (y / tileSize) * tilesPerRow;
+
+        for(unsigned x=0; x<cols; x+=tileSize, ++tileThreshold)
+        {
+            const unsigned length = x + tileSize <= cols ? tileSize : cols - x;
+            convert12To8Threshold(src + offset + x, frame ? frame + offset + x : NULL, threshed + offset + x,
+                                  length, *tileThreshold);
+        }
+        if(defects)
+            defects->maskRow(y, threshed + offset);
+    }
+}
+
+void convert12To8Threshold(const uint16_t *src, uint8_t *frame, uint8_t *threshed,
+                           unsigned rows, unsigned cols, unsigned threshold, const DefectMap &defects)
+{
+    for(unsigned y=0; y<rows; ++y)
+    {
+        const std::size_t offset = (std::size_t) y * cols;
+        convert12To8Threshold(src + offset, frame ? frame + offset : NULL, threshed + offset, cols, threshold);
+        defects.maskRow(y, threshed + offset);
+    }
+}
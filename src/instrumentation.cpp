@@ -0,0 +1,289 @@
+#include <atomic>
+#include <mutex>
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include <stdexcept>
+
+#include "instrumentation.h"
+
+namespace
+{
+/*!
+ \brief Histogram of one probe of one thread, only written by its thread
+*/
+struct ProbeCounters
+{
+    ProbeCounters() :sum(0), max(0)
+    {
+        for(unsigned b=0; b<LatencyHistogram::BUCKET_COUNT; ++b)
+            buckets[b].store(0, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> buckets[LatencyHistogram::BUCKET_COUNT]; /*!< Number of durations in each bucket*/
+    std::atomic<uint64_t> sum; /*!< Sum of all durations*/
+    std::atomic<uint64_t> max; /*!< Longest duration*/
+};
+
+/*!
+ \brief The histograms of all probes of a thread
+*/
+struct ThreadHistograms
+{
+    ThreadHistograms() :inUse(true) {}
+
+    ProbeCounters probes[Instrumentation::ProbeCount]; /*!< Histogram of each probe*/
+    bool inUse; /*!< Owned by a running thread (guarded by registryMutex)*/
+};
+
+std::mutex registryMutex; /*!< Guards registry*/
+std::vector<ThreadHistograms *> registry; /*!< Histograms of all threads which recorded, never freed*/
+
+/*!
+ \brief Returns the histograms of a thread to the registry when it exits
+*/
+struct ThreadSlot
+{
+    ThreadSlot() :histograms(NULL) {}
+    ~ThreadSlot()
+    {
+        if(histograms)
+        {
+            std::lock_guard<std::mutex> lock(registryMutex);
+            histograms->inUse = false;
+        }
+    }
+
+    ThreadHistograms * histograms; /*!< Histograms of the thread, NULL before the first record*/
+};
+
+thread_local ThreadSlot threadSlot;
+
+/*!
+ \brief Assigns histograms to the calling thread, reuses those of an exited thread
+*/
+ThreadHistograms * acquireThreadHistograms()
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(std::vector<ThreadHistograms *>::iterator it = registry.begin(); it != registry.end(); ++it)
+    {
+        if(!(*it)->inUse)
+        {
+            (*it)->inUse = true;
+            return *it;
+        }
+    }
+
+    registry.push_back(new ThreadHistograms());
+    return registry.back();
+}
+
+/*!
+ \brief Increments a counter which is only written by the calling thread
+*/
+inline void increment(std::atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+}
+
+LatencyHistogram::LatencyHistogram()
+    :mBuckets(BUCKET_COUNT, 0), mCount(0), mSum(0), mMax(0)
+{
+}
+
+void LatencyHistogram::add(uint64_t ns)
+{
+    ++mBuckets[bucketOf(ns)];
+    ++mCount;
+    mSum += ns;
+    if(ns > mMax)
+        mMax = ns;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for(unsigned b=0; b<BUCKET_COUNT; ++b)
+        mBuckets[b] += other.mBuckets[b];
+    mCount += other.mCount;
+    mSum += other.mSum;
+    if(other.mMax > mMax)
+        mMax = other.mMax;
+}
+
+uint64_t LatencyHistogram::getPercentile(double p) const
+{
+    if(mCount == 0)
+        return 0;
+
+    // smallest bucket with at least p * count durations up to it
+    uint64_t rank = (uint64_t) (p * mCount + 0.5);
+    if(rank < 1)
+        rank = 1;
+    uint64_t sum = 0;
+    for(unsigned b=0; b<BUCKET_COUNT; ++b)
+    {
+        sum += mBuckets[b];
+        if(sum >= rank)
+            return std::min(bucketUpperBound(b), mMax);
+    }
+
+    return mMax;
+}
+
+unsigned LatencyHistogram::bucketOf(uint64_t ns)
+{
+    if(ns < SUB_BUCKETS)
+        return ns;
+
+    // the 4 bits after the leading one select the sub-bucket
+    const unsigned msb = 63 - __builtin_clzll(ns);
+    const unsigned bucket = (msb - 3) * SUB_BUCKETS + ((ns >> (msb - 4)) & (SUB_BUCKETS - 1));
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned bucket)
+{
+    if(bucket < SUB_BUCKETS)
+        return bucket;
+
+    const unsigned shift = bucket / SUB_BUCKETS - 1;
+    const uint64_t lower = (uint64_t) (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+    return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+bool Instrumentation::isEnabled()
+{
+#ifdef STARCAM_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+}
+
+const char * Instrumentation::getProbeName(Instrumentation::Probe probe)
+{
+    switch(probe)
+    {
+    case GrabFrame:
+        return "grab_frame";
+    case Conversion:
+        return "conversion";
+    case Threshold:
+        return "threshold";
+    case Labelling:
+        return "labelling";
+    case SpotVectors:
+        return "spot_vectors";
+    case KVectorQuery:
+        return "kvector_query";
+    case TriadMatching:
+        return "triad_matching";
+    case AttitudeOutput:
+        return "attitude";
+    case ProbeCount: ;
+    }
+
+    throw std::invalid_argument("Unknown probe");
+}
+
+void Instrumentation::record(Instrumentation::Probe probe, uint64_t ns)
+{
+    ThreadHistograms * histograms = threadSlot.histograms;
+    if(!histograms)
+        histograms = threadSlot.histograms = acquireThreadHistograms();
+
+    ProbeCounters & counters = histograms->probes[probe];
+    increment(counters.buckets[LatencyHistogram::bucketOf(ns)], 1);
+    increment(counters.sum, ns);
+    if(ns > counters.max.load(std::memory_order_relaxed))
+        counters.max.store(ns, std::memory_order_relaxed);
+}
+
+void Instrumentation::snapshot(std::vector<LatencyHistogram> &histograms)
+{
+    histograms.assign(ProbeCount, LatencyHistogram());
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for(std::vector<ThreadHistograms *>::const_iterator it = registry.begin(); it != registry.end(); ++it)
+    {
+        for(unsigned p=0; p<ProbeCount; ++p)
+        {
+            // the count is taken from the buckets, so it matches them even while the thread records
+            const ProbeCounters & counters = (*it)->probes[p];
+            LatencyHistogram & histogram = histograms[p];
+            for(unsigned b=0; b<LatencyHistogram::BUCKET_COUNT; ++b)
+            {
+                const uint64_t n = counters.buckets[b].load(std::memory_order_relaxed);
+                histogram.mBuckets[b] += n;
+                histogram.mCount += n;
+            }
+            histogram.mSum += counters.sum.load(std::memory_order_relaxed);
+            histogram.mMax = std::max(histogram.mMax, counters.max.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+void Instrumentation::writeCsv(std::ostream &os, bool header)
+{
+    std::vector<LatencyHistogram> histograms;
+    snapshot(histograms);
+
+    if(header)
+        os << "probe,count,mean_us,p50_us,p99_us,max_us" << std::endl;
+
+    const std::ios::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    for(unsigned p=0; p<ProbeCount; ++p)
+    {
+        const LatencyHistogram & h = histograms[p];
+        os << getProbeName((Probe) p) << "," << h.getCount() << "," << h.getMean() * 1e-3 << ","
+           << h.getPercentile(0.5) * 1e-3 << "," << h.getPercentile(0.99) * 1e-3 << "," << h.getMax() * 1e-3 << std::endl;
+    }
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Instrumentation::writeJson(std::ostream &os)
+{
+    std::vector<LatencyHistogram> histograms;
+    snapshot(histograms);
+
+    const std::ios::fmtflags flags = os.flags();
+    const std::streamsize precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    os << "{" << std::endl;
+    for(unsigned p=0; p<ProbeCount; ++p)
+    {
+        const LatencyHistogram & h = histograms[p];
+        os << "  \"" << getProbeName((Probe) p) << "\": {\"count\": " << h.getCount()
+           << ", \"mean_us\": " << h.getMean() * 1e-3
+           << ", \"p50_us\": " << h.getPercentile(0.5) * 1e-3
+           << ", \"p99_us\": " << h.getPercentile(0.99) * 1e-3
+           << ", \"max_us\": " << h.getMax() * 1e-3 << "}"
+           << (p + 1 < ProbeCount ? "," : "") << std::endl;
+    }
+    os << "}" << std::endl;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Instrumentation::writeReport(const std::string &filename)
+{
+    const std::string tmpName = filename + ".tmp";
+    std::ofstream file(tmpName.c_str());
+    if(!file.is_open())
+        throw std::runtime_error("Unable to write latency report " + filename);
+
+    const std::string ext(".json");
+    if(filename.size() >= ext.size() && filename.compare(filename.size() - ext.size(), ext.size(), ext) == 0)
+        writeJson(file);
+    else
+        writeCsv(file);
+
+    file.close();
+    if(std::rename(tmpName.c_str(), filename.c_str()) != 0)
+        throw std::runtime_error("Unable to write latency report " + filename);
+}
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#include "kvectorfile.h"
+
+namespace
+{
+/*!
+ \brief Feature with its cosine, used for sorting while building the image
+*/
+struct SortedFeature
+{
+    float cosTheta;
+    float theta;
+    int hip1;
+    int hip2;
+
+    bool operator<(const SortedFeature &other) const { return cosTheta < other.cosTheta; }
+};
+}
+
+void buildKVectorImage(const std::vector<Feature2> &features, std::vector<uint8_t> &image)
+{
+    if(features.size() < 2)
+        throw std::invalid_argument("At least 2 features necessary for a k-Vector");
+
+    const double DEG_TO_RAD = M_PI / 180.0;
+
+    // star table: all hip-IDs in ascending order
+    std::vector<int32_t> hips;
+    hips.reserve(2 * features.size());
+    for(std::vector<Feature2>::const_iterator it = features.begin(); it != features.end(); ++it)
+    {
+        hips.push_back(it->id1);
+        hips.push_back(it->id2);
+    }
+    std::sort(hips.begin(), hips.end());
+    hips.erase(std::unique(hips.begin(), hips.end()), hips.end());
+
+    if(hips.size() > std::numeric_limits<uint16_t>::max())
+        throw std::runtime_error("Too many stars for 16-bit catalog indices");
+
+    std::vector<SortedFeature> sorted(features.size());
+    for(std::size_t i=0; i<features.size(); ++i)
+    {
+        sorted[i].theta = features[i].theta;
+        sorted[i].cosTheta = (float) cos(features[i].theta * DEG_TO_RAD);
+        sorted[i].hip1 = features[i].id1;
+        sorted[i].hip2 = features[i].id2;
+    }
+    std::stable_sort(sorted.begin(), sorted.end());
+
+    const uint32_t n = sorted.size();
+    const uint32_t nStars = hips.size();
+
+    // k-vector: z(i) = m*i + q with z(0) < ymin and z(n-1) > ymax (Mortari)
+    const double kEps = std::numeric_limits<float>::epsilon();
+    const double ymin = sorted.front().cosTheta;
+    const double ymax = sorted.back().cosTheta;
+    const double m = (ymax - ymin + 2 * kEps) / (n - 1);
+    const double q = ymin - kEps;
+
+    // allocate image and set up the arrays
+    const std::size_t dataSize = nStars * sizeof(int32_t)
+            + n * (sizeof(int32_t) + 2 * sizeof(float) + 2 * sizeof(uint16_t));
+    image.assign(sizeof(KVectorFileHeader) + dataSize, 0);
+
+    KVectorFileHeader * header = (KVectorFileHeader *) &image[0];
+    uint8_t * data = &image[0] + sizeof(KVectorFileHeader);
+    int32_t * hip = (int32_t *) data;
+    int32_t * kVector = hip + nStars;
+    float * cosTheta = (float *) (kVector + n);
+    float * theta = cosTheta + n;
+    uint16_t * id1 = (uint16_t *) (theta + n);
+    uint16_t * id2 = id1 + n;
+
+    std::copy(hips.begin(), hips.end(), hip);
+
+    uint32_t count = 0;
+    for(uint32_t i=0; i<n; ++i)
+    {
+        cosTheta[i] = sorted[i].cosTheta;
+        theta[i] = sorted[i].theta;
+        id1[i] = std::lower_bound(hips.begin(), hips.end(), sorted[i].hip1) - hips.begin();
+        id2[i] = std::lower_bound(hips.begin(), hips.end(), sorted[i].hip2) - hips.begin();
+
+        // number of features with cosTheta <= z(i)
+        const double z = m * i + q;
+        while(count < n && sorted[count].cosTheta <= z)
+            ++count;
+        kVector[i] = count;
+    }
+
+    std::memcpy(header->magic, KVECTOR_FILE_MAGIC, sizeof(KVECTOR_FILE_MAGIC));
+    header->version = KVECTOR_FILE_VERSION;
+    header->q = q;
+    header->m = m;
+    header->featureCount = n;
+    header->starCount = nStars;
+    header->checksum = dataChecksum(data, dataSize);
+    header->reserved = 0;
+}
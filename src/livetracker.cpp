@@ -0,0 +1,239 @@
+#include <thread>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "livetracker.h"
+#include "getTime.h"
+#include "instrumentation.h"
+
+LiveTracker::LiveTracker(StarCamera &camera, const StarIdentifier &identifier)
+    :mCamera(camera), mPipeline(identifier.getCatalog()), mFrameRate(0.0f),
+      mCentroiding(StarCamera::ConnectedComponentsWeighted), mReportInterval(10.0),
+      mFrameQueue(2), mSpotQueue(2), mVectorQueue(2),
+      mStop(false), mCaptureDone(false), mExtractionDone(false),
+      mDroppedFrames(0), mCameraDroppedFrames(0), mFailedFrames(0)
+{
+    mPipeline.getIdentifier().setMaxCandidates(identifier.getMaxCandidates());
+    mPipeline.getIdentifier().setMagnitudeTolerance(identifier.getMagnitudeTolerance());
+}
+
+void LiveTracker::run(unsigned nFrames, ResultCallback callback)
+{
+    mStop = false;
+    mCaptureDone = false;
+    mExtractionDone = false;
+    mDroppedFrames = 0;
+    mFailedFrames = 0;
+    mExtractionStats = StageStatistics();
+    mVectorStats = StageStatistics();
+    mIdentificationStats = StageStatistics();
+    mTotalStats = StageStatistics();
+    mPipeline.getTrackingIdentifier().reset();
+
+    mCamera.startStreaming();
+
+    std::thread capture(&LiveTracker::captureStage, this);
+    std::thread extraction(&LiveTracker::extractionStage, this);
+    std::thread vectors(&LiveTracker::vectorStage, this);
+
+    // the last stage runs in the calling thread, so the callback does not need to be thread safe
+    identificationStage(nFrames, callback);
+
+    mStop = true;
+    capture.join();
+    extraction.join();
+    vectors.join();
+
+    mCameraDroppedFrames = mCamera.getDroppedFrames();
+    mCamera.stopStreaming();
+
+    if(!mLatencyReport.empty())
+        Instrumentation::writeReport(mLatencyReport);
+}
+
+void LiveTracker::printStatistics(std::ostream &os) const
+{
+    os << "Stage\tCount\tMean [s]\tMax [s]" << std::endl;
+    os << "extraction\t" << mExtractionStats.count << "\t"
+       << mExtractionStats.mean() << "\t" << mExtractionStats.max << std::endl;
+    os << "vectors\t" << mVectorStats.count << "\t"
+       << mVectorStats.mean() << "\t" << mVectorStats.max << std::endl;
+    os << "identification\t" << mIdentificationStats.count << "\t"
+       << mIdentificationStats.mean() << "\t" << mIdentificationStats.max << std::endl;
+    os << "total\t" << mTotalStats.count << "\t"
+       << mTotalStats.mean() << "\t" << mTotalStats.max << std::endl;
+    os << "Dropped frames (pipeline): " << mDroppedFrames << std::endl;
+    os << "Dropped frames (camera): " << mCameraDroppedFrames << std::endl;
+    os << "Failed identifications: " << mFailedFrames << std::endl;
+    if(mPipeline.getTracking())
+    {
+        const TrackingIdentifier & tracking = mPipeline.getTrackingIdentifier();
+        os << "Tracked frames: " << tracking.getTrackedFrames() << std::endl;
+        os << "Lost-in-space frames: " << tracking.getLostInSpaceFrames() << std::endl;
+    }
+}
+
+void LiveTracker::idle()
+{
+    usleep(200);
+}
+
+void LiveTracker::captureStage()
+{
+    unsigned frame = 0;
+    const double start = getRealTime();
+
+    while(!mStop)
+    {
+        // wait for the next slot if the frame rate is limited
+        if(mFrameRate > 0.0f)
+        {
+            double next = start + frame / mFrameRate;
+            double now = getRealTime();
+            if(next > now)
+                usleep((useconds_t) ((next - now) * 1e6));
+        }
+
+        FrameToken token;
+        if(!mCamera.acquireRawFrame(&token.buffer, &token.timestamp))
+            continue;
+
+        // when rate limited, skip to the most recent frame in the ring
+        if(mFrameRate > 0.0f)
+        {
+            FrameToken newer;
+            while(mCamera.acquireRawFrame(&newer.buffer, &newer.timestamp, 0))
+            {
+                mCamera.releaseRawFrame(token.buffer);
+                token = newer;
+            }
+        }
+
+        token.frame = frame++;
+        if(!mFrameQueue.tryPush(token))
+        {
+            mCamera.releaseRawFrame(token.buffer);
+            ++mDroppedFrames;
+        }
+    }
+
+    mCaptureDone = true;
+}
+
+void LiveTracker::extractionStage()
+{
+    const unsigned rows = mCamera.getCameraRows();
+    const unsigned cols = mCamera.getCameraCols();
+
+    FrameToken token;
+    Result result;
+    while(true)
+    {
+        if(!mFrameQueue.tryPop(token))
+        {
+            // no new frames after the capture stage is done, so the queue is final
+            if(mCaptureDone && mFrameQueue.empty())
+                break;
+            idle();
+            continue;
+        }
+
+        // hand back frames which arrive after the stop request without processing them
+        if(mStop)
+        {
+            mCamera.releaseRawFrame(token.buffer);
+            continue;
+        }
+
+        double startTime = getRealTime();
+        mCamera.getImageFromBuffer(token.buffer, rows, cols);
+        mCamera.extractSpots(mCentroiding);
+        // with raw centroiding the spots are extracted from the buffer itself
+        mCamera.releaseRawFrame(token.buffer);
+        mExtractionStats.add(getRealTime() - startTime);
+
+        result.frame = token.frame;
+        result.timestamp = token.timestamp;
+        result.spots = mCamera.getSpots();
+
+        if(!mSpotQueue.tryPush(result))
+            ++mDroppedFrames;
+    }
+
+    mExtractionDone = true;
+}
+
+void LiveTracker::vectorStage()
+{
+    Result result;
+    while(true)
+    {
+        if(!mSpotQueue.tryPop(result))
+        {
+            if(mExtractionDone && mSpotQueue.empty())
+                break;
+            idle();
+            continue;
+        }
+
+        if(mStop)
+            continue;
+
+        double startTime = getRealTime();
+        if(result.spots.empty())
+            result.spotVectors.clear();
+        else
+            mCamera.calculateSpotVectors(result.spots, result.spotVectors);
+        mVectorStats.add(getRealTime() - startTime);
+
+        if(!mVectorQueue.tryPush(result))
+            ++mDroppedFrames;
+    }
+}
+
+void LiveTracker::identificationStage(unsigned nFrames, ResultCallback &callback)
+{
+    unsigned identified = 0;
+    double nextReport = getRealTime() + mReportInterval;
+    Result result;
+    while(!mStop && (nFrames == 0 || identified < nFrames))
+    {
+        if(!mVectorQueue.tryPop(result))
+        {
+            idle();
+            continue;
+        }
+
+        double startTime = getRealTime();
+        try
+        {
+            const Pipeline::Result & identified = mPipeline.identify(result.spots, result.spotVectors);
+            result.ids = identified.ids;
+            result.attitude = identified.attitude;
+            // not enough spots for an identification
+            if(!identified.identified)
+                ++mFailedFrames;
+        }
+        catch(std::exception &)
+        {
+            // e.g. not enough spots for an identification
+            result.ids.assign(result.spotVectors.size(), -1);
+            result.attitude = Attitude();
+            ++mFailedFrames;
+        }
+        double endTime = getRealTime();
+        mIdentificationStats.add(endTime - startTime);
+
+        result.latency = endTime - result.timestamp;
+        mTotalStats.add(result.latency);
+
+        callback(result);
+        ++identified;
+
+        if(!mLatencyReport.empty() && endTime >= nextReport)
+        {
+            Instrumentation::writeReport(mLatencyReport);
+            nextReport = endTime + mReportInterval;
+        }
+    }
+}
@@ -9,11 +9,19 @@
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
+#include <csignal>
 
 #include "tclap/CmdLine.h"
 #include "starcamera.h"
+#include "defectmap.h"
+#include "framecorrection.h"
 #include "starid.h"
+#include "livetracker.h"
+#include "batchreplay.h"
+#include "fixserver.h"
+#include "attitude.h"
 #include "getTime.h"
+#include "instrumentation.h"
 
 using namespace std;
 
@@ -30,16 +38,41 @@ bool printStats; /*!< TODO */
 TCLAP::CmdLine cmd("Program for attitude estimation from star images",' ', "0.1");
 
 TCLAP::ValueArg<float> epsilon("e", "epsilon", "The allowed tolerance for the feature (in degrees)", false, 0.1, "float");
-TCLAP::ValueArg<string> test("", "test", "Run test specified test (all other input will be ignored):\n -camera: Grab a frame from camera and display it on screen", false, string(), "string");
+TCLAP::ValueArg<string> test("", "test", "Run test specified test (all other input will be ignored):\n -camera: Grab a frame from camera and display it on screen\n -eps-sweep: Runtime of the identification for increasing tolerances\n -defect-calibration: Build the defect map (see --defect-map) from the dark frames given as files", false, string(), "string");
 TCLAP::ValueArg<unsigned> area("a", "area", "The minimum area (in pixel) for a spot to be considered for identification", false, 16, "unsigned int");
 TCLAP::ValueArg<unsigned> threshold("t", "threshold", "Threshold under which pixels are set to 0", false, 64, "unsigned int");
 TCLAP::ValueArg<string> calibrationFile("", "calibration", "Set the calibration file for the camera manually", false, "/home/jan/workspace/usu/starcamera/bin/aptina_12_5mm-calib.txt", "filename");
+TCLAP::ValueArg<string> darkFile("", "dark", "Subtract this raw dark frame (taken with the exposure of the images) from every image", false, string(), "filename");
+TCLAP::ValueArg<string> flatFile("", "flat", "Correct every image with the gain derived from this raw flat field", false, string(), "filename");
 TCLAP::ValueArg<string> initFile("", "init", "Set the file for initialization of the Aptina camera", false, string(), "filename");
 TCLAP::ValueArg<string> dbFile("", "db", "Set the file containing the featurelist in the SQLite database format", false, string(), "filename");
+TCLAP::ValueArg<string> catalogFile("", "catalog", "Set the hip-catalog (SQLite database) to determine the attitude from the identified stars", false, string(), "filename");
 TCLAP::ValueArg<string> kVectorFile("", "kvector", "Set the for loading kVector information", false, "/home/jan/workspace/usu/starcamera/bin/kVectorInput.txt", "filename");
 
 TCLAP::SwitchArg stats("s", "stats", "Print statistics (number of spots, number of identified spots, ratio");
 TCLAP::SwitchArg useCamera("c", "camera", "Use the connected Aptina camera as input (input files will be ignored)");
+TCLAP::SwitchArg live("l", "live", "Continuously identify frames from the camera until interrupted (requires --camera)");
+TCLAP::SwitchArg rawCentroiding("", "raw", "Extract the spots from the raw 12-bit images instead of the converted 8-bit ones");
+TCLAP::SwitchArg psfFit("", "psf-fit", "Refine the centroids of the connected components with a Gaussian PSF fit (more accurate for dim stars)");
+TCLAP::SwitchArg dropFrame("", "drop-frame", "Only write the thresholded image when loading, which saves a frame of memory traffic (--psf-fit then requires --raw)");
+TCLAP::SwitchArg adaptiveThreshold("", "adaptive", "Threshold each 64x64 tile relative to its estimated background instead of using --threshold");
+TCLAP::ValueArg<string> defectMapFile("", "defect-map", "Ignore the hot pixels and defective columns of this defect map (written by --test defect-calibration)", false, string(), "filename");
+TCLAP::ValueArg<unsigned> undistortionGrid("", "undistortion-grid", "Interpolate the lens undistortion in a grid with this spacing (in px), 0 undistorts each spot iteratively", false, 0, "unsigned int");
+TCLAP::SwitchArg track("", "track", "In live mode identify the stars from the previous frame and only fall back to lost-in-space identification when tracking is lost");
+TCLAP::ValueArg<float> frameRate("", "rate", "Maximum frame rate (in Hz) in live mode, 0 processes every frame", false, 0.0f, "float");
+TCLAP::ValueArg<unsigned> nFrames("", "frames", "Number of frames to identify in live mode, 0 runs until interrupted", false, 0, "unsigned int");
+TCLAP::ValueArg<unsigned> threads("", "threads", "Number of threads for the identification (default 1), 0 uses all cores", false, 1, "unsigned int");
+TCLAP::ValueArg<unsigned> candidates("", "candidates", "Form the triads of the identification only of the n brightest spots, 0 uses all spots", false, 0, "unsigned int");
+TCLAP::ValueArg<float> magnitudeTolerance("", "magnitude-tolerance", "Drop candidate pairs whose catalog magnitudes contradict the spot brightness by more than this (in mag), requires --catalog, 0 disables the check", false, 0.0f, "float");
+TCLAP::ValueArg<unsigned> connectivity("", "connectivity", "Neighbours of a pixel joined into one spot: 8 (with diagonals) or 4", false, 8, "unsigned int");
+TCLAP::ValueArg<unsigned> extractThreads("", "extract-threads", "Number of threads for the spot extraction (default 1), 0 uses all cores", false, 1, "unsigned int");
+TCLAP::ValueArg<string> latencyReport("", "latency-report", "Write the latency histograms of the processing steps to this file (JSON if it ends with .json, CSV otherwise), requires a build with STARCAM_INSTRUMENTATION", false, string(), "filename");
+TCLAP::ValueArg<string> daemonSocket("", "daemon", "Stay resident and compute a fix for every request on this Unix socket (grabbed from the camera with --camera, see FixServer for the requests)", false, string(), "filename");
+TCLAP::SwitchArg batch("", "batch", "Replay the files in parallel (see --workers) with the catalog loaded once and write one record per image in input order");
+TCLAP::ValueArg<unsigned> workers("", "workers", "Number of parallel workers of --batch, 0 uses all cores", false, 0, "unsigned int");
+TCLAP::ValueArg<string> batchFormat("", "batch-format", "Output format of --batch: csv or binary", false, "csv", "string");
+TCLAP::ValueArg<string> batchOutput("", "batch-output", "Write the records of --batch to this file instead of stdout", false, string(), "filename");
+TCLAP::ValueArg<float> latencyInterval("", "latency-interval", "Time between two latency reports (in s) in live mode", false, 10.0f, "float");
 TCLAP::UnlabeledMultiArg<string> files("fileNames", "List of filenames of the raw-image files", false, "file1");
 
 
@@ -72,6 +105,30 @@ std::ostream & operator << (std::ostream & os, const Spot& spot)
     return os;
 }
 
+/*!
+ \brief Printing function for Attitude structure
+
+ Prints the quaternion (w x y z) and the standard deviation of the 3 error angles (in arcsec)
+
+ \param os
+ \param attitude
+ \return std::ostream &operator
+*/
+std::ostream & operator << (std::ostream & os, const Attitude& attitude)
+{
+    const double RAD_TO_ARCSEC = 180.0 / M_PI * 3600.0;
+    os << "Attitude: ";
+    if(!attitude.valid)
+        return os << "-";
+
+    os << attitude.quaternion.w() << "\t" << attitude.quaternion.x() << "\t"
+       << attitude.quaternion.y() << "\t" << attitude.quaternion.z() << "\t"
+       << sqrt(attitude.covariance(0, 0)) * RAD_TO_ARCSEC << "\t"
+       << sqrt(attitude.covariance(1, 1)) * RAD_TO_ARCSEC << "\t"
+       << sqrt(attitude.covariance(2, 2)) * RAD_TO_ARCSEC;
+    return os;
+}
+
 /*!
  \brief Printing function for information of the star-id process
 
@@ -108,6 +165,8 @@ void centroidingComparison()
     {
         // for each file extract spots with all methods and print data to files, together with runtime
         starCam.getImageFromFile(*file);
+        if(file + 1 != fileNames.end())
+            starCam.prefetchImageFile(*(file + 1));
         double endTime, startTime;
         vector<double> runtimes;
         vector<vector<Spot> > spotLists;
@@ -201,17 +260,20 @@ void centroidingComparison()
 void identificationComparison()
 {
     const float eps = epsilon.getValue();
+
+    starId.setFeatureListDB(dbFile.getValue());
+    starId.openDb();
+    starId.loadFeatureListKVector(kVectorFile.getValue());
+
     vector<string> fileNames = files.getValue();
     for (vector<string>::const_iterator file = fileNames.begin(); file!=fileNames.end(); ++file)
     {
         starCam.getImageFromFile(*file);
+        if(file + 1 != fileNames.end())
+            starCam.prefetchImageFile(*(file + 1));
         starCam.extractSpots();
         starCam.calculateSpotVectors();
 
-        starId.setFeatureListDB(dbFile.getValue());
-        starId.openDb();
-        starId.loadFeatureListKVector(kVectorFile.getValue());
-
         double endTime, startTime;
         vector<double> runtimes;
         vector<vector<int> > idLists;
@@ -258,29 +320,180 @@ void identificationComparison()
 
 
 /*!
- \brief Quick and dirty function atm
+ \brief Counts the identified entries of an id list
+
+ \param idList
+ \return unsigned
+*/
+unsigned countIdentified(const std::vector<int> &idList)
+{
+    unsigned count = 0;
+    for(unsigned i=0; i<idList.size(); ++i)
+    {
+        if(idList[i] != -1)
+            ++count;
+    }
+    return count;
+}
+
+/*!
+ \brief Measures the runtime of the identification for increasing tolerances
+
+ Larger tolerances return more candidates from the feature list, so this
+ shows how the triad matching scales with the number of candidates. The
+ spots of each file are extracted once and then identified with every eps of
+ the sweep (k-vector and, if a database is given, SQL pyramid method).
+
+*/
+void epsilonSweep()
+{
+    const float sweep[] = {0.005f, 0.01f, 0.02f, 0.05f, 0.1f, 0.2f, 0.5f, 1.0f};
+    const unsigned nSweep = sizeof(sweep) / sizeof(sweep[0]);
+    const unsigned repetitions = 10;
+
+    starId.loadFeatureListKVector(kVectorFile.getValue());
+    const bool useDb = !dbFile.getValue().empty();
+    if(useDb)
+    {
+        starId.setFeatureListDB(dbFile.getValue());
+        starId.openDb();
+    }
+
+    StarIdentifier::Scratch scratch;
+    scratch.reserve(starId);
+    vector<int> idList;
+
+    vector<string> fileNames = files.getValue();
+    for (vector<string>::const_iterator file = fileNames.begin(); file!=fileNames.end(); ++file)
+    {
+        starCam.getImageFromFile(*file);
+        if(file + 1 != fileNames.end())
+            starCam.prefetchImageFile(*(file + 1));
+        starCam.extractSpots();
+        starCam.calculateSpotVectors();
+
+        /* print the data in the following form:
+         * File: <filename>
+         * <eps><runtime kVector><identified kVector>[<runtime SQL><identified SQL>]
+         * [...]
+         */
+        unsigned pos = file->find_last_of("/\\");
+        cout << "File: " << file->substr(pos+1, file->size()-5-pos) << endl;
+
+        for(unsigned e=0; e<nSweep; ++e)
+        {
+            double startTime = getRealTime();
+            for(unsigned n=0; n<repetitions; ++n)
+                starId.identifyStars(starCam.getSpotVectors(), sweep[e], idList, scratch, StarIdentifier::PyramidKVector);
+            double endTime = getRealTime();
+            cout << sweep[e] << "\t" << (endTime - startTime) / repetitions << "\t" << countIdentified(idList);
+
+            if(useDb)
+            {
+                startTime = getRealTime();
+                idList = starId.identifyStars(starCam.getSpotVectors(), sweep[e], StarIdentifier::PyramidSQL);
+                endTime = getRealTime();
+                cout << "\t" << endTime - startTime << "\t" << countIdentified(idList);
+            }
+            cout << endl;
+        }
+    }
+}
+
+/*!
+ \brief Builds the defect map from the dark frames given as files and writes it to --defect-map
+
+ A pixel above --threshold in at least half of the frames is a defect.
+*/
+void defectCalibration()
+{
+    if(defectMapFile.getValue().empty())
+        throw std::invalid_argument("Defect calibration requires --defect-map");
+
+    vector<string> fileNames = files.getValue();
+    if(fileNames.empty())
+        throw std::invalid_argument("Defect calibration requires dark frames");
+
+    DefectMap defects;
+    for(vector<string>::const_iterator file = fileNames.begin(); file != fileNames.end(); ++file)
+    {
+        starCam.getImageFromFile(*file);
+        if(file + 1 != fileNames.end())
+            starCam.prefetchImageFile(*(file + 1));
+
+        const cv::Mat_<uint16_t> & raw = starCam.getRawFrame();
+        if(file == fileNames.begin())
+            defects.beginCalibration(raw.rows, raw.cols);
+        defects.addDarkFrame((const uint16_t *) raw.data, starCam.getThreshold());
+    }
+    defects.endCalibration();
+    defects.save(defectMapFile.getValue());
+
+    cout << "Defects: " << defects.getPixelCount() << " pixels in " << defects.getRuns().size() << " runs" << endl;
+}
+
+/*!
+ \brief Loads the feature list and, if given, the star catalog into starId
+*/
+void loadCatalog()
+{
+    starId.loadFeatureListKVector(kVectorFile.getValue());
+    if(!catalogFile.getValue().empty())
+    {
+        const unsigned missing = starId.loadStarCatalog(catalogFile.getValue());
+        if(missing)
+            std::cerr << "Warning: " << missing << " stars of the feature list are missing in the star catalog" << endl;
+    }
+}
+
+/*!
+ \brief Returns the centroiding method of the identification modes (see --psf-fit)
+
+ \return StarCamera::CentroidingMethod
+*/
+StarCamera::CentroidingMethod centroidingMethod()
+{
+    return psfFit.getValue() ? StarCamera::ConnectedComponentsGaussianFit : StarCamera::ConnectedComponentsWeighted;
+}
+
+/*!
+ \brief Identifies the stars of the image loaded into starCam (the catalog has to be loaded, see loadCatalog())
 
  \param eps
 */
 void identifyStars(float eps)
 {
-    starCam.extractSpots(StarCamera::ConnectedComponentsWeighted);
+    starCam.extractSpots(centroidingMethod());
     starCam.calculateSpotVectors();
 
     //    starId.setFeatureListDB("/home/jan/workspace/usu/starcamera/bin/featureList2.db");
     //    starId.openDb();
 
-    starId.loadFeatureListKVector(kVectorFile.getValue());
-
     //    starId.identifyPyramidMethod(starCam.getSpotVectors(), eps);
 
-    std::vector<int> idStars = starId.identifyStars(starCam.getSpotVectors(),eps);
+    const StarIdentifier::IdentificationMethod method = (threads.getValue() == 1) ?
+                StarIdentifier::PyramidKVector : StarIdentifier::PyramidKVectorParallel;
+    const std::vector<Spot> &spots = starCam.getSpots();
+    std::vector<float> brightness(spots.size());
+    for(unsigned s=0; s<spots.size(); ++s)
+        brightness[s] = spots[s].flux;
+
+    std::vector<int> idStars;
+    StarIdentifier::Scratch scratch;
+    starId.identifyStars(starCam.getSpotVectors(), eps, idStars, scratch, method, &brightness);
 
     if(printStats)
         outputStats(cout, idStars, starCam.getSpots());
     else
         cout << idStars;
 
+    if(starId.hasStarCatalog())
+    {
+        Attitude attitude;
+        AttitudeSolver().solve(starCam.getSpotVectors(), idStars, starId, attitude);
+        cout << attitude << endl;
+    }
+
     cout << endl;
 }
 
@@ -300,6 +513,211 @@ void liveIdentification(float eps)
     counter++;
 }
 
+LiveTracker * liveTracker = NULL; /*!< Tracker used in live mode, needed to stop it from the signal handler*/
+
+/*!
+ \brief Signal handler which stops the live tracking
+
+ \param signal
+*/
+void stopLiveTracking(int signal)
+{
+    if(liveTracker)
+        liveTracker->stop();
+}
+
+/*!
+ \brief Prints the result of a frame processed in live mode
+
+ \param result
+*/
+void printLiveResult(const LiveTracker::Result &result)
+{
+    cout << "Frame: " << result.frame << endl;
+
+    if(printStats)
+        outputStats(cout, result.ids, result.spots);
+    else
+        cout << result.ids;
+
+    if(result.attitude.valid)
+        cout << result.attitude << endl;
+
+    cout << endl;
+}
+
+/*!
+ \brief Continuously identifies frames from the Aptina
+
+ The feature list is loaded only once and the frames are processed in a
+ pipeline (see LiveTracker) until the requested number of frames is
+ identified or the program receives SIGINT.
+
+ \param eps
+*/
+void liveTracking(float eps)
+{
+    LiveTracker tracker(starCam, starId);
+    tracker.setEpsilon(eps);
+    tracker.setCentroidingMethod(centroidingMethod());
+    tracker.setFrameRate(frameRate.getValue());
+    tracker.setTracking(track.getValue());
+    tracker.setLatencyReport(latencyReport.getValue(), latencyInterval.getValue());
+
+    liveTracker = &tracker;
+    std::signal(SIGINT, stopLiveTracking);
+
+    tracker.run(nFrames.getValue(), printLiveResult);
+
+    std::signal(SIGINT, SIG_DFL);
+    liveTracker = NULL;
+
+    tracker.printStatistics(cout);
+}
+
+/*!
+ \brief Configures a pipeline like starCam and starId, sharing the catalog of starId
+
+ The pipeline runs single threaded.
+
+ \param pipeline
+ \param eps
+*/
+void configurePipeline(Pipeline &pipeline, float eps)
+{
+    StarCamera & camera = pipeline.getCamera();
+    camera.setMinArea(starCam.getMinArea());
+    camera.setThreshold(starCam.getThreshold());
+    camera.loadCalibration(calibrationFile.getValue());
+    camera.setRawCentroiding(starCam.getRawCentroiding());
+    camera.setKeepFrame(starCam.getKeepFrame());
+    camera.setAdaptiveThreshold(starCam.getAdaptiveThreshold());
+    camera.setUndistortionGrid(starCam.getUndistortionGrid());
+    camera.setDefectMap(starCam.getDefectMap());
+    camera.setFrameCorrection(starCam.getFrameCorrection());
+    camera.setConnectivity(starCam.getConnectivity());
+
+    StarIdentifier & identifier = pipeline.getIdentifier();
+    identifier.setMaxCandidates(starId.getMaxCandidates());
+    identifier.setMagnitudeTolerance(starId.getMagnitudeTolerance());
+    pipeline.setEpsilon(eps);
+    pipeline.setCentroidingMethod(centroidingMethod());
+}
+
+FixServer * fixServer = NULL; /*!< Server of the daemon mode, needed to stop it from the signal handler*/
+
+/*!
+ \brief Signal handler which stops the daemon
+
+ \param signal
+*/
+void stopDaemon(int signal)
+{
+    if(fixServer)
+        fixServer->stop();
+}
+
+/*!
+ \brief Serves fix requests on the socket of --daemon until shutdown or SIGINT/SIGTERM
+
+ The camera, the calibration and the catalog are set up once before, so a
+ request only costs the grab and the processing of its frame. The fixes are
+ computed by a pipeline configured like starCam, with the threads of
+ --threads and --extract-threads.
+
+ \param eps
+*/
+void daemonMode(float eps)
+{
+    Pipeline pipeline(starId.getCatalog());
+    configurePipeline(pipeline, eps);
+    if(extractThreads.getValue() != 1)
+        pipeline.getCamera().setNumThreads(extractThreads.getValue());
+    if(threads.getValue() != 1)
+    {
+        pipeline.getIdentifier().setNumThreads(threads.getValue());
+        pipeline.setIdentificationMethod(StarIdentifier::PyramidKVectorParallel);
+    }
+    if(useCamera.getValue())
+    {
+        if (initFile.getValue().empty())
+            pipeline.getCamera().initializeCamera(NULL);
+        else
+            pipeline.getCamera().initializeCamera(initFile.getValue());
+    }
+
+    FixServer server(pipeline, useCamera.getValue());
+    server.listen(daemonSocket.getValue());
+
+    fixServer = &server;
+    std::signal(SIGINT, stopDaemon);
+    std::signal(SIGTERM, stopDaemon);
+    cout << "Listening on " << daemonSocket.getValue() << endl;
+
+    server.run();
+
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    fixServer = NULL;
+
+    const FixServer::Stats & stats = server.getStats();
+    cout << "Fixes: " << stats.fixes << ", identified: " << stats.identified << ", failed: " << stats.failed << endl;
+}
+
+/*!
+ \brief Replays the files with a pool of workers
+
+ The catalog of starId is shared by the pipelines of all workers, which
+ are configured like starCam (single threaded, the workers run in parallel).
+ The records are written in input order (see BatchReplay).
+
+ \param eps
+*/
+void batchReplay(float eps)
+{
+    const bool binary = batchFormat.getValue() == "binary";
+    if(!binary && batchFormat.getValue() != "csv")
+        throw std::invalid_argument("Unknown format of --batch-format: " + batchFormat.getValue());
+
+    std::ofstream file;
+    if(!batchOutput.getValue().empty())
+    {
+        file.open(batchOutput.getValue(), std::ios_base::out | std::ios_base::binary);
+        if(!file.is_open())
+            throw std::runtime_error("Failed to open " + batchOutput.getValue());
+    }
+    std::ostream & os = batchOutput.getValue().empty() ? cout : file;
+
+    BatchReplay replay(starId.getCatalog(), [eps](Pipeline &pipeline)
+    {
+        configurePipeline(pipeline, eps);
+    }, workers.getValue());
+
+    if(binary)
+        BatchReplay::writeBinaryHeader(os);
+    else
+        BatchReplay::writeCsvHeader(os);
+
+    unsigned failed = 0;
+    replay.run(files.getValue(), [&](const BatchReplay::ImageResult &result)
+    {
+        if(result.status == BatchReplay::Failed)
+        {
+            std::cerr << "error: " << result.filename << ": " << result.error << endl;
+            ++failed;
+        }
+
+        if(binary)
+            BatchReplay::writeBinary(os, result);
+        else
+            BatchReplay::writeCsv(os, result);
+    });
+    os.flush();
+
+    if(failed)
+        std::cerr << failed << " of " << files.getValue().size() << " images failed" << endl;
+}
+
 /*!
  \brief Main function
 
@@ -323,11 +741,36 @@ int main(int argc, char **argv)
         cmd.add(area);
         cmd.add(threshold);
         cmd.add(calibrationFile);
+        cmd.add(darkFile);
+        cmd.add(flatFile);
         cmd.add(initFile);
         cmd.add(dbFile);
         cmd.add(kVectorFile);
+        cmd.add(catalogFile);
         cmd.add(stats);
         cmd.add(useCamera);
+        cmd.add(live);
+        cmd.add(track);
+        cmd.add(frameRate);
+        cmd.add(nFrames);
+        cmd.add(threads);
+        cmd.add(extractThreads);
+        cmd.add(connectivity);
+        cmd.add(candidates);
+        cmd.add(magnitudeTolerance);
+        cmd.add(latencyReport);
+        cmd.add(latencyInterval);
+        cmd.add(daemonSocket);
+        cmd.add(batch);
+        cmd.add(workers);
+        cmd.add(batchFormat);
+        cmd.add(batchOutput);
+        cmd.add(rawCentroiding);
+        cmd.add(adaptiveThreshold);
+        cmd.add(psfFit);
+        cmd.add(dropFrame);
+        cmd.add(undistortionGrid);
+        cmd.add(defectMapFile);
         cmd.add(files);
 
         cmd.parse(argc, argv);
@@ -337,10 +780,40 @@ int main(int argc, char **argv)
         starCam.setMinArea(area.getValue() );
         starCam.setThreshold(threshold.getValue());
         starCam.loadCalibration(calibrationFile.getValue());
+        if(!darkFile.getValue().empty() || !flatFile.getValue().empty())
+        {
+            std::shared_ptr<FrameCorrection> correction(new FrameCorrection());
+            if(!darkFile.getValue().empty())
+                correction->loadDarkFrame(darkFile.getValue());
+            if(!flatFile.getValue().empty())
+                correction->loadFlatField(flatFile.getValue());
+            starCam.setFrameCorrection(correction);
+        }
         printStats = stats.getValue();
+        if(threads.getValue() != 1)
+            starId.setNumThreads(threads.getValue());
+        if(extractThreads.getValue() != 1)
+            starCam.setNumThreads(extractThreads.getValue());
+        starCam.setConnectivity(connectivity.getValue());
+        starId.setMaxCandidates(candidates.getValue());
+        starId.setMagnitudeTolerance(magnitudeTolerance.getValue());
+        starCam.setRawCentroiding(rawCentroiding.getValue());
+        if(dropFrame.getValue() && psfFit.getValue() && !rawCentroiding.getValue())
+            throw std::invalid_argument("--psf-fit with --drop-frame requires --raw");
+        starCam.setKeepFrame(!dropFrame.getValue());
+        starCam.setAdaptiveThreshold(adaptiveThreshold.getValue());
+        starCam.setUndistortionGrid(undistortionGrid.getValue());
+        if(!latencyReport.getValue().empty() && !Instrumentation::isEnabled())
+            std::cerr << "warning: built without STARCAM_INSTRUMENTATION, the latency report will be empty" << endl;
 
         // check if in test mode
         string testRoutine = test.getValue();
+        if(!defectMapFile.getValue().empty() && testRoutine != "defect-calibration")
+        {
+            std::shared_ptr<DefectMap> defects(new DefectMap());
+            defects->load(defectMapFile.getValue());
+            starCam.setDefectMap(defects);
+        }
         if(!testRoutine.empty())
         {
             if (testRoutine == "camera")
@@ -357,17 +830,41 @@ int main(int argc, char **argv)
             {
                 identificationComparison();
             }
+            if (testRoutine == "eps-sweep")
+            {
+                epsilonSweep();
+            }
+            if (testRoutine == "defect-calibration")
+            {
+                defectCalibration();
+            }
+            if(!latencyReport.getValue().empty())
+                Instrumentation::writeReport(latencyReport.getValue());
             return 0;
         }
 
-        // check if camera is to be used
-        if(useCamera.getValue() )
+        loadCatalog();
+
+        if(!daemonSocket.getValue().empty())
+        {
+            // the daemon initializes the camera of its pipeline
+            daemonMode(eps);
+        }
+        else if(useCamera.getValue() )
         {
             if (initFile.getValue().empty())
                 starCam.initializeCamera(NULL);
             else
                 starCam.initializeCamera(initFile.getValue());
-            liveIdentification(eps); // add options for multiple pictures and delay?
+
+            if(live.getValue())
+                liveTracking(eps);
+            else
+                liveIdentification(eps);
+        }
+        else if(batch.getValue())
+        {
+            batchReplay(eps);
         }
         else // use saved raw images to identifiy stars
         {
@@ -378,6 +875,9 @@ int main(int argc, char **argv)
             for(std::vector<string>::const_iterator file = fileNames.begin(); file != fileNames.end(); ++file)
             {
                 starCam.getImageFromFile(*file);
+                // read the next file from disk while this one is processed
+                if(file + 1 != fileNames.end())
+                    starCam.prefetchImageFile(*(file + 1));
 
                 // print a file identifier
                 unsigned pos = file->find_last_of("/\\");
@@ -387,6 +887,10 @@ int main(int argc, char **argv)
             }
 
         }
+
+        // the live tracker writes its own reports
+        if(!latencyReport.getValue().empty() && !(useCamera.getValue() && live.getValue()))
+            Instrumentation::writeReport(latencyReport.getValue());
     } catch (TCLAP::ArgException &e)  // catch any exceptions
     {
         std::cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
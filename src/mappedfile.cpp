@@ -0,0 +1,81 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <algorithm>
+
+#include "mappedfile.h"
+
+MappedFile::MappedFile()
+    :mData(NULL), mSize(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+void MappedFile::open(const std::string filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+        throw std::runtime_error(std::string("Failed to open file: ") + filename);
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error(std::string("Failed to determine size or empty file: ") + filename);
+    }
+
+    void * data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after closing the descriptor
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+        throw std::runtime_error(std::string("Failed to map file: ") + filename);
+
+    mData = data;
+    mSize = info.st_size;
+    mFilename = filename;
+}
+
+void MappedFile::close()
+{
+    if(mData)
+        munmap(mData, mSize);
+
+    mData = NULL;
+    mSize = 0;
+    mFilename.clear();
+}
+
+void MappedFile::advise(AccessPattern pattern) const
+{
+    if(!mData)
+        return;
+
+    int advice = MADV_NORMAL;
+    switch(pattern)
+    {
+    case Normal:     advice = MADV_NORMAL; break;
+    case Sequential: advice = MADV_SEQUENTIAL; break;
+    case Random:     advice = MADV_RANDOM; break;
+    case WillNeed:   advice = MADV_WILLNEED; break;
+    }
+
+    // only a hint, failure is not critical
+    madvise(mData, mSize, advice);
+}
+
+void MappedFile::swap(MappedFile &other)
+{
+    std::swap(mFilename, other.mFilename);
+    std::swap(mData, other.mData);
+    std::swap(mSize, other.mSize);
+}
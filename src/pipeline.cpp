@@ -0,0 +1,65 @@
+#include <stdexcept>
+
+#include "pipeline.h"
+
+Pipeline::Pipeline(const std::shared_ptr<const StarCatalog> &catalog)
+    :mTrackingIdentifier(mIdentifier), mTrackingEnabled(false), mEps(0.1f), mCentroiding(StarCamera::ConnectedComponentsWeighted), mIdentification(StarIdentifier::PyramidKVector)
+{
+    mIdentifier.setCatalog(catalog);
+    mScratch.reserve(mIdentifier);
+}
+
+const Pipeline::Result & Pipeline::processImageFile(const std::string &filename, unsigned rows, unsigned cols)
+{
+    mCamera.getImageFromFile(filename, rows, cols);
+    return process();
+}
+
+const Pipeline::Result & Pipeline::processImage(const uint16_t *buffer, unsigned rows, unsigned cols)
+{
+    mCamera.getImageFromMemory(buffer, rows, cols);
+    return process();
+}
+
+const Pipeline::Result & Pipeline::processFrame()
+{
+    mCamera.getImage();
+    return process();
+}
+
+const Pipeline::Result & Pipeline::process()
+{
+    mCamera.extractSpots(mCentroiding);
+    mCamera.calculateSpotVectors();
+    return identify(mCamera.getSpots(), mCamera.getSpotVectors());
+}
+
+const Pipeline::Result & Pipeline::identify(const std::vector<Spot> &spots, const std::vector<Eigen::Vector3f> &spotVectors)
+{
+    // the brightest spots are the candidates for the triads
+    mBrightness.resize(spots.size());
+    for(unsigned s=0; s<spots.size(); ++s)
+        mBrightness[s] = spots[s].flux;
+
+    mResult.attitude = Attitude();
+    try
+    {
+        if(mTrackingEnabled)
+            mTrackingIdentifier.identifyStars(spotVectors, mResult.ids, &mBrightness);
+        else
+            mIdentifier.identifyStars(spotVectors, mEps, mResult.ids, mScratch, mIdentification, &mBrightness);
+        mResult.identified = true;
+    }
+    catch(std::range_error &)
+    {
+        // not enough spots for an identification
+        mResult.ids.assign(spotVectors.size(), -1);
+        mResult.identified = false;
+        return mResult;
+    }
+
+    if(mIdentifier.hasStarCatalog())
+        mAttitudeSolver.solve(spotVectors, mResult.ids, mIdentifier, mResult.attitude);
+
+    return mResult;
+}
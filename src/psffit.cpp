@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+
+#include "psffit.h"
+
+PsfFitter::PsfFitter()
+    :mWindowSize(7), mMaxIterations(6), mInitialSigma(1.0f)
+{
+}
+
+void PsfFitter::setWindowSize(unsigned size)
+{
+    if(size < 5 || size > MAX_WINDOW_SIZE || size % 2 == 0)
+        throw std::invalid_argument("PSF window size has to be odd and between 5 and 15");
+
+    mWindowSize = size;
+}
+
+template<typename T>
+bool PsfFitter::fit(const T *image, std::size_t stride, unsigned rows, unsigned cols, float x, float y, GaussianPsf &psf) const
+{
+    // window around the nearest pixel, clipped to the image
+    const int half = mWindowSize / 2;
+    const int cx = (int) std::floor(x + 0.5f);
+    const int cy = (int) std::floor(y + 0.5f);
+    const int x0 = std::max(0, cx - half);
+    const int y0 = std::max(0, cy - half);
+    const int x1 = std::min((int) cols, cx + half + 1);
+    const int y1 = std::min((int) rows, cy + half + 1);
+    const int width = x1 - x0;
+    const int height = y1 - y0;
+
+    psf = GaussianPsf();
+    psf.x = x;
+    psf.y = y;
+    if(width < 3 || height < 3)
+        return false;
+
+    // copy of the window as float, the minimum and maximum give the start values
+    float pixels[MAX_WINDOW_SIZE * MAX_WINDOW_SIZE];
+    float minValue = image[(std::size_t) y0 * stride + x0];
+    float maxValue = minValue;
+    for(int v=0; v<height; ++v)
+    {
+        const T * row = image + (std::size_t) (y0 + v) * stride + x0;
+        for(int u=0; u<width; ++u)
+        {
+            const float value = row[u];
+            pixels[v * width + u] = value;
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+    }
+    if(maxValue <= minValue)
+        return false;
+
+    // parameters relative to the window: x0, y0, amplitude, background, sigma
+    typedef Eigen::Matrix<double, 5, 1> Vector5d;
+    typedef Eigen::Matrix<double, 5, 5> Matrix5d;
+    Vector5d p;
+    p << x - x0, y - y0, maxValue - minValue, minValue, mInitialSigma;
+
+    bool converged = false;
+    unsigned iteration = 0;
+    while(iteration < mMaxIterations && !converged)
+    {
+        ++iteration;
+
+        // normal equations J^T J dp = J^T r with the analytic Jacobian of the model
+        Matrix5d JtJ = Matrix5d::Zero();
+        Vector5d Jtr = Vector5d::Zero();
+        const double invSigma2 = 1.0 / (p(4) * p(4));
+        for(int v=0; v<height; ++v)
+        {
+            const double dy = v - p(1);
+            for(int u=0; u<width; ++u)
+            {
+                const double dx = u - p(0);
+                const double r2 = dx * dx + dy * dy;
+                const double e = std::exp(-0.5 * r2 * invSigma2);
+                const double ae = p(2) * e;
+
+                Vector5d J;
+                J << ae * dx * invSigma2, ae * dy * invSigma2, e, 1.0, ae * r2 * invSigma2 / p(4);
+                const double residual = pixels[v * width + u] - (p(3) + ae);
+
+                JtJ.selfadjointView<Eigen::Lower>().rankUpdate(J);
+                Jtr += J * residual;
+            }
+        }
+
+        const Eigen::LDLT<Matrix5d> ldlt(JtJ.selfadjointView<Eigen::Lower>());
+        if(ldlt.info() != Eigen::Success || !(ldlt.vectorD().array() > 0.0).all())
+            break;
+        const Vector5d step = ldlt.solve(Jtr);
+        if(!std::isfinite(step.sum()))
+            break;
+        p += step;
+
+        if(p(4) <= 0.0 || p(2) <= 0.0)
+            break;
+        converged = std::abs(step(0)) < 1e-3 && std::abs(step(1)) < 1e-3;
+    }
+
+    psf.x = (float) (p(0) + x0);
+    psf.y = (float) (p(1) + y0);
+    psf.amplitude = (float) p(2);
+    psf.background = (float) p(3);
+    psf.sigma = (float) p(4);
+    psf.iterations = iteration;
+
+    // a fit which left the window or degenerated is not a star
+    return converged && p(2) > 0.0 && p(4) >= 0.3 && p(4) <= mWindowSize &&
+           p(0) >= 0.0 && p(0) <= width - 1 && p(1) >= 0.0 && p(1) <= height - 1;
+}
+
+template bool PsfFitter::fit<uint8_t>(const uint8_t *, std::size_t, unsigned, unsigned, float, float, GaussianPsf &) const;
+template bool PsfFitter::fit<uint16_t>(const uint16_t *, std::size_t, unsigned, unsigned, float, float, GaussianPsf &) const;
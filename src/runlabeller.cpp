@@ -0,0 +1,283 @@
+#include <cstring>
+#include <stdexcept>
+#include <limits>
+
+#include "runlabeller.h"
+#include "defectmap.h"
+
+namespace
+{
+/*!
+ \brief Returns if the 8 bytes starting at data are all zero
+*/
+inline bool isZeroWord(const void *data)
+{
+    uint64_t word;
+    std::memcpy(&word, data, sizeof(word));
+    return word == 0;
+}
+
+/*!
+ \brief The same threshold for all pixels
+*/
+template<typename T>
+struct UniformThreshold
+{
+    /*!
+     \brief Threshold of the pixels of a row
+    */
+    struct Row
+    {
+        T value; /*!< Threshold*/
+        T operator[](unsigned) const { return value; }
+    };
+
+    explicit UniformThreshold(T value_) { row_.value = value_; }
+    bool isZero() const { return row_.value == 0; }
+    Row row(unsigned) const { return row_; }
+
+    Row row_; /*!< Threshold of every row*/
+};
+
+/*!
+ \brief A threshold per column for each band of tileSize rows
+*/
+template<typename T>
+struct TiledThreshold
+{
+    typedef const T * Row;
+
+    TiledThreshold(const T *data_, unsigned tileSize_, unsigned cols_) :data(data_), tileSize(tileSize_), cols(cols_) {}
+    bool isZero() const { return false; }
+    Row row(unsigned y) const { return data + (std::size_t) (y / tileSize) * cols; }
+
+    const T * data; /*!< Thresholds of all bands*/
+    unsigned tileSize; /*!< Number of rows of a band*/
+    unsigned cols; /*!< Number of thresholds of a band*/
+};
+
+/*!
+ \brief The thresholds of another policy, except for defective pixels which are never above it
+*/
+template<typename T, typename Base>
+struct DefectThreshold
+{
+    /*!
+     \brief Threshold of the pixels of a row
+
+     The columns of a row are read in increasing order while labelling, so
+     the current defect run is kept instead of searching it for each pixel.
+    */
+    struct Row
+    {
+        T operator[](unsigned x) const
+        {
+            while(run != end && run->col + run->length <= x)
+                ++run;
+            return (run != end && run->col <= x) ? std::numeric_limits<T>::max() : base[x];
+        }
+
+        typename Base::Row base; /*!< Thresholds of the row*/
+        mutable const DefectRun * run; /*!< First defect run not left of the last column read*/
+        const DefectRun * end; /*!< End of the defect runs of the row*/
+    };
+
+    DefectThreshold(const Base &base_, const DefectMap &defects_) :base(base_), defects(defects_) {}
+    bool isZero() const { return base.isZero(); }
+    Row row(unsigned y) const
+    {
+        const Row result = {base.row(y), defects.rowBegin(y), defects.rowBegin(y + 1)};
+        return result;
+    }
+
+    const Base & base; /*!< Thresholds of the other pixels*/
+    const DefectMap & defects; /*!< Defective pixels*/
+};
+}
+
+RunLabeller::RunLabeller()
+    :mConnectivity(8), mDefects(NULL)
+{
+}
+
+void RunLabeller::setConnectivity(unsigned connectivity)
+{
+    if(connectivity != 4 && connectivity != 8)
+        throw std::invalid_argument("Connectivity has to be 4 or 8");
+
+    mConnectivity = connectivity;
+}
+
+template<typename T>
+unsigned RunLabeller::label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                            const T threshold, const unsigned firstRow)
+{
+    return labelImage(image, rows, cols, stride, UniformThreshold<T>(threshold), firstRow);
+}
+
+template<typename T>
+unsigned RunLabeller::label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                            const T *thresholdRows, const unsigned tileSize, const unsigned firstRow)
+{
+    return labelImage(image, rows, cols, stride, TiledThreshold<T>(thresholdRows, tileSize, cols), firstRow);
+}
+
+template<typename T, typename Threshold>
+unsigned RunLabeller::labelImage(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                                 const Threshold &thresholds, const unsigned firstRow)
+{
+    // an empty map has no runs to index
+    if(!mDefects || mDefects->empty())
+        return labelConnectivity(image, rows, cols, stride, thresholds, firstRow);
+
+    if(firstRow + rows > mDefects->getRows() || cols != mDefects->getCols())
+        throw std::invalid_argument("Defect map does not match the labelled image");
+    return labelConnectivity(image, rows, cols, stride, DefectThreshold<T, Threshold>(thresholds, *mDefects), firstRow);
+}
+
+template<typename T, typename Threshold>
+unsigned RunLabeller::labelConnectivity(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                                        const Threshold &thresholds, const unsigned firstRow)
+{
+    if(mConnectivity == 4)
+        return labelRuns<T, Threshold, 4>(image, rows, cols, stride, thresholds, firstRow);
+    else
+        return labelRuns<T, Threshold, 8>(image, rows, cols, stride, thresholds, firstRow);
+}
+
+template<typename T, typename Threshold, unsigned Connectivity>
+unsigned RunLabeller::labelRuns(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                                const Threshold &thresholds, const unsigned firstRow)
+{
+    // diagonal neighbours: runs touch if they overlap or their ends are adjacent
+    const unsigned reach = Connectivity == 8 ? 1 : 0;
+
+    mRuns.clear();
+    mPrevRuns.clear();
+    mFirstRuns.clear();
+    mParent.clear();
+    mMoments.clear();
+    mBlobs.clear();
+
+    for(unsigned y=0; y<rows; ++y)
+    {
+        const T * row = image + y * stride;
+        const typename Threshold::Row threshold = thresholds.row(firstRow + y);
+        unsigned prev = 0; // first run of the previous row which may touch the current run
+        unsigned x = 0;
+
+        while(x < cols)
+        {
+            // skip the background, 8 bytes at a time if it is zero (thresholded images)
+            if(thresholds.isZero())
+            {
+                const unsigned perWord = sizeof(uint64_t) / sizeof(T);
+                while(x + perWord <= cols && isZeroWord(row + x))
+                    x += perWord;
+            }
+            while(x < cols && row[x] <= threshold[x])
+                ++x;
+            if(x == cols)
+                break;
+
+            // moments of the run
+            BlobMoments run;
+            const unsigned start = x;
+            for(; x < cols && row[x] > threshold[x]; ++x)
+            {
+                run.sumP += row[x];
+                run.sumXP += (int64_t) x * row[x];
+            }
+            const unsigned end = x - 1;
+            run.area = end - start + 1;
+            run.sumX = (int64_t) (start + end) * run.area / 2;
+            run.sumY = (int64_t) (firstRow + y) * run.area;
+            run.sumYP = (int64_t) (firstRow + y) * run.sumP;
+
+            // runs of the previous row touching [start-reach, end+reach]
+            while(prev < mPrevRuns.size() && mPrevRuns[prev].end + reach < start)
+                ++prev;
+
+            unsigned root = mParent.size();
+            for(unsigned r=prev; r < mPrevRuns.size() && mPrevRuns[r].start <= end + reach; ++r)
+            {
+                if(root == mParent.size())
+                    root = find(mPrevRuns[r].label);
+                else
+                    root = merge(root, mPrevRuns[r].label);
+            }
+
+            // not connected to the previous row: new label
+            if(root == mParent.size())
+            {
+                mParent.push_back(root);
+                mMoments.push_back(BlobMoments());
+            }
+
+            mMoments[root].add(run);
+            mRuns.push_back(Run(start, end, root));
+        }
+
+        if(y == 0)
+            mFirstRuns = mRuns;
+        mPrevRuns.swap(mRuns);
+        mRuns.clear();
+    }
+
+    // the roots are the labels which were created first, i.e. raster order
+    mBlobIndex.resize(mParent.size());
+    for(unsigned l=0; l<mParent.size(); ++l)
+    {
+        if(mParent[l] == l)
+        {
+            mBlobIndex[l] = mBlobs.size();
+            mBlobs.push_back(l);
+        }
+    }
+
+    // the runs of the first and last row are needed to join strips
+    for(unsigned r=0; r<mFirstRuns.size(); ++r)
+        mFirstRuns[r].label = mBlobIndex[find(mFirstRuns[r].label)];
+    for(unsigned r=0; r<mPrevRuns.size(); ++r)
+        mPrevRuns[r].label = mBlobIndex[find(mPrevRuns[r].label)];
+
+    return mBlobs.size();
+}
+
+unsigned RunLabeller::find(unsigned label)
+{
+    unsigned root = label;
+    while(mParent[root] != root)
+        root = mParent[root];
+
+    while(mParent[label] != root)
+    {
+        const unsigned next = mParent[label];
+        mParent[label] = root;
+        label = next;
+    }
+
+    return root;
+}
+
+unsigned RunLabeller::merge(unsigned rootA, unsigned label)
+{
+    const unsigned rootB = find(label);
+    if(rootA == rootB)
+        return rootA;
+
+    const unsigned root = rootA < rootB ? rootA : rootB;
+    const unsigned child = rootA < rootB ? rootB : rootA;
+    mMoments[root].add(mMoments[child]);
+    mParent[child] = root;
+    return root;
+}
+
+template unsigned RunLabeller::label<uint8_t>(const uint8_t *, const unsigned, const unsigned, const std::size_t,
+                                              const uint8_t, const unsigned);
+template unsigned RunLabeller::label<uint16_t>(const uint16_t *, const unsigned, const unsigned, const std::size_t,
+                                               const uint16_t, const unsigned);
+template unsigned RunLabeller::label<uint8_t>(const uint8_t *, const unsigned, const unsigned, const std::size_t,
+                                              const uint8_t *, const unsigned, const unsigned);
+template unsigned RunLabeller::label<uint16_t>(const uint16_t *, const unsigned, const unsigned, const std::size_t,
+                                               const uint16_t *, const unsigned, const unsigned);
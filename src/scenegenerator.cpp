@@ -0,0 +1,198 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <sqlite3.h>
+
+#include "scenegenerator.h"
+
+SceneGenerator::SceneGenerator(const StarCamera &camera)
+    :mCamera(camera), mRows(1944), mCols(2592), mPsfSigma(1.2f), mZeroPointFlux(2.5e6f),
+      mBackground(100.0f), mReadNoise(8.0f), mShotNoiseGain(1.0f), mBayerGains(1.0f, 1.0f, 1.0f, 1.0f),
+      mMaxStars(0), mHotPixels(0), mFalseSpots(0)
+{
+    mAttitude.setIdentity();
+}
+
+void SceneGenerator::loadStarCatalog(const std::string &filename, float magnitudeLimit)
+{
+    sqlite3 * db;
+    if(sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Failed to open star catalog");
+    }
+
+    const std::string sqlQuery("SELECT hip, mag, rightAscNow, declNow FROM catalog WHERE mag <= ?");
+    sqlite3_stmt * sqlStmt;
+    if (sqlite3_prepare_v2(db, sqlQuery.c_str(), sqlQuery.size()+1, &sqlStmt, 0) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Preparing SQL catalog query failed");
+    }
+    sqlite3_bind_double(sqlStmt, 1, magnitudeLimit);
+
+    const double DEG_TO_RAD = M_PI / 180.0;
+    std::vector<CatalogStar> catalog;
+    while(sqlite3_step(sqlStmt) == SQLITE_ROW)
+    {
+        CatalogStar star;
+        star.hip = sqlite3_column_int(sqlStmt, 0);
+        star.magnitude = sqlite3_column_double(sqlStmt, 1);
+        const double ra = sqlite3_column_double(sqlStmt, 2) * DEG_TO_RAD;
+        const double dec = sqlite3_column_double(sqlStmt, 3) * DEG_TO_RAD;
+        star.vector = Eigen::Vector3f(cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec));
+        catalog.push_back(star);
+    }
+
+    sqlite3_finalize(sqlStmt);
+    sqlite3_close(db);
+
+    // brightest first, so the first stars in view are the brightest ones
+    std::sort(catalog.begin(), catalog.end(), [](const CatalogStar &a, const CatalogStar &b)
+    {
+        return a.magnitude < b.magnitude || (a.magnitude == b.magnitude && a.hip < b.hip);
+    });
+    mCatalog.swap(catalog);
+}
+
+void SceneGenerator::setImageSize(unsigned rows, unsigned cols)
+{
+    if(rows == 0 || cols == 0)
+        throw std::invalid_argument("Image size has to be positive");
+    mRows = rows;
+    mCols = cols;
+}
+
+Eigen::Quaterniond SceneGenerator::randomAttitude()
+{
+    // normalized 4D gaussian vectors are uniformly distributed on the unit sphere of quaternions
+    std::normal_distribution<double> normal;
+    Eigen::Quaterniond q;
+    do
+    {
+        q = Eigen::Quaterniond(normal(mRandom), normal(mRandom), normal(mRandom), normal(mRandom));
+    } while(q.norm() < 1e-6);
+    return q.normalized();
+}
+
+const std::vector<SyntheticStar> & SceneGenerator::generate(const Eigen::Quaterniond &attitude)
+{
+    if(mCatalog.empty())
+        throw std::runtime_error("No star catalog loaded");
+
+    mAttitude = attitude.normalized();
+    mStars.clear();
+    mFalseSpotCenters.clear();
+    mSignal.assign((std::size_t) mRows * mCols, 0.0f);
+
+    // stars whose PSF reaches into the image are rendered, the ones with their center in it are the ground truth
+    const float margin = 4.0f * mPsfSigma;
+    const Eigen::Matrix3f rotation = mAttitude.toRotationMatrix().cast<float>();
+    for(std::vector<CatalogStar>::const_iterator it = mCatalog.begin(); it != mCatalog.end(); ++it)
+    {
+        if(mMaxStars && mStars.size() >= mMaxStars)
+            break;
+
+        const Eigen::Vector3f vector = rotation * it->vector;
+        Eigen::Vector2f pixel;
+        if(!mCamera.projectVector(vector, pixel))
+            continue;
+        if(pixel(0) < -margin || pixel(1) < -margin || pixel(0) > mCols - 1 + margin || pixel(1) > mRows - 1 + margin)
+            continue;
+
+        const float flux = mZeroPointFlux * std::pow(10.0f, -0.4f * it->magnitude);
+        renderPsf(pixel, flux);
+
+        if(pixel(0) >= 0.0f && pixel(1) >= 0.0f && pixel(0) <= mCols - 1 && pixel(1) <= mRows - 1)
+        {
+            SyntheticStar star;
+            star.hip = it->hip;
+            star.magnitude = it->magnitude;
+            star.vector = vector;
+            star.pixel = pixel;
+            star.flux = flux;
+            mStars.push_back(star);
+        }
+    }
+
+    // false spots with the flux of stars between magnitude 2 and 6
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    for(unsigned i=0; i<mFalseSpots; ++i)
+    {
+        const Eigen::Vector2f center(uniform(mRandom) * (mCols - 1), uniform(mRandom) * (mRows - 1));
+        renderPsf(center, mZeroPointFlux * std::pow(10.0f, -0.4f * (2.0f + 4.0f * uniform(mRandom))));
+        mFalseSpotCenters.push_back(center);
+    }
+
+    // background, gains, noise and quantization to 12 bit
+    std::normal_distribution<float> normal;
+    mImage.resize(mSignal.size());
+    for(unsigned r=0; r<mRows; ++r)
+    {
+        for(unsigned c=0; c<mCols; ++c)
+        {
+            const std::size_t i = (std::size_t) r * mCols + c;
+            const float signal = (mSignal[i] + mBackground) * mBayerGains((r & 1) * 2 + (c & 1));
+            const float variance = mShotNoiseGain * signal + mReadNoise * mReadNoise;
+            const float value = signal + std::sqrt(variance) * normal(mRandom);
+            mImage[i] = (uint16_t) std::min(std::max(value + 0.5f, 0.0f), 4095.0f);
+        }
+    }
+
+    // hot pixels are single saturated or nearly saturated pixels
+    std::uniform_int_distribution<std::size_t> pixelIndex(0, mImage.size() - 1);
+    for(unsigned i=0; i<mHotPixels; ++i)
+        mImage[pixelIndex(mRandom)] = 4095 - (uint16_t) (uniform(mRandom) * 1024.0f);
+
+    return mStars;
+}
+
+void SceneGenerator::renderPsf(const Eigen::Vector2f &center, float flux)
+{
+    const int radius = (int) std::ceil(4.0f * mPsfSigma);
+    const int x0 = std::max(0, (int) std::floor(center(0)) - radius);
+    const int x1 = std::min((int) mCols - 1, (int) std::floor(center(0)) + radius + 1);
+    const int y0 = std::max(0, (int) std::floor(center(1)) - radius);
+    const int y1 = std::min((int) mRows - 1, (int) std::floor(center(1)) + radius + 1);
+    if(x0 > x1 || y0 > y1)
+        return;
+
+    // fraction of the PSF falling on each column and row (pixel (x, y) covers [x - 0.5, x + 0.5])
+    const float scale = 1.0f / (std::sqrt(2.0f) * mPsfSigma);
+    std::vector<float> fx(x1 - x0 + 1);
+    std::vector<float> fy(y1 - y0 + 1);
+    for(int x=x0; x<=x1; ++x)
+        fx[x - x0] = 0.5f * (std::erf((x + 0.5f - center(0)) * scale) - std::erf((x - 0.5f - center(0)) * scale));
+    for(int y=y0; y<=y1; ++y)
+        fy[y - y0] = 0.5f * (std::erf((y + 0.5f - center(1)) * scale) - std::erf((y - 0.5f - center(1)) * scale));
+
+    for(int y=y0; y<=y1; ++y)
+    {
+        float * row = &mSignal[(std::size_t) y * mCols];
+        const float fluxY = flux * fy[y - y0];
+        for(int x=x0; x<=x1; ++x)
+            row[x] += fluxY * fx[x - x0];
+    }
+}
+
+std::vector<int> SceneGenerator::getTrueIds(const std::vector<Spot> &spots, float maxDistance) const
+{
+    std::vector<int> ids(spots.size(), -1);
+    const float maxDistance2 = maxDistance * maxDistance;
+    for(unsigned s=0; s<spots.size(); ++s)
+    {
+        const Eigen::Vector2f center(spots[s].center.x, spots[s].center.y);
+        float best = maxDistance2;
+        for(std::vector<SyntheticStar>::const_iterator it = mStars.begin(); it != mStars.end(); ++it)
+        {
+            const float distance2 = (it->pixel - center).squaredNorm();
+            if(distance2 <= best)
+            {
+                best = distance2;
+                ids[s] = it->hip;
+            }
+        }
+    }
+
+    return ids;
+}
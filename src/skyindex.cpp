@@ -0,0 +1,162 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "skyindex.h"
+
+SkyIndex::SkyIndex()
+    :mResolution(0)
+{
+}
+
+void SkyIndex::build(const std::vector<Eigen::Vector3f> &vectors, unsigned resolution)
+{
+    if(resolution == 0)
+        throw std::invalid_argument("Resolution of the sky index has to be positive");
+
+    mResolution = resolution;
+    const unsigned cellsPerFace = resolution * resolution;
+
+    // counting sort of the stars by cell
+    std::vector<uint32_t> cells(vectors.size());
+    std::vector<uint32_t> start(6 * cellsPerFace + 1, 0);
+    for(unsigned s=0; s<vectors.size(); ++s)
+    {
+        if(vectors[s].isZero())
+            continue;
+
+        float u, w;
+        const unsigned face = faceOf(vectors[s], u, w);
+        cells[s] = face * cellsPerFace + cellOf(w) * resolution + cellOf(u);
+        ++start[cells[s] + 1];
+    }
+    for(unsigned c=0; c<6 * cellsPerFace; ++c)
+        start[c + 1] += start[c];
+
+    std::vector<uint32_t> position(start.begin(), start.end() - 1);
+    std::vector<int> indices(start.back());
+    std::vector<Eigen::Vector3f> sorted(start.back());
+    for(unsigned s=0; s<vectors.size(); ++s)
+    {
+        if(vectors[s].isZero())
+            continue;
+
+        const uint32_t p = position[cells[s]]++;
+        indices[p] = s;
+        sorted[p] = vectors[s];
+    }
+
+    mBoundaryScale.resize(resolution + 1);
+    for(unsigned b=0; b<=resolution; ++b)
+    {
+        const float u = -1.0f + 2.0f * b / resolution;
+        mBoundaryScale[b] = 1.0f / std::sqrt(1.0f + u * u);
+    }
+
+    mCellStart.swap(start);
+    mIndices.swap(indices);
+    mVectors.swap(sorted);
+}
+
+void SkyIndex::clear()
+{
+    mResolution = 0;
+    mCellStart.clear();
+    mIndices.clear();
+    mVectors.clear();
+    mBoundaryScale.clear();
+}
+
+void SkyIndex::coneQuery(const Eigen::Vector3f &center, float radius, std::vector<int> &indices) const
+{
+    const float DEG_TO_RAD = M_PI / 180.0;
+    radius = std::min(radius, 180.0f) * DEG_TO_RAD;
+    coneQuery(center, std::cos(radius), std::sin(radius), indices);
+}
+
+void SkyIndex::coneQuery(const Eigen::Vector3f &center, float cosRadius, float sinRadius, std::vector<int> &indices) const
+{
+    indices.clear();
+    if(mIndices.empty())
+        return;
+
+    // the stars are compared by the squared chord 2 (1 - cos) = 2 sin^2 / (1 + cos), which
+    // unlike the dot product keeps its precision for small angles (the second form is used below 90 degree)
+    const float chord2 = cosRadius > 0.0f ? 2.0f * sinRadius * sinRadius / (1.0f + cosRadius) : 2.0f * (1.0f - cosRadius);
+
+    // cones of 90 degree and more touch every half-space, the slack covers the rounding of the cell assignment
+    const float sinTest = cosRadius <= 0.0f ? 1.0f : sinRadius + 1e-5f;
+    const unsigned cellsPerFace = mResolution * mResolution;
+
+    for(unsigned face=0; face<6; ++face)
+    {
+        const unsigned a = face / 2;
+        const float normal = (face & 1) ? -center(a) : center(a);
+        if(normal < -sinTest)
+            continue;
+
+        unsigned u0, u1, w0, w1;
+        if(!cellRange(center((a + 1) % 3), normal, sinTest, u0, u1) ||
+           !cellRange(center((a + 2) % 3), normal, sinTest, w0, w1))
+            continue;
+
+        for(unsigned w=w0; w<=w1; ++w)
+        {
+            const unsigned row = face * cellsPerFace + w * mResolution;
+            // the cells of a row are adjacent in memory
+            for(uint32_t p=mCellStart[row + u0]; p<mCellStart[row + u1 + 1]; ++p)
+            {
+                if((mVectors[p] - center).squaredNorm() <= chord2)
+                    indices.push_back(mIndices[p]);
+            }
+        }
+    }
+}
+
+unsigned SkyIndex::faceOf(const Eigen::Vector3f &v, float &u, float &w)
+{
+    unsigned a = 0;
+    if(std::fabs(v(1)) > std::fabs(v(a)))
+        a = 1;
+    if(std::fabs(v(2)) > std::fabs(v(a)))
+        a = 2;
+
+    const float normal = std::fabs(v(a));
+    u = v((a + 1) % 3) / normal;
+    w = v((a + 2) % 3) / normal;
+    return 2 * a + (v(a) < 0.0f ? 1 : 0);
+}
+
+unsigned SkyIndex::cellOf(float u) const
+{
+    const int c = (int) ((u + 1.0f) * 0.5f * mResolution);
+    return c < 0 ? 0 : (c >= (int) mResolution ? mResolution - 1 : c);
+}
+
+bool SkyIndex::cellRange(float axis, float normal, float sinRadius, unsigned &first, unsigned &last) const
+{
+    // signed sine of the distance of the cone axis from the boundary great circle u = u_b
+    // (positive on the side u > u_b)
+    float lower = (axis + normal) * mBoundaryScale[0];
+
+    // the edges of the face, most faces are rejected here
+    if(lower < -sinRadius || (axis - normal) * mBoundaryScale[mResolution] > sinRadius)
+        return false;
+
+    bool found = false;
+    for(unsigned c=0; c<mResolution; ++c)
+    {
+        const float u = -1.0f + 2.0f * (c + 1) / mResolution;
+        const float upper = (axis - u * normal) * mBoundaryScale[c + 1];
+        if(lower >= -sinRadius && upper <= sinRadius)
+        {
+            if(!found)
+                first = c;
+            last = c;
+            found = true;
+        }
+        lower = upper;
+    }
+
+    return found;
+}
@@ -7,101 +7,339 @@
 #include <stdexcept>
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 using std::cout;
 using std::endl;
 
 #include "starcamera.h"
+#include "imageconversion.h"
+#include "centroidkernels.h"
+#include "instrumentation.h"
 
 const float pi = 3.14159265358979323846;
 
+const unsigned StarCamera::UNDISTORT_BLOCK;
+
 StarCamera::StarCamera()
-    :mThreshold(64), mMinArea(16)
+    :mThreshold(64), mMinArea(16), mThreshedLevel(-1), mKeepFrame(true),
+      mRawCentroiding(false), mRawData(NULL), mRawRows(0), mRawCols(0), mFrameValid(false), mHeldFrame(NULL),
+      mAdaptiveThreshold(false), mGridSpacing(0), mGridCols(0), mGridRows(0)
 {
-
+    useFullFrameGeometry();
 }
 
 void StarCamera::initializeCamera(const std::string initFile)
 {
     mCamera.initialize(initFile);
+    useCameraGeometry();
 }
 
-void StarCamera::getImage()
+void StarCamera::setReadoutWindow(unsigned rowStart, unsigned colStart, unsigned height, unsigned width)
 {
-    unsigned height = mCamera.getHeight();
-    unsigned width  = mCamera.getWidth();
-    mFrame.create(height, width);
+    mCamera.setReadoutWindow(rowStart, colStart, height, width);
+    useCameraGeometry();
+}
+
+void StarCamera::setSubsampling(unsigned factor, bool binning)
+{
+    mCamera.setSubsampling(factor, binning);
+    useCameraGeometry();
+}
+
+void StarCamera::useCameraGeometry()
+{
+    const float factor = mCamera.getSubsampling();
+    const float shift = (mCamera.getBinning() ? 0.5f : -0.5f) * (factor - 1);
+    mSensorOrigin << mCamera.getColumnStart() + shift, mCamera.getRowStart() + shift;
+    mSensorScale = factor;
+}
+
+void StarCamera::useFullFrameGeometry()
+{
+    mSensorOrigin.setZero();
+    mSensorScale = 1.0f;
+}
 
+void StarCamera::getImage()
+{
     // get Image Data
     uint8_t * tmp = 0;
+
+    // the frame of the last call may still be referenced as raw data
+    releaseHeldFrame();
+
+    const bool streaming = mCamera.isCapturing();
+    if(streaming)
+    {
+        while (! mCamera.acquireFrame(&tmp) )
+            ;
+    }
+    else
+    {
+        while (! mCamera.grabFrame(&tmp) )
+            usleep(10000);
+    }
+
     // copy image data into frame, thereby changing from 12-bit to 8-bit
+    getImageFromBuffer((const uint16_t *) tmp, mCamera.getHeight(), mCamera.getWidth());
+    useCameraGeometry();
+
+    // the raw data is not needed anymore, let the camera reuse the buffer
+    // (with raw centroiding it is kept until the next frame)
+    if(streaming)
+    {
+        if(mRawData == (const uint16_t *) tmp)
+            mHeldFrame = tmp;
+        else
+            mCamera.releaseFrame(tmp);
+    }
+}
 
-    while (! mCamera.grabFrame(&tmp) )
-        usleep(10000);
+void StarCamera::stopStreaming()
+{
+    releaseHeldFrame();
+    mCamera.stopCapture();
+}
+
+void StarCamera::releaseHeldFrame()
+{
+    if(mHeldFrame)
+    {
+        if(mRawData == (const uint16_t *) mHeldFrame)
+            mRawData = NULL;
+        mCamera.releaseFrame(mHeldFrame);
+        mHeldFrame = NULL;
+    }
+}
+
+bool StarCamera::acquireRawFrame(const uint16_t **buffer, double *timestamp, unsigned timeoutMs)
+{
+    uint8_t * tmp = 0;
+    if(!mCamera.acquireFrame(&tmp, timeoutMs, timestamp))
+        return false;
+
+    *buffer = (const uint16_t *) tmp;
+    return true;
+}
+
+void StarCamera::releaseRawFrame(const uint16_t *buffer)
+{
+    mCamera.releaseFrame((uint8_t *) buffer);
+}
 
-    // iterate in a single for loop
-    unsigned length = height * width;
+void StarCamera::getImageFromBuffer(const uint16_t *buffer, const unsigned rows, const unsigned cols)
+{
+    // dark frame and flat field, all further steps use the corrected copy
+    if(hasCorrection(rows, cols))
+    {
+        STARCAM_TIMER(Instrumentation::Conversion);
+        mCorrected.resize((std::size_t) rows * cols);
+        mCorrection->apply(buffer, &mCorrected[0]);
+        buffer = &mCorrected[0];
+    }
 
-    // pointer to the raw image
-    uint16_t * imgBuf = (uint16_t *) tmp;
-    // pointer to the data of the mFrame object
-    uint8_t  * pFrame = mFrame.data;
-    // pointer to the end of the allocated memory
-    uint8_t  * pFrameEnd = pFrame + length;
+    if(mAdaptiveThreshold)
+    {
+        STARCAM_TIMER(Instrumentation::Threshold);
+        mBackground.update(buffer, rows, cols);
+    }
 
-    for(; pFrame != pFrameEnd; ++imgBuf, ++pFrame)
+    if(mRawCentroiding)
     {
-        // calculate the 8-bit value (divide by 16 or shift by 4) for each pixel from the
-        // raw image and assign it to the corresponding pixel in mFrame
-        *pFrame =  (*imgBuf) >> 4;
+        // only referenced, the 8-bit images are converted on demand
+        mRawData = buffer;
+        mRawRows = rows;
+        mRawCols = cols;
+        mFrameValid = false;
+        mThreshedLevel = -1;
+        return;
     }
 
+    mRawData = NULL;
+    convertRawFrame(buffer, rows, cols);
 }
 
-void StarCamera::getImageFromFile(const std::string filename, const unsigned rows, const unsigned cols)
+void StarCamera::convertRawFrame(const uint16_t *buffer, const unsigned rows, const unsigned cols)
 {
-    // open image file
-    std::fstream file;
-    file.open(filename, std::ios_base::in | std::ios_base::binary);
-    if(!file.is_open())
+    STARCAM_TIMER(Instrumentation::Conversion);
+    prepareFrame(rows, cols);
+
+    // change from 12-bit to 8-bit and apply the threshold in a single pass
+    // (and mask the defects of each row as soon as it is converted)
+    const DefectMap * defects = hasDefects(rows, cols) ? mDefects.get() : NULL;
+    if(mAdaptiveThreshold)
+        convert12To8ThresholdTiles(buffer, mKeepFrame ? mFrame.data : NULL, mThreshed.data, rows, cols,
+                                   mBackground.getThresholds(), mBackground.getTileSize(), defects);
+    else if(defects)
+        convert12To8Threshold(buffer, mKeepFrame ? mFrame.data : NULL, mThreshed.data, rows, cols, mThreshold, *defects);
+    else
+        convert12To8Threshold(buffer, mKeepFrame ? mFrame.data : NULL, mThreshed.data, rows * cols, mThreshold);
+    mThreshedLevel = getThresholdLevel();
+    mFrameValid = mKeepFrame;
+}
+
+const cv::Mat_<uint8_t> & StarCamera::getFrame()
+{
+    if(mRawData && !mFrameValid)
     {
-        throw std::runtime_error(std::string("Failed to open image file: ") + filename);
+        // the frame is needed, so keep it regardless of setKeepFrame()
+        const bool keepFrame = mKeepFrame;
+        mKeepFrame = true;
+        convertRawFrame(mRawData, mRawRows, mRawCols);
+        mKeepFrame = keepFrame;
     }
 
-    // resize matrix structure for image data if necessary
-    mFrame.create(rows, cols);
+    return mFrame;
+}
 
-    // read image data and transform from 12 to 8 bit
-    for (unsigned i = 0; i<rows; ++i)
+void StarCamera::thresholdFrame()
+{
+    STARCAM_TIMER(Instrumentation::Threshold);
+    if(!mAdaptiveThreshold)
     {
-        for(unsigned j = 0; j<cols; ++j)
-        {
-            u_int16_t temp;
-            file.read((char*) &temp, sizeof(u_int16_t) );
+        cv::threshold(mFrame, mThreshed, mThreshold, 0, cv::THRESH_TOZERO);
+        if(hasDefects(mThreshed.rows, mThreshed.cols))
+            mDefects->maskImage(mThreshed.data, mThreshed.step);
+        mThreshedLevel = mThreshold;
+        return;
+    }
 
-            mFrame(i,j) = temp/16;
+    const unsigned tileSize = mBackground.getTileSize();
+    if(mBackground.getTileRows() != (mFrame.rows + tileSize - 1) / tileSize ||
+       mBackground.getTilesPerRow() != (mFrame.cols + tileSize - 1) / tileSize)
+        throw std::runtime_error("ExtractSpots: Adaptive threshold enabled after loading, no background estimate");
+
+    mThreshed.create(mFrame.size());
+    const uint8_t * threshold = mBackground.getThresholds();
+    for(int y=0; y<mFrame.rows; y+=tileSize)
+    {
+        for(int x=0; x<mFrame.cols; x+=tileSize, ++threshold)
+        {
+            const cv::Rect tile(x, y, std::min<int>(tileSize, mFrame.cols - x), std::min<int>(tileSize, mFrame.rows - y));
+            cv::threshold(mFrame(tile), mThreshed(tile), *threshold, 0, cv::THRESH_TOZERO);
         }
     }
+    if(hasDefects(mThreshed.rows, mThreshed.cols))
+        mDefects->maskImage(mThreshed.data, mThreshed.step);
+    mThreshedLevel = ADAPTIVE_LEVEL;
+}
 
-    file.close();
+void StarCamera::setRawCentroiding(bool value)
+{
+    mRawCentroiding = value;
+    if(!value)
+    {
+        releaseHeldFrame();
+        mRawData = NULL;
+    }
+}
+
+void StarCamera::getImageFromFile(const std::string filename, const unsigned rows, const unsigned cols)
+{
+    releaseHeldFrame();
+
+    // the previous image wraps the mapping which is replaced, so it must not be left behind on errors
+    mRawFrame.release();
+    mRawData = NULL;
+
+    // map the image file (or take the one mapped by prefetchImageFile)
+    if(mNextRawFile.isOpen() && mNextRawFile.getFilename() == filename)
+    {
+        mRawFile.swap(mNextRawFile);
+        mNextRawFile.close();
+    }
+    else
+    {
+        mRawFile.open(filename);
+    }
+
+    if(mRawFile.size() < rows * cols * sizeof(uint16_t))
+    {
+        mRawFile.close();
+        throw std::runtime_error(std::string("Image file too short: ") + filename);
+    }
+    mRawFile.advise(MappedFile::Sequential);
 
-    //Usefull?
-    mThreshed.release();
+    // wrap the mapped data without copying it
+    mRawFrame = cv::Mat_<uint16_t>(rows, cols, (uint16_t *) mRawFile.data());
+
+    // transform from 12 to 8 bit
+    getImageFromBuffer((const uint16_t *) mRawFrame.data, rows, cols);
+    useFullFrameGeometry();
+}
+
+void StarCamera::getImageFromMemory(const uint16_t *buffer, const unsigned rows, const unsigned cols)
+{
+    releaseHeldFrame();
+    getImageFromBuffer(buffer, rows, cols);
+    useFullFrameGeometry();
+}
+
+void StarCamera::prefetchImageFile(const std::string filename)
+{
+    // only a hint, errors are reported when the file is loaded by getImageFromFile()
+    try
+    {
+        mNextRawFile.open(filename);
+        mNextRawFile.advise(MappedFile::WillNeed);
+    }
+    catch(std::exception &)
+    {
+        mNextRawFile.close();
+    }
+}
 
-    mLabels.create(mFrame.size());
+void StarCamera::prepareFrame(const unsigned rows, const unsigned cols)
+{
+    if(mKeepFrame)
+        mFrame.create(rows, cols);
+    else
+        mFrame.release();
 
+    mThreshed.create(rows, cols);
 }
 
 unsigned StarCamera::extractSpots(CentroidingMethod method)
 {
     mSpots.clear();
+    mArena.reset();
 
-    if(!mFrame.data)
+    // the connected components methods label the raw data directly
+    if(mRawData)
+    {
+        if(method == ConnectedComponentsGeometric)
+            return CentroidingConnectedComponentsGeometric();
+        if(method == ConnectedComponentsWeighted)
+            return CentroidingConnectedComponentsWeighted();
+        if(method == ConnectedComponentsGaussianFit)
+            return CentroidingGaussianFit();
+
+        // the contour methods need the 8-bit images
+        getFrame();
+    }
+
+    if(!mFrame.data && !mThreshed.data)
     {
         throw std::runtime_error("ExtractSpots: No frame loaded");
     }
 
     // Threshold the image: set all pixels lower than mThreshold to 0
-    cv::threshold(mFrame, mThreshed, mThreshold, 0, cv::THRESH_TOZERO);
+    // This is already done while loading the frame unless the threshold was changed since
+    if(mThreshedLevel != getThresholdLevel())
+    {
+        if(!mFrame.data)
+            throw std::runtime_error("ExtractSpots: Threshold changed after loading, but the frame was not kept");
+
+        thresholdFrame();
+    }
+
+    // the weighted contour methods and the fit also use the pixels below the threshold
+    if((method == ContoursWeighted || method == ContoursWeightedBoundingBox || method == ConnectedComponentsGaussianFit) &&
+       !mFrame.data)
+    {
+        throw std::runtime_error("ExtractSpots: Centroiding method requires the frame to be kept");
+    }
 
     switch (method)
     {
@@ -118,42 +356,303 @@ unsigned StarCamera::extractSpots(CentroidingMethod method)
     case ConnectedComponentsWeighted:
         return CentroidingConnectedComponentsWeighted();
         break;
+
+    case ConnectedComponentsGaussianFit:
+        return CentroidingGaussianFit();
+        break;
     }
 
     // should never reach this point
     return 0;
 }
 
+unsigned StarCamera::extractSpotsInWindows(const uint16_t *buffer, const unsigned rows, const unsigned cols,
+                                           const std::vector<Window> &windows, std::vector<int> *spotIndex)
+{
+    mSpots.clear();
+    mArena.reset();
+    if(spotIndex)
+        spotIndex->assign(windows.size(), -1);
+
+    for(unsigned w=0; w<windows.size(); ++w)
+    {
+        cv::Point2f centroid;
+        float flux;
+        unsigned area = computeWindowCentroid(buffer, rows, cols, windows[w].center, windows[w].size, centroid, flux);
+        if(area == 0)
+            continue;
+
+        // the star is off-center, it might be cut by the window
+        const float maxOffset = 0.25f * windows[w].size;
+        if(std::abs(centroid.x - windows[w].center.x) > maxOffset || std::abs(centroid.y - windows[w].center.y) > maxOffset)
+            area = computeWindowCentroid(buffer, rows, cols, centroid, windows[w].size, centroid, flux);
+
+        if(area > mMinArea)
+        {
+            if(spotIndex)
+                (*spotIndex)[w] = mSpots.size();
+            mSpots.push_back(Spot(centroid, area, flux));
+        }
+    }
+
+    return mSpots.size();
+}
+
+unsigned StarCamera::computeWindowCentroid(const uint16_t *buffer, const unsigned rows, const unsigned cols,
+                                           const cv::Point2f center, const unsigned size, cv::Point2f &centroid,
+                                           float &flux) const
+{
+    // window clipped to the frame
+    const int half = size / 2;
+    const int x0 = std::max(0, (int) floor(center.x + 0.5f) - half);
+    const int y0 = std::max(0, (int) floor(center.y + 0.5f) - half);
+    const int x1 = std::min((int) cols, (int) floor(center.x + 0.5f) - half + (int) size);
+    const int y1 = std::min((int) rows, (int) floor(center.y + 0.5f) - half + (int) size);
+
+    // a pixel passes if its 8-bit value (see convert12To8Threshold) is above the threshold
+    const unsigned limit = std::min(mThreshold, 255u);
+    const DefectMap * defects = hasDefects(rows, cols) ? mDefects.get() : NULL;
+    const FrameCorrection * correction = hasCorrection(rows, cols) ? mCorrection.get() : NULL;
+    uint64_t sum = 0, weightingX = 0, weightingY = 0;
+    unsigned area = 0;
+    for(int y=y0; y<y1; ++y)
+    {
+        const uint16_t * row = buffer + (std::size_t) y * cols;
+
+        // defects of the row, skipped in ascending order of the columns
+        const DefectRun * defect = defects ? defects->rowBegin(y) : NULL;
+        const DefectRun * defectEnd = defects ? defects->rowBegin(y + 1) : NULL;
+        for(int x=x0; x<x1; ++x)
+        {
+            while(defect != defectEnd && defect->col + defect->length <= x)
+                ++defect;
+            if(defect != defectEnd && defect->col <= x)
+                continue;
+
+            const unsigned value = correction ? correction->correct((std::size_t) y * cols + x, row[x]) : row[x];
+            if(std::min(value >> 4, 255u) > limit)
+            {
+                ++area;
+                sum += value;
+                weightingX += (uint64_t) x * value;
+                weightingY += (uint64_t) y * value;
+            }
+        }
+    }
+
+    if(area == 0)
+        return 0;
+
+    centroid.x = (float) ((double) weightingX / sum);
+    centroid.y = (float) ((double) weightingY / sum);
+    flux = (float) sum;
+    return area;
+}
+
 void StarCamera::calculateSpotVectors()
 {
-    if(mSpots.empty())
+    calculateSpotVectors(mSpots, mSpotVectors);
+}
+
+void StarCamera::calculateSpotVectors(const std::vector<Spot> &spots, std::vector<Eigen::Vector3f> &spotVectors) const
+{
+    STARCAM_TIMER(Instrumentation::SpotVectors);
+    if(spots.empty())
         throw std::runtime_error("No extracted spots in List");
 
-    bool zeroNorm = !(mDistortionCoeffi.norm() != 0.0f);
+    const bool zeroNorm = !(mDistortionCoeffi.norm() != 0.0f);
+
+    spotVectors.resize(spots.size());
+
+    // blocks of spots in SoA form for the undistortion
+    float x[UNDISTORT_BLOCK];
+    float y[UNDISTORT_BLOCK];
+    for(unsigned begin=0; begin<spots.size(); begin+=UNDISTORT_BLOCK)
+    {
+        const unsigned n = std::min<unsigned>(UNDISTORT_BLOCK, spots.size() - begin);
+        unsigned nIterative = 0;
+        for(unsigned i=0; i<n; ++i)
+        {
+            // Map to sensor coordinates
+            const Spot & spot = spots[begin + i];
+            const Eigen::Vector2f pixel = mSensorOrigin + mSensorScale * Eigen::Vector2f(spot.center.x, spot.center.y);
+
+            Eigen::Vector2f Xd;
+            if(!zeroNorm && mGridSpacing && lookupUndistortionGrid(pixel, Xd))
+            {
+                spotVectors[begin + i] << Xd(0), Xd(1), 1.0f;
+                continue;
+            }
+
+            Xd = normalizePixel(pixel);
+            x[nIterative] = Xd(0);
+            y[nIterative] = Xd(1);
+            ++nIterative;
+            spotVectors[begin + i] << Xd(0), Xd(1), 0.0f; // z marks the spots which are undistorted below
+        }
+
+        if(nIterative > 0 && !zeroNorm)
+            undistortPoints(x, y, nIterative);
+
+        for(unsigned i=0, k=0; i<n; ++i)
+        {
+            Eigen::Vector3f & spotVec = spotVectors[begin + i];
+            if(spotVec(2) == 0.0f)
+            {
+                spotVec << x[k], y[k], 1.0f;
+                ++k;
+            }
+            spotVec.normalize();
+        }
+    }
+}
+
+Eigen::Vector2f StarCamera::normalizePixel(const Eigen::Vector2f &pixel) const
+{
+    // Substract principal point and divide by the focal length
+    Eigen::Vector2f Xd = (pixel - mPrincipalPoint).array() / mFocalLength.array();
+
+    // Undo skew
+    Xd(0) = Xd(0) - mPixelSkew * Xd(1);
+    return Xd;
+}
+
+bool StarCamera::projectVector(const Eigen::Vector3f &vector, Eigen::Vector2f &pixel) const
+{
+    if(!(vector(2) > 0.0f))
+        return false;
+
+    const float x = vector(0) / vector(2);
+    const float y = vector(1) / vector(2);
+
+    // the distortion model of undistortBlock()
+    const float k1 = mDistortionCoeffi(0);
+    const float k2 = mDistortionCoeffi(1);
+    const float k3 = mDistortionCoeffi(4);
+    const float p1 = mDistortionCoeffi(2);
+    const float p2 = mDistortionCoeffi(3);
+
+    const float r2 = x * x + y * y;
+    const float kRadial = 1.0f + r2 * (k1 + r2 * (k2 + r2 * k3));
+    const float xd = x * kRadial + 2.0f * p1 * x * y + p2 * (r2 + 2.0f * x * x);
+    const float yd = y * kRadial + p1 * (r2 + 2.0f * y * y) + 2.0f * p2 * x * y;
+
+    // apply skew, focal length and principal point (inverse of normalizePixel())
+    pixel(0) = mPrincipalPoint(0) + mFocalLength(0) * (xd + mPixelSkew * yd);
+    pixel(1) = mPrincipalPoint(1) + mFocalLength(1) * yd;
+    return true;
+}
+
+void StarCamera::undistortPoints(float *x, float *y, unsigned n) const
+{
+    unsigned i = 0;
+    for(; i + UNDISTORT_BLOCK <= n; i += UNDISTORT_BLOCK)
+        undistortBlock(x + i, y + i);
+
+    // the last block is padded with the origin, which converges immediately
+    if(i < n)
+    {
+        float tailX[UNDISTORT_BLOCK] = {0};
+        float tailY[UNDISTORT_BLOCK] = {0};
+        std::copy(x + i, x + n, tailX);
+        std::copy(y + i, y + n, tailY);
+        undistortBlock(tailX, tailY);
+        std::copy(tailX, tailX + (n - i), x + i);
+        std::copy(tailY, tailY + (n - i), y + i);
+    }
+}
+
+void StarCamera::undistortBlock(float *x, float *y) const
+{
+    typedef Eigen::Array<float, UNDISTORT_BLOCK, 1> Block;
+
+    const float k1 = mDistortionCoeffi(0);
+    const float k2 = mDistortionCoeffi(1);
+    const float k3 = mDistortionCoeffi(4);
+    const float p1 = mDistortionCoeffi(2);
+    const float p2 = mDistortionCoeffi(3);
 
-    // Clear SpotVectors
-    mSpotVectors.clear();
+    Eigen::Map<Block> xd(x);
+    Eigen::Map<Block> yd(y);
+    Block xc = xd; // initial guess
+    Block yc = yd;
 
-    std::vector<Spot>::iterator pSpot;
-    for(pSpot=mSpots.begin(); pSpot != mSpots.end(); ++pSpot)
+    for(int i=0; i<20; ++i)
     {
-        // Substract principal point and divide by the focal length
+        const Block r2 = xc * xc + yc * yc;
+        const Block kRadial = 1.0f + r2 * (k1 + r2 * (k2 + r2 * k3));
+        const Block xy = xc * yc;
+        const Block deltaX = 2.0f * p1 * xy + p2 * (r2 + 2.0f * xc * xc);
+        const Block deltaY = p1 * (r2 + 2.0f * yc * yc) + 2.0f * p2 * xy;
+
+        const Block xn = (xd - deltaX) / kRadial;
+        const Block yn = (yd - deltaY) / kRadial;
+        const float change = (xn - xc).abs().max((yn - yc).abs()).maxCoeff();
+        xc = xn;
+        yc = yn;
+
+        if(change < 1e-7f)
+            break;
+    }
 
-        Eigen::Vector2f Xd(pSpot->center.x, pSpot->center.y);
-        Xd = (Xd - mPrincipalPoint).array() / mFocalLength.array();
+    xd = xc;
+    yd = yc;
+}
 
-        // Undo skew
-        Xd(0) = Xd(0) - mPixelSkew * Xd(1);
+void StarCamera::setUndistortionGrid(unsigned spacing)
+{
+    mGridSpacing = spacing;
+    buildUndistortionGrid();
+}
 
-        Eigen::Vector3f spotVec;
-        if(!zeroNorm)  // Use epsilon environment?
+void StarCamera::buildUndistortionGrid()
+{
+    mGrid.clear();
+    mGridCols = 0;
+    mGridRows = 0;
+    if(mGridSpacing == 0)
+        return;
+
+    // nodes cover the full sensor, including its last row and column
+    mGridCols = (Aptina::SENSOR_WIDTH - 1 + mGridSpacing - 1) / mGridSpacing + 1;
+    mGridRows = (Aptina::SENSOR_HEIGHT - 1 + mGridSpacing - 1) / mGridSpacing + 1;
+
+    std::vector<float> x(mGridCols * mGridRows);
+    std::vector<float> y(mGridCols * mGridRows);
+    for(unsigned r=0; r<mGridRows; ++r)
+    {
+        for(unsigned c=0; c<mGridCols; ++c)
         {
-            Xd = undistortRadialTangential(Xd);
+            const Eigen::Vector2f Xd = normalizePixel(Eigen::Vector2f(c * mGridSpacing, r * mGridSpacing));
+            x[r * mGridCols + c] = Xd(0);
+            y[r * mGridCols + c] = Xd(1);
         }
-        spotVec << Xd(0), Xd(1), 1.0f;
-        spotVec.normalize();
-        mSpotVectors.push_back(spotVec);
     }
+
+    undistortPoints(x.data(), y.data(), x.size());
+
+    mGrid.resize(x.size());
+    for(unsigned i=0; i<mGrid.size(); ++i)
+        mGrid[i] << x[i], y[i];
+}
+
+bool StarCamera::lookupUndistortionGrid(const Eigen::Vector2f &pixel, Eigen::Vector2f &out) const
+{
+    const float gx = pixel(0) / mGridSpacing;
+    const float gy = pixel(1) / mGridSpacing;
+    if(!(gx >= 0.0f && gy >= 0.0f && gx <= mGridCols - 1 && gy <= mGridRows - 1))
+        return false;
+
+    // cell of the point, the last node row and column belong to the cell before them
+    const unsigned c = std::min<unsigned>(gx, mGridCols - 2);
+    const unsigned r = std::min<unsigned>(gy, mGridRows - 2);
+    const float fx = gx - c;
+    const float fy = gy - r;
+
+    const Eigen::Vector2f * node = &mGrid[r * mGridCols + c];
+    out = (1.0f - fy) * ((1.0f - fx) * node[0] + fx * node[1]) +
+          fy * ((1.0f - fx) * node[mGridCols] + fx * node[mGridCols + 1]);
+    return true;
 }
 
 void StarCamera::loadCalibration(const std::string filename)
@@ -179,6 +678,8 @@ void StarCamera::loadCalibration(const std::string filename)
     file >> mFocalLength(1);
 
     file.close();
+
+    buildUndistortionGrid();
 }
 
 void StarCamera::cameraTest()
@@ -197,16 +698,7 @@ void StarCamera::cameraTest()
         while (! mCamera.grabFrame(&tmp) )
             usleep(10000);
 
-        uint16_t * imgBuf = (uint16_t *) tmp;
-        uint16_t * row = imgBuf;
-        for(unsigned i=0; i<height; ++i, row+= width)
-        {
-            uint16_t * col = row;
-            for(unsigned j=0; j<width; ++j, ++col)
-            {
-                mFrame(i,j) = (*col) / 16;
-            }
-        }
+        convert12To8((const uint16_t *) tmp, mFrame.data, height * width);
 
         cv::imshow("Hallo", mFrame);
         cv::waitKey();
@@ -223,24 +715,33 @@ void StarCamera::cameraTest()
 
 unsigned StarCamera::CentroidingContours(CentroidingMethod method)
 {
-    // vector which stores the point belonging to each contour
-    std::vector<Contour_t> contours;
     // Find contours in the threshed image
-    cv::findContours(mThreshed, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+    // (mContours keeps the memory of the points of the previous frames)
+    {
+        STARCAM_TIMER(Instrumentation::Labelling);
+        // findContours() modifies its input before OpenCV 3.2, mThreshed is reused by the next extractSpots()
+        mThreshed.copyTo(mContourInput);
+        cv::findContours(mContourInput, mContours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE);
+    }
+
+    // kernel of the weighted methods for the pixels the centroids are weighted with
+    const std::size_t pixelSize = mRawData ? sizeof(uint16_t) : sizeof(uint8_t);
+    const WindowMomentsKernel kernel = selectWindowMomentsKernel(pixelSize, IntensityWeighting, method == ContoursWeighted);
 
     // Find matching contours/spots
-    std::vector <std::vector<cv::Point> >::iterator it;
-    for (it = contours.begin(); it != contours.end(); ++it)
+    for (unsigned c=0; c<mContours.size(); ++c)
     {
+        const Contour_t & contour = mContours[c];
         cv::Point2f center;
         float radius;
         const float minRadius = sqrt(mMinArea / M_PI);
 
         // find the circle for each contour
-        cv::minEnclosingCircle(*it, center, radius);
+        cv::minEnclosingCircle(contour, center, radius);
 
         // Save the spot if it is large enough
         unsigned area;
+        float flux;
         if(radius > minRadius)
         {
             switch(method)
@@ -250,12 +751,12 @@ unsigned StarCamera::CentroidingContours(CentroidingMethod method)
                 break;
             case ContoursWeighted:
                 // get the area of the current contour
-                area = computeWeightedCentroid(*it, center);
-                mSpots.push_back(Spot(center, area));
+                area = computeWeightedCentroid(mContours, c, kernel, center, flux);
+                mSpots.push_back(Spot(center, area, flux));
                 break;
             case ContoursWeightedBoundingBox:
-                computeWeightedCentroidBoundingRect(*it, center, area);
-                mSpots.push_back(Spot(center, area) );
+                computeWeightedCentroidBoundingRect(contour, kernel, center, area, flux);
+                mSpots.push_back(Spot(center, area, flux) );
                 break;
 
             default: ;// to avoid warning of not handling other options
@@ -266,19 +767,72 @@ unsigned StarCamera::CentroidingContours(CentroidingMethod method)
     return mSpots.size();
 }
 
+void StarCamera::setNumThreads(unsigned nThreads)
+{
+    mStripLabeller.reset();
+    if(nThreads != 1)
+    {
+        mStripLabeller.reset(new StripLabeller(nThreads));
+        mStripLabeller->setConnectivity(mLabeller.getConnectivity());
+    }
+}
+
+void StarCamera::setConnectivity(unsigned connectivity)
+{
+    mLabeller.setConnectivity(connectivity);
+    if(mStripLabeller)
+        mStripLabeller->setConnectivity(connectivity);
+}
+
+unsigned StarCamera::labelFrame()
+{
+    STARCAM_TIMER(Instrumentation::Labelling);
+
+    // mThreshed is masked while converting, the raw data is masked by the labeller
+    const DefectMap * defects = mRawData && hasDefects(mRawRows, mRawCols) ? mDefects.get() : NULL;
+    if(mStripLabeller)
+        mStripLabeller->setDefectMap(defects);
+    else
+        mLabeller.setDefectMap(defects);
+
+    if(mRawData && mAdaptiveThreshold)
+    {
+        const uint16_t * thresholdRows = mBackground.getRawThresholdRows();
+        const unsigned tileSize = mBackground.getTileSize();
+        if(mStripLabeller)
+            return mStripLabeller->label<uint16_t>(mRawData, mRawRows, mRawCols, mRawCols, thresholdRows, tileSize);
+        else
+            return mLabeller.label<uint16_t>(mRawData, mRawRows, mRawCols, mRawCols, thresholdRows, tileSize);
+    }
+    else if(mRawData)
+    {
+        // same pixels as in mThreshed: (p >> 4) > mThreshold
+        const uint16_t threshold = (std::min(mThreshold, 255u) << 4) | 0xF;
+        if(mStripLabeller)
+            return mStripLabeller->label<uint16_t>(mRawData, mRawRows, mRawCols, mRawCols, threshold);
+        else
+            return mLabeller.label<uint16_t>(mRawData, mRawRows, mRawCols, mRawCols, threshold);
+    }
+
+    // mThreshed is 0 for all pixels which are not above mThreshold
+    if(mStripLabeller)
+        return mStripLabeller->label<uint8_t>(mThreshed.data, mThreshed.rows, mThreshed.cols, mThreshed.step, 0);
+    else
+        return mLabeller.label<uint8_t>(mThreshed.data, mThreshed.rows, mThreshed.cols, mThreshed.step, 0);
+}
+
 unsigned StarCamera::CentroidingConnectedComponentsGeometric()
 {
-    cv::Mat stats;
-    cv::Mat centroids;
-    int nLabels = cv::connectedComponentsWithStats(mThreshed, mLabels, stats, centroids, 8, CV_16U);
+    const unsigned nBlobs = labelFrame();
 
-    for(int i=1; i<nLabels; ++i)
+    for(unsigned i=0; i<nBlobs; ++i)
     {
-        const int indexArea = 4;
-        int area = stats.at<int>(i, indexArea);
-        if(area > 16)
+        const BlobMoments & blob = getLabelledBlob(i);
+        if(blob.area > mMinArea)
         {
-            mSpots.push_back(Spot(centroids.at<cv::Point2d>(i),area));
+            const float x = 1.0 * blob.sumX / blob.area;
+            const float y = 1.0 * blob.sumY / blob.area;
+            mSpots.push_back(Spot(cv::Point2f(x, y), blob.area, getLabelledFlux(blob)));
         }
     }
 
@@ -287,116 +841,101 @@ unsigned StarCamera::CentroidingConnectedComponentsGeometric()
 
 unsigned StarCamera::CentroidingConnectedComponentsWeighted()
 {
-    cv::Mat stats;
-    /* Use altered function which calculates desired stats directly
-       Stats is matrix of nLabels rows and 4 columns containing the following statistics:
-            stats[n][0]: Number of pixels corresponding to label n (i.e. area)
-            stats[n][1]: Weighted sum of label n in x direction ( sum(xi*pi) )
-            stats[n][2]: Weighted sum of label n in y direction ( sum(yi*pi) )
-            stats[n][3]: Sum of pixel values of label n ( sum(pi) )
-            n: [0, nLabels-1]
-
-            Hence the weighted centroid for label n is:
-            x = stats[n][1] / stats[n][3];
-            y = stats[n][2] / stats[n][3];
-     */
-    unsigned nLabels = cv::connectedComponentsForStarCam(mThreshed, mLabels,stats, 8, CV_16U);
+    const unsigned nBlobs = labelFrame();
 
-
-    for(unsigned i=1; i<nLabels; ++i)
+    for(unsigned i=0; i<nBlobs; ++i)
     {
-        int * row = (int*) stats.ptr(i);
-        if(*row > 16)
+        const BlobMoments & blob = getLabelledBlob(i);
+        if(blob.area > mMinArea)
         {
-            float x = 1.0 * row[1] / row[3];
-            float y = 1.0 * row[2] / row[3];
-            mSpots.push_back(Spot(cv::Point2f(x,y), *row) );
+            const float x = 1.0 * blob.sumXP / blob.sumP;
+            const float y = 1.0 * blob.sumYP / blob.sumP;
+            mSpots.push_back(Spot(cv::Point2f(x, y), blob.area, getLabelledFlux(blob)));
         }
-
     }
+
     return mSpots.size();
 }
 
-Eigen::Vector2f StarCamera::undistortRadialTangential(Eigen::Vector2f in) const
+unsigned StarCamera::CentroidingGaussianFit()
 {
-    float k1 = mDistortionCoeffi(0);
-    float k2 = mDistortionCoeffi(1);
-    float k3 = mDistortionCoeffi(4);
-    float p1 = mDistortionCoeffi(2);
-    float p2 = mDistortionCoeffi(3);
+    // start values and the area filter from the weighted moments
+    CentroidingConnectedComponentsWeighted();
 
-    float r2;
-    float r4;
-    float kRadial;
-    Eigen::Vector2f Xc = in; // initial guess
-    for(int i=0; i<20; ++i)
+    // each fit only reads the image, so the spots are independent
+    const ThreadPool::Task refine = [this](unsigned s, unsigned)
+    {
+        Spot & spot = mSpots[s];
+        GaussianPsf psf;
+        const bool valid = mRawData ?
+                    mPsfFitter.fit<uint16_t>(mRawData, mRawCols, mRawRows, mRawCols, spot.center.x, spot.center.y, psf) :
+                    mPsfFitter.fit<uint8_t>(mFrame.data, mFrame.step, mFrame.rows, mFrame.cols, spot.center.x, spot.center.y, psf);
+        if(valid)
+            spot.center = cv::Point2f(psf.x, psf.y);
+    };
+
+    if(mStripLabeller && mSpots.size() > 1)
     {
-        r2 = Xc.squaredNorm();
-        r4 = r2*r2;
-        kRadial = 1 + k1 * r2 + k2 * r4 + k3 * r2*r4;
-        Eigen::Vector2f deltaX;
-        deltaX << 2 * p1 * Xc(0) * Xc(1) + p2 *(r2 + 2 * Xc(0)*Xc(0)),
-                  p1 * (r2 + 2 * Xc(1)*Xc(1)) + 2 * p2 * Xc(0) * Xc(1);
+        mStripLabeller->getThreadPool().parallelFor(mSpots.size(), refine);
+    }
+    else
+    {
+        for(unsigned s=0; s<mSpots.size(); ++s)
+            refine(s, 0);
+    }
+
+    return mSpots.size();
+}
 
-        Xc = (in - deltaX) / kRadial;
+const void * StarCamera::getWeightPixels(const cv::Rect &rect, std::size_t &stride) const
+{
+    // the raw data is kept with raw centroiding, its 12-bit values are the better weights
+    if(mRawData)
+    {
+        stride = mRawCols;
+        return mRawData + (std::size_t) rect.y * mRawCols + rect.x;
     }
-    return Xc;
+
+    stride = mFrame.step;
+    return mFrame.ptr(rect.y) + rect.x;
 }
 
-unsigned  StarCamera::computeWeightedCentroid(Contour_t &contour, cv::Point2f &centroid)
+unsigned StarCamera::computeWeightedCentroid(const std::vector<Contour_t> &contours, unsigned index,
+                                             WindowMomentsKernel kernel, cv::Point2f &centroid, float &flux)
 {
     /*
      * Steps:
      *  1. Get bounding rectangle frome contour
-     *  2. Create temporary matrix with size of bounding rectangle
-     *  3. draw contour into small matrix and fill it
-     *  4. make AND operation with rectangle in original frame to copy contour area into empty matrix
-     *  5. calculate weighted centroid by summing
+     *  2. Create temporary mask with size of bounding rectangle
+     *  3. draw contour into the mask and fill it
+     *  4. calculate weighted centroid by summing the pixels within the mask
      */
 
     // Get bounding rectangle from contour
-    cv::Rect rect = cv::boundingRect(contour);
-
-
-    // Create a temporary matrix with size of bounding rectangle
-    cv::Mat temp(rect.size(), CV_8U, cv::Scalar(0));
+    cv::Rect rect = cv::boundingRect(contours[index]);
 
-    cv::Mat temp2 = mFrame(rect);
 
-    std::vector<Contour_t> T = std::vector<Contour_t>(1,contour);
-    // draw contour into temporary matrix
-    cv::drawContours(temp, T, -1, cv::Scalar(255), cv::FILLED, 8, cv::noArray(), INT_MAX, cv::Point(-rect.tl()) );
+    // Create a temporary mask with size of bounding rectangle (in the memory of the frame)
+    cv::Mat mask(rect.height, rect.width, CV_8U, mArena.allocate<uint8_t>(rect.area()));
+    mask = cv::Scalar(0);
 
-    // make AND operation with rectangle and original image
-    cv::bitwise_and(temp,temp2, temp);
+    // draw contour into the mask
+    cv::drawContours(mask, contours, index, cv::Scalar(255), cv::FILLED, 8, cv::noArray(), INT_MAX, cv::Point(-rect.tl()) );
 
+    std::size_t stride;
+    const void * pixels = getWeightPixels(rect, stride);
+    WindowMoments moments;
+    kernel(pixels, stride, mask.data, mask.step, rect.height, rect.width, moments);
 
-    int sum = 0, area = 0, weightingX = 0, weightingY = 0;
-    for (int i=0; i<temp.rows; ++i)
-    {
-        u_int8_t *data = temp.ptr(i);
-
-        for(int j=0; j<temp.cols; ++j, ++data)
-        {
-            if(*data >0)
-                area++;
+    centroid.x = (float) ((double) moments.sumX / moments.sum) + rect.tl().x;
+    centroid.y = (float) ((double) moments.sumY / moments.sum) + rect.tl().y;
+    flux = (mRawData ? 1.0f : 16.0f) * moments.sum;
 
-            sum += data[0];
-            weightingX += j*data[0];
-            weightingY += i*data[0];
-        }
-    }
-
-    float weightedX = 1.0 * weightingX / sum;
-    float weightedY = 1.0 * weightingX / sum;
-
-    centroid.x = weightedX + rect.tl().x;
-    centroid.y = weightedY + rect.tl().y;
-
-    return area;
+    return moments.area;
 }
 
-void StarCamera::computeWeightedCentroidBoundingRect(StarCamera::Contour_t &contour, cv::Point2f &centroid, unsigned &area)
+void StarCamera::computeWeightedCentroidBoundingRect(const StarCamera::Contour_t &contour, WindowMomentsKernel kernel,
+                                                     cv::Point2f &centroid, unsigned &area, float &flux)
 {
     /*
      * Steps:
@@ -407,29 +946,15 @@ void StarCamera::computeWeightedCentroidBoundingRect(StarCamera::Contour_t &cont
     // Get size of bounding rectangle from contour
     cv::Rect rect = cv::boundingRect(contour);
 
-    // Create object to access values within bounding rectangle
-    cv::Mat roi = mFrame(rect);
-
     // Calculate weighted sum
-    int sum = 0, weightingX = 0, weightingY = 0;
-    for (int i=0; i<roi.rows; ++i)
-    {
-        u_int8_t *data = roi.ptr(i);
-
-        for(int j=0; j<roi.cols; ++j, ++data)
-        {
-            sum += data[0];
-            weightingX += j*data[0];
-            weightingY += i*data[0];
-        }
-    }
-
-    float weightedX = 1.0 * weightingX / sum;
-    float weightedY = 1.0 * weightingY / sum;
-
+    std::size_t stride;
+    const void * pixels = getWeightPixels(rect, stride);
+    WindowMoments moments;
+    kernel(pixels, stride, NULL, 0, rect.height, rect.width, moments);
 
-    centroid.x = weightedX + rect.tl().x;
-    centroid.y = weightedY + rect.tl().y;
+    centroid.x = (float) ((double) moments.sumX / moments.sum) + rect.tl().x;
+    centroid.y = (float) ((double) moments.sumY / moments.sum) + rect.tl().y;
     area = rect.width * rect.height;
+    flux = (mRawData ? 1.0f : 16.0f) * moments.sum;
 }
 
@@ -0,0 +1,192 @@
+#include <stdexcept>
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+#include <sqlite3.h>
+
+#include "starcatalog.h"
+#include "kvectorfile.h"
+
+const int8_t StarCatalog::MAGNITUDE_UNKNOWN;
+
+StarCatalog::StarCatalog()
+    :mStarHip(NULL), mStarCount(0), mKVectorData(NULL), mCosTheta(NULL), mTheta(NULL), mId1(NULL), mId2(NULL),
+      mFeatureCount(0), mMaxStarFeatures(0), mQ(0.0), mM(0.0)
+{
+}
+
+void StarCatalog::loadFeatureListKVector(const std::string filename, bool verifyChecksum)
+{
+    mCatalogImage.clear();
+    mKVectorFile.close();
+    mStarHip = NULL;
+    mStarCount = 0;
+    mKVectorData = NULL;
+    mCosTheta = NULL;
+    mTheta = NULL;
+    mId1 = NULL;
+    mId2 = NULL;
+    mFeatureCount = 0;
+    mMaxStarFeatures = 0;
+    mStarVectors.clear();
+    mStarMagnitudes.clear();
+    mSkyIndex.clear();
+
+    // check for the magic number of the binary format
+    char magic[sizeof(KVECTOR_FILE_MAGIC)] = {0};
+    std::ifstream ifile;
+    ifile.open(filename, std::ios_base::in | std::ios_base::binary);
+    if(!ifile.is_open())
+        throw std::runtime_error("Failed to open k-Vector file");
+    ifile.read(magic, sizeof(magic));
+    ifile.close();
+
+    if(std::equal(magic, magic + sizeof(magic), KVECTOR_FILE_MAGIC))
+    {
+        // binary files are used directly from the mapping
+        mKVectorFile.open(filename);
+        attachCatalog((const uint8_t *) mKVectorFile.data(), mKVectorFile.size(), verifyChecksum);
+
+        // the k-vector is accessed at arbitrary positions
+        mKVectorFile.advise(MappedFile::Random);
+        return;
+    }
+
+    std::vector<Feature2> features;
+    readKVectorText(filename, features);
+    buildKVectorImage(features, mCatalogImage);
+    attachCatalog(&mCatalogImage[0], mCatalogImage.size(), false);
+}
+
+unsigned StarCatalog::loadStarCatalog(const std::string filename)
+{
+    if(mStarCount == 0)
+        throw std::runtime_error("No feature list loaded");
+
+    sqlite3 * db;
+    if(sqlite3_open_v2(filename.c_str(), &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Failed to open star catalog");
+    }
+
+    const std::string sqlQuery("SELECT hip, rightAscNow, declNow, mag FROM catalog");
+    sqlite3_stmt * sqlStmt;
+    if (sqlite3_prepare_v2(db, sqlQuery.c_str(), sqlQuery.size()+1, &sqlStmt, 0) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Preparing SQL catalog query failed");
+    }
+
+    const double DEG_TO_RAD = M_PI / 180.0;
+    std::vector<Eigen::Vector3f> vectors(mStarCount, Eigen::Vector3f::Zero());
+    std::vector<int8_t> magnitudes(mStarCount, MAGNITUDE_UNKNOWN);
+    unsigned found = 0;
+    while(sqlite3_step(sqlStmt) == SQLITE_ROW)
+    {
+        int index = getCatalogIndex(sqlite3_column_int(sqlStmt, 0));
+        if(index == -1)
+            continue;
+
+        const double ra = sqlite3_column_double(sqlStmt, 1) * DEG_TO_RAD;
+        const double dec = sqlite3_column_double(sqlStmt, 2) * DEG_TO_RAD;
+        vectors[index] = Eigen::Vector3f(cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec));
+        if(sqlite3_column_type(sqlStmt, 3) != SQLITE_NULL)
+        {
+            // tenths of a magnitude, -12.7 to 12.7 covers all stars which can be seen
+            const double mag = std::floor(sqlite3_column_double(sqlStmt, 3) * 10.0 + 0.5);
+            magnitudes[index] = (int8_t) std::min(127.0, std::max(-127.0, mag));
+        }
+        ++found;
+    }
+
+    sqlite3_finalize(sqlStmt);
+    sqlite3_close(db);
+
+    mStarVectors.swap(vectors);
+    mStarMagnitudes.swap(magnitudes);
+    mSkyIndex.build(mStarVectors);
+
+    return mStarCount - found;
+}
+
+int StarCatalog::getCatalogIndex(int hip) const
+{
+    const int32_t * it = std::lower_bound(mStarHip, mStarHip + mStarCount, hip);
+    if(it == mStarHip + mStarCount || *it != hip)
+        return -1;
+    return it - mStarHip;
+}
+
+void StarCatalog::attachCatalog(const uint8_t *image, std::size_t size, bool verifyChecksum)
+{
+    if(size < sizeof(KVectorFileHeader))
+        throw std::runtime_error("k-Vector file too short");
+
+    const KVectorFileHeader * header = (const KVectorFileHeader *) image;
+    if(header->version != KVECTOR_FILE_VERSION)
+        throw std::runtime_error("Unsupported version of k-Vector file");
+
+    const std::size_t n = header->featureCount;
+    const std::size_t dataSize = header->starCount * sizeof(int32_t)
+            + n * (sizeof(int32_t) + 2 * sizeof(float) + 2 * sizeof(catalogIndex_t));
+    if(size < sizeof(KVectorFileHeader) + dataSize)
+        throw std::runtime_error("k-Vector file too short");
+
+    const uint8_t * data = image + sizeof(KVectorFileHeader);
+    if(verifyChecksum && dataChecksum(data, dataSize) != header->checksum)
+        throw std::runtime_error("Checksum of k-Vector file does not match");
+
+    const std::size_t starCount = header->starCount;
+    const int32_t * starHip = (const int32_t *) data;
+    const int32_t * kVectorData = starHip + starCount;
+    const float * cosTheta = (const float *) (kVectorData + n);
+    const float * theta = cosTheta + n;
+    const catalogIndex_t * id1 = (const catalogIndex_t *) (theta + n);
+    const catalogIndex_t * id2 = id1 + n;
+
+    // size of the largest filtered query, used to size the Scratch, the indices
+    // are checked on the way since the checksum may not have been verified
+    std::vector<uint32_t> starFeatures(starCount, 0);
+    for(std::size_t i=0; i<n; ++i)
+    {
+        if(id1[i] >= starCount || id2[i] >= starCount)
+            throw std::runtime_error("Corrupt k-Vector file, star index out of range");
+        ++starFeatures[id1[i]];
+        ++starFeatures[id2[i]];
+    }
+
+    mQ = header->q;
+    mM = header->m;
+    mStarCount = starCount;
+    mFeatureCount = n;
+    mStarHip = starHip;
+    mKVectorData = kVectorData;
+    mCosTheta = cosTheta;
+    mTheta = theta;
+    mId1 = id1;
+    mId2 = id2;
+    mMaxStarFeatures = starCount ? *std::max_element(starFeatures.begin(), starFeatures.end()) : 0;
+}
+
+void StarCatalog::readKVectorText(const std::string filename, std::vector<Feature2> &features)
+{
+    std::ifstream ifile;
+    ifile.open(filename);
+
+    if(!ifile.is_open())
+        throw std::runtime_error("Failed to open k-Vector file");
+
+    // q and m are for a k-vector over theta, which is rebuilt over cos(theta)
+    double q, m;
+    ifile >> q;
+    ifile >> m;
+
+    features.clear();
+    int k, hip1, hip2;
+    float theta;
+    while(ifile >> k >> hip1 >> hip2 >> theta)
+    {
+        features.push_back(Feature2(hip1, hip2, theta));
+    }
+}
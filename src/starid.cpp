@@ -1,23 +1,67 @@
-#include<map>
 #include<stdexcept>
-#include<fstream>
 #include<iostream>
+#include<algorithm>
+#include<cmath>
 using std::cout;
 using std::endl;
 
 #include "starid.h"
+#include "instrumentation.h"
 
+namespace
+{
+/*!
+ \brief Returns the first index in [first, last) with values[index] >= value
+
+ Branchless binary search, the loop compiles to conditional moves.
+*/
+inline uint32_t lowerBound(const float *values, uint32_t first, uint32_t last, float value)
+{
+    if(first >= last)
+        return first;
+
+    const float * base = values + first;
+    uint32_t n = last - first;
+    while(n > 1)
+    {
+        const uint32_t half = n / 2;
+        base = (base[half - 1] < value) ? base + half : base;
+        n -= half;
+    }
+    return (base - values) + (*base < value);
+}
+
+/*!
+ \brief Returns the first index in [first, last) with values[index] > value
+*/
+inline uint32_t upperBound(const float *values, uint32_t first, uint32_t last, float value)
+{
+    if(first >= last)
+        return first;
+
+    const float * base = values + first;
+    uint32_t n = last - first;
+    while(n > 1)
+    {
+        const uint32_t half = n / 2;
+        base = (base[half - 1] <= value) ? base + half : base;
+        n -= half;
+    }
+    return (base - values) + (*base <= value);
+}
+}
 
 StarIdentifier::StarIdentifier()
-    :mDb(NULL), mOpenDb(false)
+    :mDb(NULL), mOpenDb(false), mIntervalClear(NULL), mIntervalInsert(NULL), mIntervalQuery(NULL), mCatalog(new StarCatalog()),
+      mMaxCandidates(0), mMagnitudeTolerance(0.0f)
 {
+    updateCatalogViews();
 }
 
 StarIdentifier::~StarIdentifier()
 {
     // close database (if open) before destroying the object
-    sqlite3_close(mDb);
-    mOpenDb = false;
+    closeDb();
 }
 
 void StarIdentifier::setFeatureListDB(const std::string filename)
@@ -32,7 +76,7 @@ void StarIdentifier::openDb()
         throw std::invalid_argument("No db-file speicfied");
     }
     // close old database (if any was open)
-    sqlite3_close(mDb);
+    closeDb();
 
     sqlite3 * tempDb;
     // open db-file
@@ -62,35 +106,105 @@ void StarIdentifier::openDb()
     // close database file
     sqlite3_close(tempDb);
 
+    // index theta in the in-memory copy (the file stays untouched) and prepare the
+    // batched interval query: all intervals of a frame are inserted into a temporary
+    // table, which is joined with the feature list by a range scan of the index per interval
+    const char * schema =
+            "CREATE INDEX IF NOT EXISTS featureList_theta ON featureList(theta);"
+            "CREATE TEMP TABLE intervals(id INTEGER PRIMARY KEY, low REAL NOT NULL, high REAL NOT NULL);";
+    const std::string sqlClear("DELETE FROM temp.intervals");
+    const std::string sqlInsert("INSERT INTO temp.intervals VALUES(?, ?, ?)");
+    const std::string sqlQuery("SELECT i.id, f.hip1, f.hip2, f.theta FROM temp.intervals AS i"
+                               " CROSS JOIN featureList AS f ON f.theta > i.low AND f.theta < i.high");
+    if(sqlite3_exec(mDb, schema, NULL, NULL, NULL) != SQLITE_OK ||
+       sqlite3_prepare_v2(mDb, sqlClear.c_str(), sqlClear.size()+1, &mIntervalClear, 0) != SQLITE_OK ||
+       sqlite3_prepare_v2(mDb, sqlInsert.c_str(), sqlInsert.size()+1, &mIntervalInsert, 0) != SQLITE_OK ||
+       sqlite3_prepare_v2(mDb, sqlQuery.c_str(), sqlQuery.size()+1, &mIntervalQuery, 0) != SQLITE_OK)
+    {
+        const std::string message = std::string("Preparing the feature list failed: ") + sqlite3_errmsg(mDb);
+        closeDb();
+        throw std::runtime_error(message);
+    }
+
     mOpenDb = true;
 }
 
-void StarIdentifier::loadFeatureListKVector(const std::string filename)
+void StarIdentifier::closeDb()
+{
+    // the statements have to be finalized before the database can be closed
+    sqlite3_finalize(mIntervalClear);
+    sqlite3_finalize(mIntervalInsert);
+    sqlite3_finalize(mIntervalQuery);
+    mIntervalClear = NULL;
+    mIntervalInsert = NULL;
+    mIntervalQuery = NULL;
+
+    sqlite3_close(mDb);
+    mDb = NULL;
+    mOpenDb = false;
+}
+
+void StarIdentifier::loadFeatureListKVector(const std::string filename, bool verifyChecksum)
 {
-    mFeatureList.clear();
-    mKVector.clear();
+    std::shared_ptr<StarCatalog> catalog(new StarCatalog());
+    catalog->loadFeatureListKVector(filename, verifyChecksum);
+
+    mCatalog = catalog;
+    mOwnCatalog = catalog;
+    updateCatalogViews();
+}
 
-    std::ifstream ifile;
-    ifile.open(filename);
+unsigned StarIdentifier::loadStarCatalog(const std::string filename)
+{
+    if(mCatalog->getStarCount() == 0)
+        throw std::runtime_error("No feature list loaded");
 
-    if(!ifile.is_open())
-        throw std::runtime_error("Failed to open k-Vector file");
+    // other identifiers may be using the catalog concurrently
+    if(mOwnCatalog != mCatalog || mCatalog.use_count() > 2)
+        throw std::logic_error("The star catalog can not be loaded into a shared catalog");
 
-    ifile >> mQ;
-    ifile >> mM;
+    const unsigned missing = mOwnCatalog->loadStarCatalog(filename);
+    updateCatalogViews();
+    return missing;
+}
 
-    do
-    {
-        int k, hip1, hip2;
-        float theta;
-        ifile >> k;
-        ifile >> hip1;
-        ifile >> hip2;
-        ifile >> theta;
+void StarIdentifier::setCatalog(const std::shared_ptr<const StarCatalog> &catalog)
+{
+    if(!catalog)
+        throw std::invalid_argument("Catalog must not be NULL");
 
-        mKVector.push_back(k);
-        mFeatureList.push_back(Feature2(hip1, hip2, theta));
-    } while(!ifile.eof());
+    mCatalog = catalog;
+    mOwnCatalog.reset();
+    updateCatalogViews();
+}
+
+void StarIdentifier::updateCatalogViews()
+{
+    const StarCatalog & catalog = *mCatalog;
+    mStarHip = catalog.getStarHip();
+    mStarCount = catalog.getStarCount();
+    mKVectorData = catalog.getKVector();
+    mCosTheta = catalog.getCosTheta();
+    mTheta = catalog.getTheta();
+    mId1 = catalog.getId1();
+    mId2 = catalog.getId2();
+    mFeatureCount = catalog.getFeatureCount();
+    mMaxStarFeatures = catalog.getMaxStarFeatures();
+    mQ = catalog.getQ();
+    mM = catalog.getM();
+    mStarVectors = catalog.hasStarCatalog() ? &catalog.getStarVectors()[0] : NULL;
+    mStarMagnitudes = catalog.hasStarCatalog() ? &catalog.getStarMagnitudes()[0] : NULL;
+}
+
+void StarIdentifier::setNumThreads(unsigned nThreads)
+{
+    std::lock_guard<std::mutex> lock(mParallelMutex);
+
+    mPool.reset();
+    if(nThreads != 1)
+        mPool.reset(new ThreadPool(nThreads));
+
+    mWorkers.resize(getNumThreads());
 }
 
 std::vector<int>  StarIdentifier::identifyStars(const vectorList_t &starVectors, const float eps, StarIdentifier::IdentificationMethod method) const
@@ -105,114 +219,155 @@ std::vector<int>  StarIdentifier::identifyStars(const vectorList_t &starVectors,
         return identifyPyramidMethod(starVectors, eps);
         break;
     case PyramidKVector:
-        return identifyPyramidMethodKVector(starVectors, eps);
-        break;
+    {
+        std::vector<int> idList;
+        Scratch scratch;
+        identifyPyramidMethodKVector(starVectors, eps, idList, scratch);
+        return idList;
+    }
+    case PyramidKVectorParallel:
+    {
+        std::vector<int> idList;
+        identifyPyramidMethodKVectorParallel(starVectors, eps, idList);
+        return idList;
+    }
     }
 
     throw std::invalid_argument("Identification method now present");
 }
 
+void StarIdentifier::identifyStars(const vectorList_t &starVectors, const float eps, std::vector<int> &idList,
+                                   StarIdentifier::Scratch &scratch, StarIdentifier::IdentificationMethod method,
+                                   const std::vector<float> *brightness) const
+{
+    if(brightness && brightness->size() != starVectors.size())
+        throw std::invalid_argument("List of brightness values must have same size as list of star vectors");
+
+    if(method == PyramidKVector)
+        identifyPyramidMethodKVector(starVectors, eps, idList, scratch, brightness);
+    else if(method == PyramidKVectorParallel)
+        identifyPyramidMethodKVectorParallel(starVectors, eps, idList, brightness);
+    else
+        idList = identifyStars(starVectors, eps, method);
+}
+
+void StarIdentifier::setMaxCandidates(unsigned n)
+{
+    if(n != 0 && n < 3)
+        throw std::invalid_argument("At least 3 candidates are necessary for a triad");
+    mMaxCandidates = n;
+}
+
+void StarIdentifier::setMagnitudeTolerance(float tolerance)
+{
+    if(tolerance < 0.0f)
+        throw std::invalid_argument("Magnitude tolerance must not be negative");
+    mMagnitudeTolerance = tolerance;
+}
+
+bool StarIdentifier::spotMagnitudes(const std::vector<float> *brightness, std::vector<float> &magnitudes) const
+{
+    magnitudes.clear();
+    if(!brightness || mMagnitudeTolerance <= 0.0f || !mStarMagnitudes)
+        return false;
+
+    // instrumental magnitude in tenths, NaN never contradicts a catalog magnitude
+    magnitudes.resize(brightness->size());
+    for(unsigned s=0; s<brightness->size(); ++s)
+    {
+        const float flux = (*brightness)[s];
+        magnitudes[s] = flux > 0.0f ? -25.0f * std::log10(flux) : NAN;
+    }
+    return true;
+}
+
+void StarIdentifier::selectCandidates(unsigned nSpots, const std::vector<float> *brightness, std::vector<int> &candidates) const
+{
+    candidates.resize(nSpots);
+    for(unsigned s=0; s<nSpots; ++s)
+        candidates[s] = s;
+
+    const unsigned n = (mMaxCandidates == 0 || mMaxCandidates > nSpots) ? nSpots : mMaxCandidates;
+    if(brightness)
+    {
+        // brightest first, ties in the order of the spots
+        std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), [brightness](int a, int b)
+        {
+            return (*brightness)[a] > (*brightness)[b] || ((*brightness)[a] == (*brightness)[b] && a < b);
+        });
+    }
+    candidates.resize(n);
+}
+
 std::vector<int> StarIdentifier::identify2StarMethod(const vectorList_t &starVectors, const float eps) const
 {
     if(!mOpenDb)
         throw std::runtime_error("No Database opened");
 
     // create a feature list from the star vectors
-    typedef std::vector<Feature2> featureList_t;
-    featureList_t featureList;
-    createFeatureList2(starVectors, featureList);
-
-    // Vector which holds a map with possible hip for each spot
-    typedef std::vector<std::map<int, int> > idTable_t ;
-    idTable_t idTable(starVectors.size(), std::map<int,int>() );
-
-    // prepare a statement for the database which searches for the feature/angle within an interval
-    std::string sql("SELECT * FROM featureList WHERE theta >? AND theta < ?");
-    sqlite3_stmt * sqlStmt;
-    if (sqlite3_prepare_v2(mDb, sql.c_str(), sql.size()+1, &sqlStmt, 0) != SQLITE_OK)
-        throw std::runtime_error("Prparing SQL search query failed");
+    createFeatureList2(starVectors, mSqlFeatures);
 
     /* Algorithm:
      *  1. Take feature from featureList (done using iterator)
      *  2. search in db for the feature within an interval of 2 epsilon (+-)
-     *  3. add all possible hip to the star spot(s) corresponding to the feature (or increase the counter if already existant) using the map
+     *  3. add all possible hip to the star spot(s) corresponding to the feature (or increase the counter if already existant)
      *  4. Goto 1.
      *  5. For each spots take the hip with the highest counter
+     *
+     *  Step 2 is done for all features at once (see queryFeatureIntervals()),
+     *  steps 3 and 5 spot by spot with the same counters (see castVote())
      */
-    for(featureList_t::const_iterator it = featureList.begin(); it != featureList.end(); ++it)
-    {
-       float low  = it->theta - eps; // lower bound of interval
-       float high = it->theta + eps; // upper bound of interval
-
-       // bind upper and lower bound to the sql statement
-       if(sqlite3_reset(sqlStmt) != SQLITE_OK)
-           throw std::runtime_error("Resetting SQL query failed");
-
-       if(sqlite3_bind_double(sqlStmt, 1, low) != SQLITE_OK)
-           throw std::runtime_error("Binding new value1 to query failed");
-
-       if(sqlite3_bind_double(sqlStmt, 2, high) != SQLITE_OK)
-               throw std::runtime_error("Binding new value2 to query failed");
+    queryFeatureIntervals(mSqlFeatures, eps, mSqlMatches);
 
+    const int nSpots = starVectors.size();
+    std::vector<int> idList(nSpots, -1);
+    for(int s=0; s<nSpots; ++s)
+    {
+        // both stars of every candidate of the features of the spot get a vote
+        for(int t=0; t<nSpots; ++t)
+        {
+            if(t == s)
+                continue;
 
-       /// TODO: maybe use sqlite_execute instead with a callback function?
-       // execute the query and iterate through the result
-       int result;
-       while( (result = sqlite3_step(sqlStmt)) == SQLITE_ROW)
-       {
-           // get the first hip
-           int index = sqlite3_column_int(sqlStmt, 0);
-
-           // increase the counter for the hip on both star spots as the problem is symmetric
-           // NOTE: an explicit insert for a new hip id is not necessary
-           // call is idTable[index of the first spot][key for hip]
-           idTable[it->id1][index]++;
-           idTable[it->id2][index]++;
-
-           // get second hip and increase counter
-           index = sqlite3_column_int(sqlStmt, 1);
-           idTable[it->id1][index]++;
-           idTable[it->id2][index]++;
-       }
+            const featureList_t & matches = mSqlMatches[pairIndex(s, t, nSpots)];
+            for(featureList_t::const_iterator it = matches.begin(); it != matches.end(); ++it)
+            {
+                castVote(it->id1);
+                castVote(it->id2);
+            }
+        }
 
-       if (result != SQLITE_DONE)
-           throw std::runtime_error("SQL search returned with unexpected result");
+        // 5. determine the hip for the spot
+        idList[s] = countVotes();
     }
 
-    sqlite3_finalize(sqlStmt);
+    return idList;
+}
 
-    // 5. determine the hip for each star spot
-    std::vector<int> idList;
-    int i=0;
-    for(idTable_t::const_iterator it = idTable.begin(); it != idTable.end(); ++it, ++i)
+int StarIdentifier::countVotes() const
+{
+    // only the counters which received votes are visited and reset
+    int hip = -1;
+    uint32_t max = 0;
+    bool unique = false;
+    for(std::vector<int>::const_iterator it = mVoted.begin(); it != mVoted.end(); ++it)
     {
-        int max = -1;
-        int hip = 0;
-        bool unique = true;
-        for(std::map<int,int>::const_iterator itMap = it->begin(); itMap != it->end(); ++itMap)
-        {
-            if(max == itMap->second)
-            {
-                unique = false;
-            }
-            else if (itMap->second > max)
-            {
-                max = itMap->second;
-                hip = itMap->first;
-                unique = true;
-            }
-        }
-        if (unique)
+        const uint32_t votes = mVotes[*it];
+        mVotes[*it] = 0;
+        if(votes > max)
         {
-            idList.push_back(hip);
+            max = votes;
+            hip = *it;
+            unique = true;
         }
-        else
+        else if(votes == max)
         {
-            idList.push_back(-1);
+            unique = false;
         }
-
     }
-    return idList;
+    mVoted.clear();
+
+    return unique ? hip : -1;
 }
 
 std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vectorList_t &starVectors, const float eps) const
@@ -221,18 +376,6 @@ std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vec
         throw std::runtime_error("No Database opened");
 
 
-    // prepare a statement for the database which searches for the feature/angle within an interval
-    const std::string sqlQuery("SELECT * FROM featureList WHERE theta >? AND theta < ?");
-    sqlite3_stmt * sqlStmt;
-    if (sqlite3_prepare_v2(mDb, sqlQuery.c_str(), sqlQuery.size()+1, &sqlStmt, 0) != SQLITE_OK)
-        throw std::runtime_error("Prparing SQL search query failed");
-
-    // prepare a statement for the database which searches for the feature/angle within an interval and for the correct hip
-    const std::string sqlQueryFinal("SELECT * FROM featureList WHERE (theta >? AND theta < ?) AND (hip1 = ? OR hip2 = ?)");
-    sqlite3_stmt * sqlFinal;
-    if (sqlite3_prepare_v2(mDb, sqlQueryFinal.c_str(), sqlQueryFinal.size()+1, &sqlFinal, 0) != SQLITE_OK)
-        throw std::runtime_error("Prparing SQL search query failed");
-
     /* Algorithm:
      *  1. Take 3 stars (take them in variable order)
      *  2. Calculate 3 angles between them
@@ -254,7 +397,15 @@ std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vec
     if( nSpots < 4)
         throw std::range_error("At least 4 star spots necessary");
 
+    // the candidates of all pairs of spots are retrieved with one query, so steps 3 and 7 only
+    // look up the candidates of the pair (see pairIndex())
+    createFeatureList2(starVectors, mSqlFeatures);
+    queryFeatureIntervals(mSqlFeatures, eps, mSqlMatches);
+    const std::vector<featureList_t> & matches = mSqlMatches;
+
     std::vector<int> idList;
+    TriadMatcher matcher;
+    featureList_t listIR, listJR, listKR;
 
     // Stop iteration as soon as one unique triad is identified
     bool identificationComplete = false;
@@ -270,96 +421,32 @@ std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vec
                 int k = j + dk;
                 idList.assign(nSpots, -1);
 
-                // calculate the 3 angles (features)
-                const float RAD_TO_DEG = 180 / M_PI;
-                // first dot product between each 2 vectors
-                float thetaIJ = starVectors[i].dot(starVectors[j]) / (starVectors[i].norm() * starVectors[j].norm() );
-                float thetaIK = starVectors[i].dot(starVectors[k]) / (starVectors[i].norm() * starVectors[k].norm() );
-                float thetaJK = starVectors[j].dot(starVectors[k]) / (starVectors[j].norm() * starVectors[k].norm() );
-
-                // arccos and conversion to deg
-                thetaIJ = acos(thetaIJ) * RAD_TO_DEG;
-                thetaIK = acos(thetaIK) * RAD_TO_DEG;
-                thetaJK = acos(thetaJK) * RAD_TO_DEG;
-
                 // get a list with possible candidates for each theta
-                featureList_t listIJ, listIK, listJK;
-
-                // bind upper and lower bound to the sql statement
-                if(sqlite3_reset(sqlStmt) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                if(sqlite3_bind_double(sqlStmt, 1, thetaIJ - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                if(sqlite3_bind_double(sqlStmt, 2, thetaIJ + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                retrieveFeatureList(sqlStmt, listIJ);
-                // if list is empty skip further processing
-                if(listIJ.empty() ) continue;
-
-                // bind upper and lower bound to the sql statement
-                if(sqlite3_reset(sqlStmt) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                if(sqlite3_bind_double(sqlStmt, 1, thetaIK - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                if(sqlite3_bind_double(sqlStmt, 2, thetaIK + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                retrieveFeatureList(sqlStmt, listIK);
-                // if list is empty skip further processing
-                if(listIK.empty() ) continue;
-
-                // bind upper and lower bound to the sql statement
-                if(sqlite3_reset(sqlStmt) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                if(sqlite3_bind_double(sqlStmt, 1, thetaJK - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                if(sqlite3_bind_double(sqlStmt, 2, thetaJK + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                retrieveFeatureList(sqlStmt, listJK);
-
-                // if list is empty skip further processing
-                if(listJK.empty() ) continue;
+                const featureList_t & listIJ = matches[pairIndex(i, j, nSpots)];
+                const featureList_t & listIK = matches[pairIndex(i, k, nSpots)];
+                const featureList_t & listJK = matches[pairIndex(j, k, nSpots)];
 
+                // if a list is empty skip further processing
+                if(listIJ.empty() || listIK.empty() || listJK.empty()) continue;
 
                 // find possible triads
-
-                int hipI, hipJ, hipK, count = 0;
-                for(featureList_t::const_iterator itIJ = listIJ.begin(), endIJ = listIJ.end(); itIJ != endIJ; ++itIJ)
-                {
-                    int tempI, tempJ, tempK;
-                    for(featureList_t::const_iterator itIK = listIK.begin(), endIK = listIK.end(); itIK != endIK; ++itIK)
-                    {
-                        if(itIJ->id1 == itIK->id1 || itIJ->id2 == itIK->id1)
-                        {
-                            tempI = itIK->id1;
-                            tempJ = (itIJ->id1 == tempI) ? itIJ->id2 : itIJ->id1;
-                            tempK = itIK->id2;
-                        }
-                        else if(itIJ->id1 == itIK->id2 || itIJ->id2 == itIK->id2)
-                        {
-                            tempI = itIK->id2;
-                            tempJ = (itIJ->id1 == tempI) ? itIJ->id2 : itIJ->id1;
-                            tempK = itIK->id1;
-                        }
-                        else
-                        {
-                            continue;
-                        }
-
-                        for(featureList_t::const_iterator itJK = listJK.begin(), endJK = listJK.end(); itJK != endJK; ++itJK)
-                        {
-                            if(itJK->id1 == tempK || itJK->id2 == tempK)
-                            {
-                                if(itJK->id1 == tempJ || itJK->id2 == tempJ)
-                                {
-                                    hipI = tempI;
-                                    hipJ = tempJ;
-                                    hipK = tempK;
-                                    count++;
-                                    break;
-                                }
-                            }
-
-                        }
-                    }
-                }
+                matcher.beginTriads(listIK.size(), listJK.size());
+                for(featureList_t::const_iterator it = listIK.begin(), end = listIK.end(); it != end; ++it)
+                    matcher.addIK(it->id1, it->id2);
+                for(featureList_t::const_iterator it = listJK.begin(), end = listJK.end(); it != end; ++it)
+                    matcher.addJK(it->id1, it->id2);
+                for(featureList_t::const_iterator it = listIJ.begin(), end = listIJ.end(); it != end; ++it)
+                    matcher.matchIJ(it->id1, it->id2);
 
                 // if no unique triangle was found try next triad
-                if(count != 1)
+                if(matcher.getTriadCount() != 1)
                 {
                     continue;
                 }
 
+                int hipI, hipJ, hipK;
+                matcher.getTriad(hipI, hipJ, hipK);
+
                 idList[i] = hipI;
                 idList[j] = hipJ;
                 idList[k] = hipK;
@@ -370,76 +457,32 @@ std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vec
                     if((r == i) || (r == j) || (r == k))
                         continue;
 
-                    // calculate the angles between the new 4th star and the stars of the triad
-                    // first dot product between each 2 vectors
-                    float thetaIR = starVectors[i].dot(starVectors[r]) / (starVectors[i].norm() * starVectors[r].norm() );
-                    float thetaJR = starVectors[j].dot(starVectors[r]) / (starVectors[j].norm() * starVectors[r].norm() );
-                    float thetaKR = starVectors[k].dot(starVectors[r]) / (starVectors[k].norm() * starVectors[r].norm() );
-
-                    // arccos and conversion to deg
-                    thetaIR = acos(thetaIR) * RAD_TO_DEG;
-                    thetaJR = acos(thetaJR) * RAD_TO_DEG;
-                    thetaKR = acos(thetaKR) * RAD_TO_DEG;
-
-                    // search in the catalog for the 4th star
-                    featureList_t listIR, listJR, listKR;
-
-                    if(sqlite3_reset(sqlFinal) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                    if(sqlite3_bind_double(sqlFinal, 1, thetaIR - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                    if(sqlite3_bind_double(sqlFinal, 2, thetaIR + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 3, hipI)          != SQLITE_OK) throw std::runtime_error("Binding new value3 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 4, hipI)          != SQLITE_OK) throw std::runtime_error("Binding new value4 to query failed");
-                    retrieveFeatureList(sqlFinal, listIR);
+                    // search in the candidates of the pairs with the triad for the 4th star
+                    selectFeatures(matches[pairIndex(i, r, nSpots)], hipI, listIR);
                     // if list is empty skip further processing
                     if(listIR.empty() ) continue;
 
-                    if(sqlite3_reset(sqlFinal) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                    if(sqlite3_bind_double(sqlFinal, 1, thetaJR - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                    if(sqlite3_bind_double(sqlFinal, 2, thetaJR + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 3, hipJ)          != SQLITE_OK) throw std::runtime_error("Binding new value3 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 4, hipJ)          != SQLITE_OK) throw std::runtime_error("Binding new value4 to query failed");
-                    retrieveFeatureList(sqlFinal, listJR);
+                    selectFeatures(matches[pairIndex(j, r, nSpots)], hipJ, listJR);
                     // if list is empty skip further processing
                     if(listJR.empty() ) continue;
 
-                    if(sqlite3_reset(sqlFinal) != SQLITE_OK) throw std::runtime_error("Resetting SQL query failed");
-                    if(sqlite3_bind_double(sqlFinal, 1, thetaKR - eps) != SQLITE_OK) throw std::runtime_error("Binding new value1 to query failed");
-                    if(sqlite3_bind_double(sqlFinal, 2, thetaKR + eps) != SQLITE_OK) throw std::runtime_error("Binding new value2 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 3, hipK)          != SQLITE_OK) throw std::runtime_error("Binding new value3 to query failed");
-                    if(sqlite3_bind_int   (sqlFinal, 4, hipK)          != SQLITE_OK) throw std::runtime_error("Binding new value4 to query failed");
-                    retrieveFeatureList(sqlFinal, listKR);
+                    selectFeatures(matches[pairIndex(k, r, nSpots)], hipK, listKR);
                     // if list is empty skip further processing
                     if(listKR.empty() ) continue;
 
-
                     // check for a unique solution
-                    /// TODO: is there a more elegant solution completely in sql?
-                    count = 0;
-                    int idCheck;
-                    for(featureList_t::const_iterator itIR=listIR.begin(), endIR = listIR.end(); itIR != endIR; ++itIR)
-                    {
-                        idCheck = (itIR->id1 == hipI) ? itIR->id2 : itIR->id1;
-
-                        for(featureList_t::const_iterator itJR=listJR.begin(), endJR = listJR.end(); itJR != endJR; ++itJR)
-                        {
-                            if(itJR->id1 == idCheck || itJR->id2 == idCheck)
-                            {
-                                for(featureList_t::const_iterator itKR=listKR.begin(), endKR = listKR.end(); itKR != endKR; ++itKR)
-                                {
-                                    if(itKR->id1 == idCheck || itKR->id2 == idCheck)
-                                    {
-                                        count++;
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                    }
+                    matcher.beginFourth(listJR.size(), listKR.size());
+                    for(featureList_t::const_iterator it = listJR.begin(), end = listJR.end(); it != end; ++it)
+                        matcher.addJR(it->id1 == hipJ ? it->id2 : it->id1);
+                    for(featureList_t::const_iterator it = listKR.begin(), end = listKR.end(); it != end; ++it)
+                        matcher.addKR(it->id1 == hipK ? it->id2 : it->id1);
+                    for(featureList_t::const_iterator it = listIR.begin(), end = listIR.end(); it != end; ++it)
+                        matcher.matchIR(it->id1 == hipI ? it->id2 : it->id1);
 
                     // if count == 1, everything is good
-                    if(count == 1)
+                    if(matcher.getFourthCount() == 1)
                     {
-                        idList[r] = idCheck;
+                        idList[r] = matcher.getFourth();
 
                         // at least one 4th star found therefore the triad is confirmed and
                         // after the current loop (with r) is through the identification is completed
@@ -450,16 +493,78 @@ std::vector<int> StarIdentifier::identifyPyramidMethod(const StarIdentifier::vec
         }
     }
 
-    sqlite3_finalize(sqlStmt);
-    sqlite3_finalize(sqlFinal);
-
     return idList;
 }
 
-std::vector<int> StarIdentifier::identifyPyramidMethodKVector(const StarIdentifier::vectorList_t &starVectors, const float eps) const
+void StarIdentifier::queryFeatureIntervals(const StarIdentifier::featureList_t &features, const float eps,
+                                           std::vector<StarIdentifier::featureList_t> &matches) const
+{
+    // the lists keep their memory between the frames
+    matches.resize(features.size());
+    for(std::vector<featureList_t>::iterator it = matches.begin(); it != matches.end(); ++it)
+        it->clear();
+
+    // fill the table of intervals in one transaction
+    if(sqlite3_exec(mDb, "BEGIN", NULL, NULL, NULL) != SQLITE_OK)
+        throw std::runtime_error(std::string("Starting SQL transaction failed: ") + sqlite3_errmsg(mDb));
+
+    int result = sqlite3_reset(mIntervalClear);
+    if(result == SQLITE_OK)
+        result = sqlite3_step(mIntervalClear);
+    for(unsigned f=0; f<features.size() && result == SQLITE_DONE; ++f)
+    {
+        // a feature of a degenerate spot (e.g. a zero vector) matches nothing
+        if(!std::isfinite(features[f].theta))
+            continue;
+
+        if(sqlite3_reset(mIntervalInsert) != SQLITE_OK ||
+           sqlite3_bind_int(mIntervalInsert, 1, f) != SQLITE_OK ||
+           sqlite3_bind_double(mIntervalInsert, 2, features[f].theta - eps) != SQLITE_OK ||
+           sqlite3_bind_double(mIntervalInsert, 3, features[f].theta + eps) != SQLITE_OK)
+            result = SQLITE_ERROR;
+        else
+            result = sqlite3_step(mIntervalInsert);
+    }
+
+    if(result != SQLITE_DONE)
+    {
+        const std::string message = std::string("Inserting the SQL search intervals failed: ") + sqlite3_errmsg(mDb);
+        sqlite3_exec(mDb, "ROLLBACK", NULL, NULL, NULL);
+        throw std::runtime_error(message);
+    }
+    if(sqlite3_exec(mDb, "COMMIT", NULL, NULL, NULL) != SQLITE_OK)
+        throw std::runtime_error(std::string("Committing SQL transaction failed: ") + sqlite3_errmsg(mDb));
+
+    // one query for all intervals
+    if(sqlite3_reset(mIntervalQuery) != SQLITE_OK)
+        throw std::runtime_error("Resetting SQL query failed");
+    while( (result = sqlite3_step(mIntervalQuery)) == SQLITE_ROW)
+    {
+        const int f = sqlite3_column_int(mIntervalQuery, 0);
+        matches[f].push_back(Feature2(sqlite3_column_int(mIntervalQuery, 1), sqlite3_column_int(mIntervalQuery, 2),
+                                      sqlite3_column_double(mIntervalQuery, 3)));
+    }
+
+    if (result != SQLITE_DONE)
+        throw std::runtime_error("SQL search returned with unexpected result");
+}
+
+void StarIdentifier::selectFeatures(const StarIdentifier::featureList_t &features, int hip, StarIdentifier::featureList_t &output)
+{
+    output.clear();
+    for(featureList_t::const_iterator it = features.begin(); it != features.end(); ++it)
+    {
+        if(it->id1 == hip || it->id2 == hip)
+            output.push_back(*it);
+    }
+}
+
+void StarIdentifier::identifyPyramidMethodKVector(const StarIdentifier::vectorList_t &starVectors, const float eps,
+                                                  std::vector<int> &idList, StarIdentifier::Scratch &scratch,
+                                                  const std::vector<float> *brightness) const
 {
 
-    if(mKVector.empty() || mFeatureList.empty() )
+    if(mFeatureCount == 0)
         throw std::runtime_error("No feature list loaded");
 
     /* Algorithm:
@@ -483,172 +588,351 @@ std::vector<int> StarIdentifier::identifyPyramidMethodKVector(const StarIdentifi
     if( nSpots < 4)
         throw std::range_error("At least 4 star spots necessary");
 
-    std::vector<int> idList;
+    // the tolerance is applied in cosine space, so no arccos is required per feature
+    const float DEG_TO_RAD = M_PI / 180;
+    const float cosEps = cos(eps * DEG_TO_RAD);
+    const float sinEps = sin(eps * DEG_TO_RAD);
+
+    // the triads are only formed of the candidates
+    std::vector<int> & candidates = scratch.mCandidates;
+    selectCandidates(nSpots, brightness, candidates);
+    const int nCandidates = candidates.size();
+
+    const float * magnitudes = spotMagnitudes(brightness, scratch.mSpotMagnitudes) ? scratch.mSpotMagnitudes.data() : NULL;
 
     // Stop iteration as soon as one unique triad is identified
     bool identificationComplete = false;
+    idList.assign(nSpots, -1);
 
     // iteration in the order suggested by Mortari 2004
-    for(int dj=1; dj<(nSpots-1) && !identificationComplete; ++dj)
+    for(int dj=1; dj<(nCandidates-1) && !identificationComplete; ++dj)
     {
-        for(int dk=1; dk<(nSpots-dj) && !identificationComplete; ++dk)
+        for(int dk=1; dk<(nCandidates-dj) && !identificationComplete; ++dk)
         {
-            for(int i=0; i<(nSpots-dj-dk) && !identificationComplete; ++i)
+            for(int i=0; i<(nCandidates-dj-dk) && !identificationComplete; ++i)
             {
                 int j = i + dj;
                 int k = j + dk;
-                idList.assign(nSpots, -1);
+                identificationComplete = identifyTriadKVector(starVectors, candidates[i], candidates[j], candidates[k],
+                                                              cosEps, sinEps, magnitudes, idList, scratch);
+            }
+        }
+    }
 
-                // calculate the 3 angles (features)
-                const float RAD_TO_DEG = 180 / M_PI;
-                // first dot product between each 2 vectors
-                float thetaIJ = starVectors[i].dot(starVectors[j]) / (starVectors[i].norm() * starVectors[j].norm() );
-                float thetaIK = starVectors[i].dot(starVectors[k]) / (starVectors[i].norm() * starVectors[k].norm() );
-                float thetaJK = starVectors[j].dot(starVectors[k]) / (starVectors[j].norm() * starVectors[k].norm() );
+    catalogIndexToHip(idList);
+}
 
-                // arccos and conversion to deg
-                thetaIJ = acos(thetaIJ) * RAD_TO_DEG;
-                thetaIK = acos(thetaIK) * RAD_TO_DEG;
-                thetaJK = acos(thetaJK) * RAD_TO_DEG;
+void StarIdentifier::identifyPyramidMethodKVectorParallel(const StarIdentifier::vectorList_t &starVectors, const float eps,
+                                                          std::vector<int> &idList, const std::vector<float> *brightness) const
+{
+    if(!mPool)
+    {
+        Scratch scratch;
+        identifyPyramidMethodKVector(starVectors, eps, idList, scratch, brightness);
+        return;
+    }
 
-                // get a list with possible candidates for each theta
-                featureList_t listIJ, listIK, listJK;
+    if(mFeatureCount == 0)
+        throw std::runtime_error("No feature list loaded");
 
-                retrieveFeatureListKVector(thetaIJ - eps, thetaIJ + eps, listIJ);
-                // if list is empty skip further processing
-                if(listIJ.empty() ) continue;
+    int nSpots = starVectors.size();
+    if( nSpots < 4)
+        throw std::range_error("At least 4 star spots necessary");
 
-                retrieveFeatureListKVector(thetaIK - eps, thetaIK + eps, listIK);
-                // if list is empty skip further processing
-                if(listIK.empty() ) continue;
+    const float DEG_TO_RAD = M_PI / 180;
+    const float cosEps = cos(eps * DEG_TO_RAD);
+    const float sinEps = sin(eps * DEG_TO_RAD);
 
-                retrieveFeatureListKVector(thetaJK - eps, thetaJK + eps, listJK);
-                // if list is empty skip further processing
-                if(listJK.empty() ) continue;
+    std::lock_guard<std::mutex> lock(mParallelMutex);
 
-                // find possible triads
+    // list the triads of the candidates in the order suggested by Mortari 2004
+    selectCandidates(nSpots, brightness, mCandidates);
+    const int nCandidates = mCandidates.size();
+    mTriads.clear();
+    for(int dj=1; dj<(nCandidates-1); ++dj)
+        for(int dk=1; dk<(nCandidates-dj); ++dk)
+            for(int i=0; i<(nCandidates-dj-dk); ++i)
+                mTriads.push_back(Eigen::Vector3i(mCandidates[i], mCandidates[i + dj], mCandidates[i + dj + dk]));
 
-                int hipI, hipJ, hipK, count = 0;
-                for(featureList_t::const_iterator itIJ = listIJ.begin(), endIJ = listIJ.end(); itIJ != endIJ; ++itIJ)
-                {
-                    int tempI, tempJ, tempK;
-                    for(featureList_t::const_iterator itIK = listIK.begin(), endIK = listIK.end(); itIK != endIK; ++itIK)
-                    {
-                        if(itIJ->id1 == itIK->id1 || itIJ->id2 == itIK->id1)
-                        {
-                            tempI = itIK->id1;
-                            tempJ = (itIJ->id1 == tempI) ? itIJ->id2 : itIJ->id1;
-                            tempK = itIK->id2;
-                        }
-                        else if(itIJ->id1 == itIK->id2 || itIJ->id2 == itIK->id2)
-                        {
-                            tempI = itIK->id2;
-                            tempJ = (itIJ->id1 == tempI) ? itIJ->id2 : itIJ->id1;
-                            tempK = itIK->id1;
-                        }
-                        else
-                        {
-                            continue;
-                        }
-
-                        for(featureList_t::const_iterator itJK = listJK.begin(), endJK = listJK.end(); itJK != endJK; ++itJK)
-                        {
-                            if(itJK->id1 == tempK || itJK->id2 == tempK)
-                            {
-                                if(itJK->id1 == tempJ || itJK->id2 == tempJ)
-                                {
-                                    hipI = tempI;
-                                    hipJ = tempJ;
-                                    hipK = tempK;
-                                    count++;
-                                    break;
-                                }
-                            }
-
-                        }
-                    }
-                }
+    const float * magnitudes = spotMagnitudes(brightness, mSpotMagnitudes) ? mSpotMagnitudes.data() : NULL;
 
-                // if no unique triangle was found try next triad
-                if(count != 1)
-                {
-                    continue;
-                }
+    const unsigned nTriads = mTriads.size();
+    for(std::vector<WorkerState>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it)
+    {
+        it->triad = nTriads;
+        it->last = nTriads;
+    }
 
-                idList[i] = hipI;
-                idList[j] = hipJ;
-                idList[k] = hipK;
-                // check if a matching 4th star is found and if identify all remaining spots
-                for(int r=0; r<nSpots; ++r)
-                {
-                    // ignore the stars of the triad
-                    if((r == i) || (r == j) || (r == k))
-                        continue;
+    // position of the first confirmed triad found so far
+    std::atomic<unsigned> best(nTriads);
 
-                    // calculate the angles between the new 4th star and the stars of the triad
-                    // first dot product between each 2 vectors
-                    float thetaIR = starVectors[i].dot(starVectors[r]) / (starVectors[i].norm() * starVectors[r].norm() );
-                    float thetaJR = starVectors[j].dot(starVectors[r]) / (starVectors[j].norm() * starVectors[r].norm() );
-                    float thetaKR = starVectors[k].dot(starVectors[r]) / (starVectors[k].norm() * starVectors[r].norm() );
+    mPool->parallelFor(nTriads, [&](unsigned triad, unsigned worker)
+    {
+        // triads after an already confirmed one can not be the result
+        if(triad >= best)
+            return;
+
+        WorkerState & state = mWorkers[worker];
+        const Eigen::Vector3i & t = mTriads[triad];
+        state.last = triad;
+        if(!identifyTriadKVector(starVectors, t[0], t[1], t[2], cosEps, sinEps, magnitudes, state.idList, state.scratch))
+            return;
+
+        // a worker takes the triads in ascending order and skips all after best,
+        // hence this is its only confirmed triad and state.idList is kept
+        state.triad = triad;
+        unsigned current = best;
+        while(triad < current && !best.compare_exchange_weak(current, triad)) {}
+    });
+
+    // without a confirmed triad the sequential search leaves the result of the last triad
+    const unsigned result = best < nTriads ? (unsigned) best : nTriads - 1;
+    idList.assign(nSpots, -1);
+    for(std::vector<WorkerState>::iterator it = mWorkers.begin(); it != mWorkers.end(); ++it)
+    {
+        if(nTriads > 0 && it->last == result)
+            idList = it->idList;
+    }
 
-                    // arccos and conversion to deg
-                    thetaIR = acos(thetaIR) * RAD_TO_DEG;
-                    thetaJR = acos(thetaJR) * RAD_TO_DEG;
-                    thetaKR = acos(thetaKR) * RAD_TO_DEG;
+    catalogIndexToHip(idList);
+}
 
-                    // search in the catalog for the 4th star
-                    featureList_t listIR, listJR, listKR;
+bool StarIdentifier::identifyTriadKVector(const StarIdentifier::vectorList_t &starVectors, int i, int j, int k,
+                                          float cosEps, float sinEps, const float *magnitudes,
+                                          std::vector<int> &idList, StarIdentifier::Scratch &scratch) const
+{
+    const int nSpots = starVectors.size();
+    float cosMin, cosMax;
 
-                    retrieveFeatureListKVector(thetaIR - eps, thetaIR + eps, hipI, listIR);
-                    // if list is empty skip further processing
-                    if(listIR.empty() ) continue;
+    // the arena has to hold the three filtered lists of the 4th star
+    scratch.mFeatures.reserve(3 * mMaxStarFeatures);
 
-                    retrieveFeatureListKVector(thetaJR - eps, thetaJR + eps, hipJ, listJR);
-                    // if list is empty skip further processing
-                    if(listJR.empty() ) continue;
+    idList.assign(nSpots, -1);
 
-                    retrieveFeatureListKVector(thetaKR - eps, thetaKR + eps, hipK, listKR);
-                    // if list is empty skip further processing
-                    if(listKR.empty() ) continue;
+    // calculate the cosines of the 3 angles (features)
+    float thetaIJ = starVectors[i].dot(starVectors[j]) / (starVectors[i].norm() * starVectors[j].norm() );
+    float thetaIK = starVectors[i].dot(starVectors[k]) / (starVectors[i].norm() * starVectors[k].norm() );
+    float thetaJK = starVectors[j].dot(starVectors[k]) / (starVectors[j].norm() * starVectors[k].norm() );
 
-                    // check for a unique solution
-                    /// TODO: is there a more elegant solution?
-                    count = 0;
-                    int idCheck;
-                    for(featureList_t::const_iterator itIR=listIR.begin(), endIR = listIR.end(); itIR != endIR; ++itIR)
-                    {
-                        idCheck = (itIR->id1 == hipI) ? itIR->id2 : itIR->id1;
-
-                        for(featureList_t::const_iterator itJR=listJR.begin(), endJR = listJR.end(); itJR != endJR; ++itJR)
-                        {
-                            if(itJR->id1 == idCheck || itJR->id2 == idCheck)
-                            {
-                                for(featureList_t::const_iterator itKR=listKR.begin(), endKR = listKR.end(); itKR != endKR; ++itKR)
-                                {
-                                    if(itKR->id1 == idCheck || itKR->id2 == idCheck)
-                                    {
-                                        count++;
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-                    }
+    // get a range of possible candidates for each theta
+    IndexRange listIJ, listIK, listJK;
+    {
+        STARCAM_TIMER(Instrumentation::KVectorQuery);
+
+        cosineInterval(thetaIJ, cosEps, sinEps, cosMin, cosMax);
+        listIJ = retrieveFeatureRangeKVector(cosMin, cosMax);
+        // if list is empty skip further processing
+        if(listIJ.empty() ) return false;
+
+        cosineInterval(thetaIK, cosEps, sinEps, cosMin, cosMax);
+        listIK = retrieveFeatureRangeKVector(cosMin, cosMax);
+        // if list is empty skip further processing
+        if(listIK.empty() ) return false;
+
+        cosineInterval(thetaJK, cosEps, sinEps, cosMin, cosMax);
+        listJK = retrieveFeatureRangeKVector(cosMin, cosMax);
+        // if list is empty skip further processing
+        if(listJK.empty() ) return false;
+    }
 
-                    // if count == 1, everything is good
-                    if(count == 1)
-                    {
-                        idList[r] = idCheck;
+    // differences of the spot magnitudes to prune the candidates with
+    const float magIJ = magnitudes ? std::fabs(magnitudes[i] - magnitudes[j]) : NAN;
+    const float magIK = magnitudes ? std::fabs(magnitudes[i] - magnitudes[k]) : NAN;
+    const float magJK = magnitudes ? std::fabs(magnitudes[j] - magnitudes[k]) : NAN;
 
-                        // at least one 4th star found therefore the triad is confirmed and
-                        // after the current loop (with r) is through the identification is completed
-                        identificationComplete = true;
-                    }
-                }
+    // find possible triads
+    TriadMatcher & matcher = scratch.mMatcher;
+    {
+        STARCAM_TIMER(Instrumentation::TriadMatching);
+        matcher.beginTriads(listIK.size(), listJK.size());
+        for(uint32_t f = listIK.begin; f < listIK.end; ++f)
+            if(!magnitudes || matchesMagnitudes(mId1[f], mId2[f], magIK))
+                matcher.addIK(mId1[f], mId2[f]);
+        for(uint32_t f = listJK.begin; f < listJK.end; ++f)
+            if(!magnitudes || matchesMagnitudes(mId1[f], mId2[f], magJK))
+                matcher.addJK(mId1[f], mId2[f]);
+        for(uint32_t f = listIJ.begin; f < listIJ.end; ++f)
+            if(!magnitudes || matchesMagnitudes(mId1[f], mId2[f], magIJ))
+                matcher.matchIJ(mId1[f], mId2[f]);
+    }
+
+    // if no unique triangle was found try next triad
+    if(matcher.getTriadCount() != 1)
+    {
+        return false;
+    }
+
+    int hipI, hipJ, hipK;
+    matcher.getTriad(hipI, hipJ, hipK);
+
+    idList[i] = hipI;
+    idList[j] = hipJ;
+    idList[k] = hipK;
+
+    // with the inertial vectors the remaining stars are predicted from the attitude of the triad,
+    // within twice the tolerance as the attitude adds the errors of the triad (cos(2 eps), sin(2 eps))
+    const float cosRadius = cosEps * cosEps - sinEps * sinEps;
+    const float sinRadius = 2.0f * sinEps * cosEps;
+    Eigen::Matrix3f attitude;
+    const bool predict = triadAttitude(starVectors, i, j, k, hipI, hipJ, hipK, cosRadius, sinRadius, attitude);
+
+    bool confirmed = false;
+    // check if a matching 4th star is found and if identify all remaining spots
+    for(int r=0; r<nSpots; ++r)
+    {
+        // ignore the stars of the triad
+        if((r == i) || (r == j) || (r == k))
+            continue;
+
+        if(predict)
+        {
+            const float magR = magnitudes ? magnitudes[r] - magnitudes[i] : NAN;
+            const int star = predictStar(attitude, starVectors[r], hipI, hipJ, hipK, cosRadius, sinRadius, magR, scratch);
+            if(star >= 0)
+            {
+                idList[r] = star;
+                confirmed = true;
+                continue;
             }
+            // ambiguous predictions are resolved with the k-vector, and as the error of the attitude
+            // grows with a short baseline of the triad a star may be outside of the radius, so spots
+            // without a predicted star are searched with the k-vector as well
+        }
+
+        // calculate the angles between the new 4th star and the stars of the triad
+        float thetaIR = starVectors[i].dot(starVectors[r]) / (starVectors[i].norm() * starVectors[r].norm() );
+        float thetaJR = starVectors[j].dot(starVectors[r]) / (starVectors[j].norm() * starVectors[r].norm() );
+        float thetaKR = starVectors[k].dot(starVectors[r]) / (starVectors[k].norm() * starVectors[r].norm() );
+
+        // search in the catalog for the 4th star
+        scratch.mFeatures.clear();
+
+        IndexRange listIR, listJR, listKR;
+        {
+            STARCAM_TIMER(Instrumentation::KVectorQuery);
+
+            cosineInterval(thetaIR, cosEps, sinEps, cosMin, cosMax);
+            listIR = retrieveFeatureRangeKVector(cosMin, cosMax, hipI, scratch);
+            // if list is empty skip further processing
+            if(listIR.empty() ) continue;
+
+            cosineInterval(thetaJR, cosEps, sinEps, cosMin, cosMax);
+            listJR = retrieveFeatureRangeKVector(cosMin, cosMax, hipJ, scratch);
+            // if list is empty skip further processing
+            if(listJR.empty() ) continue;
+
+            cosineInterval(thetaKR, cosEps, sinEps, cosMin, cosMax);
+            listKR = retrieveFeatureRangeKVector(cosMin, cosMax, hipK, scratch);
+            // if list is empty skip further processing
+            if(listKR.empty() ) continue;
+        }
+
+        // the stars of the triad are known, so the magnitude of r is compared directly
+        const float magR = magnitudes ? magnitudes[r] : NAN;
+
+        // check for a unique solution
+        {
+            STARCAM_TIMER(Instrumentation::TriadMatching);
+            const uint32_t * features = scratch.mFeatures.data();
+            matcher.beginFourth(listJR.size(), listKR.size());
+            for(uint32_t f = listJR.begin; f < listJR.end; ++f)
+            {
+                const int star = mId1[features[f]] == hipJ ? mId2[features[f]] : mId1[features[f]];
+                if(!magnitudes || matchesMagnitude(star, hipJ, magR - magnitudes[j]))
+                    matcher.addJR(star);
+            }
+            for(uint32_t f = listKR.begin; f < listKR.end; ++f)
+            {
+                const int star = mId1[features[f]] == hipK ? mId2[features[f]] : mId1[features[f]];
+                if(!magnitudes || matchesMagnitude(star, hipK, magR - magnitudes[k]))
+                    matcher.addKR(star);
+            }
+            for(uint32_t f = listIR.begin; f < listIR.end; ++f)
+            {
+                const int star = mId1[features[f]] == hipI ? mId2[features[f]] : mId1[features[f]];
+                if(!magnitudes || matchesMagnitude(star, hipI, magR - magnitudes[i]))
+                    matcher.matchIR(star);
+            }
+        }
+
+        // if count == 1, everything is good
+        if(matcher.getFourthCount() == 1)
+        {
+            idList[r] = matcher.getFourth();
+
+            // at least one 4th star found therefore the triad is confirmed and
+            // after the current loop (with r) is through the identification is completed
+            confirmed = true;
         }
     }
-    return idList;
+
+    return confirmed;
+}
+
+bool StarIdentifier::triadAttitude(const StarIdentifier::vectorList_t &starVectors, int i, int j, int k,
+                                   int hipI, int hipJ, int hipK, float cosRadius, float sinRadius,
+                                   Eigen::Matrix3f &attitude) const
+{
+    if(!mStarVectors)
+        return false;
+
+    const Eigen::Vector3f & refI = mStarVectors[hipI];
+    const Eigen::Vector3f & refJ = mStarVectors[hipJ];
+    const Eigen::Vector3f & refK = mStarVectors[hipK];
+    if(refI.isZero() || refJ.isZero() || refK.isZero())
+        return false;
+
+    // TRIAD: orthonormal frames of the first two stars in both systems
+    const Eigen::Vector3f bodyI = starVectors[i].normalized();
+    const Eigen::Vector3f bodyJ = starVectors[j].normalized();
+    Eigen::Matrix3f body, reference;
+    body.col(0) = bodyI;
+    body.col(1) = bodyI.cross(bodyJ).normalized();
+    body.col(2) = body.col(0).cross(body.col(1));
+    reference.col(0) = refI;
+    reference.col(1) = refI.cross(refJ).normalized();
+    reference.col(2) = reference.col(0).cross(reference.col(1));
+    attitude = body * reference.transpose();
+
+    // the prediction is only used if the third star is where the attitude predicts it, otherwise
+    // all spots are searched with the k-vector; compared by the squared chord 2 sin^2 / (1 + cos),
+    // which is precise for small angles
+    const float chord2 = 2.0f * sinRadius * sinRadius / (1.0f + cosRadius);
+    return (attitude * refK - starVectors[k].normalized()).squaredNorm() <= chord2;
+}
+
+int StarIdentifier::predictStar(const Eigen::Matrix3f &attitude, const Eigen::Vector3f &spot,
+                                int hipI, int hipJ, int hipK, float cosRadius, float sinRadius,
+                                float magnitude, StarIdentifier::Scratch &scratch) const
+{
+    // inertial direction of the spot
+    const Eigen::Vector3f direction = attitude.transpose() * spot.normalized();
+    getSkyIndex().coneQuery(direction, cosRadius, sinRadius, scratch.mNeighbours);
+
+    int star = PREDICTION_NONE;
+    for(std::vector<int>::const_iterator it = scratch.mNeighbours.begin(); it != scratch.mNeighbours.end(); ++it)
+    {
+        // a spot on a star of the triad is a duplicate
+        if(*it == hipI || *it == hipJ || *it == hipK)
+            continue;
+        if(!std::isnan(magnitude) && !matchesMagnitude(*it, hipI, magnitude))
+            continue;
+        if(star != PREDICTION_NONE)
+            return PREDICTION_AMBIGUOUS;
+        star = *it;
+    }
+
+    return star;
+}
+
+void StarIdentifier::catalogIndexToHip(std::vector<int> &idList) const
+{
+    // the feature list holds catalog indices, translate them into hip-IDs
+    for(std::vector<int>::iterator it = idList.begin(), end = idList.end(); it != end; ++it)
+    {
+        if(*it != -1)
+            *it = mStarHip[*it];
+    }
 }
 
 void StarIdentifier::createFeatureList2(const vectorList_t &starVectors, featureList_t &output) const
@@ -672,70 +956,67 @@ void StarIdentifier::createFeatureList2(const vectorList_t &starVectors, feature
         {
             float dot = it1->dot(*it2) / (it1->norm() * it2->norm()) ;
             // compute the angle between the two vectors and add to the feature list
-            float theta = acos(dot ) * RAD_TO_DEG;
+            // (coinciding spots may round the dot product beyond 1)
+            float theta = acos(std::min(1.0f, std::max(-1.0f, dot)) ) * RAD_TO_DEG;
             output.push_back(Feature2(i, j, theta) ) ;
         }
     }
 }
 
-void StarIdentifier::retrieveFeatureList(sqlite3_stmt * sqlStmt, StarIdentifier::featureList_t &output) const
+void StarIdentifier::cosineInterval(float cosTheta, float cosEps, float sinEps, float &cosMin, float &cosMax)
 {
-    output.clear();
-
-    int result;
-    while( (result = sqlite3_step(sqlStmt)) == SQLITE_ROW)
-    {
-        // get the first hip
-        int hip1 = sqlite3_column_int(sqlStmt, 0);
-        int hip2 = sqlite3_column_int(sqlStmt, 1);
-        float theta = sqlite3_column_double(sqlStmt, 2);
+    // sin(theta) is always positive for theta in [0, pi]
+    float sinTheta = sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
 
-        output.push_back(Feature2(hip1, hip2, theta));
-    }
+    // cos(theta + eps) and cos(theta - eps)
+    cosMin = cosTheta * cosEps - sinTheta * sinEps;
+    cosMax = cosTheta * cosEps + sinTheta * sinEps;
 
-    if (result != SQLITE_DONE)
-        throw std::runtime_error("SQL search returned with unexpected result");
+    // theta - eps < 0 includes theta = 0
+    if(cosTheta > cosEps)
+        cosMax = 1.0f;
 }
 
-void StarIdentifier::retrieveFeatureListKVector(float thetaMin, float thetaMax, StarIdentifier::featureList_t &output) const
+StarIdentifier::IndexRange StarIdentifier::retrieveFeatureRangeKVector(float cosMin, float cosMax) const
 {
-
-    output.clear();
-    // caclulate k-indices (jb and jt in mortari)
-    unsigned jb = (unsigned) ((thetaMin - mQ) / mM);
-    unsigned jt = (unsigned) ((thetaMax - mQ) / mM) +1; //always round up
+    // also rejects NaN
+    if(mFeatureCount == 0 || !(cosMin <= cosMax))
+        return IndexRange();
+
+    // caclulate k-indices (jb and jt in mortari), clamped to the k-vector
+    // before the conversion, as intervals outside of the catalog would overflow
+    const double last = mFeatureCount - 1;
+    const double jb = std::floor((cosMin - mQ) / mM);
+    const double jt = std::floor((cosMax - mQ) / mM) + 1; //always round up
+    if(jt < 0.0 || jb > last)
+        return IndexRange();
 
     // calculate bottom and top index from the kVector
-    unsigned kb = mKVector[jb] + 1;
-    unsigned kt = mKVector[jt];
-
-    for(unsigned i=kb; i<=kt; ++i)
-    {
-        output.push_back(mFeatureList[i]);
-    }
+    // (k[j] is the number of elements <= z(j), i.e. the first index above z(j))
+    const uint32_t bottom = mKVectorData[(uint32_t) std::max(jb, 0.0)];
+    const uint32_t top = mKVectorData[(uint32_t) std::min(jt, last)];
+    if(bottom >= top)
+        return IndexRange();
+
+    // the buckets are wider than the interval, trim both ends to [cosMin, cosMax]
+    const uint32_t begin = lowerBound(mCosTheta, bottom, top, cosMin);
+    const uint32_t end = upperBound(mCosTheta, begin, top, cosMax);
+    return IndexRange(begin, end);
 }
 
-void StarIdentifier::retrieveFeatureListKVector(float thetaMin, float thetaMax, int hip, StarIdentifier::featureList_t &output) const
+StarIdentifier::IndexRange StarIdentifier::retrieveFeatureRangeKVector(float cosMin, float cosMax, int star, StarIdentifier::Scratch &scratch) const
 {
-    output.clear();
-    // caclulate k-indices (jb and jt in mortari)
-    unsigned jb = (unsigned) ((thetaMin - mQ) / mM);
-    unsigned jt = (unsigned) ((thetaMax - mQ) / mM) +1; //always round up
+    const IndexRange range = retrieveFeatureRangeKVector(cosMin, cosMax);
+    const uint32_t begin = scratch.mFeatures.size();
 
-    // calculate get bottom and to index from the kVector
-    unsigned kb = mKVector[jb] + 1;
-    unsigned kt = mKVector[jt];
-
-    for(unsigned i=kb; i<=kt; ++i)
+    // only the index arrays are touched while scanning
+    for(uint32_t i=range.begin; i<range.end; ++i)
     {
-        Feature2 temp = mFeatureList[i];
-        if (temp.id1 == hip || temp.id2 == hip)
+        if (mId1[i] == star || mId2[i] == star)
         {
-            output.push_back(temp);
+            scratch.mFeatures.push_back(i);
         }
     }
-}
-
-
-
 
+    return IndexRange(begin, scratch.mFeatures.size());
+}
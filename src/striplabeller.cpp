@@ -0,0 +1,140 @@
+#include <algorithm>
+
+#include "striplabeller.h"
+
+StripLabeller::StripLabeller(unsigned nThreads)
+    :mPool(nThreads), mStrips(mPool.getNumThreads())
+{
+}
+
+void StripLabeller::setConnectivity(unsigned connectivity)
+{
+    for(unsigned s=0; s<mStrips.size(); ++s)
+        mStrips[s].setConnectivity(connectivity);
+}
+
+void StripLabeller::setDefectMap(const DefectMap *defects)
+{
+    for(unsigned s=0; s<mStrips.size(); ++s)
+        mStrips[s].setDefectMap(defects);
+}
+
+template<typename T>
+unsigned StripLabeller::label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride, const T threshold)
+{
+    return labelStrips(rows, [&](RunLabeller &labeller, unsigned begin, unsigned end)
+    {
+        labeller.label(image + begin * stride, end - begin, cols, stride, threshold, begin);
+    });
+}
+
+template<typename T>
+unsigned StripLabeller::label(const T *image, const unsigned rows, const unsigned cols, const std::size_t stride,
+                              const T *thresholdRows, const unsigned tileSize)
+{
+    return labelStrips(rows, [&](RunLabeller &labeller, unsigned begin, unsigned end)
+    {
+        labeller.label(image + begin * stride, end - begin, cols, stride, thresholdRows, tileSize, begin);
+    });
+}
+
+template<typename LabelStrip>
+unsigned StripLabeller::labelStrips(const unsigned rows, const LabelStrip &labelStrip)
+{
+    mBlobs.clear();
+    if(rows == 0)
+        return 0;
+
+    // one strip per thread, at least one row each
+    const unsigned nStrips = std::min<unsigned>(mStrips.size(), rows);
+    mPool.parallelFor(nStrips, [&](unsigned strip, unsigned)
+    {
+        const unsigned begin = (unsigned long long) rows * strip / nStrips;
+        const unsigned end = (unsigned long long) rows * (strip + 1) / nStrips;
+        labelStrip(mStrips[strip], begin, end);
+    });
+
+    // global blob index: strips in order, blobs in raster order within a strip
+    mOffset.resize(nStrips + 1);
+    mOffset[0] = 0;
+    for(unsigned s=0; s<nStrips; ++s)
+        mOffset[s + 1] = mOffset[s] + mStrips[s].getBlobCount();
+
+    mParent.resize(mOffset[nStrips]);
+    for(unsigned b=0; b<mParent.size(); ++b)
+        mParent[b] = b;
+
+    for(unsigned s=0; s+1<nStrips; ++s)
+        stitch(mStrips[s], mStrips[s + 1], mOffset[s], mOffset[s + 1]);
+
+    // the smallest index is the root, so the roots are in raster order of the first pixel
+    mOutput.resize(mParent.size());
+    for(unsigned s=0; s<nStrips; ++s)
+    {
+        for(unsigned b=0; b<mStrips[s].getBlobCount(); ++b)
+        {
+            const unsigned blob = mOffset[s] + b;
+            const unsigned root = find(blob);
+            if(root == blob)
+            {
+                mOutput[blob] = mBlobs.size();
+                mBlobs.push_back(mStrips[s].getBlob(b));
+            }
+            else
+            {
+                // roots precede their children
+                mBlobs[mOutput[root]].add(mStrips[s].getBlob(b));
+            }
+        }
+    }
+
+    return mBlobs.size();
+}
+
+void StripLabeller::stitch(const RunLabeller &upper, const RunLabeller &lower, unsigned upperOffset, unsigned lowerOffset)
+{
+    const std::vector<RunLabeller::Run> & above = upper.mPrevRuns;
+    const std::vector<RunLabeller::Run> & below = lower.mFirstRuns;
+
+    // same connectivity test as between the rows of a strip
+    const unsigned reach = upper.getConnectivity() == 8 ? 1 : 0;
+    unsigned first = 0;
+    for(unsigned r=0; r<below.size(); ++r)
+    {
+        while(first < above.size() && above[first].end + reach < below[r].start)
+            ++first;
+
+        for(unsigned a=first; a<above.size() && above[a].start <= below[r].end + reach; ++a)
+        {
+            const unsigned rootA = find(upperOffset + above[a].label);
+            const unsigned rootB = find(lowerOffset + below[r].label);
+            if(rootA < rootB)
+                mParent[rootB] = rootA;
+            else if(rootB < rootA)
+                mParent[rootA] = rootB;
+        }
+    }
+}
+
+unsigned StripLabeller::find(unsigned blob)
+{
+    unsigned root = blob;
+    while(mParent[root] != root)
+        root = mParent[root];
+
+    while(mParent[blob] != root)
+    {
+        const unsigned next = mParent[blob];
+        mParent[blob] = root;
+        blob = next;
+    }
+
+    return root;
+}
+
+template unsigned StripLabeller::label<uint8_t>(const uint8_t *, const unsigned, const unsigned, const std::size_t, const uint8_t);
+template unsigned StripLabeller::label<uint16_t>(const uint16_t *, const unsigned, const unsigned, const std::size_t, const uint16_t);
+template unsigned StripLabeller::label<uint8_t>(const uint8_t *, const unsigned, const unsigned, const std::size_t,
+                                                const uint8_t *, const unsigned);
+template unsigned StripLabeller::label<uint16_t>(const uint16_t *, const unsigned, const unsigned, const std::size_t,
+                                                 const uint16_t *, const unsigned);
@@ -0,0 +1,93 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned nThreads)
+    :mTask(NULL), mCount(0), mNext(0), mGeneration(0), mBusy(0), mShutdown(false)
+{
+    if(nThreads == 0)
+        nThreads = std::thread::hardware_concurrency();
+    if(nThreads == 0)
+        nThreads = 1;
+
+    for(unsigned worker=1; worker<nThreads; ++worker)
+        mThreads.push_back(std::thread(&ThreadPool::workerLoop, this, worker));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+    }
+    mStartCond.notify_all();
+
+    for(std::vector<std::thread>::iterator it = mThreads.begin(); it != mThreads.end(); ++it)
+        it->join();
+}
+
+void ThreadPool::parallelFor(unsigned n, const ThreadPool::Task &task)
+{
+    if(n == 0)
+        return;
+
+    std::lock_guard<std::mutex> run(mRunMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTask = &task;
+        mCount = n;
+        mNext = 0;
+        mBusy = mThreads.size();
+        mError = std::exception_ptr();
+        ++mGeneration;
+    }
+    mStartCond.notify_all();
+
+    // the calling thread is worker 0
+    work(0);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(mBusy > 0)
+        mDoneCond.wait(lock);
+    mTask = NULL;
+
+    if(mError)
+        std::rethrow_exception(mError);
+}
+
+void ThreadPool::work(unsigned worker)
+{
+    for(unsigned index = mNext++; index < mCount; index = mNext++)
+    {
+        try
+        {
+            (*mTask)(index, worker);
+        }
+        catch(...)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            if(!mError)
+                mError = std::current_exception();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned worker)
+{
+    unsigned generation = 0;
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        while(!mShutdown && generation == mGeneration)
+            mStartCond.wait(lock);
+        if(mShutdown)
+            return;
+        generation = mGeneration;
+
+        lock.unlock();
+        work(worker);
+        lock.lock();
+
+        if(--mBusy == 0)
+            mDoneCond.notify_one();
+    }
+}
@@ -0,0 +1,174 @@
+#include <cmath>
+#include <stdexcept>
+
+#include <Eigen/SVD>
+
+#include "trackingidentifier.h"
+
+TrackingIdentifier::TrackingIdentifier(const StarIdentifier &identifier)
+    :mIdentifier(identifier), mEps(0.1f), mMinTracked(3)
+{
+    setSearchRadius(0.2f);
+    reset();
+}
+
+void TrackingIdentifier::setSearchRadius(float radius)
+{
+    const float DEG_TO_RAD = M_PI / 180;
+    mCosRadius = cos(radius * DEG_TO_RAD);
+}
+
+void TrackingIdentifier::setMinTrackedStars(unsigned n)
+{
+    if(n < 2)
+        throw std::invalid_argument("At least 2 stars have to be tracked");
+    mMinTracked = n;
+}
+
+void TrackingIdentifier::reset()
+{
+    mPrevVectors.clear();
+    mPrevIds.clear();
+    mRate.setIdentity();
+    mTracking = false;
+    mTrackedFrames = 0;
+    mLostInSpaceFrames = 0;
+}
+
+void TrackingIdentifier::identifyStars(const StarIdentifier::vectorList_t &starVectors, std::vector<int> &idList,
+                                       const std::vector<float> *brightness)
+{
+    mTracking = !mPrevIds.empty() && track(starVectors, idList) >= mMinTracked;
+
+    if(mTracking)
+    {
+        ++mTrackedFrames;
+    }
+    else
+    {
+        ++mLostInSpaceFrames;
+        try
+        {
+            mIdentifier.identifyStars(starVectors, mEps, idList, mScratch, StarIdentifier::PyramidKVector, brightness);
+        }
+        catch(...)
+        {
+            // nothing to track from in the next frame
+            mPrevIds.clear();
+            throw;
+        }
+    }
+
+    update(starVectors, idList);
+}
+
+unsigned TrackingIdentifier::track(const StarIdentifier::vectorList_t &starVectors, std::vector<int> &idList)
+{
+    const unsigned nSpots = starVectors.size();
+    const unsigned nStars = mPrevVectors.size();
+
+    // predict the positions with the rotation between the last two frames
+    mPredicted.resize(nStars);
+    for(unsigned p=0; p<nStars; ++p)
+        mPredicted[p] = mRate * mPrevVectors[p];
+
+    mSpotMatch.assign(nSpots, -1);
+    mStarMatch.assign(nStars, -1);
+    mStarDot.assign(nStars, mCosRadius);
+
+    // closest star of each spot and closest spot of each star within the search radius
+    for(unsigned s=0; s<nSpots; ++s)
+    {
+        const Eigen::Vector3f spot = starVectors[s].normalized();
+        float bestDot = mCosRadius;
+        for(unsigned p=0; p<nStars; ++p)
+        {
+            const float dot = spot.dot(mPredicted[p]);
+            if(dot > bestDot)
+            {
+                bestDot = dot;
+                mSpotMatch[s] = p;
+            }
+            if(dot > mStarDot[p])
+            {
+                mStarDot[p] = dot;
+                mStarMatch[p] = s;
+            }
+        }
+    }
+
+    // only mutual nearest neighbours are unambiguous
+    idList.assign(nSpots, -1);
+    unsigned matched = 0;
+    for(unsigned s=0; s<nSpots; ++s)
+    {
+        const int p = mSpotMatch[s];
+        if(p != -1 && mStarMatch[p] == (int) s)
+        {
+            idList[s] = mPrevIds[p];
+            ++matched;
+        }
+    }
+
+    return matched;
+}
+
+void TrackingIdentifier::update(const StarIdentifier::vectorList_t &starVectors, const std::vector<int> &idList)
+{
+    // a lost-in-space result is only usable if the triad was confirmed by a 4th star
+    unsigned identified = 0;
+    for(unsigned s=0; s<idList.size(); ++s)
+    {
+        if(idList[s] != -1)
+            ++identified;
+    }
+    if(!mTracking && identified < 4)
+    {
+        mPrevVectors.clear();
+        mPrevIds.clear();
+        mRate.setIdentity();
+        return;
+    }
+
+    // rotation from the previous to this frame (Kabsch) from the stars found in both
+    Eigen::Matrix3f correlation = Eigen::Matrix3f::Zero();
+    unsigned nPairs = 0;
+    for(unsigned s=0; s<idList.size(); ++s)
+    {
+        if(idList[s] == -1)
+            continue;
+        for(unsigned p=0; p<mPrevIds.size(); ++p)
+        {
+            if(mPrevIds[p] == idList[s])
+            {
+                correlation += starVectors[s].normalized() * mPrevVectors[p].transpose();
+                ++nPairs;
+                break;
+            }
+        }
+    }
+
+    if(nPairs >= 2)
+    {
+        Eigen::JacobiSVD<Eigen::Matrix3f> svd(correlation, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        Eigen::Matrix3f reflection = Eigen::Matrix3f::Identity();
+        reflection(2, 2) = (svd.matrixU() * svd.matrixV().transpose()).determinant() < 0 ? -1.0f : 1.0f;
+        mRate = svd.matrixU() * reflection * svd.matrixV().transpose();
+    }
+    else
+    {
+        mRate.setIdentity();
+    }
+
+    // keep the identified spots for the next frame
+    mPrevVectors.clear();
+    mPrevIds.clear();
+    for(unsigned s=0; s<idList.size(); ++s)
+    {
+        if(idList[s] != -1)
+        {
+            mPrevVectors.push_back(starVectors[s].normalized());
+            mPrevIds.push_back(idList[s]);
+        }
+    }
+}
@@ -0,0 +1,142 @@
+#include "triadmatcher.h"
+
+namespace
+{
+const uint64_t EMPTY = ~(uint64_t) 0; /*!< Key of unused slots (no valid star or pair key)*/
+}
+
+void TriadMatcher::FlatTable::reset(std::size_t n)
+{
+    // keep the load factor below 0.5
+    std::size_t size = 16;
+    while(size < 2 * n)
+        size <<= 1;
+
+    mKeys.assign(size, EMPTY);
+    mValues.assign(size, -1);
+    mMask = size - 1;
+}
+
+std::size_t TriadMatcher::FlatTable::slotOf(uint64_t key) const
+{
+    // fibonacci hashing, the upper bits are the best mixed ones
+    return (std::size_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) & mMask;
+}
+
+std::size_t TriadMatcher::FlatTable::insert(uint64_t key)
+{
+    std::size_t slot = slotOf(key);
+    while(mKeys[slot] != EMPTY && mKeys[slot] != key)
+        slot = (slot + 1) & mMask;
+
+    mKeys[slot] = key;
+    return slot;
+}
+
+std::ptrdiff_t TriadMatcher::FlatTable::find(uint64_t key) const
+{
+    std::size_t slot = slotOf(key);
+    while(mKeys[slot] != EMPTY)
+    {
+        if(mKeys[slot] == key)
+            return slot;
+        slot = (slot + 1) & mMask;
+    }
+    return -1;
+}
+
+TriadMatcher::TriadMatcher()
+    :mTriadCount(0), mTriadI(-1), mTriadJ(-1), mTriadK(-1), mFourthCount(0), mFourth(-1)
+{
+    mIKHeads.reset(0);
+    mJKPairs.reset(0);
+    mJRStars.reset(0);
+    mKRStars.reset(0);
+}
+
+void TriadMatcher::beginTriads(std::size_t nIK, std::size_t nJK)
+{
+    // every IK pair is stored for both of its stars
+    mIKHeads.reset(2 * nIK);
+    mNodeStar.clear();
+    mNodeNext.clear();
+    mNodeStar.reserve(2 * nIK);
+    mNodeNext.reserve(2 * nIK);
+    mJKPairs.reset(nJK);
+
+    mTriadCount = 0;
+    mTriadI = mTriadJ = mTriadK = -1;
+}
+
+void TriadMatcher::addNeighbour(int star, int neighbour)
+{
+    int & head = mIKHeads.value(mIKHeads.insert(starKey(star)));
+    mNodeStar.push_back(neighbour);
+    mNodeNext.push_back(head);
+    head = mNodeStar.size() - 1;
+}
+
+void TriadMatcher::addIK(int a, int b)
+{
+    addNeighbour(a, b);
+    addNeighbour(b, a);
+}
+
+void TriadMatcher::addJK(int a, int b)
+{
+    mJKPairs.insert(pairKey(a, b));
+}
+
+void TriadMatcher::matchOrientation(int i, int j)
+{
+    std::ptrdiff_t slot = mIKHeads.find(starKey(i));
+    if(slot < 0)
+        return;
+
+    for(int node = mIKHeads.value(slot); node != -1; node = mNodeNext[node])
+    {
+        const int k = mNodeStar[node];
+        if(k != j && mJKPairs.find(pairKey(j, k)) >= 0)
+        {
+            mTriadI = i;
+            mTriadJ = j;
+            mTriadK = k;
+            ++mTriadCount;
+        }
+    }
+}
+
+void TriadMatcher::matchIJ(int a, int b)
+{
+    // either star of the pair can be the one matching spot i
+    matchOrientation(a, b);
+    matchOrientation(b, a);
+}
+
+void TriadMatcher::beginFourth(std::size_t nJR, std::size_t nKR)
+{
+    mJRStars.reset(nJR);
+    mKRStars.reset(nKR);
+
+    mFourthCount = 0;
+    mFourth = -1;
+}
+
+void TriadMatcher::addJR(int star)
+{
+    mJRStars.insert(starKey(star));
+}
+
+void TriadMatcher::addKR(int star)
+{
+    mKRStars.insert(starKey(star));
+}
+
+void TriadMatcher::matchIR(int star)
+{
+    if(mJRStars.find(starKey(star)) >= 0 && mKRStars.find(starKey(star)) >= 0)
+    {
+        mFourth = star;
+        ++mFourthCount;
+    }
+}
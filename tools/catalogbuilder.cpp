@@ -0,0 +1,328 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <map>
+#include <cmath>
+#include <ctime>
+#include <cstdlib>
+#include <stdexcept>
+#include <sqlite3.h>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "tclap/CmdLine.h"
+#include "kvectorfile.h"
+
+using namespace std;
+
+TCLAP::CmdLine cmd("Builds the star catalog and the binary k-vector feature list from the Hipparcos catalog", ' ', "0.1");
+
+TCLAP::ValueArg<string> hipFile("", "hip", "Hipparcos main catalog (hip_main.dat)", true, string(), "filename");
+TCLAP::ValueArg<string> kVectorFile("", "kvector", "Output binary k-vector file", true, string(), "filename");
+TCLAP::ValueArg<string> catalogFile("", "catalog", "Output star catalog (SQLite database) for StarIdentifier::loadStarCatalog()", false, string(), "filename");
+TCLAP::ValueArg<float> maxMagnitude("", "mag", "Faintest magnitude of the stars of the feature list", false, 3.5f, "float");
+TCLAP::ValueArg<float> fov("", "fov", "Largest angle between the stars of a feature (in degree), e.g. the diagonal field of view", false, 60.0f, "float");
+TCLAP::ValueArg<float> epoch("", "epoch", "Epoch the proper motion is applied for (Julian year), 0 uses the current date", false, 0.0f, "float");
+
+/*!
+ \brief A star of the Hipparcos catalog
+*/
+struct CatalogStar
+{
+    int hip; /*!< hip-ID*/
+    double mag; /*!< Visual magnitude*/
+    char magSource; /*!< Source of the magnitude (field H7)*/
+    double rightAsc; /*!< Right ascension at J2000 (in degree)*/
+    double decl; /*!< Declination at J2000 (in degree)*/
+    double motRightAsc; /*!< Proper motion in right ascension * cos(decl) (in mas/yr)*/
+    double motDecl; /*!< Proper motion in declination (in mas/yr)*/
+    double rightAscNow; /*!< Right ascension at the epoch (in degree)*/
+    double declNow; /*!< Declination at the epoch (in degree)*/
+};
+
+/*!
+ \brief Parses a field of a catalog line
+
+ \param field
+ \param value Output
+ \return bool false if the field is empty or not a number
+*/
+bool parseField(const string &field, double &value)
+{
+    const char * begin = field.c_str();
+    char * end;
+    value = strtod(begin, &end);
+    if(end == begin)
+        return false;
+    while(*end == ' ')
+        ++end;
+    return *end == '\0';
+}
+
+/*!
+ \brief Returns the current date as Julian year
+
+ \return double
+*/
+double currentJulianYear()
+{
+    // the unix epoch is J1970.0 within a few hours, far below the accuracy needed here
+    return 1970.0 + time(NULL) / (365.25 * 86400.0);
+}
+
+/*!
+ \brief Reads the Hipparcos catalog and applies the proper motion
+
+ Stars without position or proper motion (about 260) are skipped. Like
+ create-database.py the positions are propagated from the catalog epoch
+ J1991.25 to J2000 and to the epoch.
+
+ \param filename hip_main.dat
+ \param epochYear Epoch (Julian year)
+ \param stars Output
+*/
+void readHipparcos(const string &filename, double epochYear, vector<CatalogStar> &stars)
+{
+    ifstream file(filename.c_str());
+    if(!file.is_open())
+        throw std::runtime_error("Unable to open " + filename);
+
+    const double HIP_EPOCH = 1991.25;
+    const double MAS_TO_DEG = 1.0 / (1000.0 * 3600.0);
+    const double DEG_TO_RAD = M_PI / 180.0;
+
+    stars.clear();
+    string line;
+    vector<string> fields;
+    while(getline(file, line))
+    {
+        fields.clear();
+        istringstream stream(line);
+        string field;
+        while(getline(stream, field, '|'))
+            fields.push_back(field);
+        if(fields.size() < 14)
+            continue;
+
+        CatalogStar star;
+        double hip;
+        if(!parseField(fields[1], hip) || !parseField(fields[5], star.mag) ||
+           !parseField(fields[8], star.rightAsc) || !parseField(fields[9], star.decl) ||
+           !parseField(fields[12], star.motRightAsc) || !parseField(fields[13], star.motDecl))
+            continue;
+        star.hip = (int) hip;
+        star.magSource = fields[7].empty() ? ' ' : fields[7][0];
+
+        const double cosDecl = cos(star.decl * DEG_TO_RAD);
+        const double dt2000 = 2000.0 - HIP_EPOCH;
+        const double dtNow = epochYear - HIP_EPOCH;
+        star.rightAscNow = star.rightAsc + star.motRightAsc * dtNow * MAS_TO_DEG / cosDecl;
+        star.declNow = star.decl + star.motDecl * dtNow * MAS_TO_DEG;
+        star.rightAsc += star.motRightAsc * dt2000 * MAS_TO_DEG / cosDecl;
+        star.decl += star.motDecl * dt2000 * MAS_TO_DEG;
+
+        stars.push_back(star);
+    }
+}
+
+/*!
+ \brief Writes the catalog table read by StarIdentifier::loadStarCatalog()
+
+ Same schema as create-database.py.
+
+ \param filename
+ \param stars
+*/
+void writeCatalog(const string &filename, const vector<CatalogStar> &stars)
+{
+    sqlite3 * db;
+    if(sqlite3_open(filename.c_str(), &db) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Failed to open " + filename);
+    }
+
+    const char * create =
+            "DROP TABLE IF EXISTS catalog;"
+            "CREATE TABLE catalog(hip INT PRIMARY KEY NOT NULL, mag REAL NOT NULL, magSource CHAR(1) NOT NULL,"
+            " rightAsc REAL NOT NULL, decl REAL NOT NULL, motRightAsc REAL NOT NULL, motDecl REAL NOT NULL,"
+            " rightAscNow REAL, declNow REAL);"
+            "BEGIN TRANSACTION;";
+    sqlite3_stmt * sqlStmt;
+    if(sqlite3_exec(db, create, NULL, NULL, NULL) != SQLITE_OK ||
+       sqlite3_prepare_v2(db, "INSERT INTO catalog VALUES(?,?,?,?,?,?,?,?,?)", -1, &sqlStmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        throw std::runtime_error("Creating the catalog table failed");
+    }
+
+    for(vector<CatalogStar>::const_iterator it = stars.begin(); it != stars.end(); ++it)
+    {
+        const string magSource(1, it->magSource);
+        sqlite3_bind_int(sqlStmt, 1, it->hip);
+        sqlite3_bind_double(sqlStmt, 2, it->mag);
+        sqlite3_bind_text(sqlStmt, 3, magSource.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double(sqlStmt, 4, it->rightAsc);
+        sqlite3_bind_double(sqlStmt, 5, it->decl);
+        sqlite3_bind_double(sqlStmt, 6, it->motRightAsc);
+        sqlite3_bind_double(sqlStmt, 7, it->motDecl);
+        sqlite3_bind_double(sqlStmt, 8, it->rightAscNow);
+        sqlite3_bind_double(sqlStmt, 9, it->declNow);
+        if(sqlite3_step(sqlStmt) != SQLITE_DONE)
+        {
+            sqlite3_finalize(sqlStmt);
+            sqlite3_close(db);
+            throw std::runtime_error("Inserting into the catalog table failed");
+        }
+        sqlite3_reset(sqlStmt);
+    }
+
+    sqlite3_finalize(sqlStmt);
+    sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL);
+    sqlite3_close(db);
+}
+
+/*!
+ \brief Creates the features of all pairs of stars closer than maxAngle
+
+ The unit vectors are sorted into a cubic grid with the chord length of
+ maxAngle as cell size, so the partners of a star are in the 27 cells
+ around its own and only those are compared. The angles are computed with
+ atan2(|a x b|, a . b), which is accurate for small angles as well.
+
+ \param stars Stars of the feature list
+ \param maxAngle Largest angle (in degree)
+ \param features Output with hip-IDs, hip1 < hip2
+*/
+void createFeatures(const vector<CatalogStar> &stars, double maxAngle, vector<Feature2> &features)
+{
+    const double DEG_TO_RAD = M_PI / 180.0;
+    const double RAD_TO_DEG = 180.0 / M_PI;
+
+    vector<Eigen::Vector3d> vectors(stars.size());
+    for(unsigned s=0; s<stars.size(); ++s)
+    {
+        const double ra = stars[s].rightAscNow * DEG_TO_RAD;
+        const double dec = stars[s].declNow * DEG_TO_RAD;
+        vectors[s] = Eigen::Vector3d(cos(dec) * cos(ra), cos(dec) * sin(ra), sin(dec));
+    }
+
+    // cells of size chord(maxAngle) over the cube [-1, 1]^3
+    const double cellSize = std::min(2.0, 2.0 * sin(0.5 * std::min(maxAngle, 180.0) * DEG_TO_RAD));
+    const int n = std::max(1, (int) ceil(2.0 / cellSize));
+    const double cosMax = cos(maxAngle * DEG_TO_RAD);
+    map<int, vector<unsigned> > cells;
+    vector<Eigen::Vector3i> cellOf(stars.size());
+    for(unsigned s=0; s<stars.size(); ++s)
+    {
+        for(int a=0; a<3; ++a)
+            cellOf[s](a) = std::min(n - 1, (int) ((vectors[s](a) + 1.0) / cellSize));
+        cells[(cellOf[s](0) * n + cellOf[s](1)) * n + cellOf[s](2)].push_back(s);
+    }
+
+    features.clear();
+    for(unsigned s=0; s<stars.size(); ++s)
+    {
+        for(int dx=-1; dx<=1; ++dx)
+        for(int dy=-1; dy<=1; ++dy)
+        for(int dz=-1; dz<=1; ++dz)
+        {
+            const Eigen::Vector3i c = cellOf[s] + Eigen::Vector3i(dx, dy, dz);
+            if((c.array() < 0).any() || (c.array() >= n).any())
+                continue;
+
+            map<int, vector<unsigned> >::const_iterator cell = cells.find((c(0) * n + c(1)) * n + c(2));
+            if(cell == cells.end())
+                continue;
+
+            // every pair once: only partners with a larger index
+            for(vector<unsigned>::const_iterator t = cell->second.begin(); t != cell->second.end(); ++t)
+            {
+                if(*t <= s)
+                    continue;
+                const double dot = vectors[s].dot(vectors[*t]);
+                if(dot < cosMax)
+                    continue;
+
+                const double theta = atan2(vectors[s].cross(vectors[*t]).norm(), dot) * RAD_TO_DEG;
+                const int hip1 = std::min(stars[s].hip, stars[*t].hip);
+                const int hip2 = std::max(stars[s].hip, stars[*t].hip);
+                features.push_back(Feature2(hip1, hip2, theta));
+            }
+        }
+    }
+}
+
+/*!
+ \brief Main function
+
+ Reads hip_main.dat, applies the proper motion and writes the k-vector
+ feature list of all stars up to --mag with pairs up to --fov, and
+ optionally the star catalog.
+
+ \param argc
+ \param argv
+ \return int
+*/
+int main(int argc, char **argv)
+{
+    try
+    {
+        cmd.add(hipFile);
+        cmd.add(kVectorFile);
+        cmd.add(catalogFile);
+        cmd.add(maxMagnitude);
+        cmd.add(fov);
+        cmd.add(epoch);
+        cmd.parse(argc, argv);
+    }
+    catch (TCLAP::ArgException &e)
+    {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << endl;
+        return 1;
+    }
+
+    try
+    {
+        const double epochYear = epoch.getValue() > 0.0f ? epoch.getValue() : currentJulianYear();
+
+        vector<CatalogStar> stars;
+        readHipparcos(hipFile.getValue(), epochYear, stars);
+        cout << "Read " << stars.size() << " stars (epoch J" << epochYear << ")" << endl;
+
+        if(!catalogFile.getValue().empty())
+            writeCatalog(catalogFile.getValue(), stars);
+
+        vector<CatalogStar> bright;
+        for(vector<CatalogStar>::const_iterator it = stars.begin(); it != stars.end(); ++it)
+        {
+            if(it->mag <= maxMagnitude.getValue())
+                bright.push_back(*it);
+        }
+
+        vector<Feature2> features;
+        createFeatures(bright, fov.getValue(), features);
+        cout << bright.size() << " stars up to magnitude " << maxMagnitude.getValue() << ", "
+             << features.size() << " features up to " << fov.getValue() << " degree" << endl;
+
+        vector<uint8_t> image;
+        buildKVectorImage(features, image);
+
+        ofstream file(kVectorFile.getValue().c_str(), ios::binary);
+        if(!file.is_open())
+            throw std::runtime_error("Unable to write " + kVectorFile.getValue());
+        file.write((const char *) &image[0], image.size());
+        if(!file)
+            throw std::runtime_error("Unable to write " + kVectorFile.getValue());
+    }
+    catch(std::exception &e)
+    {
+        std::cerr << "error: " << e.what() << endl;
+        return 1;
+    }
+
+    return 0;
+}